@@ -29,6 +29,8 @@ namespace Ubpa {
 		void GenBuffer(int width, int height, int channel);
 		void Free() noexcept;
 		bool SaveAsPNG(const std::string& fileName, bool flip = false) const;
+		// linear values without clamping, Radiance RGBE format
+		bool SaveAsHDR(const std::string& fileName, bool flip = false) const;
 
 		Ptr<Image> GenFlip() const;
 		Ptr<Image> Clear(const rgbaf& clearColor = rgbaf{ 0.f,0.f,0.f,0.f });
@@ -5,6 +5,8 @@
 #include <string>
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cmath>
 
 namespace Ubpa {
 	namespace Math {
@@ -57,22 +59,106 @@ namespace Ubpa {
 		template<typename T>
 		T Abs(T v) { return v < 0 ? -v : v; }
 
-		// [-0x7FFFFFFFF, 0x7FFFFFFF]
+		// PCG32 of O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically Good Algorithms for Random Number Generation"
+		// 64 bit state, 2^63 independent sequences, each of period 2^64
+		class PCG32 {
+		public:
+			PCG32() { SetSequence(defaultSequence); }
+			PCG32(uint64_t sequence, uint64_t seed) { SetSequence(sequence, seed); }
+
+		public:
+			void SetSequence(uint64_t sequence) { SetSequence(sequence, MixBits(sequence)); }
+			void SetSequence(uint64_t sequence, uint64_t seed) {
+				state = 0u;
+				inc = (sequence << 1u) | 1u;
+				UniformUInt();
+				state += seed;
+				UniformUInt();
+			}
+
+			// [0, 0xFFFFFFFF]
+			uint32_t UniformUInt() {
+				const uint64_t oldState = state;
+				state = oldState * mult + inc;
+				const uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u);
+				const uint32_t rot = static_cast<uint32_t>(oldState >> 59u);
+				return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31u));
+			}
+
+			// [0.0f, 1.0f)
+			float UniformFloat() { return (UniformUInt() >> 8) * (1.f / 16777216.f); }
+
+			// [0.0, 1.0)
+			double UniformDouble() {
+				const uint64_t bits = (static_cast<uint64_t>(UniformUInt()) << 21) ^ (UniformUInt() >> 11);
+				return bits * (1.0 / 9007199254740992.0);
+			}
+
+			// skips delta numbers in O(log delta)
+			void Advance(uint64_t delta) {
+				uint64_t curMult = mult;
+				uint64_t curPlus = inc;
+				uint64_t accMult = 1u;
+				uint64_t accPlus = 0u;
+				while (delta > 0) {
+					if (delta & 1) {
+						accMult *= curMult;
+						accPlus = accPlus * curMult + curPlus;
+					}
+					curPlus = (curMult + 1) * curPlus;
+					curMult *= curMult;
+					delta /= 2;
+				}
+				state = accMult * state + accPlus;
+			}
+
+			// finalizer of MurmurHash3, spreads nearby sequence numbers over the state space
+			static uint64_t MixBits(uint64_t v) {
+				v ^= v >> 33;
+				v *= 0xff51afd7ed558ccdull;
+				v ^= v >> 33;
+				v *= 0xc4ceb9fe1a85ec53ull;
+				v ^= v >> 33;
+				return v;
+			}
+
+		public:
+			static constexpr uint64_t defaultSequence = 0xda3e39cb94b95bdbull;
+
+		private:
+			static constexpr uint64_t mult = 0x5851f42d4c957f2dull;
+
+			uint64_t state;
+			uint64_t inc;
+		};
+
+		// the functions below draw from a generator per thread, so render threads don't share any state
+
+		// [0, 0x7FFFFFFF]
 		int Rand_I();
 
 		// [0, 0xFFFFFFFF]
 		unsigned int Rand_UI();
 
-		// [0.0f, 1.0f]
+		// [0.0f, 1.0f)
 		float Rand_F();
-		// [0.0f, 1.0f]
+		// [0.0f, 1.0f)
 		float Rand_F_exclude1();
 
-		// [0.0, 1.0]
+		// [0.0, 1.0)
 		double Rand_D();
 
+		// seeds the generator of the calling thread
 		void RandSetSeedByCurTime();
 
+		// restarts the generator of the calling thread at the numbers of one pixel sample
+		// a sample may draw 65536 numbers before it runs into the numbers of the next sample of the pixel
+		// results then depend only on the pixel and the sample, not on the thread that computes them
+		void RandSetPixelSample(uint64_t pixelIdx, uint64_t sampleIdx);
+
+		// generator of the calling thread
+		PCG32& RandGenerator();
+
 		template <typename T>
 		T Mean(const std::vector<T>& data);
 
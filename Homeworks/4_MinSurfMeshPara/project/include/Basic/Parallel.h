@@ -5,6 +5,7 @@
 #include <vector>
 #include <thread>
 #include <functional>
+#include <algorithm>
 
 namespace Ubpa {
 	class Parallel
@@ -22,6 +23,11 @@ namespace Ubpa {
 		void Run(const Func & func, const std::vector<Data>& datas);
 		template<typename Func>
 		void Run(const Func& func, size_t n);
+		// splits [0, n) into chunkNum chunks of the same size, 0 for one per core, and runs func(begin, end, chunkID)
+		// on each chunk in its own thread, the chunks only depend on n and chunkNum
+		// below serialThreshold items [0, n) runs as one chunk on the calling thread, returns the number of chunks
+		template<typename Func>
+		size_t RunChunks(const Func& func, size_t n, size_t chunkNum = 0, size_t serialThreshold = 0);
 		template<typename Func>
 		typename FuncTraits<Func>::Ret RunSum(const std::vector<Func>& works);
 		template<typename Func, typename Data>
@@ -73,6 +79,25 @@ namespace Ubpa {
 		Run(func, indices);
 	}
 
+	template<typename Func>
+	size_t Parallel::RunChunks(const Func& func, size_t n, size_t chunkNum, size_t serialThreshold) {
+		if (chunkNum == 0)
+			chunkNum = coreNum;
+		if (chunkNum <= 1 || n < serialThreshold) {
+			func(static_cast<size_t>(0), n, static_cast<size_t>(0));
+			return 1;
+		}
+
+		const size_t chunkSize = (n + chunkNum - 1) / chunkNum;
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i * chunkSize < n; i++)
+			workers.emplace_back(std::cref(func), i * chunkSize, std::min(n, (i + 1) * chunkSize), i);
+
+		for (auto& worker : workers)
+			worker.join();
+		return workers.size();
+	}
+
 	template<typename Func>
 	typename FuncTraits<Func>::Ret Parallel::RunSum(const std::vector<Func>& works) {
 		using RstType = typename FuncTraits<Func>::Ret;
@@ -0,0 +1,91 @@
+#pragma once
+
+// x86 SIMD shared by the engine, the AVX and AVX2 code paths are chosen at run time,
+// functions using them are marked UBPA_TARGET_AVX or UBPA_TARGET_AVX2 and only called if the cpu supports them
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define UBPA_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define UBPA_TARGET_AVX
+#define UBPA_TARGET_AVX2
+#else
+#define UBPA_TARGET_AVX __attribute__((target("avx")))
+#define UBPA_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace Ubpa {
+	namespace SIMD {
+		inline bool CPUSupportsAVX() {
+			static const bool support = []() {
+#ifndef UBPA_SIMD
+				return false;
+#elif defined(_MSC_VER)
+				int info[4];
+				__cpuid(info, 1);
+				const bool osxsave = (info[2] & (1 << 27)) != 0;
+				const bool avx = (info[2] & (1 << 28)) != 0;
+				// the os must save the ymm registers
+				return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+				return __builtin_cpu_supports("avx") != 0;
+#endif
+			}();
+			return support;
+		}
+
+		inline bool CPUSupportsAVX2() {
+			static const bool support = []() {
+#ifndef UBPA_SIMD
+				return false;
+#elif defined(_MSC_VER)
+				int info[4];
+				__cpuid(info, 0);
+				if (info[0] < 7)
+					return false;
+				__cpuidex(info, 7, 0);
+				const bool avx2 = (info[1] & (1 << 5)) != 0;
+				return avx2 && CPUSupportsAVX();
+#else
+				return __builtin_cpu_supports("avx2") != 0;
+#endif
+			}();
+			return support;
+		}
+
+#ifdef UBPA_SIMD
+		// mask ? a : b
+		UBPA_TARGET_AVX2 inline __m256 Select(__m256 mask, __m256 a, __m256 b) {
+			return _mm256_blendv_ps(b, a, mask);
+		}
+
+		UBPA_TARGET_AVX2 inline __m256 Abs(__m256 x) {
+			return _mm256_andnot_ps(_mm256_set1_ps(-0.f), x);
+		}
+
+		// exp of Cephes, relative error below 2e-7, 0 below -87.3 where floats underflow
+		UBPA_TARGET_AVX2 inline __m256 Exp(__m256 x) {
+			const __m256 valid = _mm256_cmp_ps(x, _mm256_set1_ps(-87.3f), _CMP_GE_OQ);
+			x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+
+			const __m256 fx = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+				_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+			x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+
+			__m256 p = _mm256_set1_ps(1.9875691500e-4f);
+			p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(1.3981999507e-3f));
+			p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(8.3334519073e-3f));
+			p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(4.1665795894e-2f));
+			p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(1.6666665459e-1f));
+			p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(5.0000001201e-1f));
+			p = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, x), x), _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+
+			const __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(127)), 23);
+			return _mm256_and_ps(valid, _mm256_mul_ps(p, _mm256_castsi256_ps(exponent)));
+		}
+#endif
+	}
+}
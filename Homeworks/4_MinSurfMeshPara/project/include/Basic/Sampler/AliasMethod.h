@@ -13,6 +13,7 @@ namespace Ubpa {
 		void Init(const std::vector<double>& distribution);
 
 		void Clear() { table.clear(); }
+		bool Empty() const { return table.empty(); }
 
 		// 0, 1, ..., n - 1
 		int Sample() const;
@@ -5,7 +5,7 @@
 namespace Ubpa {
 	class FilterBox : public ImgFilter {
 	public:
-		FilterBox(const vecf2& radius) : ImgFilter(radius) { }
+		FilterBox(const vecf2& radius) : ImgFilter(radius) { InitTable(); }
 
 	protected:
 		virtual ~FilterBox() = default;
@@ -15,8 +15,8 @@ namespace Ubpa {
 			return Ubpa::New<FilterBox>(radius);
 		}
 
-	public:
-		virtual float Evaluate(const pointf2& p) const override {
+	protected:
+		virtual float Evaluate1D(float d, int axis) const override {
 			return 1;
 		}
 	};
@@ -8,7 +8,7 @@ namespace Ubpa {
 		FilterGaussian(const vecf2& radius, float alpha)
 			: ImgFilter(radius), alpha(alpha),
 			expX(std::exp(-alpha * radius[0] * radius[0])),
-			expY(std::exp(-alpha * radius[1] * radius[1])) { }
+			expY(std::exp(-alpha * radius[1] * radius[1])) { InitTable(); }
 
 	protected:
 		virtual ~FilterGaussian() = default;
@@ -18,9 +18,9 @@ namespace Ubpa {
 			return Ubpa::New<FilterGaussian>(radius, alpha);
 		}
 
-	public:
-		virtual float Evaluate(const pointf2& p) const override {
-			return Gaussian(p[0], expX) * Gaussian(p[1], expY);
+	protected:
+		virtual float Evaluate1D(float d, int axis) const override {
+			return Gaussian(d, axis == 0 ? expX : expY);
 		}
 
 	private:
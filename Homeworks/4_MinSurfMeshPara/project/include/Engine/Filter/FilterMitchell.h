@@ -5,7 +5,7 @@
 namespace Ubpa {
 	class FilterMitchell : public ImgFilter {
 	public:
-		FilterMitchell(const vecf2& radius, float B, float C) : ImgFilter(radius), B(B), C(C) { }
+		FilterMitchell(const vecf2& radius, float B, float C) : ImgFilter(radius), B(B), C(C) { InitTable(); }
 
 	protected:
 		virtual ~FilterMitchell() = default;
@@ -15,9 +15,9 @@ namespace Ubpa {
 			return Ubpa::New<FilterMitchell>(radius, B, C);
 		}
 
-	public:
-		virtual float Evaluate(const pointf2& p) const override {
-			return Mitchell1D(p[0] * invRadius[0]) * Mitchell1D(p[1] * invRadius[1]);
+	protected:
+		virtual float Evaluate1D(float d, int axis) const override {
+			return Mitchell1D(d * invRadius[axis]);
 		}
 
 	private:
@@ -5,7 +5,7 @@
 namespace Ubpa {
 	class FilterSinc : public ImgFilter {
 	public:
-		FilterSinc(const vecf2& radius, float tau) : ImgFilter(radius), tau(tau) { }
+		FilterSinc(const vecf2& radius, float tau) : ImgFilter(radius), tau(tau) { InitTable(); }
 
 	protected:
 		virtual ~FilterSinc() = default;
@@ -15,9 +15,9 @@ namespace Ubpa {
 			return Ubpa::New<FilterSinc>(radius, tau);
 		}
 
-	public:
-		virtual float Evaluate(const pointf2& p) const override {
-			return WindowSinc(p[0], radius[0]) * WindowSinc(p[1], radius[1]);
+	protected:
+		virtual float Evaluate1D(float d, int axis) const override {
+			return WindowSinc(d, radius[axis]);
 		}
 
 	private:
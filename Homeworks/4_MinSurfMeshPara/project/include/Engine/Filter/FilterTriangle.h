@@ -5,7 +5,7 @@
 namespace Ubpa {
 	class FilterTriangle : public ImgFilter {
 	public:
-		FilterTriangle(const vecf2& radius) : ImgFilter(radius) { }
+		FilterTriangle(const vecf2& radius) : ImgFilter(radius) { InitTable(); }
 
 	protected:
 		virtual ~FilterTriangle() = default;
@@ -15,10 +15,9 @@ namespace Ubpa {
 			return Ubpa::New<FilterTriangle>(radius);
 		}
 
-	public:
-		virtual float Evaluate(const pointf2& p) const override {
-			const auto delta = (radius - vecf2(p.Abs())).MaxWith({ 0,0 });
-			return delta[0] * delta[1];
+	protected:
+		virtual float Evaluate1D(float d, int axis) const override {
+			return std::max(0.f, radius[axis] - std::abs(d));
 		}
 	};
 }
@@ -5,7 +5,11 @@
 #include <UGM/point.h>
 #include <UGM/vec.h>
 
+#include <cmath>
+#include <algorithm>
+
 namespace Ubpa {
+	// separable filters, the weight of p is the product of the weights of p[0] on x and p[1] on y
 	class ImgFilter : public HeapObj {
 	protected:
 		ImgFilter(const vecf2& radius) :
@@ -13,10 +17,31 @@ namespace Ubpa {
 		virtual ~ImgFilter() = default;
 
 	public:
-		virtual float Evaluate(const pointf2& p) const = 0;
+		float Evaluate(const pointf2& p) const {
+			return Evaluate1D(p[0], 0) * Evaluate1D(p[1], 1);
+		}
+
+		// tabulated weight of the offset d on axis, 0 outside the radius
+		float Lookup1D(float d, int axis) const {
+			const auto i = static_cast<int>(std::abs(d) * invRadius[axis] * tableSize);
+			return i < tableSize ? table[axis][i] : 0.f;
+		}
+
+	protected:
+		// weight of the offset d on axis, d is inside the radius
+		virtual float Evaluate1D(float d, int axis) const = 0;
+
+		// called at the end of the constructors of the filters, Evaluate1D isn't theirs in the constructor of ImgFilter
+		void InitTable();
 
 	public:
 		const vecf2 radius;
 		const vecf2 invRadius;
+
+		// entries of the table over [0, radius) per axis
+		static constexpr int tableSize = 64;
+
+	private:
+		float table[2][tableSize];
 	};
 }
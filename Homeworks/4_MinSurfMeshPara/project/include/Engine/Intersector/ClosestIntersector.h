@@ -10,17 +10,39 @@
 #include <UGM/point.h>
 #include <UGM/normal.h>
 #include <UGM/bbox.h>
+#include <UGM/transform.h>
 
 #include <Engine/Viewer/Ray.h>
 
+#include <vector>
+
 namespace Ubpa {
 	class Element;
 
 	// ѰĽ
 	class ClosestIntersector final : public HeapObj, public SharedPtrVisitor<ClosestIntersector, Shape>, public Intersector {
+	public:
+		// world space after Visit(Ptr<BVHAccel>) and Visit(Ptr<SObj>)
+		struct Rst {
+			Rst(bool isIntersect = false) : isIntersect(isIntersect) { }
+
+			bool IsIntersect() const { return isIntersect; }
+
+			bool isIntersect;
+			Ptr<Shape> closestShape;
+			pointf3 pos;
+			normalf n;
+			pointf2 texcoord;
+			normalf tangent;
+		};
+
 	public:
 		ClosestIntersector();
 
+		// the ray is shared with the caller, ray->tMax is the distance of the closest hit after visiting
+		void Init(Ray* ray);
+		const Rst& GetRst() const { return rst; }
+
 		using SharedPtrVisitor<ClosestIntersector, Shape>::Visit;
 		void Visit(Ptr<BVHAccel> bvhAccel);
 		void Visit(Ptr<SObj> sobj);
@@ -36,5 +58,42 @@ namespace Ubpa {
 		void ImplVisit(Ptr<TriMesh> mesh);
 		void ImplVisit(Ptr<Disk> disk);
 		void ImplVisit(Ptr<Capsule> capsule);
+
+	private:
+		// traversals return the index of the closest shape, -1 if no hit
+		int VisitBVH2(const Ptr<BVHAccel>& bvhAccel);
+		template<int N>
+		int VisitWideBVH(const Ptr<BVHAccel>& bvhAccel);
+
+		// intersect shapes [shapesOffset, shapesOffset + shapesNum) in their local spaces
+		// returns the index of the closest hit shape, -1 if none is closer than ray->tMax
+		int IntersectShapes(const Ptr<BVHAccel>& bvhAccel, int shapesOffset, int shapesNum, const pointf3& origin, const vecf3& dir);
+		// closest hit in the bottom level tree, localRay.tMax shrinks on hit
+		bool IntersectMeshBVH(const BVHAccel::MeshBVH& meshBVH, Ray& localRay);
+
+		// local space attributes of the point (u, v) on the triangle
+		void SetTriangleRst(const Ptr<Triangle>& triangle, float u, float v);
+
+		// rst is in the local space before
+		void ToWorld(const transformf& l2w);
+
+	private:
+		Ray* ray;
+		Rst rst;
+
+		// the closest hit on the flat triangles or the mesh BVHs of BVHAccel, face is -1 for other shapes
+		int triangleFaceIdx;
+		float triangleU;
+		float triangleV;
+
+		// reused across rays, so traversal doesn't allocate
+		std::vector<int> nodeIdxStack;
+		std::vector<int> meshNodeIdxStack;
+		std::vector<QuantizedStackEntry> quantizedStack;
+		struct WideStackEntry {
+			int nodeIdx;
+			float tNear; // entry distance when pushed, the node is skipped if a closer hit shows up
+		};
+		std::vector<WideStackEntry> wideStack;
 	};
 }
@@ -2,6 +2,17 @@
 
 #include <UDP/Visitor/Visitor.h>
 
+#include <Engine/Viewer/BVHAccel.h>
+#include <Engine/Viewer/Ray.h>
+#include <Engine/Viewer/RTStats.h>
+
+#include <UGM/bbox.h>
+#include <UGM/point.h>
+#include <UGM/vec.h>
+#include <UGM/val.h>
+
+#include <utility>
+
 namespace Ubpa {
 	class SObj;
 
@@ -13,5 +24,171 @@ namespace Ubpa {
 	class Disk;
 	class Capsule;
 
-	class Intersector { };
+	class Intersector {
+	protected:
+		// slab test, ray segment [tMin, tMax] against box
+		static bool IntersectBox(const bboxf3& box, const pointf3& origin, const valf3& invDir, float tMin, float tMax) {
+			for (int i = 0; i < 3; i++) {
+				float t0 = (box.minP()[i] - origin[i]) * invDir[i];
+				float t1 = (box.maxP()[i] - origin[i]) * invDir[i];
+				if (invDir[i] < 0.f)
+					std::swap(t0, t1);
+
+				tMin = t0 > tMin ? t0 : tMin;
+				tMax = t1 < tMax ? t1 : tMax;
+				if (tMin > tMax)
+					return false;
+			}
+			return true;
+		}
+
+		// also outputs the entry distance tNear
+		static bool IntersectBox(const bboxf3& box, const pointf3& origin, const valf3& invDir, float tMin, float tMax, float& tNear) {
+			for (int i = 0; i < 3; i++) {
+				float t0 = (box.minP()[i] - origin[i]) * invDir[i];
+				float t1 = (box.maxP()[i] - origin[i]) * invDir[i];
+				if (invDir[i] < 0.f)
+					std::swap(t0, t1);
+
+				tMin = t0 > tMin ? t0 : tMin;
+				tMax = t1 < tMax ? t1 : tMax;
+				if (tMin > tMax)
+					return false;
+			}
+			tNear = tMin;
+			return true;
+		}
+
+		// boxes of QuantizedBVHNode are decoded from the parent box, so the stack carries the box
+		struct QuantizedStackEntry {
+			int nodeIdx;
+			float tNear;
+			bboxf3 box;
+		};
+
+		// like TraverseBVH2 on BVHAccel::GetQuantizedBVHNodes(), children are ordered by their entry distance
+		// and popped entries farther than ray.tMax are skipped
+		template<typename LeafFunc>
+		static void TraverseQuantizedBVH(const std::vector<BVHAccel::QuantizedBVHNode>& nodes, const bboxf3& rootBox,
+			QuantizedStackEntry* stack, const Ray& ray, const LeafFunc& leafFunc)
+		{
+			using QuantizedBVHNode = BVHAccel::QuantizedBVHNode;
+
+			const auto origin = ray.o;
+			const auto invDir = ray.InvDir();
+
+			float tNear;
+			if (!IntersectBox(rootBox, origin, invDir, ray.tMin, ray.tMax, tNear))
+				return;
+
+			RTStats::Counter nodeVisits(&RTStats::nodeVisits);
+			int stackSize = 0;
+			int nodeIdx = 0;
+			bboxf3 box = rootBox; // of nodeIdx, already hit
+			while (true) {
+				nodeVisits.Add();
+				const auto& node = nodes[nodeIdx];
+				if (!node.IsLeaf()) {
+					const auto scale = QuantizedBVHNode::DequantizeScale(box);
+					const int childIdx[2] = { node.GetFirstChildIdx(), node.GetSecondChildIdx() };
+					const bboxf3 childBox[2] = {
+						nodes[childIdx[0]].Dequantize(box, scale),
+						nodes[childIdx[1]].Dequantize(box, scale)
+					};
+					float childNear[2];
+					const bool hit[2] = {
+						IntersectBox(childBox[0], origin, invDir, ray.tMin, ray.tMax, childNear[0]),
+						IntersectBox(childBox[1], origin, invDir, ray.tMin, ray.tMax, childNear[1])
+					};
+
+					if (hit[0] && hit[1]) {
+						// visit the near child first, push the far one
+						const int nearChild = childNear[0] <= childNear[1] ? 0 : 1;
+						const int farChild = 1 - nearChild;
+						stack[stackSize++] = { childIdx[farChild], childNear[farChild], childBox[farChild] };
+						nodeIdx = childIdx[nearChild];
+						box = childBox[nearChild];
+						continue;
+					}
+					if (hit[0] || hit[1]) {
+						const int child = hit[0] ? 0 : 1;
+						nodeIdx = childIdx[child];
+						box = childBox[child];
+						continue;
+					}
+				}
+				else if (leafFunc(node.GetShapesOffset(), node.GetShapesNum()))
+					return;
+
+				// the ray may have been shortened since the push
+				do {
+					if (stackSize == 0)
+						return;
+					--stackSize;
+				} while (stack[stackSize].tNear > ray.tMax);
+				nodeIdx = stack[stackSize].nodeIdx;
+				box = stack[stackSize].box;
+			}
+		}
+
+		// front to back stack traversal of a binary tree with the segment [ray.tMin, ray.tMax]
+		// stack holds at least depth entries of the tree
+		// leafFunc(shapesOffset, shapesNum) may shrink ray.tMax, and returns true to stop the traversal
+		// the visited nodes are added to RTStats::nodeVisits of the thread
+		template<typename LeafFunc>
+		static void TraverseBVH2(const std::vector<BVHAccel::LinearBVHNode>& nodes, int* stack, const Ray& ray, const LeafFunc& leafFunc) {
+			const auto origin = ray.o;
+			const auto invDir = ray.InvDir();
+			const bool dirIsNeg[3] = { invDir[0] < 0, invDir[1] < 0, invDir[2] < 0 };
+
+			RTStats::Counter nodeVisits(&RTStats::nodeVisits);
+			int stackSize = 0;
+			int nodeIdx = 0;
+			while (true) {
+				nodeVisits.Add();
+				const auto& node = nodes[nodeIdx];
+				if (IntersectBox(node.GetBox(), origin, invDir, ray.tMin, ray.tMax)) {
+					if (!node.IsLeaf()) {
+						// visit the near child first, push the far one
+						const auto firstChildIdx = BVHAccel::LinearBVHNode::FirstChildIdx(nodeIdx);
+						const auto secondChildIdx = node.GetSecondChildIdx();
+						if (dirIsNeg[node.GetAxis()]) {
+							stack[stackSize++] = firstChildIdx;
+							nodeIdx = secondChildIdx;
+						}
+						else {
+							stack[stackSize++] = secondChildIdx;
+							nodeIdx = firstChildIdx;
+						}
+						continue;
+					}
+
+					if (leafFunc(node.GetShapesOffset(), node.GetShapesNum()))
+						return;
+				}
+
+				if (stackSize == 0)
+					return;
+				nodeIdx = stack[--stackSize];
+			}
+		}
+
+		// the ray is in the local space of the shape
+		// on hit, t is the nearest distance in (ray.tMin, ray.tMax)
+
+		// unit sphere
+		static bool IntersectSphere(const Ray& ray, float& t);
+		// y = 0, x, z in [-0.5, 0.5]
+		static bool IntersectPlane(const Ray& ray, float& t);
+		// y = 0, x^2 + z^2 <= 1
+		static bool IntersectDisk(const Ray& ray, float& t);
+		// radius 1, the middle cylinder is along y with length height
+		static bool IntersectCapsule(const Ray& ray, float height, float& t);
+		// (u, v) is the barycentric coordinate of p1, p2
+		static bool IntersectTriangle(const Ray& ray, const pointf3& p0, const pointf3& p1, const pointf3& p2, float& t, float& u, float& v) {
+			return IntersectTriangle(ray, p0, vecf3(p1 - p0), vecf3(p2 - p0), t, u, v);
+		}
+		// with precomputed edges e1 = p1 - p0, e2 = p2 - p0
+		static bool IntersectTriangle(const Ray& ray, const pointf3& p0, const vecf3& e1, const vecf3& e2, float& t, float& u, float& v);
+	};
 }
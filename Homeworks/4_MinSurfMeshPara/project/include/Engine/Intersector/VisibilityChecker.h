@@ -9,11 +9,26 @@
 
 #include <Engine/Viewer/Ray.h>
 
+#include <vector>
+
 namespace Ubpa {
 	class VisibilityChecker final : public SharedPtrVisitor<VisibilityChecker, Shape>, public HeapObj, public Intersector {
+	public:
+		struct Rst {
+			Rst(bool isIntersect = false) : isIntersect(isIntersect) { }
+
+			bool IsIntersect() const { return isIntersect; }
+
+			bool isIntersect;
+		};
+
 	public:
 		VisibilityChecker();
 
+		// shadow ray, any hit in (ray->tMin, tMax) occludes
+		void Init(Ray* ray, float tMax);
+		const Rst& GetRst() const { return rst; }
+
 	public:
 		static const Ptr<VisibilityChecker> New() { return Ubpa::New<VisibilityChecker>(); }
 
@@ -28,5 +43,23 @@ namespace Ubpa {
 		void ImplVisit(Ptr<Triangle> triangle);
 		void ImplVisit(Ptr<Disk> disk);
 		void ImplVisit(Ptr<Capsule> capsule);
+
+	private:
+		void VisitBVH2(const Ptr<BVHAccel>& bvhAccel);
+		template<int N>
+		void VisitWideBVH(const Ptr<BVHAccel>& bvhAccel);
+
+		// intersect shapes [shapesOffset, shapesOffset + shapesNum) in their local spaces, stop at any hit
+		void IntersectShapes(const Ptr<BVHAccel>& bvhAccel, int shapesOffset, int shapesNum, const pointf3& origin, const vecf3& dir);
+		bool IntersectMeshBVH(const BVHAccel::MeshBVH& meshBVH, const Ray& localRay);
+
+	private:
+		Ray* ray;
+		Rst rst;
+
+		// reused across rays, so traversal doesn't allocate
+		std::vector<int> nodeIdxStack;
+		std::vector<int> meshNodeIdxStack;
+		std::vector<QuantizedStackEntry> quantizedStack;
 	};
 }
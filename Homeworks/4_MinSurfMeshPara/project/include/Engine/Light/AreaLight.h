@@ -35,6 +35,13 @@ namespace Ubpa {
 
 		virtual bool IsDelta() const override { return false; }
 
+		virtual float Power(float sceneRadius) const override { return LuminancePower().illumination(); }
+		// both sides, the bound must not miss a side that Sample_L lights
+		virtual bool GetBound(LightBound& bound) const override {
+			bound = { bboxf3(pointf3(-width / 2, 0.f, -height / 2), pointf3(width / 2, 0.f, height / 2)), vecf3(0.f, 1.f, 0.f), 1.f, 0.f, true };
+			return true;
+		}
+
 	public:
 		rgbf color;
 		float intensity;
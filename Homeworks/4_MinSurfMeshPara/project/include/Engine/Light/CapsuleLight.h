@@ -36,6 +36,13 @@ namespace Ubpa {
 
 		virtual bool IsDelta() const override { return false; }
 
+		virtual float Power(float sceneRadius) const override { return LuminancePower().illumination(); }
+		virtual bool GetBound(LightBound& bound) const override {
+			const float halfHeight = height / 2 + radius;
+			bound = { bboxf3(pointf3(-radius, -halfHeight, -radius), pointf3(radius, halfHeight, radius)), vecf3(0.f, 1.f, 0.f), -1.f, 0.f, false };
+			return true;
+		}
+
 	public:
 		rgbf color;
 		float intensity;
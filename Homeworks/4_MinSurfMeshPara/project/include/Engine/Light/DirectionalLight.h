@@ -32,6 +32,10 @@ namespace Ubpa {
 
 		virtual bool IsDelta() const override { return true; }
 
+		virtual float Power(float sceneRadius) const override {
+			return PI<float> * sceneRadius * sceneRadius * (intensity * color).illumination();
+		}
+
 	public:
 		rgbf color;
 		float intensity;
@@ -37,6 +37,13 @@ namespace Ubpa {
 
 		virtual bool IsDelta() const override { return false; }
 
+		virtual float Power(float sceneRadius) const override { return LuminancePower().illumination(); }
+		// both sides, the bound must not miss a side that Sample_L lights
+		virtual bool GetBound(LightBound& bound) const override {
+			bound = { bboxf3(pointf3(-radius, 0.f, -radius), pointf3(radius, 0.f, radius)), vecf3(0.f, 1.f, 0.f), 1.f, 0.f, true };
+			return true;
+		}
+
 	public:
 		rgbf color;
 		float intensity;
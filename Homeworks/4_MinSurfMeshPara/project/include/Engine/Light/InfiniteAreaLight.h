@@ -2,6 +2,8 @@
 
 #include <Engine/Light/Light.h>
 
+#include <Basic/Sampler/AliasMethod.h>
+
 namespace Ubpa {
 	class Image;
 
@@ -36,17 +38,26 @@ namespace Ubpa {
 
 		virtual bool IsDelta() const override { return false; }
 
+		virtual float Power(float sceneRadius) const override;
+
 		// Щûлκߵ
 		virtual const rgbf Le(const Ray& ray) const override;
 
 	private:
 		const rgbf GetColor(const pointf2& texcoord) const;
 
+		// pixel of texcoord in the distribution
+		int PixelOf(const pointf2& texcoord) const;
+
 	public:
 		rgbf colorFactor;
 		float intensity;
 
 	private:
 		Ptr<Image> img;
+
+		// pixels by luminance times sin(theta), built in SetImg
+		// with the pixels uniform inside, a pixel of probability p has density p * w * h / (2 pi^2 sin(theta))
+		AliasMethod distribution;
 	};
 }
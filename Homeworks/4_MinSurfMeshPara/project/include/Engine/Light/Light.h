@@ -8,8 +8,18 @@
 #include <UGM/point.h>
 #include <UGM/vec.h>
 #include <UGM/normal.h>
+#include <UGM/bbox.h>
 
 namespace Ubpa {
+	// bound of the emission of a light, for the light BVH
+	struct LightBound {
+		bboxf3 box; // emitting points
+		vecf3 w; // the normals of the emitting points are within acos(cosThetaO) of w
+		float cosThetaO;
+		float cosThetaE; // light leaves up to acos(cosThetaE) away from the normal
+		bool twoSided;
+	};
+
 	class Light : public HeapObj {
 	protected:
 		Light() = default;
@@ -30,6 +40,13 @@ namespace Ubpa {
 
 		virtual bool IsDelta() const = 0;
 
+		// emitted power, lights picked by power get a share of the samples that follows it
+		// lights without a bound give the power through a disk of sceneRadius
+		virtual float Power(float sceneRadius) const = 0;
+
+		// bound in light space, false if the light has no finite bound
+		virtual bool GetBound(LightBound& bound) const { return false; }
+
 		// Щûлκߵ
 		virtual const rgbf Le(const Ray& ray) const { return rgbf(0.f); }
 	};
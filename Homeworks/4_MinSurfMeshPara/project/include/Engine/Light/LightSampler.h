@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Engine/Light/Light.h>
+
+#include <Basic/Sampler/AliasMethod.h>
+
+#include <UGM/transform.h>
+
+#include <vector>
+
+namespace Ubpa {
+	// chooses the light of a next event estimation
+	// Power picks lights by their power with an alias table
+	// BVH walks a tree over the bounded lights by their estimated contribution at the shading point
+	// (Conty Estevez and Kulla 2018, as in pbrt-v4), lights without a bound share the samples with the tree uniformly
+	class LightSampler : public HeapObj {
+	public:
+		enum class Mode {
+			Uniform,
+			Power,
+			BVH,
+			Auto, // Power below bvhLightNum lights, BVH from there on
+		};
+
+	public:
+		LightSampler() = default;
+
+	public:
+		static const Ptr<LightSampler> New() { return Ubpa::New<LightSampler>(); }
+
+	protected:
+		virtual ~LightSampler() = default;
+
+	public:
+		// sceneBox is the world bound of the geometry, for the power of lights without a bound
+		void Init(Mode mode, const std::vector<Ptr<Light>>& lights, const std::vector<transformf>& lightToWorldVec, const bboxf3& sceneBox);
+
+		// n is the normal at pos, zero if there is no surface
+		// returns -1 if no light can reach pos
+		int Sample(const pointf3& pos, const normalf& n, float& pmf) const;
+
+		// probability of Sample to choose light lightIdx at pos
+		float PMF(const pointf3& pos, const normalf& n, int lightIdx) const;
+
+		// Auto is resolved in Init
+		Mode GetMode() const { return mode; }
+
+	public:
+		static constexpr int bvhLightNum = 16;
+
+	private:
+		// world bound of one light or of the lights of a subtree
+		struct Bound {
+			Bound() = default;
+			Bound(const LightBound& bound, float phi) : lightBound(bound), phi(phi) { }
+
+			// estimated contribution at pos, an upper bound of the angular terms over distance squared
+			float Importance(const pointf3& pos, const normalf& n) const;
+
+			static const Bound Union(const Bound& a, const Bound& b);
+
+			LightBound lightBound;
+			float phi{ 0.f };
+		};
+
+		struct Node {
+			Bound bound;
+			int idx; // light of a leaf, second child of a branch, the first child follows its parent
+			int parent; // -1 for the root
+			bool isLeaf;
+		};
+
+		// builds the subtree over bounds[begin, end) of lightIdx, returns its node
+		int Build(std::vector<int>& lightIdx, const std::vector<Bound>& bounds, int begin, int end, int parent);
+
+		// probabilities of the two children of a branch at pos, false if none is reachable
+		bool ChildProb(const Node& node, const pointf3& pos, const normalf& n, float& p0) const;
+
+	private:
+		Mode mode{ Mode::Uniform };
+		int lightNum{ 0 };
+
+		// Power
+		AliasMethod powerTable;
+
+		// BVH
+		std::vector<Node> nodes;
+		std::vector<int> lightToLeaf; // -1 for lights without a bound
+		std::vector<int> unboundedLights;
+	};
+}
@@ -34,6 +34,12 @@ namespace Ubpa {
 
 		virtual bool IsDelta() const override { return true; }
 
+		virtual float Power(float sceneRadius) const override { return IlluminancePower().illumination(); }
+		virtual bool GetBound(LightBound& bound) const override {
+			bound = { bboxf3(pointf3(0.f), pointf3(0.f)), vecf3(0.f, 1.f, 0.f), -1.f, 0.f, false };
+			return true;
+		}
+
 	private:
 		static float Fwin(float d, float radius);
 
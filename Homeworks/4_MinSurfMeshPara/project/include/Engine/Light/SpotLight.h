@@ -38,6 +38,14 @@ namespace Ubpa {
 
 		virtual bool IsDelta() const override { return true; }
 
+		virtual float Power(float sceneRadius) const override { return IlluminancePower().illumination(); }
+		// full intensity within the falloff angle, none beyond the half angle
+		virtual bool GetBound(LightBound& bound) const override {
+			const float cosThetaE = cos(acos(CosHalfAngle()) - acos(CosFalloffAngle()));
+			bound = { bboxf3(pointf3(0.f), pointf3(0.f)), vecf3(0.f, -1.f, 0.f), CosFalloffAngle(), cosThetaE, false };
+			return true;
+		}
+
 	public:
 		float CosHalfAngle() const {
 			return cos(to_radian(angle) / 2);
@@ -2,6 +2,7 @@
 
 #include <Engine/Material/Material.h>
 #include <Engine/Material/SurfCoord.h>
+#include <Engine/Material/BSDFBatch.h>
 
 namespace Ubpa {
 	class BSDF : public Material {
@@ -19,6 +20,13 @@ namespace Ubpa {
 		// return albedo
 		virtual const rgbf Sample_f(const normalf& wo, const pointf2& texcoord, normalf& wi, float& PD) = 0;
 
+		// batch versions over all lanes of the batch, the defaults call the scalar functions lane by lane
+		// F_Batch and PDF_Batch read wo, wi and texcoord, Sample_f_Batch reads wo and texcoord and writes wi, f and pdf
+		// Sample_f_Batch draws the random numbers of the lanes in order, so it matches Sample_f called lane by lane
+		virtual void F_Batch(BSDFBatch& batch);
+		virtual void PDF_Batch(BSDFBatch& batch);
+		virtual void Sample_f_Batch(BSDFBatch& batch);
+
 		virtual bool IsDelta() const { return false; }
 
 		virtual void ChangeNormal(const pointf2& texcoord, const normalf& tangent, normalf& normal) const { return; };
@@ -26,6 +34,9 @@ namespace Ubpa {
 		// Luminance
 		virtual const rgbf Emission(const normalf& wo) const { return rgbf(0.f); }
 
+		// base color of the surface, guides the denoiser, 1 for BSDFs without one
+		virtual const rgbf Albedo(const pointf2& texcoord) const { return rgbf(1.f); }
+
 	protected:
 		static const normalf TangentSpaceNormalToWorld(const normalf& worldTangent, const normalf& worldNormal, const normalf& tangentSpaceNormal);
 	};
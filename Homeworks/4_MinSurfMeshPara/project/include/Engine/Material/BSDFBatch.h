@@ -0,0 +1,54 @@
+#pragma once
+
+#include <UGM/normal.h>
+#include <UGM/point.h>
+#include <UGM/rgb.h>
+
+#include <vector>
+
+namespace Ubpa {
+	// shading queries of one BSDF as structure of arrays, directions are in the surface coordinate
+	// the arrays are padded to whole lanes with wo = wi = (0, 0, 1), kernels run over PaddedSize() and the padding is ignored
+	class BSDFBatch {
+	public:
+		static constexpr int laneNum = 8;
+
+	public:
+		void Resize(int size) {
+			this->size = size;
+			const int paddedSize = PaddedSize();
+			for (auto arr : { &woX, &woY, &woZ, &wiX, &wiY, &wiZ, &texcoordX, &texcoordY, &fR, &fG, &fB, &pdf })
+				arr->resize(paddedSize, 0.f);
+			for (int i = size; i < paddedSize; i++) {
+				SetWo(i, normalf(0.f, 0.f, 1.f));
+				SetWi(i, normalf(0.f, 0.f, 1.f));
+				SetTexcoord(i, pointf2(0.f, 0.f));
+			}
+		}
+		int Size() const { return size; }
+		int PaddedSize() const { return (size + laneNum - 1) / laneNum * laneNum; }
+
+		const normalf Wo(int i) const { return normalf(woX[i], woY[i], woZ[i]); }
+		const normalf Wi(int i) const { return normalf(wiX[i], wiY[i], wiZ[i]); }
+		const pointf2 Texcoord(int i) const { return pointf2(texcoordX[i], texcoordY[i]); }
+		const rgbf F(int i) const { return rgbf(fR[i], fG[i], fB[i]); }
+
+		void SetWo(int i, const normalf& wo) { woX[i] = wo[0]; woY[i] = wo[1]; woZ[i] = wo[2]; }
+		void SetWi(int i, const normalf& wi) { wiX[i] = wi[0]; wiY[i] = wi[1]; wiZ[i] = wi[2]; }
+		void SetTexcoord(int i, const pointf2& texcoord) { texcoordX[i] = texcoord[0]; texcoordY[i] = texcoord[1]; }
+		void SetF(int i, const rgbf& f) { fR[i] = f[0]; fG[i] = f[1]; fB[i] = f[2]; }
+
+	public:
+		// input
+		std::vector<float> woX, woY, woZ;
+		std::vector<float> texcoordX, texcoordY;
+		// input of F and PDF, output of Sample_f
+		std::vector<float> wiX, wiY, wiZ;
+		// output
+		std::vector<float> fR, fG, fB;
+		std::vector<float> pdf;
+
+	private:
+		int size{ 0 };
+	};
+}
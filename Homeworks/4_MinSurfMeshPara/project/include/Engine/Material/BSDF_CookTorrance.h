@@ -2,6 +2,8 @@
 
 #include <Engine/Material/BSDF.h>
 
+#include <Basic/Sampler/CosHsSampler3D.h>
+
 namespace Ubpa {
 	class BSDF_CookTorrance : public BSDF {
 	public:
@@ -26,15 +28,27 @@ namespace Ubpa {
 		// return albedo
 		virtual const rgbf Sample_f(const normalf& wo, const pointf2& texcoord, normalf& wi, float& PD) override;
 
+		virtual const rgbf Albedo(const pointf2& texcoord) const override { return albedo; }
+
+		// AVX2, Sample_f_Batch is the scalar default
+		virtual void F_Batch(BSDFBatch& batch) override;
+		virtual void PDF_Batch(BSDFBatch& batch) override;
+
 	private:
 		float NDF(const normalf& h);
 		float Fr(const normalf& wi, const normalf& h);
 		float G(const normalf& wo, const normalf& wi, const normalf& h);
 
+		// probability of sampling the specular lobe, the rest samples the diffuse lobe
+		static constexpr float specularRate = 0.5f;
+
 	public:
 		float ior;
 		float m;
 		rgbf refletance;
 		rgbf albedo;
+
+	private:
+		CosHsSampler3D sampler;
 	};
 }
@@ -28,8 +28,16 @@ namespace Ubpa {
 		// return albedo
 		virtual const rgbf Sample_f(const normalf& wo, const pointf2& texcoord, normalf& wi, float& PD) override;
 
+		virtual const rgbf Albedo(const pointf2& texcoord) const override { return GetAlbedo(texcoord); }
+
+		// AVX2 without an albedo texture
+		virtual void F_Batch(BSDFBatch& batch) override;
+		virtual void PDF_Batch(BSDFBatch& batch) override;
+		virtual void Sample_f_Batch(BSDFBatch& batch) override;
+
 	private:
 		const rgbf GetAlbedo(const pointf2& texcoord) const;
+		bool IsTextured() const;
 
 	public:
 		rgbf colorFactor;
@@ -28,6 +28,8 @@ namespace Ubpa {
 		// return albedo
 		virtual const rgbf Sample_f(const normalf& wo, const pointf2& texcoord, normalf& wi, float& PD) override;
 
+		virtual const rgbf Albedo(const pointf2& texcoord) const override { return GetAlbedo(texcoord); }
+
 		virtual void ChangeNormal(const pointf2& texcoord, const normalf& tangent, normalf& normal) const override;
 
 	private:
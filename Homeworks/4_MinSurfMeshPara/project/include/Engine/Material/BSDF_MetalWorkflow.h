@@ -4,6 +4,8 @@
 
 #include <Engine/Material/SchlickGGX.h>
 
+#include <Basic/Sampler/CosHsSampler3D.h>
+
 namespace Ubpa {
 	// Disney
 	class BSDF_MetalWorkflow : public BSDF {
@@ -30,6 +32,12 @@ namespace Ubpa {
 		// return albedo
 		virtual const rgbf Sample_f(const normalf& wo, const pointf2& texcoord, normalf& wi, float& PD) override;
 
+		virtual const rgbf Albedo(const pointf2& texcoord) const override { return GetAlbedo(texcoord); }
+
+		// AVX2 without albedo, metallic and roughness textures, Sample_f_Batch is the scalar default
+		virtual void F_Batch(BSDFBatch& batch) override;
+		virtual void PDF_Batch(BSDFBatch& batch) override;
+
 		virtual void ChangeNormal(const pointf2& texcoord, const normalf& tangent, normalf& normal) const override;
 
 	private:
@@ -40,6 +48,7 @@ namespace Ubpa {
 		float GetMetallic(const pointf2& texcoord) const;
 		float GetRoughness(const pointf2& texcoord) const;
 		float GetAO(const pointf2& texcoord) const;
+		bool IsTextured() const;
 
 	public:
 		SchlickGGX sggx;
@@ -58,5 +67,8 @@ namespace Ubpa {
 		Ptr<Image> aoTexture; // ֻʵʱȾ
 
 		Ptr<Image> normalTexture;
+
+	private:
+		CosHsSampler3D sampler;
 	};
 }
@@ -25,6 +25,8 @@ namespace Ubpa {
 		// return albedo
 		virtual const rgbf Sample_f(const normalf& wo, const pointf2& texcoord, normalf& wi, float& PD) override;
 
+		virtual const rgbf Albedo(const pointf2& texcoord) const override { return reflectance; }
+
 		virtual bool IsDelta() const override { return true; }
 
 	public:
@@ -19,6 +19,7 @@ namespace Ubpa {
 			//	0.0171201f * x3 + 0.000640711f * x4;
 			alpha = roughness * roughness;
 		}
+		float GetAlpha() const { return alpha; }
 
 	public:
 		// ߷ֲ
@@ -27,6 +28,9 @@ namespace Ubpa {
 		virtual float Lambda(const normalf& w) const override;
 		virtual const normalf Sample_wh() const override;
 
+		virtual void D_Batch(const float* cosTheta, float* D, int count) const override;
+		virtual void G_Batch(const BSDFBatch& batch, float* G) const override;
+
 	private:
 		float alpha;
 	};
@@ -19,12 +19,16 @@ namespace Ubpa {
 			//	0.0171201f * x3 + 0.000640711f * x4;
 			alpha = roughness * roughness;
 		}
+		float GetAlpha() const { return alpha; }
 
 	public:
 		// ߷ֲ
 		virtual float D(const normalf& wh) const override;
 		virtual const normalf Sample_wh() const override;
 
+		virtual void D_Batch(const float* cosTheta, float* D, int count) const override;
+		virtual void G_Batch(const BSDFBatch& batch, float* G) const override;
+
 	protected:
 		virtual float Lambda(const normalf& w) const override;
 
@@ -2,6 +2,7 @@
 
 #include <UGM/normal.h>
 #include <Engine/Material/SurfCoord.h>
+#include <Engine/Material/BSDFBatch.h>
 
 namespace Ubpa {
 	class MicrofacetDistribution {
@@ -34,7 +35,25 @@ namespace Ubpa {
 		// ĸǹ wh 
 		// path tracing ҪĸӦǹ wi 
 		float PDF(const normalf& wh) const {
-			return D(wh) * abs(wh[2]);
+			return D(wh) * std::abs(wh[2]);
+		}
+
+		// batch versions, the defaults call the scalar functions lane by lane
+		// D of count half vectors given by their cos theta, count is a multiple of BSDFBatch::laneNum
+		virtual void D_Batch(const float* cosTheta, float* D, int count) const {
+			for (int i = 0; i < count; i++) {
+				const float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta[i] * cosTheta[i]));
+				D[i] = this->D(normalf(sinTheta, 0.f, cosTheta[i]));
+			}
+		}
+
+		// G of the pairs of the batch with wh = normalize(wo + wi), writes PaddedSize() values
+		virtual void G_Batch(const BSDFBatch& batch, float* G) const {
+			for (int i = 0; i < batch.PaddedSize(); i++) {
+				const normalf wo = batch.Wo(i);
+				const normalf wi = batch.Wi(i);
+				G[i] = this->G(wo, wi, (wo + wi).normalize());
+			}
 		}
 
 	protected:
@@ -19,5 +19,7 @@ namespace Ubpa {
 			auto NoW = std::max(0.f, SurfCoord::CosTheta(w));
 			return NoW / (NoW * (1 - k) + k);
 		}
+
+		virtual void G_Batch(const BSDFBatch& batch, float* G) const override;
 	};
 }
@@ -47,6 +47,9 @@ namespace Ubpa {
 
 		inline const normalf Reflect(const normalf& w) { return normalf(-w[0], -w[1], w[2]); }
 
+		// mirror to the upper hemisphere
+		inline const normalf ToUpper(const normalf& w) { return normalf(w[0], w[1], std::abs(w[2])); }
+
 		inline bool Refract(const normalf& wo, normalf& wi, float ior) {
 			float inv = IsEntering(wo) ? 1.0f / ior : ior;
 
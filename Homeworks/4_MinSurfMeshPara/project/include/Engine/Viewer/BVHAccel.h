@@ -4,13 +4,18 @@
 
 #include <UGM/bbox.h>
 #include <UGM/transform.h>
+#include <UGM/val.h>
 
 #include <vector>
+#include <string>
 #include <unordered_map>
+#include <functional>
+#include <limits>
 
 namespace Ubpa {
 	class Shape;
 	class Primitive;
+	class TriMesh;
 	class SObj;
 
 	class BVHNode;
@@ -42,15 +47,19 @@ namespace Ubpa {
 				this->axis = axis;
 			}
 
+			// refit keeps the topology
+			void SetBox(const bboxf3& box) { this->box = box; }
+
 		public:
 			const bboxf3& GetBox() const { return box; }
 			bool IsLeaf() const { return shapesNum != 0; }
-			const std::vector<int> ShapesIdx() const {
+			int GetShapesOffset() const {
+				assert(IsLeaf());
+				return shapesOffset;
+			}
+			int GetShapesNum() const {
 				assert(IsLeaf());
-				std::vector<int> rst;
-				for (uint16_t i = 0; i < shapesNum; i++)
-					rst.push_back(shapesOffset + i);
-				return rst;
+				return shapesNum;
 			}
 			static int FirstChildIdx(int nodeIdx) { return nodeIdx + 1; }
 			int GetSecondChildIdx() const {
@@ -73,10 +82,223 @@ namespace Ubpa {
 			const uint8_t pad[1]{ 0 }; // ensure 32 byte total size
 		};
 
+		// children of a wide node are stored SoA, so all N child boxes are tested at once
+		template<int N>
+		class alignas(32) WideBVHNode {
+			friend class BVHAccel;
+		public:
+			WideBVHNode() {
+				for (int i = 0; i < N; i++)
+					InitEmpty(i);
+			}
+
+			void InitEmpty(int i) {
+				for (int dim = 0; dim < 3; dim++) {
+					bounds[dim][i] = std::numeric_limits<float>::infinity();
+					bounds[3 + dim][i] = -std::numeric_limits<float>::infinity();
+				}
+				childIdx[i] = -1;
+				shapesNum[i] = 0;
+			}
+
+			void InitLeaf(int i, const bboxf3& box, int shapesOffset, int shapesNum) {
+				SetBox(i, box);
+				childIdx[i] = shapesOffset;
+				this->shapesNum[i] = static_cast<uint16_t>(shapesNum);
+			}
+
+			void InitBranch(int i, const bboxf3& box, int nodeIdx) {
+				SetBox(i, box);
+				childIdx[i] = nodeIdx;
+				shapesNum[i] = 0;
+			}
+
+		public:
+			bool IsEmpty(int i) const { return childIdx[i] == -1; }
+			bool IsLeaf(int i) const { return shapesNum[i] != 0; }
+			int GetShapesOffset(int i) const {
+				assert(IsLeaf(i));
+				return childIdx[i];
+			}
+			int GetShapesNum(int i) const {
+				assert(IsLeaf(i));
+				return shapesNum[i];
+			}
+			int GetChildIdx(int i) const {
+				assert(!IsEmpty(i) && !IsLeaf(i));
+				return childIdx[i];
+			}
+
+		private:
+			void SetBox(int i, const bboxf3& box) {
+				for (int dim = 0; dim < 3; dim++) {
+					bounds[dim][i] = box.minP()[dim];
+					bounds[3 + dim][i] = box.maxP()[dim];
+				}
+			}
+
+		private:
+			float bounds[6][N]; // min xyz, max xyz, empty children have an inverted box
+			int childIdx[N]; // interior: index of the wide node, leaf: shapes offset, empty: -1
+			uint16_t shapesNum[N]; // 0 -> interior
+		};
+
+		// binary node with its box quantized to 8 bits inside the box of its parent, 12 bytes
+		// siblings are adjacent, so only the first child is stored and the nodes can be laid out freely
+		class QuantizedBVHNode {
+		public:
+			void InitLeaf(int shapesOffset, int shapesNum) {
+				assert(shapesNum > 0 && shapesNum <= 255);
+				childIdx = shapesOffset;
+				this->shapesNum = static_cast<uint8_t>(shapesNum);
+			}
+
+			void InitBranch(int firstChildIdx) {
+				childIdx = firstChildIdx;
+				shapesNum = 0;
+			}
+
+			// the smallest box in parentBox the 8 bits can express that contains box
+			void Quantize(const bboxf3& box, const bboxf3& parentBox);
+
+		public:
+			bool IsLeaf() const { return shapesNum != 0; }
+			int GetShapesOffset() const {
+				assert(IsLeaf());
+				return childIdx;
+			}
+			int GetShapesNum() const {
+				assert(IsLeaf());
+				return shapesNum;
+			}
+			int GetFirstChildIdx() const {
+				assert(!IsLeaf());
+				return childIdx;
+			}
+			int GetSecondChildIdx() const {
+				assert(!IsLeaf());
+				return childIdx + 1;
+			}
+
+			// scale is (parentMax - parentMin) / 255 per axis
+			// the lower bound counts up from parentMin and the upper bound down from parentMax,
+			// so the full range decodes to parentBox exactly
+			const bboxf3 Dequantize(const bboxf3& parentBox, const valf3& scale) const {
+				return bboxf3(
+					{ parentBox.minP()[0] + qMin[0] * scale[0], parentBox.minP()[1] + qMin[1] * scale[1], parentBox.minP()[2] + qMin[2] * scale[2] },
+					{ parentBox.maxP()[0] - (255 - qMax[0]) * scale[0], parentBox.maxP()[1] - (255 - qMax[1]) * scale[1], parentBox.maxP()[2] - (255 - qMax[2]) * scale[2] });
+			}
+			static const valf3 DequantizeScale(const bboxf3& parentBox) {
+				const auto diagonal = parentBox.diagonal();
+				constexpr float inv255 = 1.f / 255.f;
+				return { diagonal[0] * inv255, diagonal[1] * inv255, diagonal[2] * inv255 };
+			}
+
+		private:
+			uint8_t qMin[3];
+			uint8_t qMax[3];
+			uint8_t shapesNum; // 0 -> interior node
+			const uint8_t pad{ 0 };
+			int childIdx; // interior: index of the first child, leaf: shapes offset
+		};
+
+		// world space triangle with precomputed edges, intersected without touching the mesh
+		struct WorldTriangle {
+			pointf3 p0;
+			vecf3 e1; // p1 - p0
+			vecf3 e2; // p2 - p0
+		};
+
+		// shapes[i] is the face faceIdx of meshes[meshIdx]
+		// in the two-level mode, faceIdx is -1 and shapes[i] is the whole mesh, an instance of its MeshBVH
+		// both are -1 for the other shapes
+		struct PrimRef {
+			int meshIdx;
+			int faceIdx;
+		};
+
+		// bottom level of the two-level mode, built over the triangles of a TriMesh in its local space
+		// shared by all instances of the mesh, and kept across Init while the geometry is unchanged
+		struct MeshBVH {
+			std::vector<LinearBVHNode> nodes;
+			std::vector<WorldTriangle> triangles; // in the local space here, leaf order
+			std::vector<int> faceIdx; // leaf order -> face of the mesh
+			int depth{ 0 };
+			size_t geometryHash{ 0 }; // of the positions the tree was built or last refitted for
+			double buildSAHCost{ 0. };
+		};
+
+		enum class Builder {
+			SAH, // binned SAH, best trace speed
+			LBVH, // Morton codes and radix sort, fastest build, for simulation playback and editing
+			SBVH, // binned SAH with spatial splits, slowest build, best trace speed on long thin triangles, for final renders
+		};
+
+		enum class Width {
+			BVH2, // binary LinearBVHNode, scalar box test
+			BVH4, // WideBVHNode<4>, SSE
+			BVH8, // WideBVHNode<8>, AVX
+		};
+
 	public:
 		void Init(Ptr<SObj> root);
 		void Clear();
 
+		// takes effect on the next Init, the rebuilds of Refit use it too
+		void SetBuilder(Builder builder) { this->builder = builder; }
+		Builder GetBuilder() const { return builder; }
+
+		// treelet restructuring after an LBVH build, more passes give better trees and slower builds
+		void SetTreeletPasses(int treeletPasses) { this->treeletPasses = treeletPasses; }
+		int GetTreeletPasses() const { return treeletPasses; }
+
+		// the SBVH builder makes at most budget * shapes extra references by spatial splits
+		void SetSpatialSplitBudget(float spatialSplitBudget) { this->spatialSplitBudget = spatialSplitBudget; }
+		float GetSpatialSplitBudget() const { return spatialSplitBudget; }
+
+		// directory of the BVH cache files, empty to disable the cache, takes effect on the next Init
+		// Init loads the trees of an unchanged scene from there instead of building them, and saves the trees it builds
+		// the files are keyed by the geometry and the build settings, stale files are just never read again
+		void SetCacheDir(const std::string& cacheDir) { this->cacheDir = cacheDir; }
+		const std::string& GetCacheDir() const { return cacheDir; }
+
+		// recompute the bounds from the current positions of the meshes, the topology and transforms are kept
+		// a tree whose SAH cost grew more than the max SAH growth since its build is rebuilt
+		// return false if a mesh changed its triangles, Init is needed then
+		bool Refit();
+		// root has the primitives and transforms of the last Init, and the settings are unchanged,
+		// so Refit can replace Init if just the vertices moved
+		bool IsRefittable(Ptr<SObj> root) const;
+		void SetMaxSAHGrowth(double maxSAHGrowth) { this->maxSAHGrowth = maxSAHGrowth; }
+		double GetMaxSAHGrowth() const { return maxSAHGrowth; }
+
+		// takes effect on the next Init
+		void SetWidth(Width width) { this->width = width; }
+		// width of the tree actually built, BVH2 if the cpu lacks the instructions of width
+		Width GetWidth() const { return activeWidth; }
+
+		// take effect on the next Init, only for BVH2
+		// quantized: the nodes are stored as QuantizedBVHNode, 12 bytes instead of 32
+		// clustered layout: the quantized nodes are laid out in van Emde Boas order,
+		// every subtree of half the height is contiguous, so a path touches fewer cache lines and pages
+		void SetQuantized(bool quantized) { this->quantized = quantized; }
+		void SetClusteredLayout(bool clusteredLayout) { this->clusteredLayout = clusteredLayout; }
+		bool IsQuantized() const { return activeQuantized; }
+		bool IsClusteredLayout() const { return clusteredLayout; }
+
+		// takes effect on the next Init
+		// two-level: a MeshBVH per TriMesh and a top level tree over the primitives of the scene,
+		// only the top level is rebuilt when just the transforms change
+		// worth it for scenes edited by moving objects and for meshes with many instances,
+		// a flat tree over all triangles traces faster if the scene is rendered as it is
+		void SetTwoLevel(bool twoLevel) { this->twoLevel = twoLevel; }
+		bool IsTwoLevel() const { return twoLevel; }
+
+		// slab test of all children against [tMin, tMax], returns the mask of hit children
+		// tNears[i] is the entry distance of child i
+		static int IntersectChildren(const WideBVHNode<4>& node, const pointf3& origin, const valf3& invDir, const bool dirIsNeg[3], float tMin, float tMax, float tNears[4]);
+		static int IntersectChildren(const WideBVHNode<8>& node, const pointf3& origin, const valf3& invDir, const bool dirIsNeg[3], float tMin, float tMax, float tNears[8]);
+
 	public:
 		const transformf& GetShapeW2LMat(Ptr<Shape> shape) const;
 		const Ptr<SObj> GetSObj(Ptr<Shape> shape) const;
@@ -85,13 +307,115 @@ namespace Ubpa {
 			assert(idx >= 0 && idx < linearBVHNodes.size());
 			return linearBVHNodes[idx];
 		}
-		const Ptr<Shape> GetShape(int idx) const {
+		const std::vector<LinearBVHNode>& GetBVHNodes() const { return linearBVHNodes; }
+		const Ptr<Shape>& GetShape(int idx) const {
 			assert(idx >= 0 && idx < shapes.size());
 			return shapes[idx];
 		}
+		bool IsTriangle(int idx) const {
+			assert(idx >= 0 && idx < primRefs.size());
+			return primRefs[idx].faceIdx != -1;
+		}
+		// nullptr if shapes[idx] is not a mesh instance
+		const MeshBVH* GetMeshBVH(int idx) const {
+			assert(idx >= 0 && idx < shapeMeshBVHs.size());
+			return shapeMeshBVHs[idx].get();
+		}
+		const WorldTriangle& GetWorldTriangle(int idx) const {
+			assert(IsTriangle(idx));
+			return worldTriangles[idx];
+		}
+		const PrimRef& GetPrimRef(int idx) const {
+			assert(idx >= 0 && idx < primRefs.size());
+			return primRefs[idx];
+		}
+		const Ptr<TriMesh>& GetMesh(int meshIdx) const {
+			assert(meshIdx >= 0 && meshIdx < meshes.size());
+			return meshes[meshIdx];
+		}
+		// matrixes of shapes[idx], without hashing
+		const transformf& GetShapeW2LMat(int idx) const {
+			assert(idx >= 0 && idx < shapePrimitiveIdx.size());
+			return primitiveW2LMats[shapePrimitiveIdx[idx]];
+		}
+		const transformf& GetShapeL2WMat(int idx) const {
+			assert(idx >= 0 && idx < shapePrimitiveIdx.size());
+			return primitiveL2WMats[shapePrimitiveIdx[idx]];
+		}
+
+		const std::vector<QuantizedBVHNode>& GetQuantizedBVHNodes() const { return quantizedBVHNodes; }
+		// the root of the quantized nodes is relative to this box
+		const bboxf3& GetQuantizedRootBox() const { return linearBVHNodes[0].GetBox(); }
+
+		template<int N>
+		const WideBVHNode<N>& GetWideBVHNode(int idx) const {
+			if constexpr (N == 4) {
+				assert(idx >= 0 && idx < bvh4Nodes.size());
+				return bvh4Nodes[idx];
+			}
+			else {
+				static_assert(N == 8);
+				assert(idx >= 0 && idx < bvh8Nodes.size());
+				return bvh8Nodes[idx];
+			}
+		}
+
+		bool IsEmpty() const { return linearBVHNodes.empty(); }
+		// number of nodes on the longest path from the root, bounds the traversal stack
+		int GetDepth() const { return depth; }
+		// bytes of the nodes the traversal reads
+		size_t GetNodeBytes() const;
+
+		// hash of the world space geometry of the last Init or Refit, identifies the scene of a film checkpoint
+		size_t GetSceneHash() const { return sceneHash; }
+
+		// seconds spent in the last Init
+		double GetBuildTime() const { return buildTime; }
+		// seconds spent in the last Refit
+		double GetRefitTime() const { return refitTime; }
+		// expected cost of a ray query, in units of primitive intersections
+		double GetSAHCost() const { return sahCost; }
 
 	private:
-		void LinearizeBVH(Ptr<BVHNode> bvhNode);
+		// build linearBVHNodes and the wide nodes over boxes of shapes, and reorder the per shape arrays
+		void BuildTree(const std::vector<bboxf3>& boxes);
+		// linearBVHNodes and worldTriangles from the cache file of key, the other per shape arrays are reordered
+		bool LoadTree(size_t key);
+		// the per shape arrays except worldTriangles into the leaf order primIdx, sets referenceShapes
+		void ApplyLeafOrder(std::vector<int>& primIdx);
+		// wide or quantized nodes from linearBVHNodes
+		void BuildTraversalNodes();
+		// quantizedBVHNodes in depth first or van Emde Boas order
+		void QuantizeBVH();
+
+		// nodes over boxes with builder, primIdx gets the primitives in leaf order, returns the SAH cost
+		// the SBVH builder clips primitives with splitPrim(primID, axis, pos, leftBox, rightBox) and may reference a primitive several times
+		double BuildLinearBVH(const std::vector<bboxf3>& boxes, const std::function<void(int, int, float, bboxf3&, bboxf3&)>& splitPrim,
+			std::vector<int>& primIdx, std::vector<LinearBVHNode>& nodes, int& depth) const;
+		static void LinearizeBVH(Ptr<BVHNode> bvhNode, std::vector<LinearBVHNode>& nodes, int& depth, int nodeDepth = 1);
+
+		// hash of positions and indices, detects edits of cached meshes
+		static size_t GeometryHash(const Ptr<TriMesh>& mesh);
+		// hash of the primitives in scene order, their transforms and geometry, independent of the tree
+		size_t SceneHash() const;
+		// hash of the settings a tree is built with
+		size_t SettingsKey() const;
+		// key of a cache file, the hash of the build input and the settings of the builder
+		size_t CacheKey(size_t inputHash, bool meshTree) const;
+		// hash of everything the top level build reads, the boxes and the flat triangles
+		size_t TreeInputHash(const std::vector<bboxf3>& boxes) const;
+		// cached MeshBVH of mesh, rebuilt if the geometry changed
+		const Ptr<MeshBVH> GetOrBuildMeshBVH(const Ptr<TriMesh>& mesh);
+		void BuildMeshBVH(const Ptr<TriMesh>& mesh, MeshBVH& meshBVH) const;
+
+		// world space box of shapes[idx] with the current geometry, not for flat triangles
+		const bboxf3 ShapeWBox(int idx) const;
+		// bottom-up bounds of the nodes from the boxes of the primitives in leaf order, returns the SAH cost
+		static double RefitBVH(std::vector<LinearBVHNode>& nodes, const std::vector<bboxf3>& primBoxes);
+
+		// collapse the subtree of linearBVHNodes[nodeIdx] into wideNodes[wideIdx]
+		template<int N>
+		void CollapseBVH(std::vector<WideBVHNode<N>>& wideNodes, int wideIdx, int nodeIdx);
 
 	private:
 		// triangle Ҫͨ mesh ȡ matrix
@@ -103,6 +427,55 @@ namespace Ubpa {
 		friend class BVHInitVisitor;
 		std::vector<Ptr<Shape>> shapes;
 
+		// shapes[i] belongs to the primitive shapePrimitiveIdx[i]
+		std::vector<int> shapePrimitiveIdx;
+		std::vector<Ptr<Primitive>> primitives; // in the order of the scene
+		std::vector<transformf> primitiveW2LMats;
+		std::vector<transformf> primitiveL2WMats;
+
+		// in leaf order like shapes, entries of non-triangle shapes are unused
+		std::vector<WorldTriangle> worldTriangles;
+		std::vector<PrimRef> primRefs;
+		std::vector<Ptr<TriMesh>> meshes;
+		std::vector<size_t> meshTriangleNums; // detects topology changes in Refit
+		std::vector<Ptr<MeshBVH>> shapeMeshBVHs;
+
+		// spatial splits reference a shape in several leaves, the per shape arrays then hold a copy per reference
+		// entry i is a reference of the shape referenceShapes[i] in [0, uniqueShapeNum), in the order before the last build
+		std::vector<int> referenceShapes;
+		size_t uniqueShapeNum{ 0 };
+
+		// survives Clear, entries of meshes not in the scene are dropped at the end of Init
+		std::unordered_map<Ptr<TriMesh>, Ptr<MeshBVH>> meshBVHCache;
+		size_t meshBVHBuildNum{ 0 };
+		size_t meshBVHLoadNum{ 0 };
+
 		std::vector<LinearBVHNode> linearBVHNodes;
+		std::vector<WideBVHNode<4>> bvh4Nodes;
+		std::vector<WideBVHNode<8>> bvh8Nodes;
+		std::vector<QuantizedBVHNode> quantizedBVHNodes;
+
+		Builder builder{ Builder::SAH };
+		int treeletPasses{ 0 };
+		float spatialSplitBudget{ 0.5f };
+		Width width{ Width::BVH2 };
+		Width activeWidth{ Width::BVH2 };
+		bool quantized{ false };
+		bool activeQuantized{ false };
+		bool clusteredLayout{ false };
+		bool twoLevel{ false };
+		size_t settingsKey{ 0 }; // SettingsKey of the last Init
+
+		double maxSAHGrowth{ 1.5 };
+
+		std::string cacheDir;
+		bool treeLoaded{ false }; // linearBVHNodes came from the cache in the last Init
+
+		int depth{ 0 };
+		size_t sceneHash{ 0 };
+		double buildTime{ 0. };
+		double refitTime{ 0. };
+		double sahCost{ 0. };
+		double buildSAHCost{ 0. };
 	};
 }
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <Engine/Viewer/RayTracer.h>
+#include <Engine/Light/LightSampler.h>
 
 #include <UGM/transform.h>
 #include <UGM/mat.h>
 
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 namespace Ubpa {
 	class Light;
@@ -16,6 +18,8 @@ namespace Ubpa {
 	class VisibilityChecker;
 
 	class BSDF;
+	class Primitive;
+	class Shape;
 
 	// ֻڵ߳
 	class PathTracer : public RayTracer {
@@ -30,13 +34,71 @@ namespace Ubpa {
 
 	public:
 		virtual const rgbf Trace(Ray& ray) { return Trace(ray, 0, rgbf(1.f)); }
+		virtual const AOV TraceAOV(const Ray& ray) override;
 
 		virtual void Init(Ptr<Scene> scene, Ptr<BVHAccel> bvhAccel) override;
 
 	protected:
 		// ray ϵ
+		// iterative, ray is the ray of the current bounce and is changed
+		// paths end by Russian roulette on the throughput, beyond maxDepth at least half of the paths end every bounce
 		const rgbf Trace(Ray& ray, int depth, rgbf pathThroughput);
 
+	protected:
+		struct Surface {
+			Ptr<BSDF> bsdf;
+			int bsdfIdx; // in [0, bsdfNum), the same for the surfaces of one BSDF
+			int lightIdx; // light of the same sobj, -1 if none
+		};
+
+		// shading coordinate, n is z
+		struct Frame {
+			Frame(const vecf3& s, const vecf3& t, const vecf3& n) : s(s), t(t), n(n) { }
+
+			const normalf ToLocal(const vecf3& w) const { return normalf(w.dot(s), w.dot(t), w.dot(n)); }
+			const vecf3 ToWorld(const normalf& w) const { return w[0] * s + w[1] * t + w[2] * n; }
+
+			vecf3 s;
+			vecf3 t;
+			vecf3 n;
+		};
+
+		// unoccluded light of one light sample, weighted and divided by its pdf
+		struct LightSample {
+			rgbf contribution;
+			vecf3 dir; // from the point to the light
+			float dist;
+		};
+
+		// nullptr if the shape can't scatter
+		const Surface* GetSurface(const Ptr<Shape>& shape) const;
+
+		// the normal may be changed by the normal map of the BSDF
+		static const Frame GenFrame(const Surface& surface, const pointf2& texcoord, const normalf& n, const normalf& tangent);
+
+		// MIS weighted emission of the hit, lastPos, lastN and lastPD are of the scattering that found it
+		const rgbf Emission(const Surface& surface, const normalf& wo, const vecf3& dir,
+			bool lastIsDelta, const pointf3& lastPos, const normalf& lastN, float lastPD) const;
+
+		// MIS weighted light of the lights on a miss
+		const rgbf Background(const Ray& ray, bool lastIsDelta, const pointf3& lastPos, const normalf& lastN, float lastPD) const;
+
+		// next event estimation with one light chosen by lightSampler, the shadow ray is left to the caller
+		// returns false if the sample contributes nothing
+		bool SampleLight(const pointf3& pos, const normalf& wo, const pointf2& texcoord,
+			const Frame& frame, const Surface& surface, LightSample& sample) const;
+
+		// chance of a path to go on after the bounce at depth, 1 before the roulette starts
+		float SurvivalProbability(const rgbf& pathThroughput, int depth) const;
+
+	protected:
+		// shadow rays stop short of the sampled point, so the geometry of the light doesn't occlude itself
+		static constexpr float shadowRayEpsilon = 0.001f;
+
+	private:
+		// pdf of light lightIdx to be chosen and to sample dir from pos with normal n, for the MIS of BSDF sampled hits
+		float LightPDF(int lightIdx, const pointf3& pos, const normalf& n, const vecf3& dir) const;
+
 	private:
 		enum SampleLightMode {
 			ALL,
@@ -44,13 +106,22 @@ namespace Ubpa {
 		};
 
 	public:
+		// soft cap of the path length, see Trace
 		int maxDepth;
 
-	private:
+		// how the light of the next event estimation is chosen, used by Init
+		LightSampler::Mode lightSelection;
+
+	protected:
 		std::vector<Ptr<Light>> lights;
 		std::map<Ptr<Light>, int> lightToIdx;
 		std::vector<transformf> worldToLightVec;
 		std::vector<transformf> lightToWorldVec;
+		Ptr<LightSampler> lightSampler;
+
+		// looked up once per hit instead of the components of the hit sobj
+		std::unordered_map<const Primitive*, Surface> primitive2surface;
+		int bsdfNum;
 
 		Ptr<ClosestIntersector> closestIntersector;
 		Ptr<VisibilityChecker> visibilityChecker;
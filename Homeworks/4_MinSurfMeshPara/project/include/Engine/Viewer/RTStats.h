@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+
+// define UBPA_NO_STATS to compile the counting out, the counters then stay 0
+#ifndef UBPA_NO_STATS
+#define UBPA_STATS 1
+#define UBPA_STATS_ADD(counter, n) (Ubpa::RTStats::Local().counter += (n))
+#define UBPA_STATS_PATH(length) Ubpa::RTStats::Local().AddPath(length)
+#else
+#define UBPA_STATS 0
+#define UBPA_STATS_ADD(counter, n) ((void)0)
+#define UBPA_STATS_PATH(length) ((void)0)
+#endif
+
+namespace Ubpa {
+	// counters of the ray tracing, every thread counts into its own copy without atomics
+	// RTX_Renderer sums the copies of its threads at the end of a run
+	struct RTStats {
+		enum RayType { CameraRay, IndirectRay, ShadowRay, RayTypeNum };
+		// paths of pathLengthBinNum - 1 rays and more share the last bin
+		static constexpr int pathLengthBinNum = 32;
+		static constexpr bool enabled = UBPA_STATS != 0;
+
+		long long nodeVisits{ 0 }; // BVH nodes of the scene and of the meshes, a wide node counts once
+		long long primitiveTests{ 0 };
+		long long rays[RayTypeNum]{};
+		long long pathLengths[pathLengthBinNum]{}; // paths by their number of camera and indirect rays
+		long long pathLengthSum{ 0 };
+		int maxPathLength{ 0 };
+
+		void AddPath(int length) {
+			pathLengths[length < pathLengthBinNum ? length : pathLengthBinNum - 1]++;
+			pathLengthSum += length;
+			maxPathLength = length > maxPathLength ? length : maxPathLength;
+		}
+
+		RTStats& operator+=(const RTStats& stats);
+
+		long long RayNum() const { return rays[CameraRay] + rays[IndirectRay] + rays[ShadowRay]; }
+		long long PathNum() const;
+		double MeanPathLength() const { return PathNum() > 0 ? static_cast<double>(pathLengthSum) / PathNum() : 0.; }
+
+		// a JSON object, indent is put before every line but the first
+		const std::string ToJSON(const std::string& indent = "") const;
+
+		// the counters of the calling thread
+		static RTStats& Local();
+
+		// counts in a local and adds it to a counter of the thread once it goes out of scope,
+		// so a traversal touches the thread local storage once
+		class Counter {
+		public:
+#if UBPA_STATS
+			explicit Counter(long long RTStats::* counter) : counter(counter) { }
+			~Counter() { if (n != 0) Local().*counter += n; }
+
+			void Add(long long k = 1) { n += k; }
+			long long Get() const { return n; }
+
+		private:
+			long long RTStats::* const counter;
+			long long n{ 0 };
+#else
+			explicit Counter(long long RTStats::*) { }
+
+			void Add(long long = 1) { }
+			long long Get() const { return 0; }
+#endif
+		};
+	};
+}
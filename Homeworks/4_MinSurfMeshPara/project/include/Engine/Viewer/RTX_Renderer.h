@@ -2,9 +2,16 @@
 
 #include <Basic/HeapObj.h>
 
+#include <Engine/Viewer/RTStats.h>
+
 #include <functional>
 #include <vector>
+#include <string>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 namespace Ubpa {
 	class Image;
@@ -18,6 +25,11 @@ namespace Ubpa {
 	};
 
 	class RTX_Renderer : public HeapObj {
+	public:
+		// order of the tiles in a pass, Hilbert and Spiral keep consecutive tiles next to each other
+		// so threads working at the same time touch nearby geometry
+		enum class TileOrder { ScanLine, Hilbert, Spiral };
+
 	public:
 		RTX_Renderer(const std::function<Ptr<RayTracer>()>& generator);
 
@@ -31,55 +43,151 @@ namespace Ubpa {
 		void Stop();
 		RendererState GetState() const { return state; }
 		float ProgressRate();
+		const Ptr<BVHAccel> GetBVHAccel() const { return bvhAccel; }
+
+		// side of the square tiles in pixels, the tiles at the right and bottom edges are clipped
+		void SetTileSize(int tileSize) { this->tileSize = tileSize > 0 ? tileSize : 1; }
+		int GetTileSize() const { return tileSize; }
+		void SetTileOrder(TileOrder tileOrder) { this->tileOrder = tileOrder; }
+		TileOrder GetTileOrder() const { return tileOrder; }
+
+		// seconds between the writes of the accumulated samples to the image during a run
+		void SetResolveInterval(float resolveInterval) { this->resolveInterval = resolveInterval; }
+		float GetResolveInterval() const { return resolveInterval; }
+
+		// adaptive sampling, a tile stops once the relative standard error of every pixel mean is below the threshold
+		// 0, the default, renders maxLoop loops everywhere in one lock-free pass
+		void SetErrorThreshold(float errorThreshold) { this->errorThreshold = errorThreshold; }
+		float GetErrorThreshold() const { return errorThreshold; }
+		// loops of every tile before its error is trusted
+		void SetMinLoop(int minLoop) { this->minLoop = minLoop > 2 ? minLoop : 2; }
+		int GetMinLoop() const { return minLoop; }
+		// seconds of rendering after which no more tiles start, 0 for no limit
+		void SetTimeBudget(float timeBudget) { this->timeBudget = timeBudget; }
+		float GetTimeBudget() const { return timeBudget; }
+
+		// render threads, set before Run
+		void SetThreadNum(int threadNum) { this->threadNum = threadNum > 0 ? threadNum : 1; }
+		int GetThreadNum() const { return threadNum; }
+
+		// albedo, shading normal and depth of the first hits of the camera rays, kept next to the radiance in a run
+		void SetAOV(bool aov) { this->aov = aov; }
+		bool GetAOV() const { return aov; }
+		// images of the AOVs of the last run, nullptr if it had none
+		// the normal image holds the components in [-1, 1], the depth image the distances in all channels
+		const Ptr<Image> GetAlbedoImg() const { return albedoImg; }
+		const Ptr<Image> GetNormalImg() const { return normalImg; }
+		const Ptr<Image> GetDepthImg() const { return depthImg; }
+
+		// filters the image guided by the AOVs at the end of a run, the AOVs are kept for it even without SetAOV
+		void SetDenoise(bool denoise) { this->denoise = denoise; }
+		bool GetDenoise() const { return denoise; }
+		// seconds of the denoising in the last run
+		double GetDenoiseTime() const { return denoiseTime; }
+
+		// busy time over wall time of each thread in the last run
+		const std::vector<float> & GetThreadUtilization() const { return threadUtilization; }
+		// wall time of the sampling in the last run, without the BVH build
+		double GetRenderTime() const { return renderTime; }
+		// camera samples of the last run
+		long long GetSampleNum() const { return sampleNum; }
+
+		// accumulates the samples in a memory mapped file at path, empty keeps them in memory, set before Run
+		// a run resumes from the file if it was made for the same geometry, camera, resolution, tile size and first loop,
+		// the loops of the tiles in it are skipped, materials, lights and the settings of the tracer are not checked
+		void SetCheckpoint(const std::string& checkpointPath) { this->checkpointPath = checkpointPath; }
+		const std::string& GetCheckpoint() const { return checkpointPath; }
+		// the loops [firstLoop, firstLoop + maxLoop) are rendered, runs of disjoint loops take independent samples,
+		// so their checkpoints can be merged
+		void SetFirstLoop(int firstLoop) { this->firstLoop = firstLoop > 0 ? firstLoop : 0; }
+		int GetFirstLoop() const { return firstLoop; }
+		// camera samples the last run found in its checkpoint
+		long long GetResumedSampleNum() const { return resumedSampleNum; }
+
+		// sums checkpoints of runs with disjoint loops into outPath, see Film::MergeCheckpoints
+		static bool MergeCheckpoints(const std::string& outPath, const std::vector<std::string>& inPaths);
+		// adds the checkpoint of a run to outPath, which has room for the loops [firstLoop, firstLoop + loopNum)
+		// see Film::AddCheckpoint
+		static bool AddCheckpoint(const std::string& outPath, const std::string& inPath, int firstLoop, int loopNum);
+		// the loops of [firstLoop, firstLoop + loopNum) done in a checkpoint, false if it can't be read
+		static bool GetCheckpointLoops(const std::string& path, int firstLoop, int loopNum, std::vector<bool>& loops);
+		// the image of a checkpoint, nullptr if it can't be read
+		static const Ptr<Image> ResolveCheckpoint(const std::string& path);
+
+		// BVH nodes, primitive tests, rays and path lengths of the last run, summed over the threads
+		// all 0 in a build with UBPA_NO_STATS
+		const RTStats& GetStats() const { return stats; }
+		// image of the BVH nodes visited per sample in every pixel, shadow rays included, in all channels
+		void SetCost(bool cost) { this->cost = cost; }
+		bool GetCost() const { return cost; }
+		// nullptr if the last run had no SetCost
+		const Ptr<Image> GetCostImg() const { return costImg; }
 
 	public:
 		volatile int maxLoop;
 
 	private:
+		// hands out (tile, loop) pairs, the loops of the active tiles run in passes with one atomic counter each
+		// convergence is only checked between passes, when all samples of a pass are merged,
+		// so which tiles get more samples doesn't depend on thread timing
 		class TileTask {
 		public:
-			void Init(int tileNum, int maxLoop) {
-				this->tileNum = tileNum;
-				this->maxLoop = maxLoop;
-				curTile = 0;
-				curLoop = 0;
-			}
+			struct Pass {
+				Pass(int firstLoop, int loopNum, std::vector<int>&& tiles)
+					: firstLoop(firstLoop), loopNum(loopNum), tiles(std::move(tiles)),
+					taskNum(static_cast<long long>(this->tiles.size()) * loopNum) { }
+
+				const int firstLoop;
+				const int loopNum;
+				const std::vector<int> tiles; // active tiles
+				const long long taskNum;
+				std::atomic<long long> nextTask{ 0 };
+				std::atomic<long long> doneTaskNum{ 0 };
+			};
 
-		public:
 			struct Task {
-				Task(bool hasTask, int tileID = -1, int curLoop = -1)
-					: hasTask(hasTask), tileID(tileID), curLoop(curLoop) { }
+				Task(bool hasTask, int tileID = -1, int curLoop = -1, Pass* pass = nullptr)
+					: hasTask(hasTask), tileID(tileID), curLoop(curLoop), pass(pass) { }
 
 				bool hasTask;
 				int tileID;
 				int curLoop;
+				Pass* pass;
 			};
-			const Task GetTask() {
-				if (curLoop == maxLoop)
-					return Task(false);
-
-				m.lock();
-				auto rst = Task(true, curTile, curLoop);
-				curTile++;
-				if (curTile == tileNum) {
-					curTile = 0;
-					curLoop += 1;
-				}
-				m.unlock();
-
-				return rst;
-			}
-
-			int GetCurLoop() const {
-				return curLoop;
-			}
+
+		public:
+			// isConverged is called between passes, nullptr runs all loops in one pass
+			void Init(int tileNum, int maxLoop, int minLoop, float timeBudget, const std::function<bool(int tileID)>& isConverged);
+
+			// waits at the end of a pass until the next pass starts, unless there is no isConverged
+			const Task GetTask();
+			// the last task of a pass starts the next pass, only counts the task without isConverged
+			void FinishTask(const Task& task);
+			// no more tasks, also wakes the waiting threads
+			void Stop();
+
+			// done tasks over done and remaining tasks, the remaining ones assume no more tile converges
+			float Progress();
+			long long GetDoneTaskNum() const { return doneTaskNum; }
+
+		private:
+			std::unique_ptr<Pass> GenPass(int firstLoop, std::vector<int>&& tiles) const;
 
 		private:
-			int tileNum;
-			int curTile;
-			int maxLoop;
-			int curLoop;
+			// enough tasks to keep the threads busy in a pass, fixed so that the passes don't depend on the thread count
+			static constexpr int minPassTaskNum = 256;
+
+			int maxLoop{ 0 };
+			int minLoop{ 0 };
+			float timeBudget{ 0.f };
+			std::chrono::steady_clock::time_point startTime;
+			std::function<bool(int tileID)> isConverged;
+
+			std::vector<std::unique_ptr<Pass>> passes;
+			std::atomic<Pass*> curPass{ nullptr }; // nullptr if no task is left, except for the one pass without isConverged
+			std::atomic<long long> doneTaskNum{ 0 };
 			std::mutex m;
+			std::condition_variable passCV;
 		};
 
 	private:
@@ -87,9 +195,33 @@ namespace Ubpa {
 
 		RendererState state;
 
-		const int threadNum;
+		int threadNum;
 
 		TileTask tileTask;
+		int tileSize;
+		TileOrder tileOrder;
+		float resolveInterval;
+		float errorThreshold;
+		int minLoop;
+		float timeBudget;
+		std::vector<float> threadUtilization;
+		double renderTime;
+		long long sampleNum;
+		RTStats stats;
+
+		bool cost;
+		Ptr<Image> costImg;
+
+		std::string checkpointPath;
+		int firstLoop;
+		long long resumedSampleNum;
+
+		bool aov;
+		bool denoise;
+		double denoiseTime;
+		Ptr<Image> albedoImg;
+		Ptr<Image> normalImg;
+		Ptr<Image> depthImg;
 
 		Ptr<BVHAccel> bvhAccel;
 	};
@@ -1,16 +1,31 @@
 #pragma once
 
 #include <Basic/HeapObj.h>
+#include <Basic/Math.h>
 
 #include <Engine/Viewer/Ray.h>
+#include <Engine/Viewer/RTStats.h>
 
 #include <UGM/rgb.h>
+#include <UGM/normal.h>
+
+#include <vector>
 
 namespace Ubpa {
 	class Scene;
 	class BVHAccel;
 
 	class RayTracer : public HeapObj {
+	public:
+		// first surface of a camera ray, guides the denoiser
+		struct AOV {
+			AOV() : albedo(0.f), normal(0.f), depth(0.f) { }
+
+			rgbf albedo;
+			normalf normal; // world space shading normal
+			float depth; // distance along the ray, 0 if the ray hits nothing
+		};
+
 	protected:
 		RayTracer() = default;
 		virtual ~RayTracer() = default;
@@ -18,6 +33,26 @@ namespace Ubpa {
 	public:
 		// ray ϵ
 		virtual const rgbf Trace(Ray& ray) = 0;
+		// rays[i] is traced with the random numbers of generators[i], radiances[i] is its result
+		// costs[i] is the number of BVH nodes its path visited, shadow rays included, 0 without stats
+		// the default traces the rays one by one, tracers working on whole batches override it
+		virtual void TraceBatch(std::vector<Ray>& rays, std::vector<Math::PCG32>& generators,
+			std::vector<rgbf>& radiances, std::vector<long long>& costs)
+		{
+			radiances.resize(rays.size());
+			costs.resize(rays.size());
+			auto & stats = RTStats::Local();
+			for (size_t i = 0; i < rays.size(); i++) {
+				const long long nodeVisits = stats.nodeVisits;
+				Math::RandGenerator() = generators[i];
+				radiances[i] = Trace(rays[i]);
+				generators[i] = Math::RandGenerator();
+				costs[i] = stats.nodeVisits - nodeVisits;
+			}
+		}
+		// uses no random numbers, so the radiance of the ray doesn't change
+		// the default knows no surfaces, tracers of the scene override it
+		virtual const AOV TraceAOV(const Ray& ray) { return AOV(); }
 		virtual void Init(Ptr<Scene> scene, Ptr<BVHAccel> bvhAccel) {
 			this->bvhAccel = bvhAccel;
 		}
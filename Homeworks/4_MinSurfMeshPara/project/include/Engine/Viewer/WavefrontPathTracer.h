@@ -0,0 +1,77 @@
+#pragma once
+
+#include <Engine/Viewer/PathTracer.h>
+
+#include <vector>
+
+namespace Ubpa {
+	// traces a batch of paths bounce by bounce in stages: extend all paths, sort the hits by BSDF,
+	// shade the hits of each BSDF together, then trace the shadow rays of the batch
+	// the virtual calls of one BSDF run back to back, so their branches and data stay hot
+	// a path draws the same random numbers as in PathTracer, so the radiances are the same
+	class WavefrontPathTracer : public PathTracer {
+	public:
+		WavefrontPathTracer() = default;
+
+	public:
+		static const Ptr<WavefrontPathTracer> New() { return Ubpa::New<WavefrontPathTracer>(); }
+
+	protected:
+		virtual ~WavefrontPathTracer() = default;
+
+	public:
+		virtual void TraceBatch(std::vector<Ray>& rays, std::vector<Math::PCG32>& generators,
+			std::vector<rgbf>& radiances, std::vector<long long>& costs) override;
+
+	private:
+		struct Path {
+			Ray ray;
+			rgbf throughput;
+			rgbf L;
+			int depth;
+			long long cost; // BVH nodes visited by the rays of the path
+
+			// the last scattering, for the MIS weights of BSDF sampled emission
+			pointf3 lastPos;
+			normalf lastN;
+			float lastPD;
+			bool lastIsDelta;
+		};
+
+		struct Hit {
+			int pathIdx;
+			const Surface* surface;
+			pointf3 pos;
+			normalf n;
+			normalf tangent;
+			pointf2 texcoord;
+		};
+
+		struct ShadowRay {
+			int pathIdx;
+			Ray ray;
+			float tMax;
+			rgbf contribution; // times the throughput of the path
+		};
+
+	private:
+		// closest hits of the active paths, ends the paths that miss
+		void Extend();
+		// stable counting sort of hits by BSDF into sortedHits
+		void SortHits();
+		// the next rays and active paths, the shadow rays of the bounce
+		void Shade(std::vector<Math::PCG32>& generators);
+		// returns false if the path ends
+		bool ShadeHit(const Hit& hit, Path& path);
+		void TraceShadowRays();
+
+	private:
+		// reused across batches, so a batch doesn't allocate once they have grown
+		std::vector<Path> paths;
+		std::vector<int> activePaths;
+		std::vector<Hit> hits;
+		std::vector<Hit> sortedHits;
+		std::vector<int> bsdfOffsets;
+		std::vector<ShadowRay> shadowRays;
+	};
+}
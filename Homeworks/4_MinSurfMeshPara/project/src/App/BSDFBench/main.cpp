@@ -0,0 +1,206 @@
+// benchmark of the scalar and the batched BSDF evaluation
+// usage: BSDFBench [query num] [repeat num]
+// the queries are random direction pairs, half of them on the same side of the surface
+// max diff is the largest difference of batch and scalar results relative to max(1, |scalar|)
+
+#include <Engine/Material/BSDF_Diffuse.h>
+#include <Engine/Material/BSDF_CookTorrance.h>
+#include <Engine/Material/BSDF_MetalWorkflow.h>
+#include <Engine/Material/GGX.h>
+#include <Engine/Material/Beckmann.h>
+#include <Engine/Material/SchlickGGX.h>
+
+#include <Basic/Timer.h>
+#include <Basic/Math.h>
+
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+using namespace Ubpa;
+using namespace std;
+
+namespace {
+	struct Query {
+		normalf wo;
+		normalf wi;
+		pointf2 texcoord;
+	};
+
+	const normalf RandDir(mt19937 & rng) {
+		normal_distribution<float> n(0.f, 1.f);
+		while (true) {
+			const normalf w(n(rng), n(rng), n(rng));
+			if (w.norm2() > 1e-6f)
+				return w.normalize();
+		}
+	}
+
+	const vector<Query> GenQueries(int queryNum, mt19937 & rng) {
+		uniform_real_distribution<float> u(0.f, 1.f);
+		vector<Query> queries(queryNum);
+		for (int i = 0; i < queryNum; i++) {
+			queries[i].wo = RandDir(rng);
+			queries[i].wi = RandDir(rng);
+			if (i % 2 == 0 && queries[i].wo[2] * queries[i].wi[2] < 0)
+				queries[i].wi[2] = -queries[i].wi[2];
+			queries[i].texcoord = pointf2(u(rng), u(rng));
+		}
+		return queries;
+	}
+
+	float Diff(float batch, float scalar) {
+		if (std::isnan(batch) || std::isnan(scalar))
+			return std::isnan(batch) == std::isnan(scalar) ? 0.f : INFINITY;
+		return std::abs(batch - scalar) / std::max(1.f, std::abs(scalar));
+	}
+
+	float Diff(const rgbf & batch, const rgbf & scalar) {
+		return std::max({ Diff(batch[0], scalar[0]), Diff(batch[1], scalar[1]), Diff(batch[2], scalar[2]) });
+	}
+
+	// seconds of the fastest of repeatNum runs
+	double Time(int repeatNum, const function<void()> & func) {
+		double minTime = INFINITY;
+		for (int i = 0; i < repeatNum; i++) {
+			Timer timer;
+			timer.Start();
+			func();
+			timer.Stop();
+			minTime = std::min(minTime, timer.GetWholeTime());
+		}
+		return minTime;
+	}
+
+	void Print(const char * name, int queryNum, double scalarTime, double batchTime, float maxDiff) {
+		printf("\t""%-9s scalar %8.2f Mq/s, batch %8.2f Mq/s, x%.2f, max diff %g\n",
+			name, queryNum / scalarTime / 1e6, queryNum / batchTime / 1e6, scalarTime / batchTime, maxDiff);
+	}
+
+	void BenchBSDF(const char * name, const Ptr<BSDF> & bsdf, const vector<Query> & queries, int repeatNum) {
+		const int queryNum = static_cast<int>(queries.size());
+		BSDFBatch batch;
+		batch.Resize(queryNum);
+		for (int i = 0; i < queryNum; i++) {
+			batch.SetWo(i, queries[i].wo);
+			batch.SetWi(i, queries[i].wi);
+			batch.SetTexcoord(i, queries[i].texcoord);
+		}
+		printf("%s:\n", name);
+
+		vector<rgbf> f(queryNum);
+		const double scalarF = Time(repeatNum, [&]() {
+			for (int i = 0; i < queryNum; i++)
+				f[i] = bsdf->F(queries[i].wo, queries[i].wi, queries[i].texcoord);
+		});
+		const double batchF = Time(repeatNum, [&]() { bsdf->F_Batch(batch); });
+		float maxDiff = 0.f;
+		for (int i = 0; i < queryNum; i++)
+			maxDiff = std::max(maxDiff, Diff(batch.F(i), f[i]));
+		Print("F", queryNum, scalarF, batchF, maxDiff);
+
+		vector<float> pdf(queryNum);
+		const double scalarPDF = Time(repeatNum, [&]() {
+			for (int i = 0; i < queryNum; i++)
+				pdf[i] = bsdf->PDF(queries[i].wo, queries[i].wi, queries[i].texcoord);
+		});
+		const double batchPDF = Time(repeatNum, [&]() { bsdf->PDF_Batch(batch); });
+		maxDiff = 0.f;
+		for (int i = 0; i < queryNum; i++)
+			maxDiff = std::max(maxDiff, Diff(batch.pdf[i], pdf[i]));
+		Print("PDF", queryNum, scalarPDF, batchPDF, maxDiff);
+
+		// both start at the same random numbers
+		vector<normalf> wi(queryNum);
+		const double scalarSample = Time(repeatNum, [&]() {
+			Math::RandSetPixelSample(0, 0);
+			for (int i = 0; i < queryNum; i++)
+				f[i] = bsdf->Sample_f(queries[i].wo, queries[i].texcoord, wi[i], pdf[i]);
+		});
+		const double batchSample = Time(repeatNum, [&]() {
+			Math::RandSetPixelSample(0, 0);
+			bsdf->Sample_f_Batch(batch);
+		});
+		maxDiff = 0.f;
+		for (int i = 0; i < queryNum; i++) {
+			maxDiff = std::max(maxDiff, Diff(batch.F(i), f[i]));
+			maxDiff = std::max(maxDiff, Diff(batch.pdf[i], pdf[i]));
+			for (int k = 0; k < 3; k++)
+				maxDiff = std::max(maxDiff, Diff(batch.Wi(i)[k], wi[i][k]));
+		}
+		Print("Sample_f", queryNum, scalarSample, batchSample, maxDiff);
+	}
+
+	void BenchMicrofacet(const char * name, const MicrofacetDistribution & distribution, const vector<Query> & queries, int repeatNum) {
+		const int queryNum = static_cast<int>(queries.size());
+		BSDFBatch batch;
+		batch.Resize(queryNum);
+		for (int i = 0; i < queryNum; i++) {
+			// reflection pairs above the surface
+			batch.SetWo(i, SurfCoord::ToUpper(queries[i].wo));
+			batch.SetWi(i, SurfCoord::ToUpper(queries[i].wi));
+		}
+		vector<float> cosTheta(batch.PaddedSize());
+		for (int i = 0; i < batch.PaddedSize(); i++)
+			cosTheta[i] = (batch.Wo(i) + batch.Wi(i)).normalize()[2];
+		printf("%s:\n", name);
+
+		vector<float> scalarRst(queryNum);
+		vector<float> batchRst(batch.PaddedSize());
+		const double scalarD = Time(repeatNum, [&]() {
+			for (int i = 0; i < queryNum; i++) {
+				const float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta[i] * cosTheta[i]));
+				scalarRst[i] = distribution.D(normalf(sinTheta, 0.f, cosTheta[i]));
+			}
+		});
+		const double batchD = Time(repeatNum, [&]() { distribution.D_Batch(cosTheta.data(), batchRst.data(), batch.PaddedSize()); });
+		float maxDiff = 0.f;
+		for (int i = 0; i < queryNum; i++)
+			maxDiff = std::max(maxDiff, Diff(batchRst[i], scalarRst[i]));
+		Print("D", queryNum, scalarD, batchD, maxDiff);
+
+		const double scalarG = Time(repeatNum, [&]() {
+			for (int i = 0; i < queryNum; i++) {
+				const normalf wo = batch.Wo(i);
+				const normalf wi = batch.Wi(i);
+				scalarRst[i] = distribution.G(wo, wi, (wo + wi).normalize());
+			}
+		});
+		const double batchG = Time(repeatNum, [&]() { distribution.G_Batch(batch, batchRst.data()); });
+		maxDiff = 0.f;
+		for (int i = 0; i < queryNum; i++)
+			maxDiff = std::max(maxDiff, Diff(batchRst[i], scalarRst[i]));
+		Print("G", queryNum, scalarG, batchG, maxDiff);
+	}
+}
+
+int main(int argc, char * argv[]) {
+	const int queryNum = argc > 1 ? std::max(1, atoi(argv[1])) : 1 << 20;
+	const int repeatNum = argc > 2 ? std::max(1, atoi(argv[2])) : 5;
+
+	mt19937 rng(5489u);
+	const auto queries = GenQueries(queryNum, rng);
+
+	BenchBSDF("BSDF_Diffuse", BSDF_Diffuse::New(rgbf(0.8f, 0.6f, 0.4f)), queries, repeatNum);
+	BenchBSDF("BSDF_CookTorrance", BSDF_CookTorrance::New(1.5f, 0.3f, rgbf(0.9f), rgbf(0.5f, 0.4f, 0.3f)), queries, repeatNum);
+	BenchBSDF("BSDF_MetalWorkflow", BSDF_MetalWorkflow::New(rgbf(0.9f, 0.7f, 0.3f), 0.4f, 0.6f), queries, repeatNum);
+
+	GGX ggx;
+	ggx.SetAlpha(0.4f);
+	BenchMicrofacet("GGX", ggx, queries, repeatNum);
+
+	Beckmann beckmann;
+	beckmann.SetAlpha(0.4f);
+	BenchMicrofacet("Beckmann", beckmann, queries, repeatNum);
+
+	SchlickGGX schlickGGX;
+	schlickGGX.SetAlpha(0.4f);
+	BenchMicrofacet("SchlickGGX", schlickGGX, queries, repeatNum);
+
+	return 0;
+}
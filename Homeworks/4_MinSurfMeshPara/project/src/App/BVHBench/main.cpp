@@ -0,0 +1,162 @@
+// traversal benchmark of the BVHAccel builders and node formats
+// usage: BVHBench [scene path | triangle num] [ray num]
+// without a scene path, the scene is random small triangles in a cube
+
+#include <Engine/Viewer/BVHAccel.h>
+#include <Engine/Intersector/ClosestIntersector.h>
+#include <Engine/Intersector/VisibilityChecker.h>
+#include <Engine/Scene/SObj.h>
+#include <Engine/Scene/CmptGeometry.h>
+#include <Engine/Primitive/TriMesh.h>
+
+#include <Basic/Timer.h>
+
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+
+using namespace Ubpa;
+using namespace std;
+
+namespace {
+	struct Config {
+		const char * name;
+		BVHAccel::Builder builder;
+		BVHAccel::Width width;
+		bool quantized;
+		bool clusteredLayout;
+		bool twoLevel;
+	};
+
+	const Ptr<SObj> GenScene(int triangleNum, mt19937 & rng) {
+		uniform_real_distribution<float> center(-10.f, 10.f);
+		uniform_real_distribution<float> offset(-0.3f, 0.3f);
+
+		vector<pointf3> positions;
+		vector<unsigned> indice;
+		for (int i = 0; i < triangleNum; i++) {
+			const pointf3 c(center(rng), center(rng), center(rng));
+			for (int k = 0; k < 3; k++) {
+				positions.push_back(pointf3(c[0] + offset(rng), c[1] + offset(rng), c[2] + offset(rng)));
+				indice.push_back(static_cast<unsigned>(3 * i + k));
+			}
+		}
+
+		auto root = SObj::New(nullptr, "root");
+		auto meshObj = SObj::New(root, "mesh");
+		CmptGeometry::New(meshObj, TriMesh::New(indice, positions));
+		return root;
+	}
+
+	// incoherent rays from random points in the scene box towards random directions
+	const vector<Ray> GenRays(const bboxf3 & box, int rayNum, mt19937 & rng) {
+		uniform_real_distribution<float> u(0.f, 1.f);
+		uniform_real_distribution<float> d(-1.f, 1.f);
+
+		vector<Ray> rays;
+		rays.reserve(rayNum);
+		while (static_cast<int>(rays.size()) < rayNum) {
+			const vecf3 dir(d(rng), d(rng), d(rng));
+			if (dir.norm2() < 0.01f || dir.norm2() > 1.f)
+				continue;
+
+			const pointf3 origin(
+				box.minP()[0] + u(rng) * (box.maxP()[0] - box.minP()[0]),
+				box.minP()[1] + u(rng) * (box.maxP()[1] - box.minP()[1]),
+				box.minP()[2] + u(rng) * (box.maxP()[2] - box.minP()[2]));
+			rays.emplace_back(origin, dir.normalize());
+		}
+		return rays;
+	}
+}
+
+int main(int argc, char * argv[]) {
+	mt19937 rng(5489u);
+
+	Ptr<SObj> root;
+	if (argc > 1 && !isdigit(static_cast<unsigned char>(argv[1][0]))) {
+		root = SObj::Load(argv[1]);
+		if (!root) {
+			printf("ERROR::BVHBench:\n"
+				"\t""load %s fail\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+		root = GenScene(argc > 1 ? atoi(argv[1]) : 200000, rng);
+
+	const int rayNum = argc > 2 ? atoi(argv[2]) : 500000;
+
+	const Config configs[] = {
+		{ "BVH2", BVHAccel::Builder::SAH, BVHAccel::Width::BVH2, false, false, false },
+		{ "BVH2 quantized, depth first", BVHAccel::Builder::SAH, BVHAccel::Width::BVH2, true, false, false },
+		{ "BVH2 quantized, van Emde Boas", BVHAccel::Builder::SAH, BVHAccel::Width::BVH2, true, true, false },
+		{ "BVH4", BVHAccel::Builder::SAH, BVHAccel::Width::BVH4, false, false, false },
+		{ "BVH8", BVHAccel::Builder::SAH, BVHAccel::Width::BVH8, false, false, false },
+		{ "LBVH BVH2", BVHAccel::Builder::LBVH, BVHAccel::Width::BVH2, false, false, false },
+		{ "LBVH BVH8", BVHAccel::Builder::LBVH, BVHAccel::Width::BVH8, false, false, false },
+		{ "SBVH BVH2", BVHAccel::Builder::SBVH, BVHAccel::Width::BVH2, false, false, false },
+		{ "SBVH BVH8", BVHAccel::Builder::SBVH, BVHAccel::Width::BVH8, false, false, false },
+		{ "BVH2 two-level", BVHAccel::Builder::SAH, BVHAccel::Width::BVH2, false, false, true },
+		{ "BVH8 two-level", BVHAccel::Builder::SAH, BVHAccel::Width::BVH8, false, false, true },
+	};
+
+	vector<Ray> rays;
+	auto closestIntersector = ClosestIntersector::New();
+	auto visibilityChecker = VisibilityChecker::New();
+	for (const auto & config : configs) {
+		auto bvhAccel = BVHAccel::New();
+		bvhAccel->SetBuilder(config.builder);
+		bvhAccel->SetWidth(config.width);
+		bvhAccel->SetQuantized(config.quantized);
+		bvhAccel->SetClusteredLayout(config.clusteredLayout);
+		bvhAccel->SetTwoLevel(config.twoLevel);
+		bvhAccel->Init(root);
+		if (bvhAccel->GetBVHNodes().empty()) {
+			printf("ERROR::BVHBench:\n"
+				"\t""no shapes in the scene\n");
+			return 1;
+		}
+
+		const auto & sceneBox = bvhAccel->GetBVHNodes()[0].GetBox();
+		if (rays.empty())
+			rays = GenRays(sceneBox, rayNum, rng);
+
+		// shadow rays end halfway across the scene, so some of them are unoccluded
+		const float shadowDist = 0.5f * sceneBox.diagonal().norm();
+
+		int closestHits = 0;
+		Timer closestTimer;
+		closestTimer.Start();
+		for (auto ray : rays) {
+			closestIntersector->Init(&ray);
+			closestIntersector->Visit(bvhAccel);
+			closestHits += closestIntersector->GetRst().IsIntersect();
+		}
+		closestTimer.Stop();
+
+		int shadowHits = 0;
+		Timer shadowTimer;
+		shadowTimer.Start();
+		for (auto ray : rays) {
+			visibilityChecker->Init(&ray, shadowDist);
+			visibilityChecker->Visit(bvhAccel);
+			shadowHits += visibilityChecker->GetRst().IsIntersect();
+		}
+		shadowTimer.Stop();
+
+		printf("%s:\n"
+			"\t""build %f s, %zd bytes of nodes, SAH cost %f\n"
+			"\t""closest %.3f Mrays/s, %d hits\n"
+			"\t""shadow %.3f Mrays/s, %d hits\n",
+			config.name,
+			bvhAccel->GetBuildTime(), bvhAccel->GetNodeBytes(), bvhAccel->GetSAHCost(),
+			rayNum / closestTimer.GetWholeTime() / 1e6, closestHits,
+			rayNum / shadowTimer.GetWholeTime() / 1e6, shadowHits);
+	}
+
+	return 0;
+}
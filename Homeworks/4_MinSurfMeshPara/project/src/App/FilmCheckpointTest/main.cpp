@@ -0,0 +1,168 @@
+// kills a process between Film::MergeFilmTile and Film::SetLoopDone, then resumes its checkpoint
+// the resumed run must end with the sums of a run that was never killed, bit by bit
+// usage: FilmCheckpointTest [directory of the checkpoints]
+// prints PASS or FAIL, the exit code is 0 only on PASS
+
+#include "Film.h"
+#include "FilmTile.h"
+
+#include <Engine/Filter/FilterMitchell.h>
+#include <Basic/Image.h>
+#include <Basic/Math.h>
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace Ubpa;
+using namespace std;
+
+namespace {
+	const int width = 40;
+	const int height = 24;
+	const int tileSize = 16;
+	const int loopNum = 3;
+	// a tile in the middle, its footprint reaches the pixels of all the other tiles
+	const int killTile = 1;
+	const int killLoop = 1;
+
+	const vector<bboxi2> GenTiles() {
+		vector<bboxi2> tiles;
+		for (int y = 0; y < height; y += tileSize) {
+			for (int x = 0; x < width; x += tileSize)
+				tiles.emplace_back(vali2(x, y), vali2(min(x + tileSize, width), min(y + tileSize, height)));
+		}
+		return tiles;
+	}
+
+	const Ptr<Film> MapFilm(const string & path, int tileNum, bool & resumed) {
+		auto film = Film::New(Image::New(width, height, 3), FilterMitchell::New(vecf2(2.f), 1.f / 3.f, 1.f / 3.f));
+		const Film::CheckpointKey key{ 1, tileSize, tileNum, 0, loopNum };
+		return film->MapCheckpoint(path, key, resumed) ? film : nullptr;
+	}
+
+	// the samples depend on the pixel and the loop only, like the ones of RTX_Renderer
+	const Ptr<FilmTile> TraceLoop(const Ptr<Film> & film, const bboxi2 & tile, int loop) {
+		auto filmTile = film->GenFilmTile(tile);
+		for (int y = tile.minP()[1]; y < tile.maxP()[1]; y++) {
+			for (int x = tile.minP()[0]; x < tile.maxP()[0]; x++) {
+				Math::RandSetPixelSample(static_cast<uint64_t>(y) * width + x, loop);
+				const pointf2 pos(x + Math::Rand_F(), y + Math::Rand_F());
+				const rgbf radiance(Math::Rand_F(), Math::Rand_F(), 4.f * Math::Rand_F());
+				filmTile->AddSample(pos, radiance, 1);
+			}
+		}
+		return filmTile;
+	}
+
+	// the loops of the checkpoint not done yet
+	void Render(const Ptr<Film> & film, const vector<bboxi2> & tiles) {
+		for (int loop = 0; loop < loopNum; loop++) {
+			for (int i = 0; i < static_cast<int>(tiles.size()); i++) {
+				if (film->IsLoopDone(i, loop))
+					continue;
+
+				auto filmTile = TraceLoop(film, tiles[i], loop);
+				film->BeginLoop(i, loop, filmTile);
+				film->MergeFilmTile(filmTile);
+				film->SetLoopDone(i, loop, tiles[i].area());
+			}
+		}
+	}
+}
+
+int main(int argc, char ** argv) {
+#ifdef _WIN32
+	printf("FilmCheckpointTest needs fork, SKIP\n");
+	return 0;
+#else
+	const string dir = argc > 1 ? argv[1] : ".";
+	const string refPath = dir + "/FilmCheckpointTest_ref.film";
+	const string killedPath = dir + "/FilmCheckpointTest_killed.film";
+	remove(refPath.c_str());
+	remove(killedPath.c_str());
+
+	const auto tiles = GenTiles();
+	const int tileNum = static_cast<int>(tiles.size());
+	bool resumed;
+
+	long long refSampleNum;
+	{
+		auto film = MapFilm(refPath, tileNum, resumed);
+		if (!film) {
+			printf("FAIL: can't make %s\n", refPath.c_str());
+			return 1;
+		}
+		Render(film, tiles);
+		refSampleNum = film->GetCheckpointSampleNum();
+	}
+
+	// the child takes the loops before killLoop of killTile and dies in the merge of killLoop
+	const pid_t pid = fork();
+	if (pid == 0) {
+		auto film = MapFilm(killedPath, tileNum, resumed);
+		if (!film)
+			_exit(1);
+		for (int loop = 0; loop < killLoop; loop++) {
+			for (int i = 0; i < tileNum; i++) {
+				auto filmTile = TraceLoop(film, tiles[i], loop);
+				film->BeginLoop(i, loop, filmTile);
+				film->MergeFilmTile(filmTile);
+				film->SetLoopDone(i, loop, tiles[i].area());
+			}
+		}
+
+		auto filmTile = TraceLoop(film, tiles[killTile], killLoop);
+		film->BeginLoop(killTile, killLoop, filmTile);
+		film->MergeFilmTile(filmTile);
+		raise(SIGKILL);
+		_exit(1);
+	}
+	int status;
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL) {
+		printf("FAIL: the child was not killed in the merge\n");
+		return 1;
+	}
+
+	long long killedSampleNum;
+	{
+		auto film = MapFilm(killedPath, tileNum, resumed);
+		if (!film || !resumed) {
+			printf("FAIL: can't resume %s\n", killedPath.c_str());
+			return 1;
+		}
+		if (film->IsLoopDone(killTile, killLoop)) {
+			printf("FAIL: the loop killed in its merge is done\n");
+			return 1;
+		}
+		if (film->GetCheckpointSampleNum() != killLoop * static_cast<long long>(width) * height) {
+			printf("FAIL: %lld samples after the rollback, expect %lld\n",
+				film->GetCheckpointSampleNum(), killLoop * static_cast<long long>(width) * height);
+			return 1;
+		}
+		Render(film, tiles);
+		killedSampleNum = film->GetCheckpointSampleNum();
+	}
+
+	const auto refImg = Film::ResolveCheckpoint(refPath);
+	const auto killedImg = Film::ResolveCheckpoint(killedPath);
+	if (!refImg || !killedImg) {
+		printf("FAIL: can't resolve the checkpoints\n");
+		return 1;
+	}
+	const bool same = killedSampleNum == refSampleNum
+		&& memcmp(refImg->GetData(), killedImg->GetData(), sizeof(float) * 3 * width * height) == 0;
+	printf(same ? "PASS\n" : "FAIL: the resumed run differs from the one never killed\n");
+
+	remove(refPath.c_str());
+	remove(killedPath.c_str());
+	return same ? 0 : 1;
+#endif
+}
@@ -0,0 +1,268 @@
+#include "WorkerProcess.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace Ubpa;
+
+using namespace std;
+
+#ifdef _WIN32
+namespace {
+	// quoting undone by CommandLineToArgvW, backslashes only need doubling in front of quotes
+	const string QuoteArg(const string & arg) {
+		if (!arg.empty() && arg.find_first_of(" \t\"") == string::npos)
+			return arg;
+
+		string rst = "\"";
+		size_t backslashNum = 0;
+		for (auto c : arg) {
+			if (c == '\\') {
+				backslashNum++;
+				continue;
+			}
+			rst.append(c == '"' ? backslashNum * 2 + 1 : backslashNum, '\\');
+			backslashNum = 0;
+			rst += c;
+		}
+		rst.append(backslashNum * 2, '\\');
+		return rst + "\"";
+	}
+}
+
+WorkerProcess::WorkerProcess(const vector<string> & args) {
+	if (args.empty())
+		return;
+
+	SECURITY_ATTRIBUTES attributes{ sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+	HANDLE childInput, childOutput;
+	if (!CreatePipe(&childInput, &input, &attributes, 0))
+		return;
+	if (!CreatePipe(&output, &childOutput, &attributes, 0)) {
+		CloseHandle(childInput);
+		return;
+	}
+	// only the ends of the child are inherited
+	SetHandleInformation(input, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(output, HANDLE_FLAG_INHERIT, 0);
+
+	string cmdLine;
+	for (const auto & arg : args)
+		cmdLine += (cmdLine.empty() ? "" : " ") + QuoteArg(arg);
+
+	STARTUPINFOA startupInfo{};
+	startupInfo.cb = sizeof(startupInfo);
+	startupInfo.dwFlags = STARTF_USESTDHANDLES;
+	startupInfo.hStdInput = childInput;
+	startupInfo.hStdOutput = childOutput;
+	startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+	PROCESS_INFORMATION processInfo{};
+	valid = CreateProcessA(nullptr, &cmdLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startupInfo, &processInfo);
+	CloseHandle(childInput);
+	CloseHandle(childOutput);
+	if (!valid)
+		return;
+
+	CloseHandle(processInfo.hThread);
+	process = processInfo.hProcess;
+}
+
+WorkerProcess::~WorkerProcess() {
+	CloseInput();
+	if (output != nullptr)
+		CloseHandle(output);
+	if (process != nullptr) {
+		WaitForSingleObject(process, INFINITE);
+		CloseHandle(process);
+	}
+}
+
+bool WorkerProcess::WriteLine(const string & line) {
+	const string data = line + "\n";
+	DWORD size;
+	return input != nullptr && WriteFile(input, data.data(), static_cast<DWORD>(data.size()), &size, nullptr) && size == data.size();
+}
+
+bool WorkerProcess::ReadLine(string & line) {
+	size_t end;
+	while ((end = readBuffer.find('\n')) == string::npos) {
+		char buffer[4096];
+		DWORD size;
+		if (output == nullptr || !ReadFile(output, buffer, sizeof(buffer), &size, nullptr) || size == 0)
+			return false;
+		readBuffer.append(buffer, size);
+	}
+	// the child may write "\r\n" in text mode
+	line = readBuffer.substr(0, end > 0 && readBuffer[end - 1] == '\r' ? end - 1 : end);
+	readBuffer.erase(0, end + 1);
+	return true;
+}
+
+void WorkerProcess::CloseInput() {
+	if (input != nullptr) {
+		CloseHandle(input);
+		input = nullptr;
+	}
+}
+
+int WorkerProcess::BindNumaNode(int node) {
+	ULONGLONG mask;
+	if (node < 0 || !GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask) || mask == 0)
+		return 0;
+
+	// the mask is of the processor group of the node, which fails unless it is the group of the process
+	if (!SetProcessAffinityMask(GetCurrentProcess(), static_cast<DWORD_PTR>(mask)))
+		return 0;
+
+	int cpuNum = 0;
+	for (; mask != 0; mask &= mask - 1)
+		cpuNum++;
+	return cpuNum;
+}
+
+int WorkerProcess::NumaNodeNum() {
+	ULONG highestNode;
+	return GetNumaHighestNodeNumber(&highestNode) ? static_cast<int>(highestNode) + 1 : 1;
+}
+#else
+WorkerProcess::WorkerProcess(const vector<string> & args) {
+	if (args.empty())
+		return;
+
+	// a write to a dead child fails instead of killing the parent
+	signal(SIGPIPE, SIG_IGN);
+
+	int inputPipe[2], outputPipe[2];
+	if (pipe(inputPipe) != 0)
+		return;
+	if (pipe(outputPipe) != 0) {
+		close(inputPipe[0]);
+		close(inputPipe[1]);
+		return;
+	}
+	// children started later must not hold the pipes of this one, or it never reads EOF
+	for (int fd : { inputPipe[0], inputPipe[1], outputPipe[0], outputPipe[1] })
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	vector<char *> argv;
+	for (const auto & arg : args)
+		argv.push_back(const_cast<char *>(arg.c_str()));
+	argv.push_back(nullptr);
+
+	pid = fork();
+	if (pid == 0) {
+		// dup2 clears FD_CLOEXEC of the copies
+		dup2(inputPipe[0], STDIN_FILENO);
+		dup2(outputPipe[1], STDOUT_FILENO);
+		execvp(argv[0], argv.data());
+		_exit(127);
+	}
+
+	close(inputPipe[0]);
+	close(outputPipe[1]);
+	input = inputPipe[1];
+	output = outputPipe[0];
+	valid = pid > 0;
+}
+
+WorkerProcess::~WorkerProcess() {
+	CloseInput();
+	if (output != -1)
+		close(output);
+	if (pid > 0) {
+		int status;
+		waitpid(pid, &status, 0);
+	}
+}
+
+bool WorkerProcess::WriteLine(const string & line) {
+	const string data = line + "\n";
+	size_t written = 0;
+	while (input != -1 && written < data.size()) {
+		const ssize_t size = write(input, data.data() + written, data.size() - written);
+		if (size <= 0)
+			return false;
+		written += static_cast<size_t>(size);
+	}
+	return input != -1;
+}
+
+bool WorkerProcess::ReadLine(string & line) {
+	size_t end;
+	while ((end = readBuffer.find('\n')) == string::npos) {
+		char buffer[4096];
+		const ssize_t size = output != -1 ? read(output, buffer, sizeof(buffer)) : -1;
+		if (size <= 0)
+			return false;
+		readBuffer.append(buffer, static_cast<size_t>(size));
+	}
+	line = readBuffer.substr(0, end);
+	readBuffer.erase(0, end + 1);
+	return true;
+}
+
+void WorkerProcess::CloseInput() {
+	if (input != -1) {
+		close(input);
+		input = -1;
+	}
+}
+
+int WorkerProcess::BindNumaNode(int node) {
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	FILE * file = node >= 0 ? fopen(path, "r") : nullptr;
+	if (!file)
+		return 0;
+
+	// ranges like 0-15,32-47
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	int first, last;
+	while (fscanf(file, "%d", &first) == 1) {
+		last = first;
+		int c = fgetc(file);
+		if (c == '-') {
+			if (fscanf(file, "%d", &last) != 1)
+				break;
+			c = fgetc(file);
+		}
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, &cpus);
+		if (c != ',')
+			break;
+	}
+	fclose(file);
+
+	const int cpuNum = CPU_COUNT(&cpus);
+	if (cpuNum == 0 || sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+		return 0;
+	return cpuNum;
+}
+
+int WorkerProcess::NumaNodeNum() {
+	int nodeNum = 0;
+	for (;; nodeNum++) {
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", nodeNum);
+		if (access(path, F_OK) != 0)
+			break;
+	}
+	return nodeNum > 0 ? nodeNum : 1;
+}
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Ubpa {
+	// child process talking to its parent in lines of text, the stdin and stdout of the child are pipes of the parent
+	// the stderr of the child stays the one of the parent
+	class WorkerProcess {
+	public:
+		// args[0] is the executable, looked up in PATH like a shell does
+		WorkerProcess(const std::vector<std::string>& args);
+		// closes the stdin of the child and waits for it to exit
+		~WorkerProcess();
+
+		WorkerProcess(const WorkerProcess&) = delete;
+		WorkerProcess& operator=(const WorkerProcess&) = delete;
+
+	public:
+		bool IsValid() const { return valid; }
+
+		// a '\n' is appended
+		bool WriteLine(const std::string& line);
+		// blocks until a whole line is read, the line is without '\n', false once the child closed its stdout
+		bool ReadLine(std::string& line);
+
+		// the child reads EOF after what was written
+		void CloseInput();
+
+		// pins the calling thread to the cpus of a NUMA node, call it before starting threads, they inherit it,
+		// so the memory they touch first is also on the node, returns the number of cpus of the node
+		// 0 if the node doesn't exist or the pinning fails
+		static int BindNumaNode(int node);
+		// 1 where the nodes are unknown
+		static int NumaNodeNum();
+
+	private:
+		bool valid{ false };
+		std::string readBuffer;
+#ifdef _WIN32
+		void* process{ nullptr };
+		void* input{ nullptr };
+		void* output{ nullptr };
+#else
+		int pid{ -1 };
+		int input{ -1 };
+		int output{ -1 };
+#endif
+	};
+}
@@ -0,0 +1,838 @@
+// headless batch renderer, links neither Qt nor OpenGL
+// usage: RenderCLI <scene> [options]
+//    or: RenderCLI --merge out in1 in2 ... [--png path] [--hdr path]
+//        sums the checkpoints of runs with disjoint loops into out and writes its image
+// with --workers the process is a coordinator, it starts the workers, each a RenderCLI loading the scene
+// and building its own BVH, and hands out chunks of loops over their stdin, a worker renders a chunk
+// into a checkpoint next to the output and answers on its stdout, the coordinator adds a chunk to the output
+// checkpoint once it is done and removes its file, the workers of a NUMA node touch only its memory,
+// so they scale with the nodes
+//   --spp N          loops per pixel, 64 by default
+//   --threads N      render threads, all cores but one by default
+//   --time S         seconds of rendering, no limit by default
+//   --error E        adaptive sampling threshold, 0 (default) renders spp everywhere
+//   --depth N        max path depth, 5 by default
+//   --lights M       light selection, uniform, power, bvh or auto (default)
+//   --tracer T       path (default) traces a path at a time, wavefront a batch of paths bounce by bounce
+//   --size WxH       1024x768 by default
+//   --png path       output image, tone values clamped to [0, 1]
+//   --hdr path       output image, linear radiance
+//   --denoise        filters the image guided by the albedo, normal and depth of the first hits
+//   --aov prefix     writes the AOVs to prefix_albedo.hdr, prefix_normal.hdr and prefix_depth.hdr
+//   --cost path      BVH nodes visited per sample of every pixel, as HDR
+//   --checkpoint path  accumulates in a memory mapped file, a run of the same scene resumes from it
+//   --first-loop N   renders the loops [N, N + spp), runs of disjoint loops can be merged, 0 by default
+//   --stats path     JSON statistics
+//   --bvh-cache dir  directory of persisted BVHs
+//   --two-level      a BVH per mesh under a tree over the objects, for meshes with many instances
+//   --builder B      BVH builder, sah (default), lbvh for the fastest build or sbvh for the fastest trace
+//   --workers N      renders in N worker processes, --threads is then per worker, all cores over N by default
+//   --numa           binds worker i to NUMA node i mod the node count, --workers defaults to the node count
+//                    and --threads to the cpus of the node
+//   --chunk N        loops a worker renders at a time, a quarter of its share by default
+//   --denoise, --aov, --cost and --error don't work with --workers
+
+#include <Engine/Viewer/RTX_Renderer.h>
+#include <Engine/Viewer/PathTracer.h>
+#include <Engine/Viewer/WavefrontPathTracer.h>
+#include <Engine/Viewer/BVHAccel.h>
+#include <Engine/Scene/Scene.h>
+#include <Engine/Scene/SObj.h>
+
+#include <Basic/Image.h>
+
+#include "WorkerProcess.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Ubpa;
+using namespace std;
+
+namespace {
+	struct Options {
+		string scenePath;
+		int spp{ 64 };
+		int threadNum{ 0 };
+		float timeBudget{ 0.f };
+		float errorThreshold{ 0.f };
+		int maxDepth{ 5 };
+		LightSampler::Mode lightSelection{ LightSampler::Mode::Auto };
+		bool wavefront{ false };
+		int width{ 1024 };
+		int height{ 768 };
+		string pngPath;
+		string hdrPath;
+		bool denoise{ false };
+		string aovPrefix;
+		string costPath;
+		string checkpointPath;
+		int firstLoop{ 0 };
+		string statsPath;
+		string bvhCacheDir;
+		BVHAccel::Builder builder{ BVHAccel::Builder::SAH };
+		bool twoLevel{ false };
+		int workerNum{ 0 };
+		int chunkLoops{ 0 };
+		bool numa{ false };
+		// set by the coordinator in the arguments of the workers
+		bool worker{ false };
+		int numaNode{ -1 };
+	};
+
+	bool ParseOptions(int argc, char * argv[], Options & options) {
+		if (argc < 2)
+			return false;
+
+		options.scenePath = argv[1];
+		for (int i = 2; i < argc; i++) {
+			const string key = argv[i];
+			if (key == "--denoise") {
+				options.denoise = true;
+				continue;
+			}
+			if (key == "--two-level") {
+				options.twoLevel = true;
+				continue;
+			}
+			if (key == "--numa") {
+				options.numa = true;
+				continue;
+			}
+			if (key == "--worker") {
+				options.worker = true;
+				continue;
+			}
+			if (i + 1 >= argc) {
+				printf("ERROR::RenderCLI:\n"
+					"\t""%s needs a value\n", key.c_str());
+				return false;
+			}
+			const char * val = argv[++i];
+
+			if (key == "--spp")
+				options.spp = atoi(val);
+			else if (key == "--threads")
+				options.threadNum = atoi(val);
+			else if (key == "--time")
+				options.timeBudget = static_cast<float>(atof(val));
+			else if (key == "--error")
+				options.errorThreshold = static_cast<float>(atof(val));
+			else if (key == "--depth")
+				options.maxDepth = atoi(val);
+			else if (key == "--lights") {
+				const string mode = val;
+				if (mode == "uniform")
+					options.lightSelection = LightSampler::Mode::Uniform;
+				else if (mode == "power")
+					options.lightSelection = LightSampler::Mode::Power;
+				else if (mode == "bvh")
+					options.lightSelection = LightSampler::Mode::BVH;
+				else if (mode == "auto")
+					options.lightSelection = LightSampler::Mode::Auto;
+				else {
+					printf("ERROR::RenderCLI:\n"
+						"\t""unknown light selection %s\n", val);
+					return false;
+				}
+			}
+			else if (key == "--tracer") {
+				const string tracer = val;
+				if (tracer == "path")
+					options.wavefront = false;
+				else if (tracer == "wavefront")
+					options.wavefront = true;
+				else {
+					printf("ERROR::RenderCLI:\n"
+						"\t""unknown tracer %s\n", val);
+					return false;
+				}
+			}
+			else if (key == "--size") {
+				if (sscanf(val, "%dx%d", &options.width, &options.height) != 2) {
+					printf("ERROR::RenderCLI:\n"
+						"\t""size %s is not WxH\n", val);
+					return false;
+				}
+			}
+			else if (key == "--png")
+				options.pngPath = val;
+			else if (key == "--hdr")
+				options.hdrPath = val;
+			else if (key == "--aov")
+				options.aovPrefix = val;
+			else if (key == "--cost")
+				options.costPath = val;
+			else if (key == "--checkpoint")
+				options.checkpointPath = val;
+			else if (key == "--first-loop")
+				options.firstLoop = atoi(val);
+			else if (key == "--stats")
+				options.statsPath = val;
+			else if (key == "--bvh-cache")
+				options.bvhCacheDir = val;
+			else if (key == "--builder") {
+				const string builder = val;
+				if (builder == "sah")
+					options.builder = BVHAccel::Builder::SAH;
+				else if (builder == "lbvh")
+					options.builder = BVHAccel::Builder::LBVH;
+				else if (builder == "sbvh")
+					options.builder = BVHAccel::Builder::SBVH;
+				else {
+					printf("ERROR::RenderCLI:\n"
+						"\t""unknown BVH builder %s\n", val);
+					return false;
+				}
+			}
+			else if (key == "--workers")
+				options.workerNum = atoi(val);
+			else if (key == "--chunk")
+				options.chunkLoops = atoi(val);
+			else if (key == "--numa-node")
+				options.numaNode = atoi(val);
+			else {
+				printf("ERROR::RenderCLI:\n"
+					"\t""unknown option %s\n", key.c_str());
+				return false;
+			}
+		}
+
+		if (options.spp <= 0 || options.width <= 0 || options.height <= 0) {
+			printf("ERROR::RenderCLI:\n"
+				"\t""spp and size must be positive\n");
+			return false;
+		}
+		if (options.firstLoop < 0) {
+			printf("ERROR::RenderCLI:\n"
+				"\t""first loop must not be negative\n");
+			return false;
+		}
+		if (options.workerNum < 0 || options.chunkLoops < 0) {
+			printf("ERROR::RenderCLI:\n"
+				"\t""workers and chunk must not be negative\n");
+			return false;
+		}
+		if (options.numa && options.workerNum == 0)
+			options.workerNum = WorkerProcess::NumaNodeNum();
+		if (options.pngPath.empty() && options.hdrPath.empty())
+			options.pngPath = "out.png";
+
+		return true;
+	}
+
+	// only quotes and backslashes are escaped, enough for paths
+	const string JsonStr(const string & str) {
+		string rst = "\"";
+		for (auto c : str) {
+			if (c == '"' || c == '\\')
+				rst += '\\';
+			rst += c;
+		}
+		return rst + "\"";
+	}
+
+	const char * LightSelectionName(LightSampler::Mode mode) {
+		switch (mode)
+		{
+		case LightSampler::Mode::Uniform: return "uniform";
+		case LightSampler::Mode::Power: return "power";
+		case LightSampler::Mode::BVH: return "bvh";
+		default: return "auto";
+		}
+	}
+
+	const char * TracerName(bool wavefront) {
+		return wavefront ? "wavefront" : "path";
+	}
+
+	const char * BuilderName(BVHAccel::Builder builder) {
+		switch (builder)
+		{
+		case BVHAccel::Builder::LBVH: return "lbvh";
+		case BVHAccel::Builder::SBVH: return "sbvh";
+		default: return "sah";
+		}
+	}
+
+	bool WriteStats(const Options & options, Ptr<RTX_Renderer> renderer, double loadTime, double totalTime) {
+		FILE * file = fopen(options.statsPath.c_str(), "w");
+		if (!file)
+			return false;
+
+		const auto bvhAccel = renderer->GetBVHAccel();
+		const double renderTime = renderer->GetRenderTime();
+		const long long sampleNum = renderer->GetSampleNum();
+
+		fprintf(file, "{\n");
+		fprintf(file, "\t\"scene\": %s,\n", JsonStr(options.scenePath).c_str());
+		fprintf(file, "\t\"width\": %d,\n", options.width);
+		fprintf(file, "\t\"height\": %d,\n", options.height);
+		fprintf(file, "\t\"spp\": %d,\n", options.spp);
+		fprintf(file, "\t\"threads\": %d,\n", renderer->GetThreadNum());
+		fprintf(file, "\t\"timeBudget\": %g,\n", options.timeBudget);
+		fprintf(file, "\t\"errorThreshold\": %g,\n", options.errorThreshold);
+		fprintf(file, "\t\"maxDepth\": %d,\n", options.maxDepth);
+		fprintf(file, "\t\"lights\": \"%s\",\n", LightSelectionName(options.lightSelection));
+		fprintf(file, "\t\"tracer\": \"%s\",\n", TracerName(options.wavefront));
+		fprintf(file, "\t\"loadTime\": %f,\n", loadTime);
+		fprintf(file, "\t\"builder\": \"%s\",\n", BuilderName(bvhAccel->GetBuilder()));
+		fprintf(file, "\t\"twoLevel\": %s,\n", bvhAccel->IsTwoLevel() ? "true" : "false");
+		fprintf(file, "\t\"bvhBuildTime\": %f,\n", bvhAccel->GetBuildTime());
+		fprintf(file, "\t\"bvhRefitTime\": %f,\n", bvhAccel->GetRefitTime());
+		fprintf(file, "\t\"bvhNodes\": %zd,\n", bvhAccel->GetBVHNodes().size());
+		fprintf(file, "\t\"bvhSAHCost\": %f,\n", bvhAccel->GetSAHCost());
+		fprintf(file, "\t\"renderTime\": %f,\n", renderTime);
+		fprintf(file, "\t\"denoise\": %s,\n", options.denoise ? "true" : "false");
+		fprintf(file, "\t\"denoiseTime\": %f,\n", renderer->GetDenoiseTime());
+		fprintf(file, "\t\"totalTime\": %f,\n", totalTime);
+		fprintf(file, "\t\"firstLoop\": %d,\n", options.firstLoop);
+		fprintf(file, "\t\"resumedSamples\": %lld,\n", renderer->GetResumedSampleNum());
+		fprintf(file, "\t\"cameraRays\": %lld,\n", sampleNum);
+		fprintf(file, "\t\"cameraRaysPerSecond\": %f,\n", renderTime > 0. ? sampleNum / renderTime : 0.);
+		fprintf(file, "\t\"threadUtilization\": [");
+		const auto & utilization = renderer->GetThreadUtilization();
+		for (size_t i = 0; i < utilization.size(); i++)
+			fprintf(file, "%s%f", i == 0 ? "" : ", ", utilization[i]);
+		fprintf(file, "],\n");
+		fprintf(file, "\t\"rayTracing\": %s\n", renderer->GetStats().ToJSON("\t").c_str());
+		fprintf(file, "}\n");
+
+		fclose(file);
+		return true;
+	}
+
+	bool SaveImg(Ptr<Image> img, const string & pngPath, const string & hdrPath) {
+		// images are stored top row first, like the images saved by the UI
+		bool success = true;
+		if (!pngPath.empty() && !img->SaveAsPNG(pngPath, true)) {
+			printf("ERROR::RenderCLI:\n"
+				"\t""write %s fail\n", pngPath.c_str());
+			success = false;
+		}
+		if (!hdrPath.empty() && !img->SaveAsHDR(hdrPath, true)) {
+			printf("ERROR::RenderCLI:\n"
+				"\t""write %s fail\n", hdrPath.c_str());
+			success = false;
+		}
+		return success;
+	}
+
+	int Merge(int argc, char * argv[]) {
+		string outPath;
+		vector<string> inPaths;
+		string pngPath;
+		string hdrPath;
+		for (int i = 2; i < argc; i++) {
+			const string arg = argv[i];
+			if (arg == "--png" && i + 1 < argc)
+				pngPath = argv[++i];
+			else if (arg == "--hdr" && i + 1 < argc)
+				hdrPath = argv[++i];
+			else if (outPath.empty())
+				outPath = arg;
+			else
+				inPaths.push_back(arg);
+		}
+		if (outPath.empty() || inPaths.empty()) {
+			printf("usage: RenderCLI --merge out in1 in2 ... [--png path] [--hdr path]\n");
+			return 1;
+		}
+
+		if (!RTX_Renderer::MergeCheckpoints(outPath, inPaths))
+			return 1;
+		if (pngPath.empty() && hdrPath.empty())
+			return 0;
+
+		const auto img = RTX_Renderer::ResolveCheckpoint(outPath);
+		if (!img) {
+			printf("ERROR::RenderCLI:\n"
+				"\t""read %s fail\n", outPath.c_str());
+			return 1;
+		}
+		return SaveImg(img, pngPath, hdrPath) ? 0 : 1;
+	}
+
+	const Ptr<RTX_Renderer> GenRenderer(const Options & options, int threadNum) {
+		const int maxDepth = options.maxDepth;
+		const auto lightSelection = options.lightSelection;
+		const bool wavefront = options.wavefront;
+		auto renderer = RTX_Renderer::New([maxDepth, lightSelection, wavefront]()->Ptr<RayTracer> {
+			// the same samples either way, the wavefront tracer shades the hits of a BSDF together
+			Ptr<PathTracer> pathTracer = wavefront ? WavefrontPathTracer::New() : PathTracer::New();
+			pathTracer->maxDepth = maxDepth;
+			pathTracer->lightSelection = lightSelection;
+			return pathTracer;
+		});
+		renderer->maxLoop = options.spp;
+		renderer->SetThreadNum(threadNum);
+		renderer->SetTimeBudget(options.timeBudget);
+		renderer->SetErrorThreshold(options.errorThreshold);
+		renderer->SetDenoise(options.denoise);
+		renderer->SetAOV(!options.aovPrefix.empty());
+		renderer->SetCost(!options.costPath.empty());
+		renderer->SetCheckpoint(options.checkpointPath);
+		renderer->SetFirstLoop(options.firstLoop);
+		// nobody looks at the image before the end
+		renderer->SetResolveInterval(3600.f);
+		renderer->GetBVHAccel()->SetBuilder(options.builder);
+		renderer->GetBVHAccel()->SetTwoLevel(options.twoLevel);
+		if (!options.bvhCacheDir.empty())
+			renderer->GetBVHAccel()->SetCacheDir(options.bvhCacheDir);
+		return renderer;
+	}
+
+	// the commands of the coordinator come in lines on stdin, until EOF
+	//   render <first loop> <loops> <time budget> <checkpoint path>
+	// every command is answered on stdout by a line
+	//   @done <samples> <resumed samples> <render time>
+	// or @fail, the other lines are the output of the renderer
+	int RunWorker(const Options & options) {
+		int threadNum = options.threadNum;
+		if (options.numaNode >= 0) {
+			const int cpuNum = WorkerProcess::BindNumaNode(options.numaNode);
+			if (cpuNum == 0) {
+				printf("WARNING::RenderCLI::RunWorker:\n"
+					"\t""bind to NUMA node %d fail\n", options.numaNode);
+			}
+			else if (threadNum <= 0)
+				threadNum = cpuNum;
+		}
+		if (threadNum <= 0)
+			threadNum = max(static_cast<int>(thread::hardware_concurrency()), 1);
+
+		// the scene and the BVH are loaded once, every chunk is a run of the renderer on them
+		auto root = SObj::Load(options.scenePath);
+		if (!root) {
+			printf("ERROR::RenderCLI::RunWorker:\n"
+				"\t""load %s fail\n", options.scenePath.c_str());
+			return 1;
+		}
+		auto scene = Scene::New(root, options.scenePath);
+		auto renderer = GenRenderer(options, threadNum);
+		auto img = Image::New(options.width, options.height, 3);
+
+		char line[4096];
+		while (fgets(line, sizeof(line), stdin)) {
+			int firstLoop, loopNum, pathBegin = -1;
+			float timeBudget;
+			if (sscanf(line, "render %d %d %f %n", &firstLoop, &loopNum, &timeBudget, &pathBegin) != 3 || pathBegin < 0) {
+				printf("ERROR::RenderCLI::RunWorker:\n"
+					"\t""unknown command %s", line);
+				printf("@fail\n");
+				fflush(stdout);
+				continue;
+			}
+			string path = line + pathBegin;
+			while (!path.empty() && (path.back() == '\n' || path.back() == '\r'))
+				path.pop_back();
+
+			renderer->maxLoop = loopNum;
+			renderer->SetFirstLoop(firstLoop);
+			renderer->SetTimeBudget(timeBudget);
+			renderer->SetCheckpoint(path);
+			renderer->Run(scene, img);
+			if (renderer->GetSampleNum() + renderer->GetResumedSampleNum() > 0) {
+				printf("@done %lld %lld %f\n", renderer->GetSampleNum(),
+					renderer->GetResumedSampleNum(), renderer->GetRenderTime());
+			}
+			else
+				printf("@fail\n");
+			// stdout is a pipe, so it is fully buffered
+			fflush(stdout);
+		}
+		return 0;
+	}
+
+	struct Chunk {
+		int firstLoop;
+		int loopNum;
+		string path;
+		bool done{ false };
+	};
+
+	struct WorkerResult {
+		int chunkNum{ 0 };
+		long long sampleNum{ 0 };
+		double renderTime{ 0. };
+	};
+
+	bool WriteCoordinatorStats(const Options & options, int chunkLoops, const vector<WorkerResult> & results,
+		double renderTime, double mergeTime, double totalTime)
+	{
+		FILE * file = fopen(options.statsPath.c_str(), "w");
+		if (!file)
+			return false;
+
+		long long sampleNum = 0;
+		for (const auto & result : results)
+			sampleNum += result.sampleNum;
+
+		fprintf(file, "{\n");
+		fprintf(file, "\t\"scene\": %s,\n", JsonStr(options.scenePath).c_str());
+		fprintf(file, "\t\"width\": %d,\n", options.width);
+		fprintf(file, "\t\"height\": %d,\n", options.height);
+		fprintf(file, "\t\"spp\": %d,\n", options.spp);
+		fprintf(file, "\t\"firstLoop\": %d,\n", options.firstLoop);
+		fprintf(file, "\t\"workers\": %zd,\n", results.size());
+		fprintf(file, "\t\"numa\": %s,\n", options.numa ? "true" : "false");
+		fprintf(file, "\t\"chunkLoops\": %d,\n", chunkLoops);
+		fprintf(file, "\t\"timeBudget\": %g,\n", options.timeBudget);
+		fprintf(file, "\t\"maxDepth\": %d,\n", options.maxDepth);
+		fprintf(file, "\t\"lights\": \"%s\",\n", LightSelectionName(options.lightSelection));
+		fprintf(file, "\t\"tracer\": \"%s\",\n", TracerName(options.wavefront));
+		fprintf(file, "\t\"builder\": \"%s\",\n", BuilderName(options.builder));
+		fprintf(file, "\t\"twoLevel\": %s,\n", options.twoLevel ? "true" : "false");
+		fprintf(file, "\t\"renderTime\": %f,\n", renderTime);
+		fprintf(file, "\t\"mergeTime\": %f,\n", mergeTime);
+		fprintf(file, "\t\"totalTime\": %f,\n", totalTime);
+		fprintf(file, "\t\"cameraRays\": %lld,\n", sampleNum);
+		fprintf(file, "\t\"cameraRaysPerSecond\": %f,\n", renderTime > 0. ? sampleNum / renderTime : 0.);
+		fprintf(file, "\t\"workerChunks\": [");
+		for (size_t i = 0; i < results.size(); i++)
+			fprintf(file, "%s%d", i == 0 ? "" : ", ", results[i].chunkNum);
+		fprintf(file, "],\n");
+		// busy time of each worker over the wall time, the BVH builds and the scene loads are idle time
+		fprintf(file, "\t\"workerUtilization\": [");
+		for (size_t i = 0; i < results.size(); i++)
+			fprintf(file, "%s%f", i == 0 ? "" : ", ", renderTime > 0. ? results[i].renderTime / renderTime : 0.);
+		fprintf(file, "]\n");
+		fprintf(file, "}\n");
+
+		fclose(file);
+		return true;
+	}
+
+	int RunCoordinator(const Options & options, const string & exePath) {
+		if (options.denoise || !options.aovPrefix.empty() || !options.costPath.empty() || options.errorThreshold > 0.f) {
+			printf("ERROR::RenderCLI::RunCoordinator:\n"
+				"\t""--denoise, --aov, --cost and --error need all samples of a pixel in one process, "
+				"they don't work with --workers\n");
+			return 1;
+		}
+
+		using Clock = chrono::steady_clock;
+		const auto startTime = Clock::now();
+
+		const int workerNum = options.workerNum;
+		// a few chunks per worker, so the faster ones take more
+		const int chunkLoops = options.chunkLoops > 0 ? options.chunkLoops : max(options.spp / (workerNum * 4), 1);
+		// an interrupted run repeated with the same options skips the chunks in the output and resumes the others
+		const string filmPath = !options.checkpointPath.empty() ? options.checkpointPath
+			: (!options.pngPath.empty() ? options.pngPath : options.hdrPath) + ".film";
+		vector<Chunk> chunks;
+		for (int loop = 0; loop < options.spp; loop += chunkLoops) {
+			chunks.push_back({ options.firstLoop + loop, min(chunkLoops, options.spp - loop),
+				filmPath + "." + to_string(chunks.size()) });
+		}
+
+		size_t doneChunkNum = 0;
+		if (FILE * file = fopen(filmPath.c_str(), "rb")) {
+			fclose(file);
+			vector<bool> loops;
+			if (!RTX_Renderer::GetCheckpointLoops(filmPath, options.firstLoop, options.spp, loops)) {
+				printf("ERROR::RenderCLI::RunCoordinator:\n"
+					"\t""%s is no checkpoint or is broken, remove it to start over\n", filmPath.c_str());
+				return 1;
+			}
+			// a chunk is added once, a chunk cut by a time budget stays cut
+			for (auto & chunk : chunks) {
+				for (int loop = 0; loop < chunk.loopNum && !chunk.done; loop++)
+					chunk.done = loops[chunk.firstLoop - options.firstLoop + loop];
+				if (chunk.done) {
+					// the process was killed between the add and the removal
+					remove(chunk.path.c_str());
+					doneChunkNum++;
+				}
+			}
+			printf("%zd of %zd chunks are in %s\n", doneChunkNum, chunks.size(), filmPath.c_str());
+		}
+
+		// without --numa the workers share the cores, with it a worker takes the cpus of its node
+		int threadNum = options.threadNum;
+		if (threadNum <= 0 && !options.numa)
+			threadNum = max(static_cast<int>(thread::hardware_concurrency()) / workerNum, 1);
+		const int nodeNum = options.numa ? WorkerProcess::NumaNodeNum() : 1;
+
+		// all workers start before the threads talking to them, fork doesn't mix well with threads
+		vector<unique_ptr<WorkerProcess>> workers;
+		for (int i = 0; i < workerNum; i++) {
+			vector<string> args = { exePath, options.scenePath, "--worker",
+				"--size", to_string(options.width) + "x" + to_string(options.height),
+				"--depth", to_string(options.maxDepth),
+				"--lights", LightSelectionName(options.lightSelection),
+				"--tracer", TracerName(options.wavefront),
+				"--builder", BuilderName(options.builder) };
+			if (threadNum > 0)
+				args.insert(args.end(), { "--threads", to_string(threadNum) });
+			if (options.numa)
+				args.insert(args.end(), { "--numa-node", to_string(i % nodeNum) });
+			if (options.twoLevel)
+				args.push_back("--two-level");
+			if (!options.bvhCacheDir.empty())
+				args.insert(args.end(), { "--bvh-cache", options.bvhCacheDir });
+
+			workers.push_back(make_unique<WorkerProcess>(args));
+			if (!workers.back()->IsValid()) {
+				printf("ERROR::RenderCLI::RunCoordinator:\n"
+					"\t""start worker %d fail\n", i);
+			}
+		}
+
+		printf("render %zd chunks of %d loops in %d workers\n", chunks.size(), chunkLoops, workerNum);
+		const auto renderStartTime = Clock::now();
+		mutex m; // guards pendingChunks, the counts, chunks, results, mergeTime and the output
+		condition_variable chunkReturned; // a chunk is back in pendingChunks or no chunk is rendered anymore
+		mutex filmMutex; // serializes the adds to filmPath
+		deque<size_t> pendingChunks;
+		for (size_t chunkIdx = 0; chunkIdx < chunks.size(); chunkIdx++) {
+			if (!chunks[chunkIdx].done)
+				pendingChunks.push_back(chunkIdx);
+		}
+		int renderingWorkerNum = 0;
+		int liveWorkerNum = workerNum;
+		size_t failedChunkNum = 0;
+		double mergeTime = 0.;
+		vector<WorkerResult> results(workerNum);
+		vector<thread> threads;
+		for (int i = 0; i < workerNum; i++) {
+			threads.emplace_back([&, i]() {
+				auto & worker = *workers[i];
+				// the chunk of a dead worker goes back to the others, its file resumes what was done
+				const auto returnChunk = [&](size_t chunkIdx, const char * reason) {
+					lock_guard<mutex> lock(m);
+					const auto & chunk = chunks[chunkIdx];
+					printf("ERROR::RenderCLI::RunCoordinator:\n"
+						"\t""worker %d %s, loops [%d, %d) go to another worker\n",
+						i, reason, chunk.firstLoop, chunk.firstLoop + chunk.loopNum);
+					pendingChunks.push_front(chunkIdx);
+					renderingWorkerNum--;
+					liveWorkerNum--;
+					chunkReturned.notify_all();
+				};
+
+				if (!worker.IsValid()) {
+					lock_guard<mutex> lock(m);
+					liveWorkerNum--;
+					chunkReturned.notify_all();
+				}
+				while (worker.IsValid()) {
+					size_t chunkIdx;
+					float timeBudget = 0.f;
+					{
+						unique_lock<mutex> lock(m);
+						// a chunk being rendered comes back if its worker dies
+						chunkReturned.wait(lock, [&]() { return !pendingChunks.empty() || renderingWorkerNum == 0; });
+						if (pendingChunks.empty())
+							break;
+						// no chunk starts after the budget, a chunk gets the rest of it
+						if (options.timeBudget > 0.f) {
+							timeBudget = options.timeBudget - chrono::duration<float>(Clock::now() - renderStartTime).count();
+							if (timeBudget <= 0.f)
+								break;
+						}
+						chunkIdx = pendingChunks.front();
+						pendingChunks.pop_front();
+						renderingWorkerNum++;
+					}
+					const auto & chunk = chunks[chunkIdx];
+					if (!worker.WriteLine("render " + to_string(chunk.firstLoop) + " " + to_string(chunk.loopNum)
+						+ " " + to_string(timeBudget) + " " + chunk.path))
+					{
+						returnChunk(chunkIdx, "is gone");
+						break;
+					}
+
+					string line;
+					bool answered = false;
+					while (worker.ReadLine(line)) {
+						if (line.empty() || line[0] != '@') {
+							lock_guard<mutex> lock(m);
+							printf("worker %d: %s\n", i, line.c_str());
+							continue;
+						}
+
+						long long sampleNum, resumedSampleNum;
+						double renderTime;
+						if (sscanf(line.c_str(), "@done %lld %lld %lf", &sampleNum, &resumedSampleNum, &renderTime) == 3) {
+							// so only the chunks being rendered have files on the disk
+							const auto mergeStartTime = Clock::now();
+							bool added;
+							{
+								lock_guard<mutex> filmLock(filmMutex);
+								added = RTX_Renderer::AddCheckpoint(filmPath, chunk.path, options.firstLoop, options.spp);
+								if (added)
+									remove(chunk.path.c_str());
+							}
+
+							lock_guard<mutex> lock(m);
+							mergeTime += chrono::duration<double>(Clock::now() - mergeStartTime).count();
+							if (added) {
+								chunks[chunkIdx].done = true;
+								results[i].chunkNum++;
+								results[i].sampleNum += sampleNum + resumedSampleNum;
+								results[i].renderTime += renderTime;
+								printf("chunk %zd of %zd done, loops [%d, %d) by worker %d\n", ++doneChunkNum, chunks.size(),
+									chunk.firstLoop, chunk.firstLoop + chunk.loopNum, i);
+							}
+							else {
+								failedChunkNum++;
+								printf("ERROR::RenderCLI::RunCoordinator:\n"
+									"\t""add loops [%d, %d) of worker %d to %s fail\n",
+									chunk.firstLoop, chunk.firstLoop + chunk.loopNum, i, filmPath.c_str());
+							}
+							renderingWorkerNum--;
+							chunkReturned.notify_all();
+						}
+						else {
+							// the worker is alive but can't render the chunk, another one would fail the same way
+							lock_guard<mutex> lock(m);
+							failedChunkNum++;
+							printf("ERROR::RenderCLI::RunCoordinator:\n"
+								"\t""worker %d fail on loops [%d, %d)\n", i, chunk.firstLoop, chunk.firstLoop + chunk.loopNum);
+							renderingWorkerNum--;
+							chunkReturned.notify_all();
+						}
+						answered = true;
+						break;
+					}
+					if (!answered) {
+						returnChunk(chunkIdx, "exited");
+						break;
+					}
+				}
+				worker.CloseInput();
+			});
+		}
+		for (auto & t : threads)
+			t.join();
+		// waits for the workers to exit
+		workers.clear();
+		const double renderTime = chrono::duration<double>(Clock::now() - renderStartTime).count();
+
+		if (doneChunkNum == 0) {
+			printf("ERROR::RenderCLI::RunCoordinator:\n"
+				"\t""nothing rendered\n");
+			return 1;
+		}
+
+		// the sums are fixed point, so the image doesn't depend on which worker rendered which chunk
+		const auto resolveStartTime = Clock::now();
+		const auto img = RTX_Renderer::ResolveCheckpoint(filmPath);
+		// chunks left out by a time budget are no failure, the ones left by the dead workers are,
+		// the output is kept for a rerun then
+		const bool lost = failedChunkNum > 0 || (!pendingChunks.empty() && liveWorkerNum == 0);
+		if (img && !lost && options.checkpointPath.empty())
+			remove(filmPath.c_str());
+		mergeTime += chrono::duration<double>(Clock::now() - resolveStartTime).count();
+
+		long long sampleNum = 0;
+		for (const auto & result : results)
+			sampleNum += result.sampleNum;
+		printf("render done, cost %f s, %zd of %zd chunks, %lld samples, %f Msamples/s, merge cost %f s\n",
+			renderTime, doneChunkNum, chunks.size(), sampleNum, sampleNum / renderTime * 1e-6, mergeTime);
+
+		bool success = img && SaveImg(img, options.pngPath, options.hdrPath);
+		const double totalTime = chrono::duration<double>(Clock::now() - startTime).count();
+		if (!options.statsPath.empty() && !WriteCoordinatorStats(options, chunkLoops, results, renderTime, mergeTime, totalTime)) {
+			printf("ERROR::RenderCLI:\n"
+				"\t""write %s fail\n", options.statsPath.c_str());
+			success = false;
+		}
+
+		if (!pendingChunks.empty() && liveWorkerNum == 0) {
+			printf("ERROR::RenderCLI::RunCoordinator:\n"
+				"\t""no worker is left, %zd chunks are not rendered, run again to render them\n", pendingChunks.size());
+		}
+		return success && !lost ? 0 : 1;
+	}
+}
+
+int main(int argc, char * argv[]) {
+	if (argc >= 2 && strcmp(argv[1], "--merge") == 0)
+		return Merge(argc, argv);
+
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		printf("usage: RenderCLI <scene> [--spp N] [--threads N] [--time S] [--error E] [--depth N]\n"
+			"\t""[--lights uniform|power|bvh|auto] [--tracer path|wavefront] [--size WxH]\n"
+			"\t""[--png path] [--hdr path] [--denoise] [--aov prefix] [--cost path]\n"
+			"\t""[--checkpoint path] [--first-loop N] [--stats path] [--bvh-cache dir]\n"
+			"\t""[--builder sah|lbvh|sbvh] [--two-level] [--workers N] [--numa] [--chunk N]\n"
+			"   or: RenderCLI --merge out in1 in2 ... [--png path] [--hdr path]\n");
+		return 1;
+	}
+	if (options.worker)
+		return RunWorker(options);
+	if (options.workerNum > 0)
+		return RunCoordinator(options, argv[0]);
+
+	using Clock = chrono::steady_clock;
+	const auto startTime = Clock::now();
+
+	auto root = SObj::Load(options.scenePath);
+	if (!root) {
+		printf("ERROR::RenderCLI:\n"
+			"\t""load %s fail\n", options.scenePath.c_str());
+		return 1;
+	}
+	auto scene = Scene::New(root, options.scenePath);
+	const double loadTime = chrono::duration<double>(Clock::now() - startTime).count();
+
+	auto renderer = GenRenderer(options, options.threadNum > 0 ? options.threadNum
+		: max(static_cast<int>(thread::hardware_concurrency()) - 1, 1));
+	if (!options.costPath.empty() && !RTStats::enabled) {
+		printf("WARNING::RenderCLI:\n"
+			"\t""built with UBPA_NO_STATS, the cost image is black\n");
+	}
+
+	auto img = Image::New(options.width, options.height, 3);
+	renderer->Run(scene, img);
+	if (renderer->GetSampleNum() + renderer->GetResumedSampleNum() == 0) {
+		printf("ERROR::RenderCLI:\n"
+			"\t""nothing rendered, the scene needs a camera and a usable checkpoint\n");
+		return 1;
+	}
+
+	bool success = SaveImg(img, options.pngPath, options.hdrPath);
+
+	if (!options.aovPrefix.empty()) {
+		const pair<string, Ptr<Image>> aovImgs[] = {
+			{ "_albedo.hdr", renderer->GetAlbedoImg() },
+			{ "_normal.hdr", renderer->GetNormalImg() },
+			{ "_depth.hdr", renderer->GetDepthImg() },
+		};
+		for (const auto & aovImg : aovImgs) {
+			const string path = options.aovPrefix + aovImg.first;
+			if (!aovImg.second || !aovImg.second->SaveAsHDR(path, true)) {
+				printf("ERROR::RenderCLI:\n"
+					"\t""write %s fail\n", path.c_str());
+				success = false;
+			}
+		}
+	}
+
+	if (!options.costPath.empty() && (!renderer->GetCostImg() || !renderer->GetCostImg()->SaveAsHDR(options.costPath, true))) {
+		printf("ERROR::RenderCLI:\n"
+			"\t""write %s fail\n", options.costPath.c_str());
+		success = false;
+	}
+
+	const double totalTime = chrono::duration<double>(Clock::now() - startTime).count();
+	if (!options.statsPath.empty() && !WriteStats(options, renderer, loadTime, totalTime)) {
+		printf("ERROR::RenderCLI:\n"
+			"\t""write %s fail\n", options.statsPath.c_str());
+		success = false;
+	}
+
+	return success ? 0 : 1;
+}
@@ -76,6 +76,9 @@ UEngine::UEngine(QWidget *parent)
 
 	rtxRenderer = RTX_Renderer::New(generator);
 	rtxRenderer->maxLoop = maxLoop;
+	rtxRenderer->GetBVHAccel()->SetCacheDir(ROOT_PATH + "data/cache/bvh");
+	// objects are moved between renders, two-level only rebuilds the top level then
+	rtxRenderer->GetBVHAccel()->SetTwoLevel(true);
 	
 	// init ui
 
@@ -209,6 +212,12 @@ void UEngine::InitSetting() {
 		maxDepth = val;
 	});
 
+	setting->AddTitle("[ BVH ]");
+	Grid::pSlotMap bvhSlotMap = std::make_shared<Grid::SlotMap>();
+	(*bvhSlotMap)["Two-Level"] = [this]() { rtxRenderer->GetBVHAccel()->SetTwoLevel(true); };
+	(*bvhSlotMap)["Flat"] = [this]() { rtxRenderer->GetBVHAccel()->SetTwoLevel(false); };
+	setting->AddComboBox("Mode", "Two-Level", bvhSlotMap);
+
 	setting->AddTitle("[ Viewer ]");
 	Grid::pSlotMap slotmap = std::make_shared<Grid::SlotMap>();
 	(*slotmap)["Deferred"] = [this]() {viewer->SetRaster(Viewer::RasterType::DeferredPipeline); };
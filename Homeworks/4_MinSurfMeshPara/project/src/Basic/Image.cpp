@@ -123,6 +123,14 @@ bool Image::SaveAsPNG(const string & fileName, bool flip) const {
 	return rst;
 }
 
+bool Image::SaveAsHDR(const string & fileName, bool flip) const {
+	if (!IsValid())
+		return false;
+
+	stbi_flip_vertically_on_write(flip);
+	return stbi_write_hdr(fileName.c_str(), width, height, channel, data) != 0;
+}
+
 Image & Image::operator=(const Image & img) noexcept {
 	Free();
 
@@ -1,5 +1,4 @@
 #include <Basic/Math.h>
-#include <random>
 
 #include <ctime>
 
@@ -7,33 +6,37 @@ using namespace Ubpa;
 
 using namespace std;
 
-static uniform_int_distribution<unsigned> uiMap;
-static uniform_int_distribution<signed> iMap;
-static uniform_real_distribution<float> fMap(0.0f,1.0f);
-static uniform_real_distribution<float> fMap_exclude1(0.0f, 0.99999999f);
-static uniform_real_distribution<double> dMap(0.0,1.0);
-static default_random_engine engine;
+static thread_local Math::PCG32 generator;
 
 int Math::Rand_I() {
-	return iMap(engine);
+	return static_cast<int>(generator.UniformUInt() >> 1);
 }
 
 unsigned int Math::Rand_UI() {
-	return uiMap(engine);
+	return generator.UniformUInt();
 }
 
 float Math::Rand_F() {
-	return fMap(engine);
+	return generator.UniformFloat();
 }
 
 float Math::Rand_F_exclude1() {
-	return fMap_exclude1(engine);
+	return generator.UniformFloat();
 }
 
 double Math::Rand_D() {
-	return dMap(engine);
+	return generator.UniformDouble();
 }
 
 void Math::RandSetSeedByCurTime() {
-	engine.seed(clock());
+	generator.SetSequence(PCG32::defaultSequence, static_cast<uint64_t>(clock()));
+}
+
+void Math::RandSetPixelSample(uint64_t pixelIdx, uint64_t sampleIdx) {
+	generator.SetSequence(pixelIdx);
+	generator.Advance(sampleIdx * 65536u);
+}
+
+Math::PCG32 & Math::RandGenerator() {
+	return generator;
 }
@@ -0,0 +1,11 @@
+#include <Engine/Filter/ImgFilter.h>
+
+using namespace Ubpa;
+
+void ImgFilter::InitTable() {
+	// the weights at the centers of the entries
+	for (int axis = 0; axis < 2; axis++) {
+		for (int i = 0; i < tableSize; i++)
+			table[axis][i] = Evaluate1D((i + 0.5f) / tableSize * radius[axis], axis);
+	}
+}
@@ -18,8 +18,6 @@
 #include <Basic/Math.h>
 #include <UGM/transform.h>
 
-#include <stack>
-
 using namespace Ubpa;
 
 using namespace std;
@@ -28,42 +26,340 @@ ClosestIntersector::ClosestIntersector() {
 	Regist<Sphere, Plane, Triangle, TriMesh, Disk, Capsule>();
 }
 
+void ClosestIntersector::Init(Ray * ray) {
+	this->ray = ray;
+	rst = Rst(false);
+	triangleFaceIdx = -1;
+}
+
 void ClosestIntersector::Visit(Ptr<BVHAccel> bvhAccel) {
-	cout << "WARNING::ClosestIntersector::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	if (bvhAccel->IsEmpty())
+		return;
+
+	int closestShapeIdx;
+	switch (bvhAccel->GetWidth())
+	{
+	case BVHAccel::Width::BVH4:
+		closestShapeIdx = VisitWideBVH<4>(bvhAccel);
+		break;
+	case BVHAccel::Width::BVH8:
+		closestShapeIdx = VisitWideBVH<8>(bvhAccel);
+		break;
+	default:
+		closestShapeIdx = VisitBVH2(bvhAccel);
+		break;
+	}
+
+	if (closestShapeIdx == -1)
+		return;
+
+	if (triangleFaceIdx != -1) {
+		// triangles are hit without the visitor, attributes come from the mesh
+		const auto & primRef = bvhAccel->GetPrimRef(closestShapeIdx);
+		const auto & triangle = bvhAccel->GetMesh(primRef.meshIdx)->GetTriangles()[triangleFaceIdx];
+		rst.isIntersect = true;
+		SetTriangleRst(triangle, triangleU, triangleV);
+	}
+
+	ToWorld(bvhAccel->GetShapeL2WMat(closestShapeIdx));
+}
+
+int ClosestIntersector::VisitBVH2(const Ptr<BVHAccel> & bvhAccel) {
+	const auto origin = ray->o;
+	const auto dir = ray->d;
+
+	// ray->tMax shrinks with every hit, so farther nodes are culled
+	int closestShapeIdx = -1;
+	auto leafFunc = [&](int shapesOffset, int shapesNum) {
+		const int hitShapeIdx = IntersectShapes(bvhAccel, shapesOffset, shapesNum, origin, dir);
+		if (hitShapeIdx != -1)
+			closestShapeIdx = hitShapeIdx;
+		return false;
+	};
+
+	if (bvhAccel->IsQuantized()) {
+		if (quantizedStack.size() < static_cast<size_t>(bvhAccel->GetDepth()))
+			quantizedStack.resize(bvhAccel->GetDepth());
+		TraverseQuantizedBVH(bvhAccel->GetQuantizedBVHNodes(), bvhAccel->GetQuantizedRootBox(), quantizedStack.data(), *ray, leafFunc);
+	}
+	else {
+		if (nodeIdxStack.size() < static_cast<size_t>(bvhAccel->GetDepth()))
+			nodeIdxStack.resize(bvhAccel->GetDepth());
+		TraverseBVH2(bvhAccel->GetBVHNodes(), nodeIdxStack.data(), *ray, leafFunc);
+	}
+
+	return closestShapeIdx;
+}
+
+template<int N>
+int ClosestIntersector::VisitWideBVH(const Ptr<BVHAccel> & bvhAccel) {
+	const auto origin = ray->o;
+	const auto dir = ray->d;
+	const auto invDir = ray->InvDir();
+	const bool dirIsNeg[3] = { invDir[0] < 0, invDir[1] < 0, invDir[2] < 0 };
+
+	// every level pushes at most N - 1 nodes
+	const size_t stackCapacity = static_cast<size_t>(bvhAccel->GetDepth()) * (N - 1) + 1;
+	if (wideStack.size() < stackCapacity)
+		wideStack.resize(stackCapacity);
+
+	RTStats::Counter nodeVisits(&RTStats::nodeVisits);
+	int closestShapeIdx = -1;
+	int stackSize = 0;
+	wideStack[stackSize++] = { 0, ray->tMin };
+	while (stackSize > 0) {
+		const auto entry = wideStack[--stackSize];
+		if (entry.tNear > ray->tMax)
+			continue;
+
+		nodeVisits.Add();
+		const auto & node = bvhAccel->GetWideBVHNode<N>(entry.nodeIdx);
+		float tNears[N];
+		const int hitMask = BVHAccel::IntersectChildren(node, origin, invDir, dirIsNeg, ray->tMin, ray->tMax, tNears);
+		if (hitMask == 0)
+			continue;
+
+		// hit children sorted near to far
+		int hitChildren[N];
+		int hitNum = 0;
+		for (int i = 0; i < N; i++) {
+			if (!(hitMask & (1 << i)))
+				continue;
+
+			int j = hitNum++;
+			for (; j > 0 && tNears[hitChildren[j - 1]] > tNears[i]; j--)
+				hitChildren[j] = hitChildren[j - 1];
+			hitChildren[j] = i;
+		}
+
+		// leaves first, near to far, so that ray->tMax shrinks before the pushed nodes are popped
+		for (int k = 0; k < hitNum; k++) {
+			const int i = hitChildren[k];
+			if (!node.IsLeaf(i) || tNears[i] > ray->tMax)
+				continue;
+
+			const int hitShapeIdx = IntersectShapes(bvhAccel, node.GetShapesOffset(i), node.GetShapesNum(i), origin, dir);
+			if (hitShapeIdx != -1)
+				closestShapeIdx = hitShapeIdx;
+		}
+
+		// push far to near, the nearest is popped first
+		for (int k = hitNum - 1; k >= 0; k--) {
+			const int i = hitChildren[k];
+			if (!node.IsLeaf(i) && tNears[i] <= ray->tMax)
+				wideStack[stackSize++] = { node.GetChildIdx(i), tNears[i] };
+		}
+	}
+
+	return closestShapeIdx;
+}
+
+int ClosestIntersector::IntersectShapes(const Ptr<BVHAccel> & bvhAccel, int shapesOffset, int shapesNum, const pointf3 & origin, const vecf3 & dir) {
+	// the triangles of a mesh instance are counted in IntersectMeshBVH
+	RTStats::Counter primitiveTests(&RTStats::primitiveTests);
+	int closestShapeIdx = -1;
+	const int shapesEnd = shapesOffset + shapesNum;
+	for (int i = shapesOffset; i < shapesEnd; i++) {
+		if (bvhAccel->IsTriangle(i)) {
+			primitiveTests.Add();
+			const auto & triangle = bvhAccel->GetWorldTriangle(i);
+			float t, u, v;
+			if (IntersectTriangle(*ray, triangle.p0, triangle.e1, triangle.e2, t, u, v)) {
+				ray->tMax = t;
+				triangleFaceIdx = bvhAccel->GetPrimRef(i).faceIdx;
+				triangleU = u;
+				triangleV = v;
+				closestShapeIdx = i;
+			}
+			continue;
+		}
+
+		// other shapes are intersected in the local space, t is the same in both spaces
+		const auto & w2l = bvhAccel->GetShapeW2LMat(i);
+
+		if (const auto meshBVH = bvhAccel->GetMeshBVH(i)) {
+			Ray localRay(w2l * origin, w2l * dir, ray->tMin, ray->tMax);
+			if (IntersectMeshBVH(*meshBVH, localRay)) {
+				ray->tMax = localRay.tMax;
+				closestShapeIdx = i;
+			}
+			continue;
+		}
+
+		primitiveTests.Add();
+		ray->o = w2l * origin;
+		ray->d = w2l * dir;
+
+		const float tMax = ray->tMax;
+		Visit(bvhAccel->GetShape(i));
+		if (ray->tMax < tMax) {
+			triangleFaceIdx = -1;
+			closestShapeIdx = i;
+		}
+
+		ray->o = origin;
+		ray->d = dir;
+	}
+
+	return closestShapeIdx;
+}
+
+bool ClosestIntersector::IntersectMeshBVH(const BVHAccel::MeshBVH & meshBVH, Ray & localRay) {
+	if (meshNodeIdxStack.size() < static_cast<size_t>(meshBVH.depth))
+		meshNodeIdxStack.resize(meshBVH.depth);
+
+	RTStats::Counter primitiveTests(&RTStats::primitiveTests);
+	bool isIntersect = false;
+	TraverseBVH2(meshBVH.nodes, meshNodeIdxStack.data(), localRay, [&](int shapesOffset, int shapesNum) {
+		primitiveTests.Add(shapesNum);
+		const int shapesEnd = shapesOffset + shapesNum;
+		for (int i = shapesOffset; i < shapesEnd; i++) {
+			const auto & triangle = meshBVH.triangles[i];
+			float t, u, v;
+			if (IntersectTriangle(localRay, triangle.p0, triangle.e1, triangle.e2, t, u, v)) {
+				localRay.tMax = t;
+				triangleFaceIdx = meshBVH.faceIdx[i];
+				triangleU = u;
+				triangleV = v;
+				isIntersect = true;
+			}
+		}
+		return false;
+	});
+
+	return isIntersect;
 }
 
 void ClosestIntersector::Visit(Ptr<SObj> sobj) {
-	cout << "WARNING::ClosestIntersector::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	// brute force, for picking
+	const auto origin = ray->o;
+	const auto dir = ray->d;
+
+	transformf closestL2W;
+	for (auto geo : sobj->GetComponentsInChildren<CmptGeometry>()) {
+		if (!geo->primitive)
+			continue;
+
+		const auto l2w = geo->GetSObj()->GetLocalToWorldMatrix();
+		const auto w2l = l2w.inverse();
+		ray->o = w2l * origin;
+		ray->d = w2l * dir;
+
+		const float tMax = ray->tMax;
+		Visit(geo->primitive);
+		if (ray->tMax < tMax)
+			closestL2W = l2w;
+	}
+	ray->o = origin;
+	ray->d = dir;
+
+	if (rst.isIntersect)
+		ToWorld(closestL2W);
+}
+
+void ClosestIntersector::ToWorld(const transformf & l2w) {
+	rst.pos = l2w * rst.pos;
+	rst.n = (l2w * rst.n).normalize();
+	rst.tangent = (l2w * rst.tangent.cast_to<vecf3>()).normalize().cast_to<normalf>();
 }
 
 void ClosestIntersector::ImplVisit(Ptr<Sphere> sphere) {
-	cout << "WARNING::ClosestIntersector::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	float t;
+	if (!IntersectSphere(*ray, t))
+		return;
+
+	ray->tMax = t;
+
+	rst.isIntersect = true;
+	rst.closestShape = sphere;
+	rst.pos = ray->at(t);
+	rst.n = rst.pos.cast_to<normalf>();
+	rst.texcoord = Sphere::TexcoordOf(rst.n);
+	rst.tangent = Sphere::TangentOf(rst.n);
 }
 
 void ClosestIntersector::ImplVisit(Ptr<Plane> plane) {
-	cout << "WARNING::ClosestIntersector::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	float t;
+	if (!IntersectPlane(*ray, t))
+		return;
+
+	ray->tMax = t;
+
+	rst.isIntersect = true;
+	rst.closestShape = plane;
+	rst.pos = ray->at(t);
+	rst.n = normalf(0, 1, 0);
+	rst.texcoord = pointf2(rst.pos[0] + 0.5f, 0.5f - rst.pos[2]);
+	rst.tangent = normalf(1, 0, 0);
 }
 
 void ClosestIntersector::ImplVisit(Ptr<Triangle> triangle) {
-	cout << "WARNING::ClosestIntersector::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	const auto & positions = triangle->GetMesh()->GetPositions();
+	float t, u, v;
+	if (!IntersectTriangle(*ray, positions[triangle->idx[0]], positions[triangle->idx[1]], positions[triangle->idx[2]], t, u, v))
+		return;
+
+	ray->tMax = t;
+
+	rst.isIntersect = true;
+	SetTriangleRst(triangle, u, v);
+}
+
+void ClosestIntersector::SetTriangleRst(const Ptr<Triangle> & triangle, float u, float v) {
+	const auto mesh = triangle->GetMesh();
+	const unsigned idx0 = triangle->idx[0];
+	const unsigned idx1 = triangle->idx[1];
+	const unsigned idx2 = triangle->idx[2];
+
+	const float w = 1.f - u - v;
+	const auto & positions = mesh->GetPositions();
+	const auto & normals = mesh->GetNormals();
+	const auto & texcoords = mesh->GetTexcoords();
+	const auto & tangents = mesh->GetTangents();
+
+	rst.closestShape = triangle;
+	rst.pos = (w * positions[idx0].cast_to<vecf3>() + u * positions[idx1].cast_to<vecf3>() + v * positions[idx2].cast_to<vecf3>()).cast_to<pointf3>();
+	rst.n = (w * normals[idx0] + u * normals[idx1] + v * normals[idx2]).normalize();
+	rst.texcoord = (w * texcoords[idx0].cast_to<vecf2>() + u * texcoords[idx1].cast_to<vecf2>() + v * texcoords[idx2].cast_to<vecf2>()).cast_to<pointf2>();
+	const auto tangent = w * tangents[idx0] + u * tangents[idx1] + v * tangents[idx2];
+	rst.tangent = tangent.norm2() > 0.f ? tangent.normalize() : tangent;
 }
 
 void ClosestIntersector::ImplVisit(Ptr<TriMesh> mesh) {
-	cout << "WARNING::ClosestIntersector::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	for (const auto & triangle : mesh->GetTriangles())
+		ImplVisit(triangle);
 }
 
 void ClosestIntersector::ImplVisit(Ptr<Disk> disk) {
-	cout << "WARNING::ClosestIntersector::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	float t;
+	if (!IntersectDisk(*ray, t))
+		return;
+
+	ray->tMax = t;
+
+	rst.isIntersect = true;
+	rst.closestShape = disk;
+	rst.pos = ray->at(t);
+	rst.n = normalf(0, 1, 0);
+	rst.texcoord = pointf2((1.f + rst.pos[0]) / 2.f, (1.f - rst.pos[2]) / 2.f);
+	rst.tangent = normalf(1, 0, 0);
 }
 
 void ClosestIntersector::ImplVisit(Ptr<Capsule> capsule) {
-	cout << "WARNING::ClosestIntersector::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	float t;
+	if (!IntersectCapsule(*ray, capsule->height, t))
+		return;
+
+	ray->tMax = t;
+
+	rst.isIntersect = true;
+	rst.closestShape = capsule;
+	rst.pos = ray->at(t);
+
+	// normal points away from the axis segment
+	const float halfH = capsule->height / 2.f;
+	const float axisY = Math::Clamp(rst.pos[1], -halfH, halfH);
+	rst.n = normalf(rst.pos[0], rst.pos[1] - axisY, rst.pos[2]).normalize();
+	rst.texcoord = Sphere::TexcoordOf(rst.n);
+	rst.tangent = Sphere::TangentOf(rst.n);
 }
@@ -0,0 +1,142 @@
+#include <Engine/Intersector/Intersector.h>
+
+#include <Engine/Viewer/Ray.h>
+
+using namespace Ubpa;
+
+using namespace std;
+
+namespace Ubpa {
+	// nearest root of a t^2 + b t + c in (tMin, tMax)
+	static bool NearestRoot(float a, float b, float c, float tMin, float tMax, float& t) {
+		const float discriminant = b * b - 4.f * a * c;
+		if (discriminant < 0.f || a == 0.f)
+			return false;
+
+		const float sqrtDiscriminant = sqrt(discriminant);
+		const float inv2A = 0.5f / a;
+		float t0 = (-b - sqrtDiscriminant) * inv2A;
+		float t1 = (-b + sqrtDiscriminant) * inv2A;
+		if (t0 > t1)
+			swap(t0, t1);
+
+		if (t0 > tMin && t0 < tMax) {
+			t = t0;
+			return true;
+		}
+		if (t1 > tMin && t1 < tMax) {
+			t = t1;
+			return true;
+		}
+		return false;
+	}
+
+	// intersection with y = 0
+	static bool IntersectY0(const Ray& ray, float& t) {
+		if (ray.d[1] == 0.f)
+			return false;
+
+		t = -ray.o[1] / ray.d[1];
+		return t > ray.tMin && t < ray.tMax;
+	}
+}
+
+bool Intersector::IntersectSphere(const Ray& ray, float& t) {
+	const auto o = ray.o.cast_to<vecf3>();
+	const auto& d = ray.d;
+
+	const float a = d.dot(d);
+	const float b = 2.f * o.dot(d);
+	const float c = o.dot(o) - 1.f;
+	return NearestRoot(a, b, c, ray.tMin, ray.tMax, t);
+}
+
+bool Intersector::IntersectPlane(const Ray& ray, float& t) {
+	if (!IntersectY0(ray, t))
+		return false;
+
+	const auto pos = ray(t);
+	return pos[0] >= -0.5f && pos[0] <= 0.5f && pos[2] >= -0.5f && pos[2] <= 0.5f;
+}
+
+bool Intersector::IntersectDisk(const Ray& ray, float& t) {
+	if (!IntersectY0(ray, t))
+		return false;
+
+	const auto pos = ray(t);
+	return pos[0] * pos[0] + pos[2] * pos[2] <= 1.f;
+}
+
+bool Intersector::IntersectCapsule(const Ray& ray, float height, float& t) {
+	const float halfH = height / 2.f;
+	const auto& o = ray.o;
+	const auto& d = ray.d;
+
+	bool isIntersect = false;
+	float tMax = ray.tMax;
+
+	// cylinder
+	{
+		const float a = d[0] * d[0] + d[2] * d[2];
+		const float b = 2.f * (o[0] * d[0] + o[2] * d[2]);
+		const float c = o[0] * o[0] + o[2] * o[2] - 1.f;
+		float tCylinder;
+		if (NearestRoot(a, b, c, ray.tMin, tMax, tCylinder)) {
+			const float y = o[1] + tCylinder * d[1];
+			if (y >= -halfH && y <= halfH) {
+				t = tCylinder;
+				tMax = tCylinder;
+				isIntersect = true;
+			}
+		}
+	}
+
+	// caps, only the outer half of each sphere belongs to the capsule
+	for (const float centerY : { halfH, -halfH }) {
+		const vecf3 oc(o[0], o[1] - centerY, o[2]);
+		const float a = d.dot(d);
+		const float b = 2.f * oc.dot(d);
+		const float c = oc.dot(oc) - 1.f;
+		const float discriminant = b * b - 4.f * a * c;
+		if (discriminant < 0.f)
+			continue;
+
+		const float sqrtDiscriminant = sqrt(discriminant);
+		for (const float tSphere : { (-b - sqrtDiscriminant) / (2.f * a), (-b + sqrtDiscriminant) / (2.f * a) }) {
+			if (tSphere <= ray.tMin || tSphere >= tMax)
+				continue;
+
+			const float y = o[1] + tSphere * d[1];
+			if (centerY > 0.f ? y >= centerY : y <= centerY) {
+				t = tSphere;
+				tMax = tSphere;
+				isIntersect = true;
+				break;
+			}
+		}
+	}
+
+	return isIntersect;
+}
+
+bool Intersector::IntersectTriangle(const Ray& ray, const pointf3& p0, const vecf3& e1, const vecf3& e2, float& t, float& u, float& v) {
+	// Moller-Trumbore
+	const vecf3 pVec = ray.d.cross(e2);
+	const float det = e1.dot(pVec);
+	if (det == 0.f)
+		return false;
+
+	const float invDet = 1.f / det;
+	const vecf3 s = ray.o - p0;
+	u = s.dot(pVec) * invDet;
+	if (u < 0.f || u > 1.f)
+		return false;
+
+	const vecf3 qVec = s.cross(e1);
+	v = ray.d.dot(qVec) * invDet;
+	if (v < 0.f || u + v > 1.f)
+		return false;
+
+	t = e2.dot(qVec) * invDet;
+	return t > ray.tMin && t < ray.tMax;
+}
@@ -11,8 +11,6 @@
 #include <Engine/Primitive/Disk.h>
 #include <Engine/Primitive/Capsule.h>
 
-#include <stack>
-
 using namespace Ubpa;
 
 using namespace std;
@@ -21,32 +19,162 @@ VisibilityChecker::VisibilityChecker() {
 	Regist<Sphere, Plane, Triangle, Disk, Capsule>();
 }
 
+void VisibilityChecker::Init(Ray * ray, float tMax) {
+	this->ray = ray;
+	ray->tMax = tMax;
+	rst = Rst(false);
+}
+
 void VisibilityChecker::Visit(Ptr<BVHAccel> bvhAccel) {
-	cout << "WARNING::VisibilityChecker::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	if (bvhAccel->IsEmpty())
+		return;
+
+	switch (bvhAccel->GetWidth())
+	{
+	case BVHAccel::Width::BVH4:
+		VisitWideBVH<4>(bvhAccel);
+		break;
+	case BVHAccel::Width::BVH8:
+		VisitWideBVH<8>(bvhAccel);
+		break;
+	default:
+		VisitBVH2(bvhAccel);
+		break;
+	}
+}
+
+void VisibilityChecker::VisitBVH2(const Ptr<BVHAccel> & bvhAccel) {
+	const auto origin = ray->o;
+	const auto dir = ray->d;
+
+	// any hit is enough
+	auto leafFunc = [&](int shapesOffset, int shapesNum) {
+		IntersectShapes(bvhAccel, shapesOffset, shapesNum, origin, dir);
+		return rst.isIntersect;
+	};
+
+	if (bvhAccel->IsQuantized()) {
+		if (quantizedStack.size() < static_cast<size_t>(bvhAccel->GetDepth()))
+			quantizedStack.resize(bvhAccel->GetDepth());
+		TraverseQuantizedBVH(bvhAccel->GetQuantizedBVHNodes(), bvhAccel->GetQuantizedRootBox(), quantizedStack.data(), *ray, leafFunc);
+	}
+	else {
+		if (nodeIdxStack.size() < static_cast<size_t>(bvhAccel->GetDepth()))
+			nodeIdxStack.resize(bvhAccel->GetDepth());
+		TraverseBVH2(bvhAccel->GetBVHNodes(), nodeIdxStack.data(), *ray, leafFunc);
+	}
+}
+
+template<int N>
+void VisibilityChecker::VisitWideBVH(const Ptr<BVHAccel> & bvhAccel) {
+	const auto origin = ray->o;
+	const auto dir = ray->d;
+	const auto invDir = ray->InvDir();
+	const bool dirIsNeg[3] = { invDir[0] < 0, invDir[1] < 0, invDir[2] < 0 };
+
+	// every level pushes at most N - 1 nodes
+	const size_t stackCapacity = static_cast<size_t>(bvhAccel->GetDepth()) * (N - 1) + 1;
+	if (nodeIdxStack.size() < stackCapacity)
+		nodeIdxStack.resize(stackCapacity);
+
+	RTStats::Counter nodeVisits(&RTStats::nodeVisits);
+	int stackSize = 0;
+	nodeIdxStack[stackSize++] = 0;
+	while (stackSize > 0) {
+		nodeVisits.Add();
+		const auto & node = bvhAccel->GetWideBVHNode<N>(nodeIdxStack[--stackSize]);
+		float tNears[N];
+		const int hitMask = BVHAccel::IntersectChildren(node, origin, invDir, dirIsNeg, ray->tMin, ray->tMax, tNears);
+
+		// order doesn't matter for any hit
+		for (int i = 0; i < N; i++) {
+			if (!(hitMask & (1 << i)))
+				continue;
+
+			if (node.IsLeaf(i)) {
+				IntersectShapes(bvhAccel, node.GetShapesOffset(i), node.GetShapesNum(i), origin, dir);
+				if (rst.isIntersect)
+					return;
+			}
+			else
+				nodeIdxStack[stackSize++] = node.GetChildIdx(i);
+		}
+	}
+}
+
+void VisibilityChecker::IntersectShapes(const Ptr<BVHAccel> & bvhAccel, int shapesOffset, int shapesNum, const pointf3 & origin, const vecf3 & dir) {
+	// the triangles of a mesh instance are counted in IntersectMeshBVH
+	RTStats::Counter primitiveTests(&RTStats::primitiveTests);
+	const int shapesEnd = shapesOffset + shapesNum;
+	for (int i = shapesOffset; i < shapesEnd && !rst.isIntersect; i++) {
+		if (bvhAccel->IsTriangle(i)) {
+			primitiveTests.Add();
+			const auto & triangle = bvhAccel->GetWorldTriangle(i);
+			float t, u, v;
+			rst.isIntersect = IntersectTriangle(*ray, triangle.p0, triangle.e1, triangle.e2, t, u, v);
+			continue;
+		}
+
+		const auto & w2l = bvhAccel->GetShapeW2LMat(i);
+
+		if (const auto meshBVH = bvhAccel->GetMeshBVH(i)) {
+			rst.isIntersect = IntersectMeshBVH(*meshBVH, Ray(w2l * origin, w2l * dir, ray->tMin, ray->tMax));
+			continue;
+		}
+
+		primitiveTests.Add();
+		ray->o = w2l * origin;
+		ray->d = w2l * dir;
+
+		Visit(bvhAccel->GetShape(i));
+
+		ray->o = origin;
+		ray->d = dir;
+	}
+}
+
+bool VisibilityChecker::IntersectMeshBVH(const BVHAccel::MeshBVH & meshBVH, const Ray & localRay) {
+	if (meshNodeIdxStack.size() < static_cast<size_t>(meshBVH.depth))
+		meshNodeIdxStack.resize(meshBVH.depth);
+
+	RTStats::Counter primitiveTests(&RTStats::primitiveTests);
+	bool isIntersect = false;
+	TraverseBVH2(meshBVH.nodes, meshNodeIdxStack.data(), localRay, [&](int shapesOffset, int shapesNum) {
+		const int shapesEnd = shapesOffset + shapesNum;
+		for (int i = shapesOffset; i < shapesEnd && !isIntersect; i++) {
+			primitiveTests.Add();
+			const auto & triangle = meshBVH.triangles[i];
+			float t, u, v;
+			isIntersect = IntersectTriangle(localRay, triangle.p0, triangle.e1, triangle.e2, t, u, v);
+		}
+		return isIntersect;
+	});
+
+	return isIntersect;
 }
 
 void VisibilityChecker::ImplVisit(Ptr<Sphere> sphere) {
-	cout << "WARNING::VisibilityChecker::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	float t;
+	rst.isIntersect = IntersectSphere(*ray, t);
 }
 
 void VisibilityChecker::ImplVisit(Ptr<Plane> plane) {
-	cout << "WARNING::VisibilityChecker::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	float t;
+	rst.isIntersect = IntersectPlane(*ray, t);
 }
 
 void VisibilityChecker::ImplVisit(Ptr<Triangle> triangle) {
-	cout << "WARNING::VisibilityChecker::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	const auto & positions = triangle->GetMesh()->GetPositions();
+	float t, u, v;
+	rst.isIntersect = IntersectTriangle(*ray, positions[triangle->idx[0]], positions[triangle->idx[1]], positions[triangle->idx[2]], t, u, v);
 }
 
 void VisibilityChecker::ImplVisit(Ptr<Disk> disk) {
-	cout << "WARNING::VisibilityChecker::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	float t;
+	rst.isIntersect = IntersectDisk(*ray, t);
 }
 
 void VisibilityChecker::ImplVisit(Ptr<Capsule> capsule) {
-	cout << "WARNING::VisibilityChecker::ImplVisit:" << endl
-		<< "\t" << "not implemented" << endl;
+	float t;
+	rst.isIntersect = IntersectCapsule(*ray, capsule->height, t);
 }
@@ -5,33 +5,96 @@
 #include <Engine/Primitive/Sphere.h>
 #include <Basic/Math.h>
 
+#include <limits>
+
 using namespace Ubpa;
 
 using namespace std;
 
 void InfiniteAreaLight::SetImg(Ptr<Image> img) {
-	if(img && img->IsValid())
-		this->img = img;
-	cout << "WARNING::InfiniteAreaLight:" << endl
-		<< "\t" << "not implemented" << endl;
+	this->img = img && img->IsValid() ? img : nullptr;
+	distribution.Clear();
+	if (!this->img)
+		return;
+
+	// rows are stretched to rings of sin(theta), the poles get less
+	const int w = this->img->GetWidth();
+	const int h = this->img->GetHeight();
+	vector<double> weights(static_cast<size_t>(w) * h);
+	double sum = 0.;
+	for (int y = 0; y < h; y++) {
+		const double sinTheta = sin(PI<double> * (y + 0.5) / h);
+		for (int x = 0; x < w; x++) {
+			const double weight = max(0.f, this->img->GetPixel(x, y).to_rgb().illumination()) * sinTheta;
+			weights[static_cast<size_t>(y) * w + x] = weight;
+			sum += weight;
+		}
+	}
+
+	// a black image keeps uniform sampling
+	if (!(sum > 0.))
+		return;
+
+	for (auto & weight : weights)
+		weight /= sum;
+	distribution.Init(weights);
 }
 
 const rgbf InfiniteAreaLight::Sample_L(const pointf3 & p, normalf & wi, float & distToLight, float & PD) const {
-	cout << "WARNING::InfiniteAreaLight:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	distToLight = numeric_limits<float>::max();
+
+	if (!img || distribution.Empty()) {
+		wi = BasicSampler::UniformOnSphere(PD).cast_to<normalf>();
+		return GetColor(Sphere::TexcoordOf(wi));
+	}
+
+	double pixelP;
+	const int pixel = distribution.Sample(pixelP);
+	const int w = img->GetWidth();
+	const int h = img->GetHeight();
+	const pointf2 texcoord(
+		(pixel % w + Math::Rand_F()) / w,
+		(pixel / w + Math::Rand_F()) / h);
+
+	const Sphere::SphereCoord coord(texcoord);
+	const float sinTheta = sin(coord.theta);
+	if (sinTheta <= 0.f) {
+		PD = 0.f;
+		return 0.f;
+	}
+
+	wi = coord.ToDir();
+	PD = static_cast<float>(pixelP) * w * h / (2.f * PI<float> * PI<float> * sinTheta);
+	return GetColor(texcoord);
 }
 
 float InfiniteAreaLight::PDF(const pointf3 & p, const normalf & wi) const {
-	cout << "WARNING::InfiniteAreaLight:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	if (!img || distribution.Empty())
+		return BasicSampler::PDofUniformOnSphere();
+
+	const pointf2 texcoord = Sphere::TexcoordOf(wi);
+	const float sinTheta = sin(Sphere::SphereCoord(texcoord).theta);
+	if (sinTheta <= 0.f)
+		return 0.f;
+
+	const float pixelP = static_cast<float>(distribution.P(PixelOf(texcoord)));
+	return pixelP * img->GetWidth() * img->GetHeight() / (2.f * PI<float> * PI<float> * sinTheta);
 }
 
 const rgbf InfiniteAreaLight::Le(const Ray & ray) const {
-	cout << "WARNING::InfiniteAreaLight:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	return GetColor(Sphere::TexcoordOf(ray.d.cast_to<normalf>()));
+}
+
+float InfiniteAreaLight::Power(float sceneRadius) const {
+	// radiance from every direction through a disk of sceneRadius
+	rgbf radiance = intensity * colorFactor;
+	if (img && img->IsValid()) {
+		rgbf sum(0.f);
+		for (int i = 0; i < img->GetPixelNum(); i++)
+			sum += img->GetPixel(i).to_rgb();
+		radiance *= sum / static_cast<float>(img->GetPixelNum());
+	}
+	return 4 * PI<float> * PI<float> * sceneRadius * sceneRadius * radiance.illumination();
 }
 
 const rgbf InfiniteAreaLight::GetColor(const pointf2 & texcoord) const {
@@ -40,3 +103,12 @@ const rgbf InfiniteAreaLight::GetColor(const pointf2 & texcoord) const {
 
 	return intensity * colorFactor * (img->Sample(texcoord, Image::Mode::BILINEAR)).to_rgb();
 }
+
+int InfiniteAreaLight::PixelOf(const pointf2 & texcoord) const {
+	// same clamping as Image::SampleNearest
+	const int w = img->GetWidth();
+	const int h = img->GetHeight();
+	const int x = static_cast<int>(Math::Clamp(texcoord[0], 0.f, 0.999999f) * w);
+	const int y = static_cast<int>(Math::Clamp(texcoord[1], 0.f, 0.999999f) * h);
+	return y * w + x;
+}
@@ -0,0 +1,379 @@
+#include <Engine/Light/LightSampler.h>
+
+#include <Basic/Math.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Ubpa;
+
+using namespace std;
+
+namespace Ubpa {
+	// buckets of the centroids per axis when a node is split
+	static constexpr int bucketNum = 12;
+
+	// largest float below 1, keeps the reused random number in [0, 1)
+	static constexpr float oneMinusEpsilon = 0x1.fffffep-1f;
+
+	static float SafeSqrt(float x) { return sqrt(max(0.f, x)); }
+	static float SafeACos(float x) { return acos(Math::Clamp(x, -1.f, 1.f)); }
+
+	// cos(max(0, a - b)) and sin(max(0, a - b)) of the angles a and b
+	static float CosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+		return cosA > cosB ? 1.f : cosA * cosB + sinA * sinB;
+	}
+	static float SinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+		return cosA > cosB ? 0.f : sinA * cosB - cosA * sinB;
+	}
+
+	// w rotated by theta around the unit axis
+	static const vecf3 Rotate(const vecf3& w, const vecf3& axis, float theta) {
+		const float c = cos(theta);
+		const float s = sin(theta);
+		return c * w + s * axis.cross(w) + (1 - c) * axis.dot(w) * axis;
+	}
+
+	// solid angle term of the split cost (pbrt-v4)
+	static float MOmega(const LightBound& bound) {
+		const float thetaO = SafeACos(bound.cosThetaO);
+		const float thetaE = SafeACos(bound.cosThetaE);
+		const float thetaW = min(thetaO + thetaE, PI<float>);
+		const float sinThetaO = SafeSqrt(1 - bound.cosThetaO * bound.cosThetaO);
+		return 2 * PI<float> * (1 - bound.cosThetaO)
+			+ PI<float> / 2 * (2 * thetaW * sinThetaO - cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + bound.cosThetaO);
+	}
+}
+
+void LightSampler::Init(Mode mode, const vector<Ptr<Light>> & lights, const vector<transformf> & lightToWorldVec, const bboxf3 & sceneBox) {
+	lightNum = static_cast<int>(lights.size());
+	if (mode == Mode::Auto)
+		mode = lightNum >= bvhLightNum ? Mode::BVH : Mode::Power;
+	this->mode = mode;
+
+	powerTable.Clear();
+	nodes.clear();
+	lightToLeaf.clear();
+	unboundedLights.clear();
+	if (lightNum == 0 || mode == Mode::Uniform)
+		return;
+
+	const auto sceneDiagonal = sceneBox.diagonal();
+	const float sceneRadius = sceneDiagonal[0] >= 0.f ? sceneDiagonal.norm() / 2 : 0.f;
+	vector<float> powers(lightNum);
+	for (int i = 0; i < lightNum; i++) {
+		const float power = lights[i]->Power(sceneRadius);
+		powers[i] = power > 0.f && isfinite(power) ? power : 0.f;
+	}
+
+	if (mode == Mode::Power) {
+		double sum = 0.;
+		for (auto power : powers)
+			sum += power;
+		if (sum <= 0.) {
+			this->mode = Mode::Uniform;
+			return;
+		}
+
+		vector<double> distribution(lightNum);
+		for (int i = 0; i < lightNum; i++)
+			distribution[i] = powers[i] / sum;
+		powerTable.Init(distribution);
+		return;
+	}
+
+	// lights without power are never chosen
+	lightToLeaf.resize(lightNum, -1);
+	vector<Bound> bounds(lightNum);
+	vector<int> boundedLights;
+	for (int i = 0; i < lightNum; i++) {
+		LightBound lightBound;
+		if (!lights[i]->GetBound(lightBound)) {
+			unboundedLights.push_back(i);
+			continue;
+		}
+		if (powers[i] == 0.f)
+			continue;
+
+		const auto & lightToWorld = lightToWorldVec[i];
+		const auto & box = lightBound.box;
+		bboxf3 worldBox;
+		for (int corner = 0; corner < 8; corner++) {
+			const pointf3 p(
+				(corner & 1 ? box.maxP() : box.minP())[0],
+				(corner & 2 ? box.maxP() : box.minP())[1],
+				(corner & 4 ? box.maxP() : box.minP())[2]);
+			worldBox.combine_with(lightToWorld * p);
+		}
+		lightBound.box = worldBox;
+		lightBound.w = (lightToWorld * lightBound.w).normalize();
+
+		bounds[i] = Bound(lightBound, powers[i]);
+		boundedLights.push_back(i);
+	}
+
+	if (!boundedLights.empty())
+		Build(boundedLights, bounds, 0, static_cast<int>(boundedLights.size()), -1);
+}
+
+int LightSampler::Build(vector<int> & lightIdx, const vector<Bound> & bounds, int begin, int end, int parent) {
+	const int nodeIdx = static_cast<int>(nodes.size());
+	nodes.push_back(Node{ Bound(), -1, parent, false });
+
+	if (end - begin == 1) {
+		const int idx = lightIdx[begin];
+		nodes[nodeIdx].bound = bounds[idx];
+		nodes[nodeIdx].idx = idx;
+		nodes[nodeIdx].isLeaf = true;
+		lightToLeaf[idx] = nodeIdx;
+		return nodeIdx;
+	}
+
+	bboxf3 box;
+	bboxf3 centroidBox;
+	for (int i = begin; i < end; i++) {
+		const auto & lightBox = bounds[lightIdx[i]].lightBound.box;
+		box.combine_with(lightBox);
+		centroidBox.combine_with(lightBox.center());
+	}
+
+	// split with the least cost over the buckets of the centroids, the cost follows power, solid angle and area
+	const auto boxDiagonal = box.diagonal();
+	const auto centroidDiagonal = centroidBox.diagonal();
+	const float maxExtent = max(max(boxDiagonal[0], boxDiagonal[1]), boxDiagonal[2]);
+	auto Cost = [](const Bound & bound, float Kr) {
+		return bound.phi * MOmega(bound.lightBound) * Kr * bound.lightBound.box.area();
+	};
+	auto BucketOf = [&](int idx, int dim) {
+		const float offset = (bounds[idx].lightBound.box.center()[dim] - centroidBox.minP()[dim]) / centroidDiagonal[dim];
+		return min(static_cast<int>(offset * bucketNum), bucketNum - 1);
+	};
+
+	float minCost = INFINITY;
+	int minDim = -1;
+	int minBucket = -1;
+	for (int dim = 0; dim < 3; dim++) {
+		if (centroidDiagonal[dim] <= 0.f)
+			continue;
+
+		Bound buckets[bucketNum];
+		for (int i = begin; i < end; i++) {
+			auto & bucket = buckets[BucketOf(lightIdx[i], dim)];
+			bucket = Bound::Union(bucket, bounds[lightIdx[i]]);
+		}
+
+		const float Kr = boxDiagonal[dim] > 0.f ? maxExtent / boxDiagonal[dim] : 1.f;
+		for (int split = 0; split < bucketNum - 1; split++) {
+			Bound below, above;
+			for (int b = 0; b <= split; b++)
+				below = Bound::Union(below, buckets[b]);
+			for (int b = split + 1; b < bucketNum; b++)
+				above = Bound::Union(above, buckets[b]);
+
+			const float cost = Cost(below, Kr) + Cost(above, Kr);
+			if (below.phi > 0.f && above.phi > 0.f && cost < minCost) {
+				minCost = cost;
+				minDim = dim;
+				minBucket = split;
+			}
+		}
+	}
+
+	int mid;
+	if (minDim != -1)
+		mid = static_cast<int>(partition(lightIdx.begin() + begin, lightIdx.begin() + end,
+			[&](int idx) { return BucketOf(idx, minDim) <= minBucket; }) - lightIdx.begin());
+	else
+		mid = (begin + end) / 2;
+	if (mid == begin || mid == end)
+		mid = (begin + end) / 2;
+
+	Build(lightIdx, bounds, begin, mid, nodeIdx);
+	const int secondChild = Build(lightIdx, bounds, mid, end, nodeIdx);
+
+	nodes[nodeIdx].idx = secondChild;
+	nodes[nodeIdx].bound = Bound::Union(nodes[nodeIdx + 1].bound, nodes[secondChild].bound);
+	return nodeIdx;
+}
+
+int LightSampler::Sample(const pointf3 & pos, const normalf & n, float & pmf) const {
+	if (lightNum == 0)
+		return -1;
+
+	if (mode == Mode::Uniform) {
+		pmf = 1.f / lightNum;
+		return min(static_cast<int>(Math::Rand_F() * lightNum), lightNum - 1);
+	}
+
+	if (mode == Mode::Power) {
+		const int idx = powerTable.Sample();
+		pmf = static_cast<float>(powerTable.P(idx));
+		return idx;
+	}
+
+	// the unbounded lights and the tree as a whole are chosen uniformly
+	const int unboundedNum = static_cast<int>(unboundedLights.size());
+	const int choiceNum = unboundedNum + (nodes.empty() ? 0 : 1);
+	if (choiceNum == 0)
+		return -1;
+
+	float u = Math::Rand_F();
+	const float pUnbounded = static_cast<float>(unboundedNum) / choiceNum;
+	if (u < pUnbounded) {
+		pmf = 1.f / choiceNum;
+		return unboundedLights[min(static_cast<int>(u * choiceNum), unboundedNum - 1)];
+	}
+	u = min((u - pUnbounded) / (1 - pUnbounded), oneMinusEpsilon);
+
+	pmf = 1 - pUnbounded;
+	int nodeIdx = 0;
+	while (!nodes[nodeIdx].isLeaf) {
+		const auto & node = nodes[nodeIdx];
+		float p0;
+		if (!ChildProb(node, pos, n, p0))
+			return -1;
+
+		if (u < p0) {
+			nodeIdx++;
+			pmf *= p0;
+			u = min(u / p0, oneMinusEpsilon);
+		}
+		else {
+			nodeIdx = node.idx;
+			pmf *= 1 - p0;
+			u = min((u - p0) / (1 - p0), oneMinusEpsilon);
+		}
+	}
+
+	const auto & leaf = nodes[nodeIdx];
+	if (!(leaf.bound.Importance(pos, n) > 0.f))
+		return -1;
+	return leaf.idx;
+}
+
+float LightSampler::PMF(const pointf3 & pos, const normalf & n, int lightIdx) const {
+	if (lightNum == 0)
+		return 0.f;
+
+	if (mode == Mode::Uniform)
+		return 1.f / lightNum;
+
+	if (mode == Mode::Power)
+		return static_cast<float>(powerTable.P(lightIdx));
+
+	const int unboundedNum = static_cast<int>(unboundedLights.size());
+	const int choiceNum = unboundedNum + (nodes.empty() ? 0 : 1);
+	const int leafIdx = lightToLeaf[lightIdx];
+	if (leafIdx == -1)
+		return find(unboundedLights.cbegin(), unboundedLights.cend(), lightIdx) != unboundedLights.cend() ? 1.f / choiceNum : 0.f;
+
+	if (!(nodes[leafIdx].bound.Importance(pos, n) > 0.f))
+		return 0.f;
+
+	// up from the leaf, the first child of a branch follows it
+	float pmf = 1 - static_cast<float>(unboundedNum) / choiceNum;
+	for (int nodeIdx = leafIdx; nodes[nodeIdx].parent != -1; nodeIdx = nodes[nodeIdx].parent) {
+		const int parent = nodes[nodeIdx].parent;
+		float p0;
+		if (!ChildProb(nodes[parent], pos, n, p0))
+			return 0.f;
+		pmf *= nodeIdx == parent + 1 ? p0 : 1 - p0;
+	}
+	return pmf;
+}
+
+bool LightSampler::ChildProb(const Node & node, const pointf3 & pos, const normalf & n, float & p0) const {
+	const int nodeIdx = static_cast<int>(&node - nodes.data());
+	const float importance0 = nodes[nodeIdx + 1].bound.Importance(pos, n);
+	const float importance1 = nodes[node.idx].bound.Importance(pos, n);
+	if (!(importance0 + importance1 > 0.f))
+		return false;
+
+	p0 = importance0 / (importance0 + importance1);
+	return true;
+}
+
+float LightSampler::Bound::Importance(const pointf3 & pos, const normalf & n) const {
+	if (phi == 0.f)
+		return 0.f;
+
+	const auto & box = lightBound.box;
+	const pointf3 center = box.center();
+	const vecf3 toPos = pos - center;
+	// distance squared, clamped inside the bound
+	const float d2 = max(toPos.norm2(), box.diagonal().norm() / 2);
+
+	// angle of pos to w, less the spread of the normals
+	float cosThetaW = toPos.norm2() > 0.f ? lightBound.w.dot(toPos.normalize()) : 1.f;
+	if (lightBound.twoSided)
+		cosThetaW = abs(cosThetaW);
+	const float sinThetaW = SafeSqrt(1 - cosThetaW * cosThetaW);
+
+	// half angle of the cone around the direction to the center that holds the bound
+	const float radius2 = box.diagonal().norm2() / 4;
+	const float dist2 = toPos.norm2();
+	const float cosThetaB = dist2 <= radius2 ? -1.f : SafeSqrt(1 - radius2 / dist2);
+	const float sinThetaB = SafeSqrt(1 - cosThetaB * cosThetaB);
+
+	const float cosThetaO = lightBound.cosThetaO;
+	const float sinThetaO = SafeSqrt(1 - cosThetaO * cosThetaO);
+	const float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	const float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	const float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= lightBound.cosThetaE)
+		return 0.f;
+
+	float importance = phi * cosThetaP / d2;
+
+	// the cos of the surface at pos
+	if (n[0] != 0.f || n[1] != 0.f || n[2] != 0.f) {
+		const float cosThetaI = dist2 > 0.f ? abs(n.cast_to<vecf3>().dot(-toPos.normalize())) : 1.f;
+		const float sinThetaI = SafeSqrt(1 - cosThetaI * cosThetaI);
+		importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	}
+
+	return max(importance, 0.f);
+}
+
+const LightSampler::Bound LightSampler::Bound::Union(const Bound & a, const Bound & b) {
+	if (a.phi == 0.f)
+		return b;
+	if (b.phi == 0.f)
+		return a;
+
+	Bound rst;
+	rst.phi = a.phi + b.phi;
+	rst.lightBound.box = a.lightBound.box;
+	rst.lightBound.box.combine_with(b.lightBound.box);
+	rst.lightBound.cosThetaE = min(a.lightBound.cosThetaE, b.lightBound.cosThetaE);
+	rst.lightBound.twoSided = a.lightBound.twoSided || b.lightBound.twoSided;
+
+	// the smallest cone that holds both cones of the normals
+	const auto & wa = a.lightBound.w;
+	const auto & wb = b.lightBound.w;
+	const float thetaA = SafeACos(a.lightBound.cosThetaO);
+	const float thetaB = SafeACos(b.lightBound.cosThetaO);
+	const float thetaD = SafeACos(wa.dot(wb));
+	if (min(thetaD + thetaB, PI<float>) <= thetaA) {
+		rst.lightBound.w = wa;
+		rst.lightBound.cosThetaO = a.lightBound.cosThetaO;
+		return rst;
+	}
+	if (min(thetaD + thetaA, PI<float>) <= thetaB) {
+		rst.lightBound.w = wb;
+		rst.lightBound.cosThetaO = b.lightBound.cosThetaO;
+		return rst;
+	}
+
+	const float thetaO = (thetaA + thetaD + thetaB) / 2;
+	const vecf3 axis = wa.cross(wb);
+	if (thetaO >= PI<float> || axis.norm2() == 0.f) {
+		rst.lightBound.w = wa;
+		rst.lightBound.cosThetaO = -1.f;
+		return rst;
+	}
+
+	rst.lightBound.w = Rotate(wa, axis.normalize(), thetaO - thetaA).normalize();
+	rst.lightBound.cosThetaO = cos(thetaO);
+	return rst;
+}
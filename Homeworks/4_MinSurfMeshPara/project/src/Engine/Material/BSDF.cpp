@@ -6,6 +6,26 @@
 
 using namespace Ubpa;
 
+void BSDF::F_Batch(BSDFBatch & batch) {
+	for (int i = 0; i < batch.Size(); i++)
+		batch.SetF(i, F(batch.Wo(i), batch.Wi(i), batch.Texcoord(i)));
+}
+
+void BSDF::PDF_Batch(BSDFBatch & batch) {
+	for (int i = 0; i < batch.Size(); i++)
+		batch.pdf[i] = PDF(batch.Wo(i), batch.Wi(i), batch.Texcoord(i));
+}
+
+void BSDF::Sample_f_Batch(BSDFBatch & batch) {
+	for (int i = 0; i < batch.Size(); i++) {
+		normalf wi;
+		float pd;
+		batch.SetF(i, Sample_f(batch.Wo(i), batch.Texcoord(i), wi, pd));
+		batch.SetWi(i, wi);
+		batch.pdf[i] = pd;
+	}
+}
+
 const normalf BSDF::TangentSpaceNormalToWorld(const normalf & worldTangent, const normalf & worldNormal, const normalf & tangentSpaceNormal) {
 	const normalf bitangent = worldTangent.cross(worldNormal);
 	matf3 TBN(worldTangent.cast_to<vecf3>(), bitangent.cast_to<vecf3>(), worldNormal.cast_to<vecf3>());
@@ -0,0 +1,122 @@
+#pragma once
+
+// 8 lane AVX2 kernels of the BSDF batches, chosen at run time like the BVH traversal
+// functions using them are marked UBPA_TARGET_AVX2 and only called if SIMD::CPUSupportsAVX2()
+
+#include <Basic/SIMD.h>
+
+#ifdef UBPA_SIMD
+#define UBPA_BSDF_SIMD
+#endif
+
+#ifdef UBPA_BSDF_SIMD
+#include <Engine/Material/BSDFBatch.h>
+
+namespace Ubpa {
+	namespace BSDFSIMD {
+		// wo and wi on the same side of the surface
+		UBPA_TARGET_AVX2 inline __m256 IsSameSide(__m256 woZ, __m256 wiZ) {
+			return _mm256_cmp_ps(_mm256_mul_ps(woZ, wiZ), _mm256_setzero_ps(), _CMP_GT_OQ);
+		}
+
+		UBPA_TARGET_AVX2 inline __m256 Pow5(__m256 x) {
+			const __m256 x2 = _mm256_mul_ps(x, x);
+			return _mm256_mul_ps(_mm256_mul_ps(x2, x2), x);
+		}
+
+		// lanes i to i + 7 of wo and wi in a batch and their half vector normalize(wo + wi)
+		// upper mirrors wo and wi to the upper hemisphere first, for reflection lobes of pairs on the same side
+		struct Pairs {
+			__m256 woX, woY, woZ;
+			__m256 wiX, wiY, wiZ;
+			__m256 hX, hY, hZ;
+		};
+
+		UBPA_TARGET_AVX2 inline Pairs LoadPairs(const BSDFBatch& batch, int i, bool upper = false) {
+			Pairs p;
+			p.woX = _mm256_loadu_ps(&batch.woX[i]);
+			p.woY = _mm256_loadu_ps(&batch.woY[i]);
+			p.woZ = _mm256_loadu_ps(&batch.woZ[i]);
+			p.wiX = _mm256_loadu_ps(&batch.wiX[i]);
+			p.wiY = _mm256_loadu_ps(&batch.wiY[i]);
+			p.wiZ = _mm256_loadu_ps(&batch.wiZ[i]);
+			if (upper) {
+				p.woZ = SIMD::Abs(p.woZ);
+				p.wiZ = SIMD::Abs(p.wiZ);
+			}
+			p.hX = _mm256_add_ps(p.woX, p.wiX);
+			p.hY = _mm256_add_ps(p.woY, p.wiY);
+			p.hZ = _mm256_add_ps(p.woZ, p.wiZ);
+			const __m256 norm = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(p.hX, p.hX), _mm256_mul_ps(p.hY, p.hY)), _mm256_mul_ps(p.hZ, p.hZ)));
+			p.hX = _mm256_div_ps(p.hX, norm);
+			p.hY = _mm256_div_ps(p.hY, norm);
+			p.hZ = _mm256_div_ps(p.hZ, norm);
+			return p;
+		}
+
+		UBPA_TARGET_AVX2 inline __m256 Dot(__m256 aX, __m256 aY, __m256 aZ, __m256 bX, __m256 bY, __m256 bZ) {
+			return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(aX, bX), _mm256_mul_ps(aY, bY)), _mm256_mul_ps(aZ, bZ));
+		}
+
+		// SurfCoord::IsVisible of wo and wi against the half vector
+		UBPA_TARGET_AVX2 inline __m256 IsVisible(const Pairs& p) {
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 woH = Dot(p.woX, p.woY, p.woZ, p.hX, p.hY, p.hZ);
+			const __m256 wiH = Dot(p.wiX, p.wiY, p.wiZ, p.hX, p.hY, p.hZ);
+			return _mm256_and_ps(_mm256_cmp_ps(_mm256_mul_ps(p.woZ, woH), zero, _CMP_GT_OQ),
+				_mm256_cmp_ps(_mm256_mul_ps(p.wiZ, wiH), zero, _CMP_GT_OQ));
+		}
+
+		// the microfacet terms below take the z of directions in the upper hemisphere of the surface coordinate
+
+		// GGX::D
+		UBPA_TARGET_AVX2 inline __m256 GGX_D(__m256 alpha, __m256 cosTheta) {
+			const __m256 alpha2 = _mm256_mul_ps(alpha, alpha);
+			const __m256 cos2Theta = _mm256_mul_ps(cosTheta, cosTheta);
+			const __m256 t = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(alpha2, _mm256_set1_ps(1.f)), cos2Theta), _mm256_set1_ps(1.f));
+			const __m256 D = _mm256_div_ps(alpha2, _mm256_mul_ps(_mm256_set1_ps(3.14159265f), _mm256_mul_ps(t, t)));
+			return _mm256_and_ps(_mm256_cmp_ps(cosTheta, _mm256_setzero_ps(), _CMP_GE_OQ), D);
+		}
+
+		// GGX::Lambda
+		UBPA_TARGET_AVX2 inline __m256 GGX_Lambda(__m256 alpha, __m256 cosTheta) {
+			const __m256 cos2Theta = _mm256_mul_ps(cosTheta, cosTheta);
+			const __m256 tan2Theta = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), cos2Theta), cos2Theta);
+			const __m256 alpha2Tan2Theta = _mm256_mul_ps(_mm256_mul_ps(alpha, alpha), tan2Theta);
+			return _mm256_mul_ps(_mm256_sub_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_set1_ps(1.f), alpha2Tan2Theta)), _mm256_set1_ps(1.f)), _mm256_set1_ps(0.5f));
+		}
+
+		// SchlickGGX::G1
+		UBPA_TARGET_AVX2 inline __m256 SchlickGGX_G1(__m256 alpha, __m256 cosTheta) {
+			const __m256 k = _mm256_mul_ps(alpha, _mm256_set1_ps(0.5f));
+			const __m256 NoW = _mm256_max_ps(cosTheta, _mm256_setzero_ps());
+			return _mm256_div_ps(NoW, _mm256_add_ps(_mm256_mul_ps(NoW, _mm256_sub_ps(_mm256_set1_ps(1.f), k)), k));
+		}
+
+		// Beckmann::D
+		UBPA_TARGET_AVX2 inline __m256 Beckmann_D(__m256 alpha, __m256 cosTheta) {
+			const __m256 cos2Theta = _mm256_mul_ps(cosTheta, cosTheta);
+			const __m256 tan2Theta = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), cos2Theta), cos2Theta);
+			const __m256 alpha2 = _mm256_mul_ps(alpha, alpha);
+			const __m256 e = SIMD::Exp(_mm256_div_ps(_mm256_sub_ps(_mm256_setzero_ps(), tan2Theta), alpha2));
+			const __m256 D = _mm256_div_ps(e, _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(3.14159265f), alpha2), _mm256_mul_ps(cos2Theta, cos2Theta)));
+			return _mm256_and_ps(_mm256_cmp_ps(cosTheta, _mm256_setzero_ps(), _CMP_GT_OQ), D);
+		}
+
+		// Beckmann::Lambda
+		UBPA_TARGET_AVX2 inline __m256 Beckmann_Lambda(__m256 alpha, __m256 cosTheta) {
+			const __m256 absCosTheta = SIMD::Abs(cosTheta);
+			const __m256 sinTheta = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(cosTheta, cosTheta)), _mm256_setzero_ps()));
+			// 1 / (alpha * tanTheta)
+			const __m256 a = _mm256_div_ps(absCosTheta, _mm256_mul_ps(alpha, sinTheta));
+			const __m256 a2 = _mm256_mul_ps(a, a);
+			const __m256 num = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(_mm256_set1_ps(1.259f), a)), _mm256_mul_ps(_mm256_set1_ps(0.396f), a2));
+			const __m256 den = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(3.535f), a), _mm256_mul_ps(_mm256_set1_ps(2.181f), a2));
+			const __m256 valid = _mm256_and_ps(_mm256_cmp_ps(a, _mm256_set1_ps(1.6f), _CMP_LT_OQ),
+				_mm256_cmp_ps(absCosTheta, _mm256_setzero_ps(), _CMP_GT_OQ));
+			return _mm256_and_ps(valid, _mm256_div_ps(num, den));
+		}
+	}
+}
+#endif // UBPA_BSDF_SIMD
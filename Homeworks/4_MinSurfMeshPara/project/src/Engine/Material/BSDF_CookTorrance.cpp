@@ -2,42 +2,174 @@
 
 #include <Basic/Math.h>
 
+#include "BSDFSIMD.h"
+
 using namespace Ubpa;
 
 using namespace std;
 
+#ifdef UBPA_BSDF_SIMD
+namespace Ubpa {
+	UBPA_TARGET_AVX2
+	static void CookTorrance_F_AVX2(float ior, float m, const rgbf & refletance, const rgbf & albedo, BSDFBatch & batch) {
+		const __m256 one = _mm256_set1_ps(1.f);
+		const __m256 two = _mm256_set1_ps(2.f);
+		const __m256 m8 = _mm256_set1_ps(m);
+		const float f0 = (ior - 1) * (ior - 1) / ((ior + 1) * (ior + 1));
+		const __m256 F0 = _mm256_set1_ps(f0);
+		const __m256 invPi = _mm256_set1_ps(1.f / PI<float>);
+		const __m256 refletanceRGB[3] = { _mm256_set1_ps(refletance[0]), _mm256_set1_ps(refletance[1]), _mm256_set1_ps(refletance[2]) };
+		const __m256 albedoRGB[3] = { _mm256_set1_ps(albedo[0]), _mm256_set1_ps(albedo[1]), _mm256_set1_ps(albedo[2]) };
+		float * const f[3] = { batch.fR.data(), batch.fG.data(), batch.fB.data() };
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const __m256 sameSide = BSDFSIMD::IsSameSide(_mm256_loadu_ps(&batch.woZ[i]), _mm256_loadu_ps(&batch.wiZ[i]));
+			const auto p = BSDFSIMD::LoadPairs(batch, i, true);
+
+			const __m256 OoH = BSDFSIMD::Dot(p.woX, p.woY, p.woZ, p.hX, p.hY, p.hZ);
+			const __m256 IoH = BSDFSIMD::Dot(p.wiX, p.wiY, p.wiZ, p.hX, p.hY, p.hZ);
+
+			const __m256 fr = _mm256_add_ps(F0, _mm256_mul_ps(_mm256_sub_ps(one, F0),
+				BSDFSIMD::Pow5(_mm256_sub_ps(one, _mm256_max_ps(IoH, _mm256_setzero_ps())))));
+			const __m256 D = BSDFSIMD::Beckmann_D(m8, p.hZ);
+			const __m256 twoNoH = _mm256_mul_ps(two, p.hZ);
+			const __m256 G = _mm256_min_ps(one, _mm256_min_ps(
+				_mm256_div_ps(_mm256_mul_ps(twoNoH, p.woZ), OoH),
+				_mm256_div_ps(_mm256_mul_ps(twoNoH, p.wiZ), OoH)));
+
+			const __m256 spec = _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(D, G), fr),
+				_mm256_mul_ps(_mm256_set1_ps(4.f), _mm256_mul_ps(p.woZ, p.wiZ)));
+			const __m256 diffuse = _mm256_mul_ps(_mm256_sub_ps(one, fr), invPi);
+			for (int c = 0; c < 3; c++) {
+				const __m256 rst = _mm256_add_ps(_mm256_mul_ps(albedoRGB[c], diffuse), _mm256_mul_ps(refletanceRGB[c], spec));
+				_mm256_storeu_ps(f[c] + i, _mm256_and_ps(sameSide, rst));
+			}
+		}
+	}
+
+	UBPA_TARGET_AVX2
+	static void CookTorrance_PDF_AVX2(float m, float specularRate, BSDFBatch & batch) {
+		const __m256 m8 = _mm256_set1_ps(m);
+		const __m256 specRate = _mm256_set1_ps(specularRate);
+		const __m256 diffuseRate = _mm256_set1_ps(1 - specularRate);
+		const __m256 invPi = _mm256_set1_ps(1.f / PI<float>);
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const __m256 sameSide = BSDFSIMD::IsSameSide(_mm256_loadu_ps(&batch.woZ[i]), _mm256_loadu_ps(&batch.wiZ[i]));
+			const auto p = BSDFSIMD::LoadPairs(batch, i, true);
+
+			const __m256 OoH = BSDFSIMD::Dot(p.woX, p.woY, p.woZ, p.hX, p.hY, p.hZ);
+			const __m256 pdfSpec = _mm256_div_ps(_mm256_mul_ps(BSDFSIMD::Beckmann_D(m8, p.hZ), p.hZ),
+				_mm256_mul_ps(_mm256_set1_ps(4.f), OoH));
+			const __m256 pdfDiffuse = _mm256_mul_ps(p.wiZ, invPi);
+			const __m256 rst = _mm256_add_ps(_mm256_mul_ps(specRate, pdfSpec), _mm256_mul_ps(diffuseRate, pdfDiffuse));
+			_mm256_storeu_ps(&batch.pdf[i], _mm256_and_ps(sameSide, rst));
+		}
+	}
+}
+#endif
+
 float BSDF_CookTorrance::NDF(const normalf & h) {
-	cout << "WARNING::BSDF_CookTorrance:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	// Beckmann with the rms slope m
+	const float cosTheta = SurfCoord::CosTheta(h);
+	if (cosTheta <= 0)
+		return 0.f;
+
+	const float cos2Theta = cosTheta * cosTheta;
+	const float tan2Theta = (1 - cos2Theta) / cos2Theta;
+	const float m2 = m * m;
+	return std::exp(-tan2Theta / m2) / (PI<float> * m2 * cos2Theta * cos2Theta);
 }
 
 float BSDF_CookTorrance::Fr(const normalf & wi, const normalf & h) {
-	cout << "WARNING::BSDF_CookTorrance:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	// Schlick
+	const float F0 = (ior - 1) * (ior - 1) / ((ior + 1) * (ior + 1));
+	const float x = 1 - std::max(0.f, wi.dot(h));
+	const float x2 = x * x;
+	return F0 + (1 - F0) * (x2 * x2 * x);
 }
 
 float BSDF_CookTorrance::G(const normalf & wo, const normalf & wi, const normalf & h){
-	cout << "WARNING::BSDF_CookTorrance:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	const float twoNoH = 2 * SurfCoord::CosTheta(h);
+	const float OoH = wo.dot(h);
+	return std::min(1.f, std::min(twoNoH * SurfCoord::CosTheta(wo) / OoH, twoNoH * SurfCoord::CosTheta(wi) / OoH));
 }
 
 const rgbf BSDF_CookTorrance::F(const normalf & wo, const normalf & wi, const pointf2 & texcoord) {
-	cout << "WARNING::BSDF_CookTorrance:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	if (!SurfCoord::IsSameSide(wo, wi))
+		return rgbf(0.f);
+
+	// the lobes are symmetric, pairs below the surface are mirrored
+	const normalf o = SurfCoord::ToUpper(wo);
+	const normalf i = SurfCoord::ToUpper(wi);
+	const normalf h = (o + i).normalize();
+
+	const float fr = Fr(i, h);
+	const float spec = NDF(h) * G(o, i, h) * fr / (4 * SurfCoord::CosTheta(o) * SurfCoord::CosTheta(i));
+	const float diffuse = (1 - fr) / PI<float>;
+	return albedo * diffuse + refletance * spec;
 }
 
 float BSDF_CookTorrance::PDF(const normalf & wo, const normalf & wi, const pointf2 & texcoord) {
-	cout << "WARNING::BSDF_CookTorrance:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	if (!SurfCoord::IsSameSide(wo, wi))
+		return 0.f;
+
+	const normalf o = SurfCoord::ToUpper(wo);
+	const normalf i = SurfCoord::ToUpper(wi);
+	const normalf h = (o + i).normalize();
+
+	// the density of h over the one of the reflected wi
+	const float pdfSpec = NDF(h) * SurfCoord::CosTheta(h) / (4 * o.dot(h));
+	const float pdfDiffuse = SurfCoord::CosTheta(i) / PI<float>;
+	return specularRate * pdfSpec + (1 - specularRate) * pdfDiffuse;
 }
 
 const rgbf BSDF_CookTorrance::Sample_f(const normalf & wo, const pointf2 & texcoord, normalf & wi, float & pd) {
-	cout << "WARNING::BSDF_CookTorrance:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	const normalf o = SurfCoord::ToUpper(wo);
+
+	normalf i;
+	if (Math::Rand_F() < specularRate) {
+		// Beckmann
+		const float Xi1 = Math::Rand_F();
+		const float Xi2 = Math::Rand_F();
+		const float tan2Theta = -m * m * std::log(1 - Xi1);
+		const float cosTheta = 1 / std::sqrt(1 + tan2Theta);
+		const float sinTheta = std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta));
+		const normalf h = SurfCoord::SphericalDirection(sinTheta, cosTheta, 2 * PI<float> * Xi2);
+
+		const float OoH = o.dot(h);
+		i = normalf(2 * OoH * h[0] - o[0], 2 * OoH * h[1] - o[1], 2 * OoH * h[2] - o[2]);
+		if (SurfCoord::CosTheta(i) <= 0) {
+			wi = i;
+			pd = 0.f;
+			return rgbf(0.f);
+		}
+	}
+	else {
+		float diffusePD;
+		const auto sample = sampler.GetSample(diffusePD);
+		i = normalf(sample[0], sample[1], sample[2]);
+	}
+
+	wi = SurfCoord::CosTheta(wo) < 0 ? normalf(i[0], i[1], -i[2]) : i;
+	pd = PDF(wo, wi, texcoord);
+	return F(wo, wi, texcoord);
+}
+
+void BSDF_CookTorrance::F_Batch(BSDFBatch & batch) {
+#ifdef UBPA_BSDF_SIMD
+	if (SIMD::CPUSupportsAVX2()) {
+		CookTorrance_F_AVX2(ior, m, refletance, albedo, batch);
+		return;
+	}
+#endif
+	BSDF::F_Batch(batch);
+}
+
+void BSDF_CookTorrance::PDF_Batch(BSDFBatch & batch) {
+#ifdef UBPA_BSDF_SIMD
+	if (SIMD::CPUSupportsAVX2()) {
+		CookTorrance_PDF_AVX2(m, specularRate, batch);
+		return;
+	}
+#endif
+	BSDF::PDF_Batch(batch);
 }
@@ -3,30 +3,133 @@
 #include <Basic/Math.h>
 #include <Basic/Image.h>
 
+#include "BSDFSIMD.h"
+
 using namespace Ubpa;
 using namespace std;
 
+#ifdef UBPA_BSDF_SIMD
+namespace Ubpa {
+	// albedo / PI on the side of wo, 0 else
+	UBPA_TARGET_AVX2
+	static void Diffuse_F_AVX2(const rgbf & albedo, BSDFBatch & batch) {
+		const __m256 r = _mm256_set1_ps(albedo[0] / PI<float>);
+		const __m256 g = _mm256_set1_ps(albedo[1] / PI<float>);
+		const __m256 b = _mm256_set1_ps(albedo[2] / PI<float>);
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const __m256 woZ = _mm256_loadu_ps(&batch.woZ[i]);
+			const __m256 wiZ = _mm256_loadu_ps(&batch.wiZ[i]);
+			const __m256 sameSide = BSDFSIMD::IsSameSide(woZ, wiZ);
+			_mm256_storeu_ps(&batch.fR[i], _mm256_and_ps(sameSide, r));
+			_mm256_storeu_ps(&batch.fG[i], _mm256_and_ps(sameSide, g));
+			_mm256_storeu_ps(&batch.fB[i], _mm256_and_ps(sameSide, b));
+		}
+	}
+
+	// |cos theta| / PI on the side of wo, 0 else
+	UBPA_TARGET_AVX2
+	static void Diffuse_PDF_AVX2(BSDFBatch & batch) {
+		const __m256 invPi = _mm256_set1_ps(1.f / PI<float>);
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const __m256 woZ = _mm256_loadu_ps(&batch.woZ[i]);
+			const __m256 wiZ = _mm256_loadu_ps(&batch.wiZ[i]);
+			const __m256 sameSide = BSDFSIMD::IsSameSide(woZ, wiZ);
+			_mm256_storeu_ps(&batch.pdf[i], _mm256_and_ps(sameSide, _mm256_mul_ps(SIMD::Abs(wiZ), invPi)));
+		}
+	}
+
+	// wi holds samples of the upper hemisphere, moves them to the side of wo
+	UBPA_TARGET_AVX2
+	static void Diffuse_Flip_AVX2(const rgbf & albedo, BSDFBatch & batch) {
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 r = _mm256_set1_ps(albedo[0] / PI<float>);
+		const __m256 g = _mm256_set1_ps(albedo[1] / PI<float>);
+		const __m256 b = _mm256_set1_ps(albedo[2] / PI<float>);
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const __m256 woZ = _mm256_loadu_ps(&batch.woZ[i]);
+			const __m256 wiZ = _mm256_loadu_ps(&batch.wiZ[i]);
+			const __m256 below = _mm256_cmp_ps(woZ, zero, _CMP_LT_OQ);
+			_mm256_storeu_ps(&batch.wiZ[i], SIMD::Select(below, _mm256_sub_ps(zero, wiZ), wiZ));
+			_mm256_storeu_ps(&batch.fR[i], r);
+			_mm256_storeu_ps(&batch.fG[i], g);
+			_mm256_storeu_ps(&batch.fB[i], b);
+		}
+	}
+}
+#endif
+
 const rgbf BSDF_Diffuse::F(const normalf & wo, const normalf & wi, const pointf2 & texcoord) {
-	cout << "WARNING::BSDF_Diffuse:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	if (!SurfCoord::IsSameSide(wo, wi))
+		return rgbf(0.f);
+
+	return GetAlbedo(texcoord) / PI<float>;
 }
 
 const rgbf BSDF_Diffuse::Sample_f(const normalf & wo, const pointf2 & texcoord, normalf & wi, float & PD) {
-	cout << "WARNING::BSDF_Diffuse:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	// cos weighted on the upper hemisphere, then moved to the side of wo
+	const auto sample = sampler.GetSample(PD);
+	wi = normalf(sample[0], sample[1], sample[2]);
+	if (SurfCoord::CosTheta(wo) < 0)
+		wi[2] = -wi[2];
+
+	return GetAlbedo(texcoord) / PI<float>;
 }
 
 float BSDF_Diffuse::PDF(const normalf & wo, const normalf & wi, const pointf2 & texcoord) {
-	cout << "WARNING::BSDF_Diffuse:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	if (!SurfCoord::IsSameSide(wo, wi))
+		return 0.f;
+
+	return SurfCoord::AbsCosTheta(wi) / PI<float>;
+}
+
+void BSDF_Diffuse::F_Batch(BSDFBatch & batch) {
+#ifdef UBPA_BSDF_SIMD
+	if (!IsTextured() && SIMD::CPUSupportsAVX2()) {
+		Diffuse_F_AVX2(colorFactor, batch);
+		return;
+	}
+#endif
+	BSDF::F_Batch(batch);
+}
+
+void BSDF_Diffuse::PDF_Batch(BSDFBatch & batch) {
+#ifdef UBPA_BSDF_SIMD
+	if (SIMD::CPUSupportsAVX2()) {
+		Diffuse_PDF_AVX2(batch);
+		return;
+	}
+#endif
+	BSDF::PDF_Batch(batch);
+}
+
+void BSDF_Diffuse::Sample_f_Batch(BSDFBatch & batch) {
+#ifdef UBPA_BSDF_SIMD
+	if (!IsTextured() && SIMD::CPUSupportsAVX2()) {
+		// the sampler draws the random numbers lane by lane, as Sample_f does
+		for (int i = 0; i < batch.PaddedSize(); i++) {
+			if (i < batch.Size()) {
+				const auto sample = sampler.GetSample(batch.pdf[i]);
+				batch.SetWi(i, normalf(sample[0], sample[1], sample[2]));
+			}
+			else {
+				batch.SetWi(i, normalf(0.f, 0.f, 1.f));
+				batch.pdf[i] = 0.f;
+			}
+		}
+		Diffuse_Flip_AVX2(colorFactor, batch);
+		return;
+	}
+#endif
+	BSDF::Sample_f_Batch(batch);
 }
 
 const rgbf BSDF_Diffuse::GetAlbedo(const pointf2 & texcoord) const {
-	if (!albedoTexture || !albedoTexture->IsValid())
+	if (!IsTextured())
 		return colorFactor;
 
 	return colorFactor * albedoTexture->Sample(texcoord, Image::Mode::BILINEAR).to_rgb();
 }
+
+bool BSDF_Diffuse::IsTextured() const {
+	return albedoTexture && albedoTexture->IsValid();
+}
@@ -5,31 +5,169 @@
 #include <Basic/Image.h>
 #include <Basic/Math.h>
 
+#include "BSDFSIMD.h"
+
 using namespace Ubpa;
 using namespace std;
 
+#ifdef UBPA_BSDF_SIMD
+namespace Ubpa {
+	UBPA_TARGET_AVX2
+	static void MetalWorkflow_F_AVX2(const rgbf & albedo, float metallic, float alpha, BSDFBatch & batch) {
+		const __m256 one = _mm256_set1_ps(1.f);
+		const __m256 alpha8 = _mm256_set1_ps(alpha);
+		const __m256 invPi = _mm256_set1_ps(1.f / PI<float>);
+		__m256 F0[3];
+		__m256 diffuseAlbedo[3];
+		for (int c = 0; c < 3; c++) {
+			F0[c] = _mm256_set1_ps(0.04f + (albedo[c] - 0.04f) * metallic);
+			diffuseAlbedo[c] = _mm256_set1_ps((1 - metallic) * albedo[c]);
+		}
+		float * const f[3] = { batch.fR.data(), batch.fG.data(), batch.fB.data() };
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const __m256 sameSide = BSDFSIMD::IsSameSide(_mm256_loadu_ps(&batch.woZ[i]), _mm256_loadu_ps(&batch.wiZ[i]));
+			const auto p = BSDFSIMD::LoadPairs(batch, i, true);
+
+			const __m256 IoH = BSDFSIMD::Dot(p.wiX, p.wiY, p.wiZ, p.hX, p.hY, p.hZ);
+			const __m256 schlick = BSDFSIMD::Pow5(_mm256_sub_ps(one, _mm256_max_ps(IoH, _mm256_setzero_ps())));
+			const __m256 D = BSDFSIMD::GGX_D(alpha8, p.hZ);
+			const __m256 G = _mm256_and_ps(BSDFSIMD::IsVisible(p),
+				_mm256_mul_ps(BSDFSIMD::SchlickGGX_G1(alpha8, p.woZ), BSDFSIMD::SchlickGGX_G1(alpha8, p.wiZ)));
+			const __m256 DG = _mm256_div_ps(_mm256_mul_ps(D, G), _mm256_mul_ps(_mm256_set1_ps(4.f), _mm256_mul_ps(p.woZ, p.wiZ)));
+			for (int c = 0; c < 3; c++) {
+				const __m256 fr = _mm256_add_ps(F0[c], _mm256_mul_ps(_mm256_sub_ps(one, F0[c]), schlick));
+				const __m256 diffuse = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(one, fr), diffuseAlbedo[c]), invPi);
+				const __m256 rst = _mm256_add_ps(diffuse, _mm256_mul_ps(DG, fr));
+				_mm256_storeu_ps(f[c] + i, _mm256_and_ps(sameSide, rst));
+			}
+		}
+	}
+
+	UBPA_TARGET_AVX2
+	static void MetalWorkflow_PDF_AVX2(float specularRate, float alpha, BSDFBatch & batch) {
+		const __m256 alpha8 = _mm256_set1_ps(alpha);
+		const __m256 specRate = _mm256_set1_ps(specularRate);
+		const __m256 diffuseRate = _mm256_set1_ps(1 - specularRate);
+		const __m256 invPi = _mm256_set1_ps(1.f / PI<float>);
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const __m256 sameSide = BSDFSIMD::IsSameSide(_mm256_loadu_ps(&batch.woZ[i]), _mm256_loadu_ps(&batch.wiZ[i]));
+			const auto p = BSDFSIMD::LoadPairs(batch, i, true);
+
+			const __m256 OoH = BSDFSIMD::Dot(p.woX, p.woY, p.woZ, p.hX, p.hY, p.hZ);
+			const __m256 pdfSpec = _mm256_div_ps(_mm256_mul_ps(BSDFSIMD::GGX_D(alpha8, p.hZ), p.hZ),
+				_mm256_mul_ps(_mm256_set1_ps(4.f), OoH));
+			const __m256 pdfDiffuse = _mm256_mul_ps(p.wiZ, invPi);
+			const __m256 rst = _mm256_add_ps(_mm256_mul_ps(specRate, pdfSpec), _mm256_mul_ps(diffuseRate, pdfDiffuse));
+			_mm256_storeu_ps(&batch.pdf[i], _mm256_and_ps(sameSide, rst));
+		}
+	}
+}
+#endif
+
+namespace Ubpa {
+	// metals are mostly specular
+	static float SpecularRate(float metallic) {
+		return (1 + metallic) / 2;
+	}
+}
+
 const rgbf BSDF_MetalWorkflow::F(const normalf & wo, const normalf & wi, const pointf2 & texcoord) {
-	cout << "WARNING::BSDF_MetalWorkflow:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	if (!SurfCoord::IsSameSide(wo, wi))
+		return rgbf(0.f);
+
+	// the lobes are symmetric, pairs below the surface are mirrored
+	const normalf o = SurfCoord::ToUpper(wo);
+	const normalf i = SurfCoord::ToUpper(wi);
+	const normalf h = (o + i).normalize();
+
+	const auto albedo = GetAlbedo(texcoord);
+	const float metallic = GetMetallic(texcoord);
+	// a copy, F may run on many threads
+	SchlickGGX ggx;
+	ggx.SetAlpha(GetRoughness(texcoord));
+
+	const rgbf fr = Fr(i, h, albedo, metallic);
+	const rgbf diffuse = (1 - metallic) * (rgbf(1.f) - fr) * albedo / PI<float>;
+	const rgbf spec = ggx.D(h) * ggx.G(o, i, h) / (4 * SurfCoord::CosTheta(o) * SurfCoord::CosTheta(i)) * fr;
+	return diffuse + spec;
 }
 
 float BSDF_MetalWorkflow::PDF(const normalf & wo, const normalf & wi, const pointf2 & texcoord) {
-	cout << "WARNING::BSDF_MetalWorkflow:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	if (!SurfCoord::IsSameSide(wo, wi))
+		return 0.f;
+
+	const normalf o = SurfCoord::ToUpper(wo);
+	const normalf i = SurfCoord::ToUpper(wi);
+	const normalf h = (o + i).normalize();
+
+	SchlickGGX ggx;
+	ggx.SetAlpha(GetRoughness(texcoord));
+
+	// the density of h over the one of the reflected wi
+	const float specularRate = SpecularRate(GetMetallic(texcoord));
+	const float pdfSpec = ggx.PDF(h) / (4 * o.dot(h));
+	const float pdfDiffuse = SurfCoord::CosTheta(i) / PI<float>;
+	return specularRate * pdfSpec + (1 - specularRate) * pdfDiffuse;
 }
 
 const rgbf BSDF_MetalWorkflow::Sample_f(const normalf & wo, const pointf2 & texcoord, normalf & wi, float & pd) {
-	cout << "WARNING::BSDF_MetalWorkflow:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	const normalf o = SurfCoord::ToUpper(wo);
+
+	normalf i;
+	if (Math::Rand_F() < SpecularRate(GetMetallic(texcoord))) {
+		SchlickGGX ggx;
+		ggx.SetAlpha(GetRoughness(texcoord));
+		const normalf h = ggx.Sample_wh();
+
+		const float OoH = o.dot(h);
+		i = normalf(2 * OoH * h[0] - o[0], 2 * OoH * h[1] - o[1], 2 * OoH * h[2] - o[2]);
+		if (SurfCoord::CosTheta(i) <= 0) {
+			wi = i;
+			pd = 0.f;
+			return rgbf(0.f);
+		}
+	}
+	else {
+		float diffusePD;
+		const auto sample = sampler.GetSample(diffusePD);
+		i = normalf(sample[0], sample[1], sample[2]);
+	}
+
+	wi = SurfCoord::CosTheta(wo) < 0 ? normalf(i[0], i[1], -i[2]) : i;
+	pd = PDF(wo, wi, texcoord);
+	return F(wo, wi, texcoord);
 }
 
 const rgbf BSDF_MetalWorkflow::Fr(const normalf & w, const normalf & h, const rgbf & albedo, float metallic) {
-	cout << "WARNING::BSDF_MetalWorkflow:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	// Schlick, dielectrics reflect 4%
+	const rgbf F0 = rgbf(0.04f) + (albedo - rgbf(0.04f)) * metallic;
+	const float x = 1 - std::max(0.f, w.dot(h));
+	const float x2 = x * x;
+	return F0 + (rgbf(1.f) - F0) * (x2 * x2 * x);
+}
+
+void BSDF_MetalWorkflow::F_Batch(BSDFBatch & batch) {
+#ifdef UBPA_BSDF_SIMD
+	if (!IsTextured() && SIMD::CPUSupportsAVX2()) {
+		SchlickGGX ggx;
+		ggx.SetAlpha(roughnessFactor);
+		MetalWorkflow_F_AVX2(colorFactor, metallicFactor, ggx.GetAlpha(), batch);
+		return;
+	}
+#endif
+	BSDF::F_Batch(batch);
+}
+
+void BSDF_MetalWorkflow::PDF_Batch(BSDFBatch & batch) {
+#ifdef UBPA_BSDF_SIMD
+	if (!IsTextured() && SIMD::CPUSupportsAVX2()) {
+		SchlickGGX ggx;
+		ggx.SetAlpha(roughnessFactor);
+		MetalWorkflow_PDF_AVX2(SpecularRate(metallicFactor), ggx.GetAlpha(), batch);
+		return;
+	}
+#endif
+	BSDF::PDF_Batch(batch);
 }
 
 const rgbf BSDF_MetalWorkflow::GetAlbedo(const pointf2 & texcoord) const {
@@ -69,3 +207,9 @@ void BSDF_MetalWorkflow::ChangeNormal(const pointf2 & texcoord, const normalf &
 
 	normal = TangentSpaceNormalToWorld(tangent, normal, tangentSpaceNormal);
 }
+
+bool BSDF_MetalWorkflow::IsTextured() const {
+	return (albedoTexture && albedoTexture->IsValid())
+		|| (metallicTexture && metallicTexture->IsValid())
+		|| (roughnessTexture && roughnessTexture->IsValid());
+}
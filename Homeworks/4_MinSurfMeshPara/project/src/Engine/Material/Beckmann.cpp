@@ -2,23 +2,92 @@
 
 #include <Engine/Material/SurfCoord.h>
 
+#include "BSDFSIMD.h"
+
 using namespace Ubpa;
 using namespace std;
 
+#ifdef UBPA_BSDF_SIMD
+namespace Ubpa {
+	UBPA_TARGET_AVX2
+	static void Beckmann_D_AVX2(float alpha, const float * cosTheta, float * D, int count) {
+		const __m256 alpha8 = _mm256_set1_ps(alpha);
+		for (int i = 0; i < count; i += BSDFBatch::laneNum)
+			_mm256_storeu_ps(D + i, BSDFSIMD::Beckmann_D(alpha8, _mm256_loadu_ps(cosTheta + i)));
+	}
+
+	UBPA_TARGET_AVX2
+	static void Beckmann_G_AVX2(float alpha, const BSDFBatch & batch, float * G) {
+		const __m256 alpha8 = _mm256_set1_ps(alpha);
+		const __m256 one = _mm256_set1_ps(1.f);
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const auto p = BSDFSIMD::LoadPairs(batch, i);
+			const __m256 lambda = _mm256_add_ps(BSDFSIMD::Beckmann_Lambda(alpha8, p.woZ), BSDFSIMD::Beckmann_Lambda(alpha8, p.wiZ));
+			const __m256 g = _mm256_div_ps(one, _mm256_add_ps(one, lambda));
+			_mm256_storeu_ps(G + i, _mm256_and_ps(BSDFSIMD::IsVisible(p), g));
+		}
+	}
+}
+#endif
+
 float Beckmann::D(const normalf & wh) const {
-	cout << "WARNING::Beckmann:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	if (SurfCoord::CosTheta(wh) <= 0)
+		return 0.f;
+
+	const float tan2Theta = SurfCoord::Tan2Theta(wh);
+	if (std::isinf(tan2Theta))
+		return 0.f;
+
+	const float alpha2 = alpha * alpha;
+	const float cos4Theta = SurfCoord::Cos2Theta(wh) * SurfCoord::Cos2Theta(wh);
+	return std::exp(-tan2Theta / alpha2) / (PI<float> * alpha2 * cos4Theta);
 }
 
 float Beckmann::Lambda(const normalf & w) const {
-	cout << "WARNING::Beckmann:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	const float absCosTheta = SurfCoord::AbsCosTheta(w);
+	if (absCosTheta == 0.f)
+		return 0.f;
+
+	// rational approximation of pbrt
+	const float a = absCosTheta / (alpha * SurfCoord::SinTheta(w));
+	if (a >= 1.6f)
+		return 0.f;
+
+	return (1 - 1.259f * a + 0.396f * a * a) / (3.535f * a + 2.181f * a * a);
 }
 
 const normalf Beckmann::Sample_wh() const {
-	cout << "WARNING::Beckmann:" << endl
-		<< "\t" << "not implemented" << endl;
-	return 0.f;
+	// sample
+	const float Xi1 = Math::Rand_F();
+	const float Xi2 = Math::Rand_F();
+
+	// theta
+	const auto tan2Theta = -alpha * alpha * std::log(1 - Xi1);
+	const auto cosTheta = 1 / std::sqrt(1 + tan2Theta);
+	const auto sinTheta = std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta));
+
+	// phi
+	const auto phi = 2 * PI<float> * Xi2;
+
+	return SurfCoord::SphericalDirection(sinTheta, cosTheta, phi);
+}
+
+void Beckmann::D_Batch(const float * cosTheta, float * D, int count) const {
+#ifdef UBPA_BSDF_SIMD
+	if (SIMD::CPUSupportsAVX2()) {
+		Beckmann_D_AVX2(alpha, cosTheta, D, count);
+		return;
+	}
+#endif
+	MicrofacetDistribution::D_Batch(cosTheta, D, count);
+}
+
+void Beckmann::G_Batch(const BSDFBatch & batch, float * G) const {
+#ifdef UBPA_BSDF_SIMD
+	if (SIMD::CPUSupportsAVX2()) {
+		Beckmann_G_AVX2(alpha, batch, G);
+		return;
+	}
+#endif
+	MicrofacetDistribution::G_Batch(batch, G);
 }
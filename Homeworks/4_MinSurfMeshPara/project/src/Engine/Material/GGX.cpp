@@ -2,8 +2,33 @@
 
 #include <Engine/Material/SurfCoord.h>
 
+#include "BSDFSIMD.h"
+
 using namespace Ubpa;
 
+#ifdef UBPA_BSDF_SIMD
+namespace Ubpa {
+	UBPA_TARGET_AVX2
+	static void GGX_D_AVX2(float alpha, const float * cosTheta, float * D, int count) {
+		const __m256 alpha8 = _mm256_set1_ps(alpha);
+		for (int i = 0; i < count; i += BSDFBatch::laneNum)
+			_mm256_storeu_ps(D + i, BSDFSIMD::GGX_D(alpha8, _mm256_loadu_ps(cosTheta + i)));
+	}
+
+	UBPA_TARGET_AVX2
+	static void GGX_G_AVX2(float alpha, const BSDFBatch & batch, float * G) {
+		const __m256 alpha8 = _mm256_set1_ps(alpha);
+		const __m256 one = _mm256_set1_ps(1.f);
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const auto p = BSDFSIMD::LoadPairs(batch, i);
+			const __m256 lambda = _mm256_add_ps(BSDFSIMD::GGX_Lambda(alpha8, p.woZ), BSDFSIMD::GGX_Lambda(alpha8, p.wiZ));
+			const __m256 g = _mm256_div_ps(one, _mm256_add_ps(one, lambda));
+			_mm256_storeu_ps(G + i, _mm256_and_ps(BSDFSIMD::IsVisible(p), g));
+		}
+	}
+}
+#endif
+
 float GGX::D(const normalf & wh) const {
 	if (SurfCoord::CosTheta(wh) < 0)
 		return 0.f;
@@ -41,3 +66,23 @@ const normalf GGX::Sample_wh() const {
 
 	return SurfCoord::SphericalDirection(sinTheta, cosTheta, phi);
 }
+
+void GGX::D_Batch(const float * cosTheta, float * D, int count) const {
+#ifdef UBPA_BSDF_SIMD
+	if (SIMD::CPUSupportsAVX2()) {
+		GGX_D_AVX2(alpha, cosTheta, D, count);
+		return;
+	}
+#endif
+	MicrofacetDistribution::D_Batch(cosTheta, D, count);
+}
+
+void GGX::G_Batch(const BSDFBatch & batch, float * G) const {
+#ifdef UBPA_BSDF_SIMD
+	if (SIMD::CPUSupportsAVX2()) {
+		GGX_G_AVX2(alpha, batch, G);
+		return;
+	}
+#endif
+	MicrofacetDistribution::G_Batch(batch, G);
+}
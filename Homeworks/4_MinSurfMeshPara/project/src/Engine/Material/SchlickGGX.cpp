@@ -0,0 +1,29 @@
+#include <Engine/Material/SchlickGGX.h>
+
+#include "BSDFSIMD.h"
+
+using namespace Ubpa;
+
+#ifdef UBPA_BSDF_SIMD
+namespace Ubpa {
+	UBPA_TARGET_AVX2
+	static void SchlickGGX_G_AVX2(float alpha, const BSDFBatch & batch, float * G) {
+		const __m256 alpha8 = _mm256_set1_ps(alpha);
+		for (int i = 0; i < batch.PaddedSize(); i += BSDFBatch::laneNum) {
+			const auto p = BSDFSIMD::LoadPairs(batch, i);
+			const __m256 g = _mm256_mul_ps(BSDFSIMD::SchlickGGX_G1(alpha8, p.woZ), BSDFSIMD::SchlickGGX_G1(alpha8, p.wiZ));
+			_mm256_storeu_ps(G + i, _mm256_and_ps(BSDFSIMD::IsVisible(p), g));
+		}
+	}
+}
+#endif
+
+void SchlickGGX::G_Batch(const BSDFBatch & batch, float * G) const {
+#ifdef UBPA_BSDF_SIMD
+	if (SIMD::CPUSupportsAVX2()) {
+		SchlickGGX_G_AVX2(alpha, batch, G);
+		return;
+	}
+#endif
+	MicrofacetDistribution::G_Batch(batch, G);
+}
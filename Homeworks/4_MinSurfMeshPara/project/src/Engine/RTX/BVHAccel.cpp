@@ -1,6 +1,9 @@
 #include <Engine/Viewer/BVHAccel.h>
 
 #include "BVHNode.h"
+#include "LBVH.h"
+#include "SBVH.h"
+#include "BVHCache.h"
 
 #include <Engine/Primitive/Sphere.h>
 #include <Engine/Primitive/Plane.h>
@@ -13,12 +16,206 @@
 #include <Engine/Scene/SObj.h>
 
 #include <Basic/Timer.h>
+#include <Basic/Parallel.h>
+#include <Basic/Math.h>
+#include <Basic/SIMD.h>
 
 #include <UDP/Visitor/Visitor.h>
 
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
 using namespace std;
 using namespace Ubpa;
 
+namespace Ubpa {
+	// FNV-1a over 8 byte words with a shift to feed the high bits back, then the tail bytes
+	static size_t HashBytes(size_t hash, const void * data, size_t size) {
+		const auto bytes = static_cast<const unsigned char *>(data);
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+			uint64_t word;
+			memcpy(&word, bytes + i, sizeof(uint64_t));
+			hash ^= word;
+			hash *= 1099511628211ull;
+			hash ^= hash >> 29;
+		}
+		for (; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static const char * BuilderName(BVHAccel::Builder builder) {
+		switch (builder) {
+		case BVHAccel::Builder::LBVH:
+			return "LBVH";
+		case BVHAccel::Builder::SBVH:
+			return "SBVH";
+		default:
+			return "SAH";
+		}
+	}
+
+	// below this many items the refit runs on the calling thread
+	static constexpr size_t parallelRefitThreshold = 1 << 12;
+
+	// the subtree of a node in depth first order is nodes[nodeIdx, end)
+	struct SubtreeRange {
+		int begin;
+		int end;
+	};
+
+	// subtrees at depth levels below nodeIdx, leaves above that depth are subtrees too
+	static void CollectSubtrees(const vector<BVHAccel::LinearBVHNode> & nodes, int nodeIdx, int end, int levels, vector<SubtreeRange> & subtrees) {
+		const auto & node = nodes[nodeIdx];
+		if (levels == 0 || node.IsLeaf()) {
+			subtrees.push_back({ nodeIdx, end });
+			return;
+		}
+
+		const int secondChildIdx = node.GetSecondChildIdx();
+		CollectSubtrees(nodes, BVHAccel::LinearBVHNode::FirstChildIdx(nodeIdx), secondChildIdx, levels - 1, subtrees);
+		CollectSubtrees(nodes, secondChildIdx, end, levels - 1, subtrees);
+	}
+
+	// children come after their parent, so a backward sweep sees them first
+	// returns the SAH cost sum of the range, not normalized
+	static double RefitRange(vector<BVHAccel::LinearBVHNode> & nodes, const vector<bboxf3> & primBoxes, int begin, int end) {
+		double costSum = 0.;
+		for (int i = end - 1; i >= begin; i--) {
+			auto & node = nodes[i];
+			bboxf3 box;
+			if (node.IsLeaf()) {
+				const int shapesEnd = node.GetShapesOffset() + node.GetShapesNum();
+				for (int j = node.GetShapesOffset(); j < shapesEnd; j++)
+					box.combine_with(primBoxes[j]);
+				costSum += node.GetShapesNum() * box.area();
+			}
+			else {
+				box = nodes[BVHAccel::LinearBVHNode::FirstChildIdx(i)].GetBox();
+				box.combine_with(nodes[node.GetSecondChildIdx()].GetBox());
+				costSum += BVHNode::t_trav * box.area();
+			}
+			node.SetBox(box);
+		}
+		return costSum;
+	}
+
+	// QuantizedBVHNode are placed in units, the root or the two children of an interior node
+	// a unit is named by the parent of its nodes, -1 for the root
+	class QuantizedLayout {
+	public:
+		QuantizedLayout(const vector<BVHAccel::LinearBVHNode> & nodes) : nodes(nodes), heights(nodes.size()) {
+			// children come after their parent
+			for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+				const auto & node = nodes[i];
+				heights[i] = node.IsLeaf() ? 1 : 1 + std::max(heights[BVHAccel::LinearBVHNode::FirstChildIdx(i)], heights[node.GetSecondChildIdx()]);
+			}
+		}
+
+	public:
+		// returns the number of nodes
+		int UnitNodes(int unit, int unitNodes[2]) const {
+			if (unit == -1) {
+				unitNodes[0] = 0;
+				return 1;
+			}
+
+			unitNodes[0] = BVHAccel::LinearBVHNode::FirstChildIdx(unit);
+			unitNodes[1] = nodes[unit].GetSecondChildIdx();
+			return 2;
+		}
+
+		int UnitHeight(int unit) const {
+			int unitNodes[2];
+			const int num = UnitNodes(unit, unitNodes);
+			return num == 1 ? heights[unitNodes[0]] : std::max(heights[unitNodes[0]], heights[unitNodes[1]]);
+		}
+
+		void AppendDepthFirst(int unit, vector<int> & units) const {
+			units.push_back(unit);
+			int unitNodes[2];
+			const int num = UnitNodes(unit, unitNodes);
+			for (int i = 0; i < num; i++) {
+				if (!nodes[unitNodes[i]].IsLeaf())
+					AppendDepthFirst(unitNodes[i], units);
+			}
+		}
+
+		// the top half of the levels first, then every subtree below it, both recursively
+		void AppendVanEmdeBoas(int unit, int levels, vector<int> & units) const {
+			if (levels == 1) {
+				units.push_back(unit);
+				return;
+			}
+
+			const int topLevels = levels / 2;
+			AppendVanEmdeBoas(unit, topLevels, units);
+
+			vector<int> bottomUnits;
+			CollectUnits(unit, topLevels, bottomUnits);
+			for (auto bottomUnit : bottomUnits)
+				AppendVanEmdeBoas(bottomUnit, levels - topLevels, units);
+		}
+
+	private:
+		// units depth levels below unit
+		void CollectUnits(int unit, int depth, vector<int> & units) const {
+			if (depth == 0) {
+				units.push_back(unit);
+				return;
+			}
+
+			int unitNodes[2];
+			const int num = UnitNodes(unit, unitNodes);
+			for (int i = 0; i < num; i++) {
+				if (!nodes[unitNodes[i]].IsLeaf())
+					CollectUnits(unitNodes[i], depth - 1, units);
+			}
+		}
+
+	private:
+		const vector<BVHAccel::LinearBVHNode> & nodes;
+		vector<int> heights; // of the subtrees
+	};
+
+	// SAH cost of linear nodes with up to date boxes, normalized like BVHNode::SAHCost
+	static double SAHCost(const vector<BVHAccel::LinearBVHNode> & nodes) {
+		double costSum = 0.;
+		size_t primNum = 0;
+		for (const auto & node : nodes) {
+			if (node.IsLeaf()) {
+				costSum += node.GetShapesNum() * node.GetBox().area();
+				primNum += node.GetShapesNum();
+			}
+			else
+				costSum += BVHNode::t_trav * node.GetBox().area();
+		}
+
+		const double area = nodes[0].GetBox().area();
+		return area == 0. ? static_cast<double>(primNum) : costSum / area;
+	}
+
+	// the nodes above the subtrees of CollectSubtrees, whose boxes are refitted already
+	static double RefitUpperLevels(vector<BVHAccel::LinearBVHNode> & nodes, int nodeIdx, int levels) {
+		auto & node = nodes[nodeIdx];
+		if (levels == 0 || node.IsLeaf())
+			return 0.;
+
+		const int firstChildIdx = BVHAccel::LinearBVHNode::FirstChildIdx(nodeIdx);
+		const int secondChildIdx = node.GetSecondChildIdx();
+		const double costSum = RefitUpperLevels(nodes, firstChildIdx, levels - 1) + RefitUpperLevels(nodes, secondChildIdx, levels - 1);
+
+		bboxf3 box = nodes[firstChildIdx].GetBox();
+		box.combine_with(nodes[secondChildIdx].GetBox());
+		node.SetBox(box);
+		return costSum + BVHNode::t_trav * box.area();
+	}
+}
+
 // ------------ BVHInitVisitor ------------
 
 class BVHAccel::BVHInitVisitor final : public SharedPtrVisitor<BVHAccel::BVHInitVisitor, Primitive>, public HeapObj{
@@ -28,7 +225,8 @@ public:
 	}
 
 public:
-	unordered_map<Ptr<Shape>, bboxf3> shape2wbbox;
+	// world space box of holder->shapes[i]
+	vector<bboxf3> shapeWBoxes;
 
 public:
 	static const Ptr<BVHInitVisitor> New(BVHAccel * holder) {
@@ -45,8 +243,12 @@ public:
 		if (!primitive)
 			return;
 
-		const auto w2l = geo->GetSObj()->GetLocalToWorldMatrix().inverse();
+		const auto l2w = geo->GetSObj()->GetLocalToWorldMatrix();
+		const auto w2l = l2w.inverse();
 		holder->worldToLocalMatrixes[primitive] = w2l;
+		holder->primitiveW2LMats.push_back(w2l);
+		holder->primitiveL2WMats.push_back(l2w);
+		holder->primitives.push_back(primitive);
 
 		holder->primitive2sobj[geo->primitive] = geo->GetSObj();
 		Visit(geo->primitive);
@@ -55,34 +257,72 @@ public:
 protected:
 	void ImplVisit(Ptr<Sphere> sphere) {
 		const auto l2w = holder->GetShapeW2LMat(sphere).inverse();
-		holder->shapes.push_back(sphere);
-		shape2wbbox[sphere] = l2w * sphere->GetBBox();
+		AddShape(sphere);
+		shapeWBoxes.push_back(l2w * sphere->GetBBox());
 	}
 
 	void ImplVisit(Ptr<Plane> plane) {
 		const auto l2w = holder->GetShapeW2LMat(plane).inverse();
-		holder->shapes.push_back(plane);
-		shape2wbbox[plane] = l2w * plane->GetBBox();
+		AddShape(plane);
+		shapeWBoxes.push_back(l2w * plane->GetBBox());
 	}
 
 	void ImplVisit(Ptr<TriMesh> mesh) {
 		const auto l2w = holder->GetShapeW2LMat(mesh).inverse();
-		for (auto triangle : mesh->GetTriangles()) {
-			holder->shapes.push_back(triangle);
-			shape2wbbox[triangle] = l2w * triangle->GetBBox();
+		const auto & positions = mesh->GetPositions();
+		const auto & triangles = mesh->GetTriangles();
+		if (triangles.empty())
+			return;
+
+		const int meshIdx = static_cast<int>(holder->meshes.size());
+		holder->meshes.push_back(mesh);
+		holder->meshTriangleNums.push_back(triangles.size());
+
+		if (holder->twoLevel) {
+			// one instance of the cached bottom level tree
+			// the root box follows the positions, the box of the mesh is not updated by TriMesh::Update
+			const auto meshBVH = holder->GetOrBuildMeshBVH(mesh);
+			AddShape(mesh, { meshIdx, -1 }, WorldTriangle(), meshBVH);
+			shapeWBoxes.push_back(l2w * meshBVH->nodes[0].GetBox());
+			return;
+		}
+
+		for (size_t i = 0; i < triangles.size(); i++) {
+			const auto & triangle = triangles[i];
+			const pointf3 p0 = l2w * positions[triangle->idx[0]];
+			const pointf3 p1 = l2w * positions[triangle->idx[1]];
+			const pointf3 p2 = l2w * positions[triangle->idx[2]];
+			AddShape(triangle, { meshIdx, static_cast<int>(i) }, { p0, vecf3(p1 - p0), vecf3(p2 - p0) });
+
+			// box of the transformed vertices is tighter than the transformed local box
+			bboxf3 wbox;
+			wbox.combine_with(p0);
+			wbox.combine_with(p1);
+			wbox.combine_with(p2);
+			shapeWBoxes.push_back(wbox);
 		}
 	}
 
 	void ImplVisit(Ptr<Disk> disk) {
 		const auto l2w = holder->GetShapeW2LMat(disk).inverse();
-		holder->shapes.push_back(disk);
-		shape2wbbox[disk] = l2w * disk->GetBBox();
+		AddShape(disk);
+		shapeWBoxes.push_back(l2w * disk->GetBBox());
 	}
 
 	void ImplVisit(Ptr<Capsule> capsule) {
 		const auto l2w = holder->GetShapeW2LMat(capsule).inverse();
-		holder->shapes.push_back(capsule);
-		shape2wbbox[capsule] = l2w * capsule->GetBBox();
+		AddShape(capsule);
+		shapeWBoxes.push_back(l2w * capsule->GetBBox());
+	}
+
+private:
+	// the shape belongs to the last visited primitive
+	void AddShape(Ptr<Shape> shape, const PrimRef & primRef = { -1, -1 }, const WorldTriangle & worldTriangle = WorldTriangle(), Ptr<MeshBVH> meshBVH = nullptr) {
+		holder->shapes.push_back(shape);
+		holder->shapePrimitiveIdx.push_back(static_cast<int>(holder->primitiveW2LMats.size()) - 1);
+		holder->primRefs.push_back(primRef);
+		holder->worldTriangles.push_back(worldTriangle);
+		holder->shapeMeshBVHs.push_back(meshBVH);
 	}
 
 private:
@@ -107,35 +347,702 @@ void BVHAccel::Clear() {
 	worldToLocalMatrixes.clear();
 	primitive2sobj.clear();
 	shapes.clear();
+	shapePrimitiveIdx.clear();
+	primitiveW2LMats.clear();
+	primitiveL2WMats.clear();
+	primitives.clear();
+	worldTriangles.clear();
+	primRefs.clear();
+	meshes.clear();
+	meshTriangleNums.clear();
+	shapeMeshBVHs.clear();
+	referenceShapes.clear();
+	uniqueShapeNum = 0;
+	meshBVHBuildNum = 0;
+	meshBVHLoadNum = 0;
+	treeLoaded = false;
 	linearBVHNodes.clear();
+	bvh4Nodes.clear();
+	bvh8Nodes.clear();
+	quantizedBVHNodes.clear();
+	activeWidth = Width::BVH2;
+	activeQuantized = false;
+	depth = 0;
+	sceneHash = 0;
+	buildTime = 0.;
+	refitTime = 0.;
+	sahCost = 0.;
+	buildSAHCost = 0.;
 }
 
 void BVHAccel::Init(Ptr<SObj> root) {
 	Clear();
+	settingsKey = SettingsKey();
+
+	printf("Building BVH...\n");
+	Timer timer;
+	timer.Start();
 
 	auto geos = root->GetComponentsInChildren<CmptGeometry>();
 	auto initVisitor = BVHInitVisitor::New(this);
 	for (auto geo : geos)
 		initVisitor->Visit(geo);
 
-	printf("Building BVH...\n");
+	// drop the cached trees of meshes not in the scene
+	const unordered_set<Ptr<TriMesh>> sceneMeshes(meshes.cbegin(), meshes.cend());
+	for (auto iter = meshBVHCache.begin(); iter != meshBVHCache.end();) {
+		if (sceneMeshes.find(iter->first) == sceneMeshes.cend())
+			iter = meshBVHCache.erase(iter);
+		else
+			++iter;
+	}
+
+	if (shapes.empty())
+		return;
+
+	activeWidth = width;
+#ifndef UBPA_SIMD
+	if (activeWidth != Width::BVH2) {
+		printf("WARNING::BVHAccel::Init:\n"
+			"\t""no SIMD support, use BVH2\n");
+		activeWidth = Width::BVH2;
+	}
+#endif
+	if (activeWidth == Width::BVH8 && !SIMD::CPUSupportsAVX()) {
+		printf("WARNING::BVHAccel::Init:\n"
+			"\t""cpu lacks AVX, use BVH2\n");
+		activeWidth = Width::BVH2;
+	}
+	activeQuantized = quantized && activeWidth == Width::BVH2;
+	if (quantized && !activeQuantized) {
+		printf("WARNING::BVHAccel::Init:\n"
+			"\t""quantized nodes are only for BVH2, use the wide nodes\n");
+	}
+
+	const size_t inputHash = TreeInputHash(initVisitor->shapeWBoxes);
+	sceneHash = SceneHash();
+
+	const size_t treeKey = cacheDir.empty() ? 0 : CacheKey(inputHash, false);
+	treeLoaded = !cacheDir.empty() && LoadTree(treeKey);
+	if (!treeLoaded) {
+		BuildTree(initVisitor->shapeWBoxes);
+		if (!cacheDir.empty())
+			BVHCache::Save(BVHCache::FilePath(cacheDir, treeKey), treeKey, linearBVHNodes, referenceShapes, worldTriangles, depth, buildSAHCost);
+	}
+	timer.Stop();
+
+	buildTime = timer.GetWholeTime();
+	printf("BVH build done, cost %f s, %zu shapes, %zu nodes, SAH cost %f, %s builder\n",
+		buildTime, uniqueShapeNum, linearBVHNodes.size(), sahCost, BuilderName(builder));
+	if (treeLoaded)
+		printf("\tloaded from the cache\n");
+	if (referenceShapes.size() != uniqueShapeNum)
+		printf("\t%zu references after spatial splits\n", referenceShapes.size());
+	if (twoLevel) {
+		printf("\ttwo-level, %zu mesh instances, %zu mesh BVHs built, %zu loaded from the cache, %zu reused\n",
+			meshes.size(), meshBVHBuildNum, meshBVHLoadNum, meshes.size() - meshBVHBuildNum - meshBVHLoadNum);
+	}
+	else
+		printf("\t%zu bytes per triangle for intersection\n", sizeof(WorldTriangle) + sizeof(PrimRef));
+	if (activeWidth == Width::BVH4)
+		printf("\tcollapsed into %zu BVH4 nodes\n", bvh4Nodes.size());
+	else if (activeWidth == Width::BVH8)
+		printf("\tcollapsed into %zu BVH8 nodes\n", bvh8Nodes.size());
+	else if (activeQuantized)
+		printf("\tquantized nodes in %s order\n", clusteredLayout ? "van Emde Boas" : "depth first");
+	printf("\t%zu bytes of nodes\n", GetNodeBytes());
+}
+
+void BVHAccel::BuildTree(const vector<bboxf3> & boxes) {
+	// a rebuild after spatial splits starts from one entry per shape, its first reference
+	vector<bboxf3> uniqueBoxes;
+	if (referenceShapes.size() != uniqueShapeNum) {
+		vector<int> firstReferences(uniqueShapeNum, -1);
+		for (size_t i = 0; i < referenceShapes.size(); i++) {
+			if (firstReferences[referenceShapes[i]] == -1)
+				firstReferences[referenceShapes[i]] = static_cast<int>(i);
+		}
+
+		auto toUnique = [&firstReferences](auto & arr) {
+			remove_reference_t<decltype(arr)> unique(firstReferences.size());
+			for (size_t i = 0; i < firstReferences.size(); i++)
+				unique[i] = arr[firstReferences[i]];
+			arr.swap(unique);
+		};
+		uniqueBoxes = boxes;
+		toUnique(uniqueBoxes);
+		toUnique(shapes);
+		toUnique(shapePrimitiveIdx);
+		toUnique(worldTriangles);
+		toUnique(primRefs);
+		toUnique(shapeMeshBVHs);
+	}
+	const auto & shapeBoxes = uniqueBoxes.empty() ? boxes : uniqueBoxes;
+
+	// flat triangles are clipped exactly, other shapes by their boxes
+	auto splitShape = [&](int idx, int axis, float pos, bboxf3 & leftBox, bboxf3 & rightBox) {
+		if (primRefs[idx].faceIdx == -1) {
+			leftBox = shapeBoxes[idx];
+			rightBox = shapeBoxes[idx];
+			return;
+		}
+
+		const auto & triangle = worldTriangles[idx];
+		SBVH::SplitTriangle(triangle.p0, triangle.p0 + triangle.e1, triangle.p0 + triangle.e2, axis, pos, leftBox, rightBox);
+	};
+
+	vector<int> primIdx;
+	sahCost = BuildLinearBVH(shapeBoxes, splitShape, primIdx, linearBVHNodes, depth);
+	buildSAHCost = sahCost;
+
+	vector<WorldTriangle> orderedTriangles(primIdx.size());
+	for (size_t i = 0; i < primIdx.size(); i++)
+		orderedTriangles[i] = worldTriangles[primIdx[i]];
+	worldTriangles.swap(orderedTriangles);
+	ApplyLeafOrder(primIdx);
+
+	BuildTraversalNodes();
+}
+
+bool BVHAccel::LoadTree(size_t key) {
+	vector<int> primIdx;
+	vector<WorldTriangle> triangles;
+	if (!BVHCache::Load(BVHCache::FilePath(cacheDir, key), key, shapes.size(), linearBVHNodes, primIdx, triangles, depth, sahCost))
+		return false;
+
+	buildSAHCost = sahCost;
+	worldTriangles.swap(triangles);
+	ApplyLeafOrder(primIdx);
+
+	BuildTraversalNodes();
+	return true;
+}
+
+void BVHAccel::ApplyLeafOrder(vector<int> & primIdx) {
+	// per shape arrays in leaf order, with a copy per reference
+	auto toLeafOrder = [&primIdx](auto & arr) {
+		remove_reference_t<decltype(arr)> ordered(primIdx.size());
+		for (size_t i = 0; i < primIdx.size(); i++)
+			ordered[i] = arr[primIdx[i]];
+		arr.swap(ordered);
+	};
+	uniqueShapeNum = shapes.size();
+	toLeafOrder(shapes);
+	toLeafOrder(shapePrimitiveIdx);
+	toLeafOrder(primRefs);
+	toLeafOrder(shapeMeshBVHs);
+	referenceShapes.swap(primIdx);
+}
+
+double BVHAccel::BuildLinearBVH(const vector<bboxf3> & boxes, const function<void(int, int, float, bboxf3 &, bboxf3 &)> & splitPrim,
+	vector<int> & primIdx, vector<LinearBVHNode> & nodes, int & depth) const
+{
+	if (builder == Builder::SBVH) {
+		SBVH::Build(boxes, splitPrim, spatialSplitBudget, primIdx, nodes, depth);
+		return SAHCost(nodes);
+	}
+
+	vector<pointf3> centroids(boxes.size());
+	primIdx.resize(boxes.size());
+	for (size_t i = 0; i < boxes.size(); i++) {
+		centroids[i] = boxes[i].center();
+		primIdx[i] = static_cast<int>(i);
+	}
+
+	nodes.clear();
+	depth = 0;
+	if (builder == Builder::LBVH) {
+		LBVH::Build({ boxes, centroids, primIdx }, treeletPasses, nodes, depth);
+		return SAHCost(nodes);
+	}
+
+	const auto bvhRoot = BVHNode::New({ boxes, centroids, primIdx }, 0, boxes.size());
+	nodes.reserve(bvhRoot->NodeNum());
+	LinearizeBVH(bvhRoot, nodes, depth);
+	return bvhRoot->SAHCost();
+}
+
+void BVHAccel::BuildTraversalNodes() {
+	bvh4Nodes.clear();
+	bvh8Nodes.clear();
+	quantizedBVHNodes.clear();
+	if (activeWidth == Width::BVH4) {
+		bvh4Nodes.emplace_back();
+		CollapseBVH(bvh4Nodes, 0, 0);
+	}
+	else if (activeWidth == Width::BVH8) {
+		bvh8Nodes.emplace_back();
+		CollapseBVH(bvh8Nodes, 0, 0);
+	}
+	else if (activeQuantized)
+		QuantizeBVH();
+}
+
+void BVHAccel::QuantizeBVH() {
+	static_assert(sizeof(QuantizedBVHNode) == 12, "QuantizedBVHNode should be 12 bytes");
+
+	// 1. order of the units
+
+	const QuantizedLayout layout(linearBVHNodes);
+	vector<int> units;
+	if (clusteredLayout)
+		layout.AppendVanEmdeBoas(-1, layout.UnitHeight(-1), units);
+	else
+		layout.AppendDepthFirst(-1, units);
+
+	vector<int> quantizedIdx(linearBVHNodes.size());
+	int nextIdx = 0;
+	for (auto unit : units) {
+		int unitNodes[2];
+		const int num = layout.UnitNodes(unit, unitNodes);
+		for (int i = 0; i < num; i++)
+			quantizedIdx[unitNodes[i]] = nextIdx++;
+	}
+
+	// 2. quantize top-down, a box is relative to the dequantized box of its parent as the traversal sees it
+
+	quantizedBVHNodes.resize(linearBVHNodes.size());
+	vector<pair<int, bboxf3>> stack{ { 0, GetQuantizedRootBox() } };
+	while (!stack.empty()) {
+		const int nodeIdx = stack.back().first;
+		const bboxf3 parentBox = stack.back().second;
+		stack.pop_back();
+
+		const auto & node = linearBVHNodes[nodeIdx];
+		auto & quantizedNode = quantizedBVHNodes[quantizedIdx[nodeIdx]];
+		quantizedNode.Quantize(node.GetBox(), parentBox);
+		if (node.IsLeaf()) {
+			quantizedNode.InitLeaf(node.GetShapesOffset(), node.GetShapesNum());
+			continue;
+		}
+
+		const int firstChildIdx = LinearBVHNode::FirstChildIdx(nodeIdx);
+		const int secondChildIdx = node.GetSecondChildIdx();
+		assert(quantizedIdx[secondChildIdx] == quantizedIdx[firstChildIdx] + 1);
+		quantizedNode.InitBranch(quantizedIdx[firstChildIdx]);
+
+		const bboxf3 box = quantizedNode.Dequantize(parentBox, QuantizedBVHNode::DequantizeScale(parentBox));
+		stack.emplace_back(firstChildIdx, box);
+		stack.emplace_back(secondChildIdx, box);
+	}
+}
+
+void BVHAccel::QuantizedBVHNode::Quantize(const bboxf3 & box, const bboxf3 & parentBox) {
+	const auto scale = DequantizeScale(parentBox);
+	for (int dim = 0; dim < 3; dim++) {
+		if (scale[dim] <= 0.f) {
+			qMin[dim] = 0;
+			qMax[dim] = 255;
+			continue;
+		}
+
+		// round outwards
+		const float lower = std::floor((box.minP()[dim] - parentBox.minP()[dim]) / scale[dim]);
+		const float upper = 255.f - std::floor((parentBox.maxP()[dim] - box.maxP()[dim]) / scale[dim]);
+		qMin[dim] = static_cast<uint8_t>(Math::Clamp(lower, 0.f, 255.f));
+		qMax[dim] = static_cast<uint8_t>(Math::Clamp(upper, 0.f, 255.f));
+	}
+
+	// then fix the rounding errors of the float math with the exact code of the traversal, so the box is conservative
+	for (int dim = 0; dim < 3; dim++) {
+		while (qMin[dim] > 0 && Dequantize(parentBox, scale).minP()[dim] > box.minP()[dim])
+			qMin[dim]--;
+		while (qMax[dim] < 255 && Dequantize(parentBox, scale).maxP()[dim] < box.maxP()[dim])
+			qMax[dim]++;
+	}
+}
+
+size_t BVHAccel::GetNodeBytes() const {
+	switch (activeWidth) {
+	case Width::BVH4:
+		return bvh4Nodes.size() * sizeof(WideBVHNode<4>);
+	case Width::BVH8:
+		return bvh8Nodes.size() * sizeof(WideBVHNode<8>);
+	default:
+		return activeQuantized ? quantizedBVHNodes.size() * sizeof(QuantizedBVHNode) : linearBVHNodes.size() * sizeof(LinearBVHNode);
+	}
+}
+
+bool BVHAccel::Refit() {
+	if (shapes.empty())
+		return true;
+
 	Timer timer;
 	timer.Start();
-	const auto bvhRoot = BVHNode::New(initVisitor->shape2wbbox, shapes, 0, shapes.size());
-	LinearizeBVH(bvhRoot);
+
+	for (size_t i = 0; i < meshes.size(); i++) {
+		if (meshes[i]->GetTriangles().size() != meshTriangleNums[i]) {
+			printf("WARNING::BVHAccel::Refit:\n"
+				"\t""triangles of a mesh changed, call Init\n");
+			return false;
+		}
+	}
+
+	if (twoLevel) {
+		// the cache holds exactly the meshes of the scene, a mesh shared by instances is refitted once
+		for (auto & target : meshBVHCache) {
+			const auto & mesh = target.first;
+			auto & meshBVH = *target.second;
+			const auto & positions = mesh->GetPositions();
+			const auto & indice = mesh->GetIndice();
+
+			vector<bboxf3> triangleBoxes(meshBVH.triangles.size());
+			Parallel::Instance().RunChunks([&](size_t begin, size_t end, size_t) {
+				for (size_t i = begin; i < end; i++) {
+					const auto vertexIdx = &indice[3 * meshBVH.faceIdx[i]];
+					const auto & p0 = positions[vertexIdx[0]];
+					const auto & p1 = positions[vertexIdx[1]];
+					const auto & p2 = positions[vertexIdx[2]];
+					meshBVH.triangles[i] = { p0, vecf3(p1 - p0), vecf3(p2 - p0) };
+					triangleBoxes[i].combine_with(p0);
+					triangleBoxes[i].combine_with(p1);
+					triangleBoxes[i].combine_with(p2);
+				}
+			}, meshBVH.triangles.size(), 0, parallelRefitThreshold);
+
+			const double meshSAHCost = RefitBVH(meshBVH.nodes, triangleBoxes);
+			if (meshSAHCost > maxSAHGrowth * meshBVH.buildSAHCost)
+				BuildMeshBVH(mesh, meshBVH);
+			// the tree fits the current positions, so the next Init keeps it while they don't move
+			meshBVH.geometryHash = GeometryHash(mesh);
+		}
+	}
+
+	// flat triangles follow the positions, the other shapes follow their bottom level tree or keep their box
+	vector<bboxf3> boxes(shapes.size());
+	Parallel::Instance().RunChunks([&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			const auto & primRef = primRefs[i];
+			if (primRef.faceIdx == -1) {
+				boxes[i] = ShapeWBox(static_cast<int>(i));
+				continue;
+			}
+
+			// face i of a mesh is indice[3i, 3i + 3), cheaper than reaching the Triangle
+			const auto & l2w = primitiveL2WMats[shapePrimitiveIdx[i]];
+			const auto & mesh = meshes[primRef.meshIdx];
+			const auto & positions = mesh->GetPositions();
+			const auto vertexIdx = &mesh->GetIndice()[3 * primRef.faceIdx];
+			const pointf3 p0 = l2w * positions[vertexIdx[0]];
+			const pointf3 p1 = l2w * positions[vertexIdx[1]];
+			const pointf3 p2 = l2w * positions[vertexIdx[2]];
+			worldTriangles[i] = { p0, vecf3(p1 - p0), vecf3(p2 - p0) };
+			boxes[i].combine_with(p0);
+			boxes[i].combine_with(p1);
+			boxes[i].combine_with(p2);
+		}
+	}, shapes.size(), 0, parallelRefitThreshold);
+
+	sahCost = RefitBVH(linearBVHNodes, boxes);
+	if (sahCost > maxSAHGrowth * buildSAHCost) {
+		// the tree degraded too far, the boxes are up to date, so just rebuild over them
+		BuildTree(boxes);
+	}
+	else
+		BuildTraversalNodes();
+	sceneHash = SceneHash();
+
 	timer.Stop();
-	printf("BVH build done, cost %f s\n", timer.GetWholeTime());
+	refitTime = timer.GetWholeTime();
+	return true;
+}
+
+bool BVHAccel::IsRefittable(Ptr<SObj> root) const {
+	if (shapes.empty() || settingsKey != SettingsKey())
+		return false;
+
+	// the primitives are visited in the order of Init
+	size_t primitiveIdx = 0;
+	for (auto geo : root->GetComponentsInChildren<CmptGeometry>()) {
+		if (!geo->primitive)
+			continue;
+		if (primitiveIdx == primitives.size() || geo->primitive != primitives[primitiveIdx])
+			return false;
+
+		// bit equal, any change of a transform moves the world space boxes
+		const auto l2w = geo->GetSObj()->GetLocalToWorldMatrix();
+		if (memcmp(&l2w, &primitiveL2WMats[primitiveIdx], sizeof(transformf)) != 0)
+			return false;
+		primitiveIdx++;
+	}
+	if (primitiveIdx != primitives.size())
+		return false;
+
+	for (size_t i = 0; i < meshes.size(); i++) {
+		if (meshes[i]->GetTriangles().size() != meshTriangleNums[i])
+			return false;
+	}
+	return true;
+}
+
+const bboxf3 BVHAccel::ShapeWBox(int idx) const {
+	assert(!IsTriangle(idx));
+	if (const auto meshBVH = GetMeshBVH(idx))
+		return GetShapeL2WMat(idx) * meshBVH->nodes[0].GetBox();
+	else
+		return GetShapeL2WMat(idx) * shapes[idx]->GetBBox();
+}
+
+double BVHAccel::RefitBVH(vector<LinearBVHNode> & nodes, const vector<bboxf3> & primBoxes) {
+	double costSum;
+	if (nodes.size() < parallelRefitThreshold)
+		costSum = RefitRange(nodes, primBoxes, 0, static_cast<int>(nodes.size()));
+	else {
+		// enough subtrees to balance the cores, the levels above are refitted after them
+		int levels = 2;
+		while ((static_cast<size_t>(1) << levels) < 4 * Parallel::Instance().CoreNum())
+			levels++;
+
+		vector<SubtreeRange> subtrees;
+		CollectSubtrees(nodes, 0, static_cast<int>(nodes.size()), levels, subtrees);
+		vector<double> subtreeCostSums(subtrees.size());
+		Parallel::Instance().Run([&](size_t i) {
+			subtreeCostSums[i] = RefitRange(nodes, primBoxes, subtrees[i].begin, subtrees[i].end);
+		}, subtrees.size());
+
+		costSum = RefitUpperLevels(nodes, 0, levels);
+		for (auto subtreeCostSum : subtreeCostSums)
+			costSum += subtreeCostSum;
+	}
+
+	const double area = nodes[0].GetBox().area();
+	return area == 0. ? static_cast<double>(primBoxes.size()) : costSum / area;
 }
 
-void BVHAccel::LinearizeBVH(Ptr<BVHNode> bvhNode) {
-	linearBVHNodes.push_back(LinearBVHNode());
-	const auto curNodeIdx = linearBVHNodes.size() - 1;
+void BVHAccel::LinearizeBVH(Ptr<BVHNode> bvhNode, vector<LinearBVHNode>& nodes, int& depth, int nodeDepth) {
+	nodes.push_back(LinearBVHNode());
+	const auto curNodeIdx = nodes.size() - 1;
+	depth = std::max(depth, nodeDepth);
 
 	if (!bvhNode->IsLeaf()) {
-		LinearizeBVH(bvhNode->GetL());
-		linearBVHNodes[curNodeIdx].InitBranch(bvhNode->GetBBox(), static_cast<int>(linearBVHNodes.size()), bvhNode->GetAxis());
-		LinearizeBVH(bvhNode->GetR());
+		LinearizeBVH(bvhNode->GetL(), nodes, depth, nodeDepth + 1);
+		nodes[curNodeIdx].InitBranch(bvhNode->GetBBox(), static_cast<int>(nodes.size()), bvhNode->GetAxis());
+		LinearizeBVH(bvhNode->GetR(), nodes, depth, nodeDepth + 1);
 	}
 	else
-		linearBVHNodes[curNodeIdx].InitLeaf(bvhNode->GetBBox(), static_cast<int>(bvhNode->GetShapeOffset()), static_cast<int>(bvhNode->GetShapesNum()));
+		nodes[curNodeIdx].InitLeaf(bvhNode->GetBBox(), static_cast<int>(bvhNode->GetShapeOffset()), static_cast<int>(bvhNode->GetShapesNum()));
+}
+
+size_t BVHAccel::GeometryHash(const Ptr<TriMesh>& mesh) {
+	const auto & positions = mesh->GetPositions();
+	const auto & indice = mesh->GetIndice();
+	size_t hash = 14695981039346656037ull;
+	hash = HashBytes(hash, positions.data(), positions.size() * sizeof(pointf3));
+	hash = HashBytes(hash, indice.data(), indice.size() * sizeof(unsigned));
+	return hash;
+}
+
+size_t BVHAccel::SceneHash() const {
+	size_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < primitives.size(); i++) {
+		hash = HashBytes(hash, &primitiveL2WMats[i], sizeof(transformf));
+		if (const auto mesh = CastTo<TriMesh>(primitives[i])) {
+			const size_t geometryHash = GeometryHash(mesh);
+			hash = HashBytes(hash, &geometryHash, sizeof(size_t));
+		}
+		else {
+			const auto box = primitives[i]->GetBBox();
+			hash = HashBytes(hash, &box, sizeof(bboxf3));
+		}
+	}
+	return hash;
+}
+
+size_t BVHAccel::SettingsKey() const {
+	size_t key = CacheKey(0, false);
+	auto combine = [&key](const auto & value) {
+		key = HashBytes(key, &value, sizeof(value));
+	};
+	combine(static_cast<int>(width));
+	combine(quantized);
+	combine(clusteredLayout);
+	return key;
+}
+
+size_t BVHAccel::TreeInputHash(const vector<bboxf3>& boxes) const {
+	// the triangles are hashed too, they are loaded with the tree and boxes don't tell them apart
+	size_t hash = 14695981039346656037ull;
+	hash = HashBytes(hash, boxes.data(), boxes.size() * sizeof(bboxf3));
+	for (size_t i = 0; i < worldTriangles.size(); i++) {
+		if (primRefs[i].faceIdx != -1)
+			hash = HashBytes(hash, &worldTriangles[i], sizeof(WorldTriangle));
+	}
+	return hash;
+}
+
+size_t BVHAccel::CacheKey(size_t inputHash, bool meshTree) const {
+	size_t key = inputHash;
+	auto combine = [&key](const auto & value) {
+		key = HashBytes(key, &value, sizeof(value));
+	};
+	combine(meshTree);
+	combine(twoLevel);
+	combine(static_cast<int>(builder));
+	combine(builder == Builder::LBVH ? treeletPasses : 0);
+	combine(builder == Builder::SBVH ? spatialSplitBudget : 0.f);
+	return key;
+}
+
+const Ptr<BVHAccel::MeshBVH> BVHAccel::GetOrBuildMeshBVH(const Ptr<TriMesh>& mesh) {
+	const size_t geometryHash = GeometryHash(mesh);
+	auto target = meshBVHCache.find(mesh);
+	if (target != meshBVHCache.end() && target->second->geometryHash == geometryHash)
+		return target->second;
+
+	auto meshBVH = make_shared<MeshBVH>();
+	meshBVH->geometryHash = geometryHash;
+
+	const size_t cacheKey = cacheDir.empty() ? 0 : CacheKey(geometryHash, true);
+	const string cachePath = cacheDir.empty() ? string() : BVHCache::FilePath(cacheDir, cacheKey);
+	if (!cacheDir.empty() && BVHCache::Load(cachePath, cacheKey, mesh->GetTriangles().size(),
+		meshBVH->nodes, meshBVH->faceIdx, meshBVH->triangles, meshBVH->depth, meshBVH->buildSAHCost))
+	{
+		meshBVHLoadNum++;
+	}
+	else {
+		BuildMeshBVH(mesh, *meshBVH);
+		meshBVHBuildNum++;
+		if (!cacheDir.empty())
+			BVHCache::Save(cachePath, cacheKey, meshBVH->nodes, meshBVH->faceIdx, meshBVH->triangles, meshBVH->depth, meshBVH->buildSAHCost);
+	}
+
+	meshBVHCache[mesh] = meshBVH;
+	return meshBVH;
+}
+
+void BVHAccel::BuildMeshBVH(const Ptr<TriMesh>& mesh, MeshBVH& meshBVH) const {
+	const auto & positions = mesh->GetPositions();
+	const auto & triangles = mesh->GetTriangles();
+
+	vector<bboxf3> boxes(triangles.size());
+	for (size_t i = 0; i < triangles.size(); i++) {
+		for (auto idx : triangles[i]->idx)
+			boxes[i].combine_with(positions[idx]);
+	}
+
+	auto splitTriangle = [&](int idx, int axis, float pos, bboxf3 & leftBox, bboxf3 & rightBox) {
+		const auto & vertexIdx = triangles[idx]->idx;
+		SBVH::SplitTriangle(positions[vertexIdx[0]], positions[vertexIdx[1]], positions[vertexIdx[2]], axis, pos, leftBox, rightBox);
+	};
+
+	vector<int> primIdx;
+	meshBVH.buildSAHCost = BuildLinearBVH(boxes, splitTriangle, primIdx, meshBVH.nodes, meshBVH.depth);
+
+	meshBVH.triangles.clear();
+	meshBVH.triangles.reserve(triangles.size());
+	meshBVH.faceIdx = primIdx;
+	for (auto faceIdx : primIdx) {
+		const auto & triangle = triangles[faceIdx];
+		const auto & p0 = positions[triangle->idx[0]];
+		const auto & p1 = positions[triangle->idx[1]];
+		const auto & p2 = positions[triangle->idx[2]];
+		meshBVH.triangles.push_back({ p0, vecf3(p1 - p0), vecf3(p2 - p0) });
+	}
+}
+
+template<int N>
+void BVHAccel::CollapseBVH(vector<WideBVHNode<N>>& wideNodes, int wideIdx, int nodeIdx) {
+	int children[N];
+	int childNum = 0;
+	const auto & node = linearBVHNodes[nodeIdx];
+	if (node.IsLeaf())
+		children[childNum++] = nodeIdx;
+	else {
+		children[childNum++] = LinearBVHNode::FirstChildIdx(nodeIdx);
+		children[childNum++] = node.GetSecondChildIdx();
+
+		// open the interior child with the largest surface area until N children
+		while (childNum < N) {
+			int bestChild = -1;
+			float bestArea = -1.f;
+			for (int i = 0; i < childNum; i++) {
+				const auto & child = linearBVHNodes[children[i]];
+				if (child.IsLeaf())
+					continue;
+
+				const float area = child.GetBox().area();
+				if (area > bestArea) {
+					bestArea = area;
+					bestChild = i;
+				}
+			}
+			if (bestChild == -1)
+				break;
+
+			const int openedIdx = children[bestChild];
+			children[bestChild] = LinearBVHNode::FirstChildIdx(openedIdx);
+			children[childNum++] = linearBVHNodes[openedIdx].GetSecondChildIdx();
+		}
+	}
+
+	for (int i = 0; i < childNum; i++) {
+		const auto & child = linearBVHNodes[children[i]];
+		if (child.IsLeaf()) {
+			wideNodes[wideIdx].InitLeaf(i, child.GetBox(), child.GetShapesOffset(), child.GetShapesNum());
+			continue;
+		}
+
+		// wideNodes may reallocate, so only indices are kept across the recursion
+		const int childWideIdx = static_cast<int>(wideNodes.size());
+		wideNodes.emplace_back();
+		wideNodes[wideIdx].InitBranch(i, child.GetBox(), childWideIdx);
+		CollapseBVH(wideNodes, childWideIdx, children[i]);
+	}
+}
+
+int BVHAccel::IntersectChildren(const WideBVHNode<4>& node, const pointf3& origin, const valf3& invDir, const bool dirIsNeg[3], float tMin, float tMax, float tNears[4]) {
+#ifdef UBPA_SIMD
+	__m128 t0 = _mm_set1_ps(tMin);
+	__m128 t1 = _mm_set1_ps(tMax);
+	for (int dim = 0; dim < 3; dim++) {
+		const __m128 o = _mm_set1_ps(origin[dim]);
+		const __m128 inv = _mm_set1_ps(invDir[dim]);
+		const int nearRow = dirIsNeg[dim] ? 3 + dim : dim;
+		const int farRow = dirIsNeg[dim] ? dim : 3 + dim;
+		// NaN (0 * inf) keeps the old t0, t1, which is the second operand
+		t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearRow]), o), inv), t0);
+		t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[farRow]), o), inv), t1);
+	}
+	_mm_storeu_ps(tNears, t0);
+	return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+	int mask = 0;
+	for (int i = 0; i < 4; i++) {
+		float t0 = tMin;
+		float t1 = tMax;
+		for (int dim = 0; dim < 3; dim++) {
+			const float tNear = (node.bounds[dirIsNeg[dim] ? 3 + dim : dim][i] - origin[dim]) * invDir[dim];
+			const float tFar = (node.bounds[dirIsNeg[dim] ? dim : 3 + dim][i] - origin[dim]) * invDir[dim];
+			t0 = tNear > t0 ? tNear : t0;
+			t1 = tFar < t1 ? tFar : t1;
+		}
+		tNears[i] = t0;
+		mask |= (t0 <= t1) << i;
+	}
+	return mask;
+#endif
+}
+
+#ifdef UBPA_SIMD
+UBPA_TARGET_AVX
+int BVHAccel::IntersectChildren(const WideBVHNode<8>& node, const pointf3& origin, const valf3& invDir, const bool dirIsNeg[3], float tMin, float tMax, float tNears[8]) {
+	// only called when Init found AVX
+	__m256 t0 = _mm256_set1_ps(tMin);
+	__m256 t1 = _mm256_set1_ps(tMax);
+	for (int dim = 0; dim < 3; dim++) {
+		const __m256 o = _mm256_set1_ps(origin[dim]);
+		const __m256 inv = _mm256_set1_ps(invDir[dim]);
+		const int nearRow = dirIsNeg[dim] ? 3 + dim : dim;
+		const int farRow = dirIsNeg[dim] ? dim : 3 + dim;
+		t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[nearRow]), o), inv), t0);
+		t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[farRow]), o), inv), t1);
+	}
+	_mm256_storeu_ps(tNears, t0);
+	return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#else
+int BVHAccel::IntersectChildren(const WideBVHNode<8>& node, const pointf3& origin, const valf3& invDir, const bool dirIsNeg[3], float tMin, float tMax, float tNears[8]) {
+	assert(false && "BVH8 needs AVX");
+	return 0;
 }
+#endif
@@ -0,0 +1,182 @@
+#include "BVHCache.h"
+#include "MappedBuffer.h"
+
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <type_traits>
+#include <algorithm>
+
+using namespace Ubpa;
+
+using namespace std;
+
+namespace Ubpa {
+	struct BVHCacheHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t nodeBytes; // sizeof(LinearBVHNode), guards against layout changes
+		uint32_t triangleBytes; // sizeof(WorldTriangle)
+		int32_t depth;
+		uint64_t key;
+		uint64_t nodeNum;
+		uint64_t primNum; // entries of primIdx, spatial splits may repeat primitives
+		uint64_t triangleNum;
+		double sahCost;
+	};
+
+	static constexpr char bvhCacheMagic[8] = { 'U', 'B', 'P', 'A', 'B', 'V', 'H', '\0' };
+
+	static_assert(is_trivially_copyable<BVHAccel::LinearBVHNode>::value, "LinearBVHNode is stored as raw bytes");
+	static_assert(is_trivially_copyable<BVHAccel::WorldTriangle>::value, "WorldTriangle is stored as raw bytes");
+
+	// copy count items at offset, the file is checked to hold them
+	// copied rather than served from the mapping, Refit rewrites the nodes and the triangles in place
+	template<typename T>
+	static void CopyArray(const MappedBuffer& file, size_t& offset, size_t count, vector<T>& arr) {
+		arr.resize(count);
+		if (count > 0)
+			memcpy(static_cast<void *>(arr.data()), file.GetData() + offset, count * sizeof(T));
+		offset += count * sizeof(T);
+	}
+
+	template<typename T>
+	static void WriteArray(ofstream& out, const vector<T>& arr) {
+		out.write(reinterpret_cast<const char *>(arr.data()), static_cast<streamsize>(arr.size() * sizeof(T)));
+	}
+}
+
+const string BVHCache::FilePath(const string& dir, uint64_t key) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(key));
+	return (filesystem::path(dir) / name).string();
+}
+
+bool BVHCache::Load(const string& path, uint64_t key, size_t primNum,
+	vector<BVHAccel::LinearBVHNode>& nodes, vector<int>& primIdx,
+	vector<BVHAccel::WorldTriangle>& triangles, int& depth, double& sahCost)
+{
+	const MappedBuffer file(path, 0, true);
+	if (!file.IsValid() || file.GetSize() < sizeof(BVHCacheHeader))
+		return false;
+
+	BVHCacheHeader header;
+	memcpy(&header, file.GetData(), sizeof(BVHCacheHeader));
+	if (memcmp(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic)) != 0
+		|| header.version != version
+		|| header.nodeBytes != sizeof(BVHAccel::LinearBVHNode)
+		|| header.triangleBytes != sizeof(BVHAccel::WorldTriangle)
+		|| header.key != key)
+	{
+		return false;
+	}
+
+	const uint64_t bytes = sizeof(BVHCacheHeader)
+		+ header.nodeNum * sizeof(BVHAccel::LinearBVHNode)
+		+ header.primNum * sizeof(int)
+		+ header.triangleNum * sizeof(BVHAccel::WorldTriangle);
+	if (bytes != file.GetSize() || header.nodeNum == 0 || header.primNum < primNum || header.triangleNum != header.primNum) {
+		printf("WARNING::BVHCache::Load:\n"
+			"\t""%s is broken\n", path.c_str());
+		return false;
+	}
+
+	size_t offset = sizeof(BVHCacheHeader);
+	CopyArray(file, offset, static_cast<size_t>(header.nodeNum), nodes);
+	CopyArray(file, offset, static_cast<size_t>(header.primNum), primIdx);
+	CopyArray(file, offset, static_cast<size_t>(header.triangleNum), triangles);
+
+	// a file of a colliding key must not send the traversal out of the arrays or beyond its stack
+	// every node has one parent before it, so the depths are known in one pass
+	bool consistent = true;
+	for (auto idx : primIdx)
+		consistent &= idx >= 0 && static_cast<size_t>(idx) < primNum;
+	vector<int> nodeDepths(nodes.size(), 0);
+	nodeDepths[0] = 1;
+	int maxDepth = 0;
+	for (size_t i = 0; i < nodes.size() && consistent; i++) {
+		const auto & node = nodes[i];
+		consistent = nodeDepths[i] != 0;
+		maxDepth = std::max(maxDepth, nodeDepths[i]);
+		if (node.IsLeaf()) {
+			consistent &= node.GetShapesOffset() >= 0 && static_cast<size_t>(node.GetShapesOffset()) + node.GetShapesNum() <= primIdx.size();
+			continue;
+		}
+
+		const size_t children[2] = { i + 1, static_cast<size_t>(node.GetSecondChildIdx()) };
+		for (auto child : children) {
+			if (child <= i || child >= nodes.size() || nodeDepths[child] != 0) {
+				consistent = false;
+				break;
+			}
+			nodeDepths[child] = nodeDepths[i] + 1;
+		}
+	}
+	if (!consistent || maxDepth != header.depth) {
+		printf("WARNING::BVHCache::Load:\n"
+			"\t""%s does not match the scene\n", path.c_str());
+		nodes.clear();
+		primIdx.clear();
+		triangles.clear();
+		return false;
+	}
+
+	depth = header.depth;
+	sahCost = header.sahCost;
+	return true;
+}
+
+bool BVHCache::Save(const string& path, uint64_t key,
+	const vector<BVHAccel::LinearBVHNode>& nodes, const vector<int>& primIdx,
+	const vector<BVHAccel::WorldTriangle>& triangles, int depth, double sahCost)
+{
+	error_code ec;
+	const filesystem::path filePath(path);
+	if (filePath.has_parent_path())
+		filesystem::create_directories(filePath.parent_path(), ec);
+
+	const string tmpPath = path + ".tmp";
+	{
+		ofstream out(tmpPath, ios::binary | ios::trunc);
+		if (!out) {
+			printf("WARNING::BVHCache::Save:\n"
+				"\t""can't write %s\n", tmpPath.c_str());
+			return false;
+		}
+
+		BVHCacheHeader header;
+		memset(&header, 0, sizeof(BVHCacheHeader));
+		memcpy(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic));
+		header.version = version;
+		header.nodeBytes = sizeof(BVHAccel::LinearBVHNode);
+		header.triangleBytes = sizeof(BVHAccel::WorldTriangle);
+		header.depth = depth;
+		header.key = key;
+		header.nodeNum = nodes.size();
+		header.primNum = primIdx.size();
+		header.triangleNum = triangles.size();
+		header.sahCost = sahCost;
+
+		out.write(reinterpret_cast<const char *>(&header), sizeof(BVHCacheHeader));
+		WriteArray(out, nodes);
+		WriteArray(out, primIdx);
+		WriteArray(out, triangles);
+		if (!out) {
+			printf("WARNING::BVHCache::Save:\n"
+				"\t""can't write %s\n", tmpPath.c_str());
+			out.close();
+			filesystem::remove(tmpPath, ec);
+			return false;
+		}
+	}
+
+	filesystem::rename(tmpPath, filePath, ec);
+	if (ec) {
+		printf("WARNING::BVHCache::Save:\n"
+			"\t""can't write %s\n", path.c_str());
+		filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	return true;
+}
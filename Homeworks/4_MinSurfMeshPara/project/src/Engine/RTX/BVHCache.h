@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Engine/Viewer/BVHAccel.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Ubpa {
+	// binary file of a built tree: the nodes, the leaf order of the primitives and the triangles in leaf order
+	// a file is named and checked by the key of the build input, files of another version, layout or key are ignored
+	// the files are raw memory images, only valid on machines of the same endianness
+	class BVHCache {
+	public:
+		static const std::string FilePath(const std::string& dir, uint64_t key);
+
+		// memory maps the file and copies the arrays out
+		// returns false if the file is missing, stale or inconsistent with primNum primitives
+		static bool Load(const std::string& path, uint64_t key, size_t primNum,
+			std::vector<BVHAccel::LinearBVHNode>& nodes, std::vector<int>& primIdx,
+			std::vector<BVHAccel::WorldTriangle>& triangles, int& depth, double& sahCost);
+
+		// written to a temporary file first, so a reader never sees a partial file
+		static bool Save(const std::string& path, uint64_t key,
+			const std::vector<BVHAccel::LinearBVHNode>& nodes, const std::vector<int>& primIdx,
+			const std::vector<BVHAccel::WorldTriangle>& triangles, int depth, double sahCost);
+
+	public:
+		// bump on any change of the file layout or of the builders
+		static constexpr uint32_t version = 1;
+	};
+}
@@ -1,123 +1,224 @@
 #include "BVHNode.h"
 
-#include <Engine/Viewer/BVHAccel.h>
 #include <Basic/Math.h>
+#include <Basic/Parallel.h>
+
+#include <thread>
+#include <algorithm>
 
 using namespace Ubpa;
 
 using namespace std;
 
-void BVHNode::Build(const unordered_map<Ptr<Shape>, bboxf3> & shape2wbbox, vector<Ptr<Shape>> & shapes) {
-	// Build bvh form shapesOffset to shapesOffset + shapesNum
-
-	constexpr int bucketNum = 12;
-	constexpr int maxLeafSize = 4;
-	constexpr double t_trav = 0.125;
-
-	bboxf3 extentBox;
-	for (size_t i = shapesOffset; i < shapesOffset + shapesNum; i++) {
-		auto target = shape2wbbox.find(shapes[i]);
-		assert(target != shape2wbbox.cend());
-		const auto worldBox = target->second;
-
-		extentBox.combine_with(worldBox.center());
-		box.combine_with(worldBox);
+namespace Ubpa {
+	// nodes with at least this many primitives bin / build children on several threads
+	static constexpr size_t parallelBinThreshold = 1 << 16;
+	static constexpr size_t parallelBuildThreshold = 1 << 12;
+
+	// top levels of the tree are built as parallel tasks, enough to keep every core busy
+	static int ParallelBuildDepth() {
+		static const int depth = []() {
+			int d = 0;
+			while ((static_cast<size_t>(1) << d) < Parallel::Instance().CoreNum())
+				d++;
+			return d + 1;
+		}();
+		return depth;
 	}
 
-	if (shapesNum <= maxLeafSize) {
-		l = nullptr;
-		r = nullptr;
-		return;
+	static int BucketID(float centroid, float minP, float extent) {
+		const int bucketID = static_cast<int>(BVHNode::bucketNum * ((centroid - minP) / extent));
+		return Math::Clamp(bucketID, 0, BVHNode::bucketNum - 1);
 	}
+}
 
-	// get best partition
-	vector<Ptr<Shape>> bestPartition[2];
-	double minCost = DBL_MAX;
-	for (int dim = 0; dim < 3; dim++) {
+void BVHNode::ComputeBounds(const BuildData& data, size_t begin, size_t end, bboxf3& box, bboxf3& centroidBox) {
+	auto computeRange = [&data](size_t rangeBegin, size_t rangeEnd, bboxf3& rangeBox, bboxf3& rangeCentroidBox) {
+		for (size_t i = rangeBegin; i < rangeEnd; i++) {
+			const int id = data.primIdx[i];
+			rangeBox.combine_with(data.boxes[id]);
+			rangeCentroidBox.combine_with(data.centroids[id]);
+		}
+	};
 
-		// 1. compute buckets
+	if (end - begin < parallelBinThreshold) {
+		computeRange(begin, end, box, centroidBox);
+		return;
+	}
 
-		vector<vector<Ptr<Shape>>> buckets(bucketNum);
-		vector<bboxf3> boxesOfBuckets(bucketNum);
-		{//  shape ŵ bucket Уÿ bucket  box
-			double bucketLen = extentBox.diagonal()[dim] / bucketNum;
-			if (bucketLen == 0)
-				continue;
+	vector<bboxf3> boxes(Parallel::Instance().CoreNum());
+	vector<bboxf3> centroidBoxes(Parallel::Instance().CoreNum());
+	const size_t chunkNum = Parallel::Instance().RunChunks([&](size_t chunkBegin, size_t chunkEnd, size_t chunkID) {
+		computeRange(begin + chunkBegin, begin + chunkEnd, boxes[chunkID], centroidBoxes[chunkID]);
+	}, end - begin);
+	for (size_t i = 0; i < chunkNum; i++) {
+		box.combine_with(boxes[i]);
+		centroidBox.combine_with(centroidBoxes[i]);
+	}
+}
 
-			double left = extentBox.minP()[dim];
-			for (size_t i = shapesOffset; i < shapesOffset + shapesNum; i++) {
-				auto target = shape2wbbox.find(shapes[i]);
-				assert(target != shape2wbbox.cend());
-				const auto & worldBox = target->second;
+void BVHNode::FillBuckets(const BuildData& data, size_t begin, size_t end, const bboxf3& centroidBox, Buckets& buckets) {
+	const auto& minP = centroidBox.minP();
+	const auto extent = centroidBox.diagonal();
+	auto fillRange = [&](size_t rangeBegin, size_t rangeEnd, Buckets& rangeBuckets) {
+		for (size_t i = rangeBegin; i < rangeEnd; i++) {
+			const int id = data.primIdx[i];
+			const auto& primBox = data.boxes[id];
+			const auto& centroid = data.centroids[id];
+			for (int dim = 0; dim < 3; dim++) {
+				if (extent[dim] <= 0.f)
+					continue;
+
+				auto& bucket = rangeBuckets[dim][BucketID(centroid[dim], minP[dim], extent[dim])];
+				bucket.box.combine_with(primBox);
+				bucket.centroidBox.combine_with(centroid);
+				bucket.num++;
+			}
+		}
+	};
 
-				double center = worldBox.center()[dim];
-				int bucketID = Math::Clamp(static_cast<int>((center - left) / bucketLen), 0, bucketNum - 1);
+	if (end - begin < parallelBinThreshold) {
+		fillRange(begin, end, buckets);
+		return;
+	}
 
-				buckets[bucketID].push_back(shapes[i]);
-				boxesOfBuckets[bucketID].combine_with(worldBox);
+	vector<Buckets> chunkBuckets(Parallel::Instance().CoreNum());
+	const size_t chunkNum = Parallel::Instance().RunChunks([&](size_t chunkBegin, size_t chunkEnd, size_t chunkID) {
+		fillRange(begin + chunkBegin, begin + chunkEnd, chunkBuckets[chunkID]);
+	}, end - begin);
+	for (size_t i = 0; i < chunkNum; i++) {
+		for (int dim = 0; dim < 3; dim++) {
+			for (int b = 0; b < bucketNum; b++) {
+				auto& bucket = buckets[dim][b];
+				const auto& chunkBucket = chunkBuckets[i][dim][b];
+				bucket.box.combine_with(chunkBucket.box);
+				bucket.centroidBox.combine_with(chunkBucket.centroidBox);
+				bucket.num += chunkBucket.num;
 			}
 		}
+	}
+}
 
-		// 2. accumulate buckets
+void BVHNode::Build(const BuildData& data, const bboxf3& centroidBox, int depth) {
+	// Build bvh form shapesOffset to shapesOffset + shapesNum
+	// box and centroidBox of this node are known here
 
-		vector<bboxf3> leftBox(bucketNum);
-		vector<size_t> leftAccNum(bucketNum);
-		vector<bboxf3> rightBox(bucketNum);
-		vector<size_t> rightAccNum(bucketNum);
-		leftAccNum[0] = 0;
-		rightAccNum[0] = 0;
-		for (int i = 1; i <= bucketNum - 1; i++) {
-			leftBox[i] = leftBox[i - 1].combine(boxesOfBuckets[i - 1]);
-			leftAccNum[i] = leftAccNum[i - 1] + buckets[i - 1].size();
+	if (shapesNum <= maxLeafSize)
+		return;
 
-			rightBox[i] = rightBox[i - 1].combine(boxesOfBuckets[bucketNum - i]);
-			rightAccNum[i] = rightAccNum[i - 1] + buckets[bucketNum - i].size();
-		}
+	const size_t begin = shapesOffset;
+	const size_t end = shapesOffset + shapesNum;
 
-		// 3. get best partition of dim
-		int bestLeftBucketsNum = 0;
-		double minCostOfDim = DBL_MAX;
-		for (int leftNum = 1; leftNum <= bucketNum - 1; leftNum++) {
-			int rightNum = bucketNum - leftNum;
+	// 1. fill buckets of all axes in one pass
 
-			double leftS = leftBox[leftNum].area();
-			double rightS = rightBox[rightNum].area();
+	Buckets buckets;
+	FillBuckets(data, begin, end, centroidBox, buckets);
 
-			double curCost = t_trav + leftS * leftAccNum[leftNum] + rightS * rightAccNum[rightNum];
+	// 2. get best partition, sweep the buckets from both sides
 
-			if (curCost < minCostOfDim) {
-				bestLeftBucketsNum = leftNum;
-				minCostOfDim = curCost;
-			}
+	const auto extent = centroidBox.diagonal();
+	double minCost = DBL_MAX;
+	int bestSplit = -1;
+	for (int dim = 0; dim < 3; dim++) {
+		if (extent[dim] <= 0.f)
+			continue;
+
+		double rightArea[bucketNum];
+		size_t rightNum[bucketNum];
+		bboxf3 rightBox;
+		size_t rightAccNum = 0;
+		for (int i = bucketNum - 1; i > 0; i--) {
+			rightBox.combine_with(buckets[dim][i].box);
+			rightAccNum += buckets[dim][i].num;
+			rightArea[i] = rightAccNum > 0 ? rightBox.area() : 0.;
+			rightNum[i] = rightAccNum;
 		}
 
-		// 4. set best partition
-		if (minCostOfDim < minCost) {
-			bestPartition[0].clear();
-			bestPartition[1].clear();
+		bboxf3 leftBox;
+		size_t leftAccNum = 0;
+		for (int split = 1; split < bucketNum; split++) {
+			leftBox.combine_with(buckets[dim][split - 1].box);
+			leftAccNum += buckets[dim][split - 1].num;
+			if (leftAccNum == 0 || rightNum[split] == 0)
+				continue;
 
-			minCost = minCostOfDim;
-			axis = dim;
-			for (int i = 0; i < bestLeftBucketsNum; i++) {
-				for (auto primitive : buckets[i])
-					bestPartition[0].push_back(primitive);
+			const double curCost = t_trav + leftBox.area() * leftAccNum + rightArea[split] * rightNum[split];
+			if (curCost < minCost) {
+				minCost = curCost;
+				bestSplit = split;
+				axis = dim;
 			}
-			for (int i = bestLeftBucketsNum; i < bucketNum; i++) {
-				for (auto primitive : buckets[i])
-					bestPartition[1].push_back(primitive);
+		}
+	}
+
+	// 3. partition primIdx in place, bounds of children come from the buckets
+
+	auto first = data.primIdx.begin() + begin;
+	auto last = data.primIdx.begin() + end;
+	size_t leftNum;
+	bboxf3 leftBox, leftCentroidBox, rightBox, rightCentroidBox;
+	if (bestSplit != -1) {
+		const float minP = centroidBox.minP()[axis];
+		const float extentOfAxis = extent[axis];
+		const int splitAxis = axis;
+		const int split = bestSplit;
+		const auto mid = std::partition(first, last, [&](int id) {
+			return BucketID(data.centroids[id][splitAxis], minP, extentOfAxis) < split;
+		});
+		leftNum = static_cast<size_t>(mid - first);
+
+		for (int i = 0; i < bucketNum; i++) {
+			const auto& bucket = buckets[axis][i];
+			if (i < bestSplit) {
+				leftBox.combine_with(bucket.box);
+				leftCentroidBox.combine_with(bucket.centroidBox);
+			}
+			else {
+				rightBox.combine_with(bucket.box);
+				rightCentroidBox.combine_with(bucket.centroidBox);
 			}
 		}
 	}
+	else {
+		// all centroids coincide, split into halves to keep leaves small
+		const auto diagonal = box.diagonal();
+		axis = diagonal[0] > diagonal[1] ? (diagonal[0] > diagonal[2] ? 0 : 2) : (diagonal[1] > diagonal[2] ? 1 : 2);
+		leftNum = shapesNum / 2;
+		ComputeBounds(data, begin, begin + leftNum, leftBox, leftCentroidBox);
+		ComputeBounds(data, begin + leftNum, end, rightBox, rightCentroidBox);
+	}
 
 	// recursion
-	if (bestPartition[0].size() == 0 || bestPartition[1].size() == 0)
-		return;
+	const size_t rightNum = shapesNum - leftNum;
+	if (depth < ParallelBuildDepth() && shapesNum >= parallelBuildThreshold) {
+		thread leftWorker([&]() { l = BVHNode::New(data, begin, leftNum, leftBox, leftCentroidBox, depth + 1); });
+		r = BVHNode::New(data, begin + leftNum, rightNum, rightBox, rightCentroidBox, depth + 1);
+		leftWorker.join();
+	}
+	else {
+		l = BVHNode::New(data, begin, leftNum, leftBox, leftCentroidBox, depth + 1);
+		r = BVHNode::New(data, begin + leftNum, rightNum, rightBox, rightCentroidBox, depth + 1);
+	}
+}
+
+size_t BVHNode::NodeNum() const {
+	if (IsLeaf())
+		return 1;
+
+	return 1 + l->NodeNum() + r->NodeNum();
+}
+
+double BVHNode::SAHCostSum() const {
+	if (IsLeaf())
+		return shapesNum * box.area();
+
+	return t_trav * box.area() + l->SAHCostSum() + r->SAHCostSum();
+}
 
-	for (size_t i = 0; i < bestPartition[0].size(); i++)
-		shapes[i + shapesOffset] = bestPartition[0][i];
-	for (size_t i = 0; i < bestPartition[1].size(); i++)
-		shapes[i + shapesOffset + bestPartition[0].size()] = bestPartition[1][i];
+double BVHNode::SAHCost() const {
+	const double area = box.area();
+	if (area == 0.)
+		return static_cast<double>(shapesNum);
 
-	l = BVHNode::New(shape2wbbox, shapes, shapesOffset, bestPartition[0].size());
-	r = BVHNode::New(shape2wbbox, shapes, shapesOffset + bestPartition[0].size(), bestPartition[1].size());
+	return SAHCostSum() / area;
 }
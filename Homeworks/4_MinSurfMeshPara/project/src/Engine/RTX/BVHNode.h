@@ -1,22 +1,44 @@
 #pragma once
 
-#include <Engine/Primitive/Shape.h>
+#include <Basic/HeapObj.h>
 #include <UGM/bbox.h>
+#include <UGM/point.h>
 
 #include <vector>
-#include <unordered_map>
+#include <array>
 
 namespace Ubpa {
 	class BVHNode final : public HeapObj {
 	public:
-		BVHNode(const std::unordered_map<Ptr<Shape>, bboxf3>& shape2wbbox, std::vector<Ptr<Shape>>& shapes, size_t shapesOffset, size_t shapesNum)
+		// boxes, centroids are indexed by primitive ID and read only
+		// primIdx is partitioned in place, every node owns primIdx[shapesOffset, shapesOffset + shapesNum)
+		struct BuildData {
+			const std::vector<bboxf3>& boxes;
+			const std::vector<pointf3>& centroids;
+			std::vector<int>& primIdx;
+		};
+
+	public:
+		BVHNode(const BuildData& data, size_t shapesOffset, size_t shapesNum)
 			: shapesOffset(shapesOffset), shapesNum(shapesNum) {
-			Build(shape2wbbox, shapes);
+			bboxf3 centroidBox;
+			ComputeBounds(data, shapesOffset, shapesOffset + shapesNum, box, centroidBox);
+			Build(data, centroidBox, 0);
+		}
+
+		// box and centroidBox are already known from the bucket sweep of the parent
+		BVHNode(const BuildData& data, size_t shapesOffset, size_t shapesNum, const bboxf3& box, const bboxf3& centroidBox, int depth)
+			: shapesOffset(shapesOffset), shapesNum(shapesNum), box(box) {
+			Build(data, centroidBox, depth);
 		}
 
 	public:
-		static const Ptr<BVHNode> New(const std::unordered_map<Ptr<Shape>, bboxf3>& shape2wbbox, std::vector<Ptr<Shape>>& shapes, size_t shapesOffset, size_t shapesNum) {
-			return Ubpa::New<BVHNode>(shape2wbbox, shapes, shapesOffset, shapesNum);
+		static const Ptr<BVHNode> New(const BuildData& data, size_t shapesOffset, size_t shapesNum) {
+			return Ubpa::New<BVHNode>(data, shapesOffset, shapesNum);
+		}
+
+		static const Ptr<BVHNode> New(const BuildData& data, size_t shapesOffset, size_t shapesNum, const bboxf3& box, const bboxf3& centroidBox, int depth) {
+			return Ubpa::New<BVHNode>(data, shapesOffset, shapesNum, box, centroidBox, depth);
 		}
 
 	private:
@@ -32,14 +54,37 @@ namespace Ubpa {
 		Ptr<BVHNode> GetL() const { return l; }
 		Ptr<BVHNode> GetR() const { return r; }
 
+		size_t NodeNum() const;
+		// SAH cost of the subtree, normalized by the surface area of this node
+		double SAHCost() const;
+
+	public:
+		static constexpr int bucketNum = 12;
+		static constexpr size_t maxLeafSize = 4;
+		static constexpr double t_trav = 0.125;
+
 	private:
-		//  shapes Ԫ˳ l, r, box  axis
-		void Build(const std::unordered_map<Ptr<Shape>, bboxf3>& shape2wbbox, std::vector<Ptr<Shape>>& shapes);
+		// partition primIdx in place, then build l, r and axis
+		void Build(const BuildData& data, const bboxf3& centroidBox, int depth);
+
+		struct Bucket {
+			bboxf3 box;
+			bboxf3 centroidBox;
+			size_t num{ 0 };
+		};
+		using Buckets = std::array<std::array<Bucket, bucketNum>, 3>;
+
+		// compute box and the box of centroids in [begin, end), parallel for large ranges
+		static void ComputeBounds(const BuildData& data, size_t begin, size_t end, bboxf3& box, bboxf3& centroidBox);
+		// fill buckets of all three axes in [begin, end), parallel for large ranges
+		static void FillBuckets(const BuildData& data, size_t begin, size_t end, const bboxf3& centroidBox, Buckets& buckets);
+
+		double SAHCostSum() const;
 
 	private:
-		bboxf3 box;
 		size_t shapesOffset;
 		size_t shapesNum;
+		bboxf3 box;
 		int axis{ -1 };
 		Ptr<BVHNode> l;
 		Ptr<BVHNode> r;
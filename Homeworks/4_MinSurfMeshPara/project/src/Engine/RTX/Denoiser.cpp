@@ -0,0 +1,329 @@
+#include "Denoiser.h"
+
+#include <Basic/Parallel.h>
+#include <Basic/SIMD.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace Ubpa;
+
+using namespace std;
+
+namespace Ubpa {
+	// B3 spline
+	static constexpr float kernel[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+	// albedos below are not divided out, they would blow up the noise
+	static constexpr float minAlbedo = 0.01f;
+
+	// keeps the weights finite where the variance or the depth gradient is 0
+	static constexpr float lumEpsilon = 1e-6f;
+	static constexpr float relativeDepthEpsilon = 1e-3f;
+
+	// planes of the pixels, so that 8 neighboring pixels are one load
+	struct DenoiseGuide {
+		vector<float> nx, ny, nz;
+		vector<float> depth; // 0 for pixels without a hit
+		vector<float> depthGradient;
+	};
+
+	struct DenoiseColor {
+		void Resize(size_t n) {
+			r.resize(n);
+			g.resize(n);
+			b.resize(n);
+			lum.resize(n);
+			variance.resize(n);
+			sigmaLum.resize(n);
+		}
+
+		vector<float> r, g, b;
+		vector<float> lum;
+		vector<float> variance;
+		vector<float> sigmaLum; // of the 3 x 3 blurred variance, see SVGF
+	};
+
+	struct DenoisePass {
+		int w;
+		int h;
+		int step;
+		float sigmaLum;
+		float sigmaDepth;
+		const DenoiseGuide * guide;
+		const DenoiseColor * src;
+		DenoiseColor * dst;
+	};
+
+	static float NormalWeight(float cosTheta) {
+		float weight = max(cosTheta, 0.f);
+		for (int i = 0; i < Denoiser::normalPowerLog2; i++)
+			weight *= weight;
+		return weight;
+	}
+
+	static void FilterPixel(const DenoisePass & pass, int x, int y) {
+		const auto & guide = *pass.guide;
+		const auto & src = *pass.src;
+		auto & dst = *pass.dst;
+		const int p = y * pass.w + x;
+
+		const float depthP = guide.depth[p];
+		if (!(depthP > 0.f)) {
+			dst.r[p] = src.r[p];
+			dst.g[p] = src.g[p];
+			dst.b[p] = src.b[p];
+			dst.variance[p] = src.variance[p];
+			return;
+		}
+
+		const float invSigmaLum = 1.f / (pass.sigmaLum * src.sigmaLum[p] + lumEpsilon);
+		float sumW = 0.f;
+		float sumR = 0.f;
+		float sumG = 0.f;
+		float sumB = 0.f;
+		float sumVariance = 0.f;
+		for (int dy = -2; dy <= 2; dy++) {
+			const int qy = y + dy * pass.step;
+			if (qy < 0 || qy >= pass.h)
+				continue;
+
+			for (int dx = -2; dx <= 2; dx++) {
+				const int qx = x + dx * pass.step;
+				if (qx < 0 || qx >= pass.w)
+					continue;
+
+				const int q = qy * pass.w + qx;
+				if (!(guide.depth[q] > 0.f))
+					continue;
+
+				const float dist = pass.step * sqrt(static_cast<float>(dx * dx + dy * dy));
+				const float invSigmaDepth = 1.f / (pass.sigmaDepth * guide.depthGradient[p] * dist + relativeDepthEpsilon * depthP);
+				const float cosTheta = guide.nx[p] * guide.nx[q] + guide.ny[p] * guide.ny[q] + guide.nz[p] * guide.nz[q];
+				const float weight = kernel[dx + 2] * kernel[dy + 2] * NormalWeight(cosTheta)
+					* exp(-(abs(src.lum[p] - src.lum[q]) * invSigmaLum + abs(depthP - guide.depth[q]) * invSigmaDepth));
+
+				sumW += weight;
+				sumR += weight * src.r[q];
+				sumG += weight * src.g[q];
+				sumB += weight * src.b[q];
+				sumVariance += weight * weight * src.variance[q];
+			}
+		}
+
+		// opposite normals of the samples of a pixel may leave it with no weight, even for itself
+		if (!(sumW > 0.f)) {
+			dst.r[p] = src.r[p];
+			dst.g[p] = src.g[p];
+			dst.b[p] = src.b[p];
+			dst.variance[p] = src.variance[p];
+			return;
+		}
+
+		const float invSumW = 1.f / sumW;
+		dst.r[p] = sumR * invSumW;
+		dst.g[p] = sumG * invSumW;
+		dst.b[p] = sumB * invSumW;
+		dst.variance[p] = sumVariance * invSumW * invSumW;
+	}
+
+#ifdef UBPA_SIMD
+	// pixels [x, x + 8) of row y, all neighbors are inside the image
+	UBPA_TARGET_AVX2 static void FilterPixels8(const DenoisePass & pass, int x, int y) {
+		const auto & guide = *pass.guide;
+		const auto & src = *pass.src;
+		auto & dst = *pass.dst;
+		const int p = y * pass.w + x;
+
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 depthP = _mm256_loadu_ps(&guide.depth[p]);
+		const __m256 hitP = _mm256_cmp_ps(depthP, zero, _CMP_GT_OQ);
+		const __m256 lumP = _mm256_loadu_ps(&src.lum[p]);
+		const __m256 nxP = _mm256_loadu_ps(&guide.nx[p]);
+		const __m256 nyP = _mm256_loadu_ps(&guide.ny[p]);
+		const __m256 nzP = _mm256_loadu_ps(&guide.nz[p]);
+		const __m256 gradientP = _mm256_mul_ps(_mm256_set1_ps(pass.sigmaDepth), _mm256_loadu_ps(&guide.depthGradient[p]));
+		const __m256 depthEpsilon = _mm256_mul_ps(_mm256_set1_ps(relativeDepthEpsilon), depthP);
+		const __m256 invSigmaLum = _mm256_div_ps(_mm256_set1_ps(1.f),
+			_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(pass.sigmaLum), _mm256_loadu_ps(&src.sigmaLum[p])), _mm256_set1_ps(lumEpsilon)));
+
+		__m256 sumW = zero;
+		__m256 sumR = zero;
+		__m256 sumG = zero;
+		__m256 sumB = zero;
+		__m256 sumVariance = zero;
+		for (int dy = -2; dy <= 2; dy++) {
+			for (int dx = -2; dx <= 2; dx++) {
+				const int q = p + (dy * pass.w + dx) * pass.step;
+
+				const float dist = pass.step * sqrt(static_cast<float>(dx * dx + dy * dy));
+				const __m256 invSigmaDepth = _mm256_div_ps(_mm256_set1_ps(1.f),
+					_mm256_add_ps(_mm256_mul_ps(gradientP, _mm256_set1_ps(dist)), depthEpsilon));
+
+				const __m256 depthQ = _mm256_loadu_ps(&guide.depth[q]);
+				const __m256 hitQ = _mm256_cmp_ps(depthQ, zero, _CMP_GT_OQ);
+
+				__m256 normalWeight = _mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(nxP, _mm256_loadu_ps(&guide.nx[q])),
+					_mm256_mul_ps(nyP, _mm256_loadu_ps(&guide.ny[q]))),
+					_mm256_mul_ps(nzP, _mm256_loadu_ps(&guide.nz[q])));
+				normalWeight = _mm256_max_ps(normalWeight, zero);
+				for (int i = 0; i < Denoiser::normalPowerLog2; i++)
+					normalWeight = _mm256_mul_ps(normalWeight, normalWeight);
+
+				const __m256 lumTerm = _mm256_mul_ps(SIMD::Abs(_mm256_sub_ps(lumP, _mm256_loadu_ps(&src.lum[q]))), invSigmaLum);
+				const __m256 depthTerm = _mm256_mul_ps(SIMD::Abs(_mm256_sub_ps(depthP, depthQ)), invSigmaDepth);
+				const __m256 e = SIMD::Exp(_mm256_sub_ps(zero, _mm256_add_ps(lumTerm, depthTerm)));
+
+				const __m256 weight = _mm256_and_ps(hitQ,
+					_mm256_mul_ps(_mm256_set1_ps(kernel[dx + 2] * kernel[dy + 2]), _mm256_mul_ps(normalWeight, e)));
+
+				sumW = _mm256_add_ps(sumW, weight);
+				sumR = _mm256_add_ps(sumR, _mm256_mul_ps(weight, _mm256_loadu_ps(&src.r[q])));
+				sumG = _mm256_add_ps(sumG, _mm256_mul_ps(weight, _mm256_loadu_ps(&src.g[q])));
+				sumB = _mm256_add_ps(sumB, _mm256_mul_ps(weight, _mm256_loadu_ps(&src.b[q])));
+				sumVariance = _mm256_add_ps(sumVariance, _mm256_mul_ps(_mm256_mul_ps(weight, weight), _mm256_loadu_ps(&src.variance[q])));
+			}
+		}
+
+		// lanes without a weight divide by 0 and keep their source, like FilterPixel
+		const __m256 valid = _mm256_and_ps(hitP, _mm256_cmp_ps(sumW, zero, _CMP_GT_OQ));
+		const __m256 invSumW = _mm256_div_ps(_mm256_set1_ps(1.f), sumW);
+		_mm256_storeu_ps(&dst.r[p], SIMD::Select(valid, _mm256_mul_ps(sumR, invSumW), _mm256_loadu_ps(&src.r[p])));
+		_mm256_storeu_ps(&dst.g[p], SIMD::Select(valid, _mm256_mul_ps(sumG, invSumW), _mm256_loadu_ps(&src.g[p])));
+		_mm256_storeu_ps(&dst.b[p], SIMD::Select(valid, _mm256_mul_ps(sumB, invSumW), _mm256_loadu_ps(&src.b[p])));
+		_mm256_storeu_ps(&dst.variance[p], SIMD::Select(valid,
+			_mm256_mul_ps(sumVariance, _mm256_mul_ps(invSumW, invSumW)), _mm256_loadu_ps(&src.variance[p])));
+	}
+#endif
+
+	static void FilterRows(const DenoisePass & pass, int y0, int y1) {
+		const int border = 2 * pass.step;
+#ifdef UBPA_SIMD
+		const bool simd = SIMD::CPUSupportsAVX2();
+#else
+		const bool simd = false;
+#endif
+		for (int y = y0; y < y1; y++) {
+			int x = 0;
+#ifdef UBPA_SIMD
+			if (simd && y >= border && y < pass.h - border) {
+				for (; x < border; x++)
+					FilterPixel(pass, x, y);
+				for (; x + 8 <= pass.w - border; x += 8)
+					FilterPixels8(pass, x, y);
+			}
+#endif
+			for (; x < pass.w; x++)
+				FilterPixel(pass, x, y);
+		}
+	}
+
+	// luminance and the standard error for the weights of the next pass
+	static void PrepareColor(DenoiseColor & color, int w, int h, int y0, int y1) {
+		for (int y = y0; y < y1; y++) {
+			for (int x = 0; x < w; x++) {
+				const int p = y * w + x;
+				color.lum[p] = rgbf(color.r[p], color.g[p], color.b[p]).illumination();
+
+				// 3 x 3 Gaussian of the variance
+				float sum = 0.f;
+				float sumW = 0.f;
+				for (int dy = -1; dy <= 1; dy++) {
+					const int qy = y + dy;
+					if (qy < 0 || qy >= h)
+						continue;
+					for (int dx = -1; dx <= 1; dx++) {
+						const int qx = x + dx;
+						if (qx < 0 || qx >= w)
+							continue;
+						const float weight = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+						sum += weight * color.variance[qy * w + qx];
+						sumW += weight;
+					}
+				}
+				color.sigmaLum[p] = sqrt(max(sum / sumW, 0.f));
+			}
+		}
+	}
+}
+
+void Denoiser::Run(int w, int h, vector<rgbf> & radiance, const vector<RayTracer::AOV> & aovs,
+	const vector<float> & variances, int threadNum) const
+{
+	const size_t n = static_cast<size_t>(w) * h;
+	if (w <= 0 || h <= 0 || radiance.size() != n || aovs.size() != n || variances.size() != n) {
+		printf("WARNING::Denoiser::Run:\n"
+			"\t""buffers don't match the size %d x %d\n", w, h);
+		return;
+	}
+
+	DenoiseGuide guide;
+	guide.nx.resize(n);
+	guide.ny.resize(n);
+	guide.nz.resize(n);
+	guide.depth.resize(n);
+	guide.depthGradient.resize(n);
+	DenoiseColor colors[2];
+	colors[0].Resize(n);
+	colors[1].Resize(n);
+	vector<rgbf> demodulation(n);
+
+	// rows are split over threadNum threads
+	const size_t rowChunkNum = static_cast<size_t>(max(threadNum, 1));
+	Parallel::Instance().RunChunks([&](size_t y0, size_t y1, size_t) {
+		for (size_t p = y0 * w; p < y1 * w; p++) {
+			const auto & aov = aovs[p];
+			guide.nx[p] = aov.normal[0];
+			guide.ny[p] = aov.normal[1];
+			guide.nz[p] = aov.normal[2];
+			guide.depth[p] = aov.depth > 0.f && isfinite(aov.depth) ? aov.depth : 0.f;
+
+			for (int c = 0; c < 3; c++)
+				demodulation[p][c] = aov.albedo[c] > minAlbedo ? aov.albedo[c] : 1.f;
+			const float demodulationLum = max(demodulation[p].illumination(), minAlbedo);
+			colors[0].r[p] = radiance[p][0] / demodulation[p][0];
+			colors[0].g[p] = radiance[p][1] / demodulation[p][1];
+			colors[0].b[p] = radiance[p][2] / demodulation[p][2];
+			colors[0].variance[p] = variances[p] / (demodulationLum * demodulationLum);
+		}
+	}, h, rowChunkNum);
+
+	// largest central difference of the depths of the hit neighbors
+	Parallel::Instance().RunChunks([&](size_t y0, size_t y1, size_t) {
+		auto depthAt = [&](int x, int y, float depth) {
+			if (x < 0 || x >= w || y < 0 || y >= h)
+				return depth;
+			const float neighbor = guide.depth[y * w + x];
+			return neighbor > 0.f ? neighbor : depth;
+		};
+		for (int y = static_cast<int>(y0); y < static_cast<int>(y1); y++) {
+			for (int x = 0; x < w; x++) {
+				const float depth = guide.depth[y * w + x];
+				const float gradientX = abs(depthAt(x + 1, y, depth) - depthAt(x - 1, y, depth));
+				const float gradientY = abs(depthAt(x, y + 1, depth) - depthAt(x, y - 1, depth));
+				guide.depthGradient[y * w + x] = 0.5f * max(gradientX, gradientY);
+			}
+		}
+	}, h, rowChunkNum);
+
+	int cur = 0;
+	for (int i = 0; i < iterationNum; i++) {
+		Parallel::Instance().RunChunks([&](size_t y0, size_t y1, size_t) {
+			PrepareColor(colors[cur], w, h, static_cast<int>(y0), static_cast<int>(y1));
+		}, h, rowChunkNum);
+
+		const DenoisePass pass{ w, h, 1 << i, sigmaLum, sigmaDepth, &guide, &colors[cur], &colors[1 - cur] };
+		Parallel::Instance().RunChunks([&](size_t y0, size_t y1, size_t) {
+			FilterRows(pass, static_cast<int>(y0), static_cast<int>(y1));
+		}, h, rowChunkNum);
+		cur = 1 - cur;
+	}
+
+	for (size_t p = 0; p < n; p++) {
+		if (!(guide.depth[p] > 0.f))
+			continue;
+		radiance[p] = rgbf(colors[cur].r[p], colors[cur].g[p], colors[cur].b[p]) * demodulation[p];
+	}
+}
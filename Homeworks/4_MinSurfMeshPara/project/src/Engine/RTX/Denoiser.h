@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Engine/Viewer/RayTracer.h>
+
+#include <UGM/rgb.h>
+
+#include <vector>
+
+namespace Ubpa {
+	// edge avoiding a-trous wavelet filter (Dammertz et al. 2010) with the weights of SVGF (Schied et al. 2017), spatial only
+	// the radiance is divided by the albedo while it is filtered, so textures stay sharp
+	// neighbors are weighted by their luminance against the standard error of the pixel, their depth and their normal
+	class Denoiser : public HeapObj {
+	public:
+		Denoiser() = default;
+
+	public:
+		static const Ptr<Denoiser> New() { return Ubpa::New<Denoiser>(); }
+
+	protected:
+		virtual ~Denoiser() = default;
+
+	public:
+		// radiance is filtered in place, variances are of the mean luminance of the pixels
+		// all arrays are row major w x h, pixels without a hit are kept
+		void Run(int w, int h, std::vector<rgbf>& radiance, const std::vector<RayTracer::AOV>& aovs,
+			const std::vector<float>& variances, int threadNum) const;
+
+	public:
+		// passes of the 5 x 5 kernel, the step doubles every pass, 5 passes cover 125 x 125 pixels
+		int iterationNum{ 5 };
+		// luminance differences are measured in standard errors
+		float sigmaLum{ 4.f };
+		// depth differences are measured in the depth gradient times the distance
+		float sigmaDepth{ 1.f };
+
+		// the normal weight is max(0, dot)^(2^normalPowerLog2)
+		static constexpr int normalPowerLog2 = 7;
+	};
+}
@@ -1,30 +1,626 @@
 #include "Film.h"
 
 #include "FilmTile.h"
+#include "MappedBuffer.h"
 
 #include <Engine/Filter/ImgFilter.h>
 #include <Basic/Image.h>
 
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
 using namespace Ubpa;
 
-Film::Film(Ptr<Image> img, Ptr<ImgFilter> filter)
+struct Film::CheckpointHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t pixelBytes; // sizeof(AtomicPixel), guards against layout changes
+	uint32_t momentsBytes; // sizeof(AtomicMoments)
+	int32_t width;
+	int32_t height;
+	int32_t tileSize;
+	int32_t tileNum;
+	int32_t loopWords; // 0 in merged files
+	int32_t loopBegin; // the samples are of loops in [loopBegin, loopEnd)
+	int32_t loopEnd;
+	uint64_t sceneHash;
+	std::atomic<long long> sampleNum;
+	int32_t journalPixelNum; // 0 in merged files
+	// the loop being merged, -1 if none, -2 while AddCheckpoint adds to the file
+	// mergeMin, mergeMax and mergeSampleNum are from before the merge of the loop
+	std::atomic<int32_t> mergeTile;
+	int32_t mergeLoop; // counted from loopBegin
+	int32_t mergeMin[2];
+	int32_t mergeMax[2];
+	long long mergeSampleNum;
+};
+
+namespace Ubpa {
+	// the sums are used in place in the mapped file
+	static_assert(std::atomic<long long>::is_always_lock_free, "atomics of a checkpoint must be plain integers");
+	static_assert(std::atomic<int>::is_always_lock_free, "atomics of a checkpoint must be plain integers");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "atomics of a checkpoint must be plain integers");
+
+	static constexpr char filmCheckpointMagic[8] = { 'U', 'B', 'P', 'A', 'F', 'I', 'L', 'M' };
+	// bump on any change of the file layout
+	static constexpr uint32_t filmCheckpointVersion = 2;
+
+	// the arrays start on cache lines
+	static size_t AlignCacheLine(size_t offset) {
+		return (offset + 63) / 64 * 64;
+	}
+
+	template<typename T>
+	static void CopySum(const std::atomic<T> & from, std::atomic<T> & to) {
+		to.store(from.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+}
+
+Film::Film(Ptr<Image> img, Ptr<ImgFilter> filter, bool hasAOV)
 	: resolution(img->GetWidth(), img->GetHeight()),
-	pixels(img->GetWidth(), std::vector<Pixel>(img->GetHeight())),
+	pixelBuffer(img->GetWidth() * img->GetHeight()),
+	momentBuffer(img->GetWidth() * img->GetHeight()),
+	aovs(hasAOV ? img->GetWidth() * img->GetHeight() : 0),
 	frame({ 0,0 }, { img->GetWidth(),img->GetHeight() }),
 	filter(filter),
 	img(img)
 {
 	assert(img != nullptr && img->IsValid());
 	assert(img->GetChannel() == 3);
+	pixels = pixelBuffer.data();
+	moments = momentBuffer.data();
 }
 
+Film::~Film() = default;
+
 const Ptr<FilmTile> Film::GenFilmTile(const bboxi2 & frame) const {
-	return FilmTile::New(frame, filter);
+	auto filmTile = FilmTile::New(this->frame, filter, HasAOV());
+	filmTile->Reset(frame);
+	return filmTile;
 }
 
 void Film::MergeFilmTile(Ptr<FilmTile> filmTile) {
-	for (const auto pos : filmTile->AllPos()) {
-		pixels[pos[0]][pos[1]] += filmTile->At(pos);
-		img->SetPixel(pos, pixels[pos[0]][pos[1]].ToRadiance());
+	const auto footprint = filmTile->GetFootprint();
+	for (int y = footprint.minP()[1]; y < footprint.maxP()[1]; y++) {
+		for (int x = footprint.minP()[0]; x < footprint.maxP()[0]; x++) {
+			const auto & tilePixel = filmTile->At({ x,y });
+			if (tilePixel.filterWeightSum == 0.f)
+				continue;
+
+			auto & pixel = pixels[y * resolution[0] + x];
+			for (int c = 0; c < 3; c++)
+				pixel.weightRadianceSum[c].fetch_add(ToFixedPoint(tilePixel.weightRadianceSum[c]), std::memory_order_relaxed);
+			pixel.filterWeightSum.fetch_add(ToFixedPoint(tilePixel.filterWeightSum), std::memory_order_relaxed);
+		}
+	}
+
+	const auto frame = filmTile->GetFrame();
+	for (int y = frame.minP()[1]; y < frame.maxP()[1]; y++) {
+		for (int x = frame.minP()[0]; x < frame.maxP()[0]; x++) {
+			const auto & tileMoments = filmTile->MomentsAt({ x,y });
+			if (tileMoments.sampleNum == 0)
+				continue;
+
+			auto & pixelMoments = moments[y * resolution[0] + x];
+			pixelMoments.sampleNum.fetch_add(tileMoments.sampleNum, std::memory_order_relaxed);
+			pixelMoments.lumSum.fetch_add(tileMoments.lumSum, std::memory_order_relaxed);
+			pixelMoments.lumSquareSum.fetch_add(tileMoments.lumSquareSum, std::memory_order_relaxed);
+			pixelMoments.costSum.fetch_add(tileMoments.costSum, std::memory_order_relaxed);
+		}
+	}
+
+	if (!HasAOV())
+		return;
+	for (int y = frame.minP()[1]; y < frame.maxP()[1]; y++) {
+		for (int x = frame.minP()[0]; x < frame.maxP()[0]; x++) {
+			const auto & tileAOV = filmTile->AOVAt({ x,y });
+			if (tileAOV.sampleNum == 0)
+				continue;
+
+			auto & aov = aovs[y * resolution[0] + x];
+			for (int c = 0; c < 3; c++) {
+				aov.albedoSum[c].fetch_add(ToFixedPoint(tileAOV.albedoSum[c]), std::memory_order_relaxed);
+				aov.normalSum[c].fetch_add(ToFixedPoint(tileAOV.normalSum[c]), std::memory_order_relaxed);
+			}
+			aov.depthSum.fetch_add(ToFixedPoint(tileAOV.depthSum), std::memory_order_relaxed);
+			aov.sampleNum.fetch_add(tileAOV.sampleNum, std::memory_order_relaxed);
+			aov.hitNum.fetch_add(tileAOV.hitNum, std::memory_order_relaxed);
+		}
+	}
+}
+
+void Film::Resolve() {
+	for (int y = 0; y < resolution[1]; y++) {
+		for (int x = 0; x < resolution[0]; x++)
+			img->SetPixel(x, y, LoadPixel(pixels[y * resolution[0] + x]).ToRadiance());
+	}
+}
+
+float Film::Error(const bboxi2 & frame) const {
+	double maxError = 0.;
+	for (int y = frame.minP()[1]; y < frame.maxP()[1]; y++) {
+		for (int x = frame.minP()[0]; x < frame.maxP()[0]; x++) {
+			const auto & pixelMoments = moments[y * resolution[0] + x];
+			const int n = pixelMoments.sampleNum.load(std::memory_order_relaxed);
+			if (n < 2)
+				return std::numeric_limits<float>::max();
+
+			const double mean = pixelMoments.lumSum.load(std::memory_order_relaxed) / momentScale / n;
+			const double squareMean = pixelMoments.lumSquareSum.load(std::memory_order_relaxed) / momentScale / n;
+			const double variance = std::max(squareMean - mean * mean, 0.) * n / (n - 1);
+			maxError = std::max(maxError, std::sqrt(variance / n) / std::max(mean, 1e-2));
+		}
+	}
+	return static_cast<float>(maxError);
+}
+
+void Film::ResolveAOV(std::vector<RayTracer::AOV> & aovs) const {
+	aovs.assign(this->aovs.size(), RayTracer::AOV());
+	for (size_t i = 0; i < aovs.size(); i++) {
+		const auto & pixelAOV = this->aovs[i];
+		const int sampleNum = pixelAOV.sampleNum.load(std::memory_order_relaxed);
+		const int hitNum = pixelAOV.hitNum.load(std::memory_order_relaxed);
+		if (hitNum == 0)
+			continue;
+
+		auto & aov = aovs[i];
+		vecf3 normal;
+		for (int c = 0; c < 3; c++) {
+			aov.albedo[c] = FromFixedPoint(pixelAOV.albedoSum[c].load(std::memory_order_relaxed)) / sampleNum;
+			normal[c] = FromFixedPoint(pixelAOV.normalSum[c].load(std::memory_order_relaxed));
+		}
+		if (normal.norm2() > 0.f)
+			aov.normal = normal.normalize().cast_to<normalf>();
+		aov.depth = FromFixedPoint(pixelAOV.depthSum.load(std::memory_order_relaxed)) / hitNum;
+	}
+}
+
+void Film::ResolveVariance(std::vector<float> & variances) const {
+	variances.resize(static_cast<size_t>(resolution[0]) * resolution[1]);
+	for (size_t i = 0; i < variances.size(); i++) {
+		const auto & pixelMoments = moments[i];
+		const int n = pixelMoments.sampleNum.load(std::memory_order_relaxed);
+		if (n == 0) {
+			variances[i] = 0.f;
+			continue;
+		}
+
+		const double mean = pixelMoments.lumSum.load(std::memory_order_relaxed) / momentScale / n;
+		if (n < 2) {
+			variances[i] = static_cast<float>(mean * mean);
+			continue;
+		}
+		const double squareMean = pixelMoments.lumSquareSum.load(std::memory_order_relaxed) / momentScale / n;
+		variances[i] = static_cast<float>(std::max(squareMean - mean * mean, 0.) / (n - 1));
+	}
+}
+
+void Film::ResolveCost(std::vector<float> & costs) const {
+	costs.resize(static_cast<size_t>(resolution[0]) * resolution[1]);
+	for (size_t i = 0; i < costs.size(); i++) {
+		const auto & pixelMoments = moments[i];
+		const int n = pixelMoments.sampleNum.load(std::memory_order_relaxed);
+		costs[i] = n > 0 ? static_cast<float>(static_cast<double>(pixelMoments.costSum.load(std::memory_order_relaxed)) / n) : 0.f;
+	}
+}
+
+size_t Film::CheckpointLayout(size_t pixelNum, int tileNum, int loopWords, size_t journalPixelNum, CheckpointOffsets & offsets) {
+	const size_t pixelsOffset = AlignCacheLine(sizeof(CheckpointHeader));
+	offsets.moments = AlignCacheLine(pixelsOffset + pixelNum * sizeof(AtomicPixel));
+	offsets.loopBits = AlignCacheLine(offsets.moments + pixelNum * sizeof(AtomicMoments));
+	offsets.journal = AlignCacheLine(offsets.loopBits + static_cast<size_t>(tileNum) * loopWords * sizeof(uint64_t));
+	// the journal pixels, then the journal moments
+	return offsets.journal + journalPixelNum * (sizeof(AtomicPixel) + sizeof(AtomicMoments));
+}
+
+Film::CheckpointHeader * Film::CheckpointHeaderOf(const MappedBuffer & file) {
+	if (!file.IsValid() || file.GetSize() < sizeof(CheckpointHeader))
+		return nullptr;
+
+	const auto header = reinterpret_cast<CheckpointHeader *>(file.GetData());
+	if (memcmp(header->magic, filmCheckpointMagic, sizeof(filmCheckpointMagic)) != 0
+		|| header->version != filmCheckpointVersion
+		|| header->pixelBytes != sizeof(AtomicPixel)
+		|| header->momentsBytes != sizeof(AtomicMoments)
+		|| header->width <= 0 || header->height <= 0 || header->tileNum < 0 || header->loopWords < 0
+		|| header->journalPixelNum < 0)
+		return nullptr;
+
+	CheckpointOffsets offsets;
+	const size_t size = CheckpointLayout(static_cast<size_t>(header->width) * header->height,
+		header->tileNum, header->loopWords, header->journalPixelNum, offsets);
+	return file.GetSize() == size ? header : nullptr;
+}
+
+void Film::CopyJournal(const bboxi2 & footprint, bool restore) {
+	const int footprintWidth = footprint.maxP()[0] - footprint.minP()[0];
+	for (int y = footprint.minP()[1]; y < footprint.maxP()[1]; y++) {
+		for (int x = footprint.minP()[0]; x < footprint.maxP()[0]; x++) {
+			const size_t i = static_cast<size_t>(y) * resolution[0] + x;
+			const size_t j = static_cast<size_t>(y - footprint.minP()[1]) * footprintWidth + x - footprint.minP()[0];
+			auto & fromPixel = restore ? journalPixels[j] : pixels[i];
+			auto & toPixel = restore ? pixels[i] : journalPixels[j];
+			for (int c = 0; c < 3; c++)
+				CopySum(fromPixel.weightRadianceSum[c], toPixel.weightRadianceSum[c]);
+			CopySum(fromPixel.filterWeightSum, toPixel.filterWeightSum);
+
+			auto & fromMoments = restore ? journalMoments[j] : moments[i];
+			auto & toMoments = restore ? moments[i] : journalMoments[j];
+			CopySum(fromMoments.sampleNum, toMoments.sampleNum);
+			CopySum(fromMoments.lumSum, toMoments.lumSum);
+			CopySum(fromMoments.lumSquareSum, toMoments.lumSquareSum);
+			CopySum(fromMoments.costSum, toMoments.costSum);
+		}
+	}
+}
+
+bool Film::MapCheckpoint(const std::string & path, const CheckpointKey & key, bool & resumed) {
+	resumed = false;
+	const size_t pixelNum = static_cast<size_t>(resolution[0]) * resolution[1];
+	// a footprint is at most tileSize + 2 * radius + 1 pixels wide, see FilmTile::Reset
+	const int journalWidth = std::min(key.tileSize + 2 * static_cast<int>(std::ceil(filter->radius[0])) + 1, resolution[0]);
+	const int journalHeight = std::min(key.tileSize + 2 * static_cast<int>(std::ceil(filter->radius[1])) + 1, resolution[1]);
+	const int journalPixelNum = journalWidth * journalHeight;
+
+	auto file = std::make_unique<MappedBuffer>(path);
+	if (file->IsValid()) {
+		const auto header = CheckpointHeaderOf(*file);
+		if (!header || header->width != resolution[0] || header->height != resolution[1]
+			|| header->sceneHash != key.sceneHash || header->tileSize != key.tileSize || header->tileNum != key.tileNum
+			|| header->loopBegin != key.firstLoop || header->loopWords * 64 < key.loopNum
+			|| header->journalPixelNum < journalPixelNum)
+		{
+			printf("ERROR::Film::MapCheckpoint:\n"
+				"\t""%s is no checkpoint of this run, remove it to start over\n", path.c_str());
+			return false;
+		}
+
+		const int mergeTile = header->mergeTile.load();
+		if (mergeTile < -1) {
+			printf("ERROR::Film::MapCheckpoint:\n"
+				"\t""%s was killed while a checkpoint was added to it, remove it to start over\n", path.c_str());
+			return false;
+		}
+		if (mergeTile >= 0 && (mergeTile >= header->tileNum || header->mergeLoop < 0 || header->mergeLoop >= header->loopWords * 64
+			|| header->mergeMin[0] < 0 || header->mergeMin[1] < 0
+			|| header->mergeMax[0] > resolution[0] || header->mergeMax[1] > resolution[1]
+			|| header->mergeMax[0] < header->mergeMin[0] || header->mergeMax[1] < header->mergeMin[1]
+			|| (header->mergeMax[0] - header->mergeMin[0]) * (header->mergeMax[1] - header->mergeMin[1]) > header->journalPixelNum))
+		{
+			printf("ERROR::Film::MapCheckpoint:\n"
+				"\t""the journal of %s is broken, remove it to start over\n", path.c_str());
+			return false;
+		}
+		resumed = true;
+	}
+	else {
+		const int keyLoopWords = (std::max(key.loopNum, 1) + 63) / 64;
+		CheckpointOffsets offsets;
+		file = std::make_unique<MappedBuffer>(path, CheckpointLayout(pixelNum, key.tileNum, keyLoopWords, journalPixelNum, offsets));
+		if (!file->IsValid()) {
+			printf("ERROR::Film::MapCheckpoint:\n"
+				"\t""create %s fail\n", path.c_str());
+			return false;
+		}
+
+		// the new file is zero filled, so are the sums
+		const auto header = reinterpret_cast<CheckpointHeader *>(file->GetData());
+		memcpy(header->magic, filmCheckpointMagic, sizeof(filmCheckpointMagic));
+		header->version = filmCheckpointVersion;
+		header->pixelBytes = sizeof(AtomicPixel);
+		header->momentsBytes = sizeof(AtomicMoments);
+		header->width = resolution[0];
+		header->height = resolution[1];
+		header->tileSize = key.tileSize;
+		header->tileNum = key.tileNum;
+		header->loopWords = keyLoopWords;
+		header->loopBegin = key.firstLoop;
+		header->loopEnd = key.firstLoop;
+		header->sceneHash = key.sceneHash;
+		header->journalPixelNum = journalPixelNum;
+		header->mergeTile.store(-1);
+	}
+
+	checkpointHeader = reinterpret_cast<CheckpointHeader *>(file->GetData());
+	checkpointHeader->loopEnd = std::max(checkpointHeader->loopEnd, key.firstLoop + key.loopNum);
+	loopWords = checkpointHeader->loopWords;
+	firstLoop = key.firstLoop;
+
+	CheckpointOffsets offsets;
+	CheckpointLayout(pixelNum, key.tileNum, loopWords, checkpointHeader->journalPixelNum, offsets);
+	pixels = reinterpret_cast<AtomicPixel *>(file->GetData() + AlignCacheLine(sizeof(CheckpointHeader)));
+	moments = reinterpret_cast<AtomicMoments *>(file->GetData() + offsets.moments);
+	loopBits = reinterpret_cast<std::atomic<uint64_t> *>(file->GetData() + offsets.loopBits);
+	journalPixels = reinterpret_cast<AtomicPixel *>(file->GetData() + offsets.journal);
+	journalMoments = reinterpret_cast<AtomicMoments *>(journalPixels + checkpointHeader->journalPixelNum);
+	checkpoint = std::move(file);
+
+	std::vector<AtomicPixel>().swap(pixelBuffer);
+	std::vector<AtomicMoments>().swap(momentBuffer);
+
+	// the last run was killed in a merge, a loop not done yet is undone, a killed restore is just done again
+	const int mergeTile = checkpointHeader->mergeTile.load();
+	if (mergeTile >= 0) {
+		if (!IsLoopDone(mergeTile, firstLoop + checkpointHeader->mergeLoop)) {
+			const bboxi2 footprint({ checkpointHeader->mergeMin[0], checkpointHeader->mergeMin[1] },
+				{ checkpointHeader->mergeMax[0], checkpointHeader->mergeMax[1] });
+			CopyJournal(footprint, true);
+			checkpointHeader->sampleNum.store(checkpointHeader->mergeSampleNum);
+			printf("WARNING::Film::MapCheckpoint:\n"
+				"\t""%s was killed in the merge of loop %d of tile %d, the loop is undone\n",
+				path.c_str(), firstLoop + checkpointHeader->mergeLoop, mergeTile);
+		}
+		checkpointHeader->mergeTile.store(-1);
+	}
+	return true;
+}
+
+bool Film::IsLoopDone(int tileIdx, int loop) const {
+	const int bit = loop - firstLoop;
+	if (loopBits == nullptr || bit < 0 || bit >= loopWords * 64)
+		return false;
+
+	const uint64_t word = loopBits[static_cast<size_t>(tileIdx) * loopWords + bit / 64].load(std::memory_order_relaxed);
+	return (word >> (bit % 64)) & 1;
+}
+
+void Film::BeginLoop(int tileIdx, int loop, Ptr<FilmTile> filmTile) {
+	const int bit = loop - firstLoop;
+	if (loopBits == nullptr || bit < 0 || bit >= loopWords * 64)
+		return;
+
+	mergeMutex.lock();
+	const auto footprint = filmTile->GetFootprint();
+	assert(footprint.area() <= checkpointHeader->journalPixelNum);
+	CopyJournal(footprint, false);
+	checkpointHeader->mergeLoop = bit;
+	for (int i = 0; i < 2; i++) {
+		checkpointHeader->mergeMin[i] = footprint.minP()[i];
+		checkpointHeader->mergeMax[i] = footprint.maxP()[i];
+	}
+	checkpointHeader->mergeSampleNum = checkpointHeader->sampleNum.load(std::memory_order_relaxed);
+	// sequentially consistent, so the journal is written before and the sums are added after
+	checkpointHeader->mergeTile.store(tileIdx);
+}
+
+void Film::SetLoopDone(int tileIdx, int loop, long long sampleNum) {
+	const int bit = loop - firstLoop;
+	if (loopBits == nullptr || bit < 0 || bit >= loopWords * 64)
+		return;
+
+	checkpointHeader->sampleNum.fetch_add(sampleNum, std::memory_order_relaxed);
+	loopBits[static_cast<size_t>(tileIdx) * loopWords + bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_release);
+	// after the done bit, a run killed in between keeps the merge
+	checkpointHeader->mergeTile.store(-1, std::memory_order_release);
+	mergeMutex.unlock();
+}
+
+long long Film::GetCheckpointSampleNum() const {
+	return checkpointHeader != nullptr ? checkpointHeader->sampleNum.load(std::memory_order_relaxed) : 0;
+}
+
+bool Film::FlushCheckpoint() {
+	return checkpoint != nullptr && checkpoint->Flush();
+}
+
+bool Film::MergeCheckpoints(const std::string & outPath, const std::vector<std::string> & inPaths) {
+	std::vector<std::unique_ptr<MappedBuffer>> files;
+	std::vector<const CheckpointHeader *> headers;
+	for (const auto & path : inPaths) {
+		if (path == outPath) {
+			printf("ERROR::Film::MergeCheckpoints:\n"
+				"\t""%s is also the output\n", path.c_str());
+			return false;
+		}
+
+		auto file = std::make_unique<MappedBuffer>(path, 0, true);
+		const auto header = CheckpointHeaderOf(*file);
+		if (!header) {
+			printf("ERROR::Film::MergeCheckpoints:\n"
+				"\t""%s is no checkpoint\n", path.c_str());
+			return false;
+		}
+		if (header->mergeTile.load() != -1) {
+			printf("ERROR::Film::MergeCheckpoints:\n"
+				"\t""%s was killed in a merge, resume it first\n", path.c_str());
+			return false;
+		}
+		if (!headers.empty() && (header->width != headers[0]->width || header->height != headers[0]->height
+			|| header->sceneHash != headers[0]->sceneHash))
+		{
+			printf("ERROR::Film::MergeCheckpoints:\n"
+				"\t""%s is of another scene or resolution than %s\n", path.c_str(), inPaths[0].c_str());
+			return false;
+		}
+		for (size_t i = 0; i < headers.size(); i++) {
+			if (header->loopBegin < headers[i]->loopEnd && headers[i]->loopBegin < header->loopEnd) {
+				printf("ERROR::Film::MergeCheckpoints:\n"
+					"\t""loops [%d, %d) of %s overlap loops [%d, %d) of %s, the runs took the same samples\n",
+					header->loopBegin, header->loopEnd, path.c_str(), headers[i]->loopBegin, headers[i]->loopEnd, inPaths[i].c_str());
+				return false;
+			}
+		}
+
+		headers.push_back(header);
+		files.push_back(std::move(file));
+	}
+	if (headers.empty())
+		return false;
+
+	const size_t pixelNum = static_cast<size_t>(headers[0]->width) * headers[0]->height;
+	CheckpointOffsets offsets;
+	MappedBuffer out(outPath, CheckpointLayout(pixelNum, headers[0]->tileNum, 0, 0, offsets));
+	if (!out.IsValid()) {
+		printf("ERROR::Film::MergeCheckpoints:\n"
+			"\t""create %s fail\n", outPath.c_str());
+		return false;
+	}
+
+	const auto outHeader = reinterpret_cast<CheckpointHeader *>(out.GetData());
+	memcpy(static_cast<void *>(outHeader), headers[0], sizeof(CheckpointHeader));
+	outHeader->loopWords = 0;
+	outHeader->journalPixelNum = 0;
+	long long sampleNum = 0;
+	for (const auto header : headers) {
+		outHeader->loopBegin = std::min(outHeader->loopBegin, header->loopBegin);
+		outHeader->loopEnd = std::max(outHeader->loopEnd, header->loopEnd);
+		sampleNum += header->sampleNum.load(std::memory_order_relaxed);
+	}
+	outHeader->sampleNum.store(sampleNum, std::memory_order_relaxed);
+
+	// the sums are fixed point, so the order of the inputs doesn't matter
+	for (const auto & file : files)
+		AddCheckpointSums(out, *file, pixelNum);
+
+	return out.Flush();
+}
+
+void Film::AddCheckpointSums(MappedBuffer & out, const MappedBuffer & in, size_t pixelNum) {
+	// the moments follow the pixels in any checkpoint
+	CheckpointOffsets offsets;
+	CheckpointLayout(pixelNum, 0, 0, 0, offsets);
+	const auto outPixels = reinterpret_cast<AtomicPixel *>(out.GetData() + AlignCacheLine(sizeof(CheckpointHeader)));
+	const auto outMoments = reinterpret_cast<AtomicMoments *>(out.GetData() + offsets.moments);
+	const auto inPixels = reinterpret_cast<const AtomicPixel *>(in.GetData() + AlignCacheLine(sizeof(CheckpointHeader)));
+	const auto inMoments = reinterpret_cast<const AtomicMoments *>(in.GetData() + offsets.moments);
+	for (size_t i = 0; i < pixelNum; i++) {
+		for (int c = 0; c < 3; c++)
+			outPixels[i].weightRadianceSum[c].fetch_add(inPixels[i].weightRadianceSum[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		outPixels[i].filterWeightSum.fetch_add(inPixels[i].filterWeightSum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+		outMoments[i].sampleNum.fetch_add(inMoments[i].sampleNum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		outMoments[i].lumSum.fetch_add(inMoments[i].lumSum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		outMoments[i].lumSquareSum.fetch_add(inMoments[i].lumSquareSum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		outMoments[i].costSum.fetch_add(inMoments[i].costSum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+}
+
+bool Film::AddCheckpoint(const std::string & outPath, const std::string & inPath, int firstLoop, int loopNum) {
+	if (inPath == outPath) {
+		printf("ERROR::Film::AddCheckpoint:\n"
+			"\t""%s is also the output\n", inPath.c_str());
+		return false;
+	}
+
+	MappedBuffer in(inPath, 0, true);
+	const auto inHeader = CheckpointHeaderOf(in);
+	if (!inHeader || inHeader->mergeTile.load() != -1) {
+		printf("ERROR::Film::AddCheckpoint:\n"
+			"\t""%s is no checkpoint or was killed in a merge\n", inPath.c_str());
+		return false;
+	}
+
+	const size_t pixelNum = static_cast<size_t>(inHeader->width) * inHeader->height;
+	auto out = std::make_unique<MappedBuffer>(outPath);
+	if (!out->IsValid()) {
+		// done loops are kept for each tile like in a run, a merged file has no journal
+		const int loopWords = (std::max(loopNum, 1) + 63) / 64;
+		CheckpointOffsets offsets;
+		out = std::make_unique<MappedBuffer>(outPath, CheckpointLayout(pixelNum, inHeader->tileNum, loopWords, 0, offsets));
+		if (!out->IsValid()) {
+			printf("ERROR::Film::AddCheckpoint:\n"
+				"\t""create %s fail\n", outPath.c_str());
+			return false;
+		}
+
+		const auto header = reinterpret_cast<CheckpointHeader *>(out->GetData());
+		memcpy(static_cast<void *>(header), inHeader, sizeof(CheckpointHeader));
+		header->loopWords = loopWords;
+		header->loopBegin = firstLoop;
+		header->loopEnd = firstLoop;
+		header->sampleNum.store(0);
+		header->journalPixelNum = 0;
+		header->mergeTile.store(-1);
+	}
+
+	const auto outHeader = CheckpointHeaderOf(*out);
+	if (!outHeader || outHeader->mergeTile.load() != -1) {
+		printf("ERROR::Film::AddCheckpoint:\n"
+			"\t""%s is no checkpoint or was killed in a merge or an add\n", outPath.c_str());
+		return false;
+	}
+	if (inHeader->width != outHeader->width || inHeader->height != outHeader->height || inHeader->sceneHash != outHeader->sceneHash
+		|| inHeader->tileSize != outHeader->tileSize || inHeader->tileNum != outHeader->tileNum
+		|| inHeader->loopBegin < outHeader->loopBegin || inHeader->loopEnd > outHeader->loopBegin + outHeader->loopWords * 64)
+	{
+		printf("ERROR::Film::AddCheckpoint:\n"
+			"\t""%s is of another scene, resolution or loops than %s\n", inPath.c_str(), outPath.c_str());
+		return false;
+	}
+
+	CheckpointOffsets inOffsets, outOffsets;
+	CheckpointLayout(pixelNum, inHeader->tileNum, inHeader->loopWords, inHeader->journalPixelNum, inOffsets);
+	CheckpointLayout(pixelNum, outHeader->tileNum, outHeader->loopWords, outHeader->journalPixelNum, outOffsets);
+	const auto inBits = reinterpret_cast<const std::atomic<uint64_t> *>(in.GetData() + inOffsets.loopBits);
+	const auto outBits = reinterpret_cast<std::atomic<uint64_t> *>(out->GetData() + outOffsets.loopBits);
+	// the loops of in are within the ones of out, a loop done in both was sampled twice
+	const int bitOffset = inHeader->loopBegin - outHeader->loopBegin;
+	const int bitNum = inHeader->loopEnd - inHeader->loopBegin;
+	for (int tileIdx = 0; tileIdx < inHeader->tileNum; tileIdx++) {
+		const auto tileInBits = inBits + static_cast<size_t>(tileIdx) * inHeader->loopWords;
+		const auto tileOutBits = outBits + static_cast<size_t>(tileIdx) * outHeader->loopWords;
+		for (int bit = 0; bit < bitNum; bit++) {
+			const int outBit = bitOffset + bit;
+			if (((tileInBits[bit / 64].load() >> (bit % 64)) & 1) && ((tileOutBits[outBit / 64].load() >> (outBit % 64)) & 1)) {
+				printf("ERROR::Film::AddCheckpoint:\n"
+					"\t""loop %d of tile %d of %s is already in %s\n", inHeader->loopBegin + bit, tileIdx, inPath.c_str(), outPath.c_str());
+				return false;
+			}
+		}
+	}
+
+	// a process killed from here on leaves out broken
+	outHeader->mergeTile.store(-2);
+	AddCheckpointSums(*out, in, pixelNum);
+	outHeader->sampleNum.fetch_add(inHeader->sampleNum.load());
+	for (int tileIdx = 0; tileIdx < inHeader->tileNum; tileIdx++) {
+		const auto tileInBits = inBits + static_cast<size_t>(tileIdx) * inHeader->loopWords;
+		const auto tileOutBits = outBits + static_cast<size_t>(tileIdx) * outHeader->loopWords;
+		for (int bit = 0; bit < bitNum; bit++) {
+			const int outBit = bitOffset + bit;
+			if ((tileInBits[bit / 64].load() >> (bit % 64)) & 1)
+				tileOutBits[outBit / 64].fetch_or(uint64_t(1) << (outBit % 64));
+		}
+	}
+	outHeader->loopEnd = std::max(outHeader->loopEnd, inHeader->loopEnd);
+	outHeader->mergeTile.store(-1);
+
+	return out->Flush();
+}
+
+bool Film::GetCheckpointLoops(const std::string & path, int firstLoop, int loopNum, std::vector<bool> & loops) {
+	MappedBuffer file(path, 0, true);
+	const auto header = CheckpointHeaderOf(file);
+	if (!header || header->mergeTile.load() != -1)
+		return false;
+
+	CheckpointOffsets offsets;
+	CheckpointLayout(static_cast<size_t>(header->width) * header->height, header->tileNum, header->loopWords, header->journalPixelNum, offsets);
+	const auto bits = reinterpret_cast<const std::atomic<uint64_t> *>(file.GetData() + offsets.loopBits);
+	loops.assign(std::max(loopNum, 0), false);
+	for (int tileIdx = 0; tileIdx < header->tileNum; tileIdx++) {
+		for (int bit = 0; bit < header->loopWords * 64; bit++) {
+			const int i = header->loopBegin + bit - firstLoop;
+			if (i >= 0 && i < loopNum && ((bits[static_cast<size_t>(tileIdx) * header->loopWords + bit / 64].load() >> (bit % 64)) & 1))
+				loops[i] = true;
+		}
+	}
+	return true;
+}
+
+const Ptr<Image> Film::ResolveCheckpoint(const std::string & path) {
+	MappedBuffer file(path, 0, true);
+	const auto header = CheckpointHeaderOf(file);
+	if (!header || header->mergeTile.load() != -1)
+		return nullptr;
+
+	const auto filePixels = reinterpret_cast<const AtomicPixel *>(file.GetData() + AlignCacheLine(sizeof(CheckpointHeader)));
+	auto img = Image::New(header->width, header->height, 3);
+	for (int y = 0; y < header->height; y++) {
+		for (int x = 0; x < header->width; x++)
+			img->SetPixel(x, y, LoadPixel(filePixels[y * header->width + x]).ToRadiance());
 	}
+	return img;
 }
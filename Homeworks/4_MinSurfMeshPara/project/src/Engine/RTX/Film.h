@@ -2,35 +2,108 @@
 
 #include <Basic/HeapObj.h>
 
+#include <Engine/Viewer/RayTracer.h>
+
 #include <UGM/rgb.h>
 #include <UGM/point.h>
 #include <UGM/val.h>
 
 #include <Basic/Array2D.h>
 #include <UGM/bbox.h>
+#include <Basic/Math.h>
+
 #include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <cmath>
 
 namespace Ubpa {
 	class Image;
 	class ImgFilter;
 	class FilmTile;
+	class MappedBuffer;
 
 	class Film : public HeapObj {
 	public:
-		Film(Ptr<Image> img, Ptr<ImgFilter> filter);
+		// with hasAOV the AOVs of the camera rays taken in a pixel are kept too, box filtered
+		Film(Ptr<Image> img, Ptr<ImgFilter> filter, bool hasAOV = false);
 
 	protected:
-		virtual ~Film() = default;
+		virtual ~Film();
 
 	public:
-		static Ptr<Film> New(Ptr<Image> img, Ptr<ImgFilter> filter) {
-			return Ubpa::New<Film>(img, filter);
+		static Ptr<Film> New(Ptr<Image> img, Ptr<ImgFilter> filter, bool hasAOV = false) {
+			return Ubpa::New<Film>(img, filter, hasAOV);
 		}
 
 	public:
 		const Ptr<FilmTile> GenFilmTile(const bboxi2& frame) const;
+
+		// adds the footprint of the tile without locks, footprints of concurrent tiles may overlap
+		// the sums are fixed point, so the result does not depend on the order of the merges
 		void MergeFilmTile(Ptr<FilmTile> filmTile);
 
+		// writes the radiance of every pixel to the image, safe to call while tiles are merged
+		void Resolve();
+
+		// largest relative standard error of the mean luminance of the pixels in frame
+		// the means are measured against 1e-2 at least, so dark pixels don't need exact zeros
+		float Error(const bboxi2& frame) const;
+
+		bool HasAOV() const { return !aovs.empty(); }
+		// row major AOVs of the pixels, the normals are normalized and the depths are the means of the hits
+		void ResolveAOV(std::vector<RayTracer::AOV>& aovs) const;
+		// row major variances of the mean luminance of the pixels, from the moments
+		// pixels with less than 2 samples get their squared mean, an error of 100%
+		void ResolveVariance(std::vector<float>& variances) const;
+		// row major mean costs of the samples taken in the pixels, see FilmTile::AddSample
+		void ResolveCost(std::vector<float>& costs) const;
+
+	public:
+		// a run resumes only from a checkpoint of the same key and resolution
+		// the loops of a tile are counted from firstLoop, the file has room for loopNum rounded up to 64
+		struct CheckpointKey {
+			uint64_t sceneHash;
+			int tileSize;
+			int tileNum;
+			int firstLoop;
+			int loopNum;
+		};
+
+		// moves the sums to a memory mapped file at path, call it before any tile is merged
+		// an existing file of the same key is resumed, its sums replace the ones of the film
+		// returns false if the file can't be made or is of another run, the file is left alone then
+		bool MapCheckpoint(const std::string& path, const CheckpointKey& key, bool& resumed);
+		bool HasCheckpoint() const { return checkpoint != nullptr; }
+		// without a checkpoint no loop is done
+		bool IsLoopDone(int tileIdx, int loop) const;
+		// a loop not done is merged between BeginLoop and SetLoopDone, the merges of a checkpoint are serialized in between
+		// BeginLoop keeps the sums of the footprint of filmTile in the checkpoint, a run killed before SetLoopDone
+		// gets them back on resume, so the samples of the loop are taken again but never counted twice
+		void BeginLoop(int tileIdx, int loop, Ptr<FilmTile> filmTile);
+		void SetLoopDone(int tileIdx, int loop, long long sampleNum);
+		// camera samples in the checkpoint
+		long long GetCheckpointSampleNum() const;
+		bool FlushCheckpoint();
+
+		// sums the checkpoints of independent runs of one scene into a new checkpoint at outPath
+		// the loop ranges of the runs must not overlap, else the runs took the same samples
+		// the result keeps no done loops, so it can be merged and resolved but not resumed
+		static bool MergeCheckpoints(const std::string& outPath, const std::vector<std::string>& inPaths);
+		// adds the sums and the done loops of the checkpoint at inPath to the one at outPath, for results that grow
+		// a run at a time, a missing outPath is made with room for the loops [firstLoop, firstLoop + loopNum)
+		// fails if a loop of inPath is done in outPath too, outPath is left alone then
+		// a process killed in the add leaves outPath broken, it can't be added to or resolved anymore
+		static bool AddCheckpoint(const std::string& outPath, const std::string& inPath, int firstLoop, int loopNum);
+		// whether the loops [firstLoop, firstLoop + loopNum) are done in some tile of the checkpoint at path
+		// false if it can't be read or was killed in a merge or an add
+		static bool GetCheckpointLoops(const std::string& path, int firstLoop, int loopNum, std::vector<bool>& loops);
+		// the radiance of the pixels of a checkpoint, nullptr if it can't be read or was killed in a merge or an add
+		static const Ptr<Image> ResolveCheckpoint(const std::string& path);
+
 	private:
 		friend class FilmTile;
 
@@ -54,10 +127,82 @@ namespace Ubpa {
 			}
 		};
 
+		struct AtomicPixel {
+			std::atomic<long long> weightRadianceSum[3]{};
+			std::atomic<long long> filterWeightSum{ 0 };
+		};
+
+		// integer adds are associative, float adds are not
+		// 2^26 steps per unit, sums up to 1e11 fit
+		static constexpr double fixedPointScale = 67108864.0;
+		static long long ToFixedPoint(float val) {
+			return std::llround(Math::Clamp(static_cast<double>(val), -1e11, 1e11) * fixedPointScale);
+		}
+		static float FromFixedPoint(long long val) {
+			return static_cast<float>(val / fixedPointScale);
+		}
+		static const Pixel LoadPixel(const AtomicPixel& pixel) {
+			Pixel sum;
+			for (int c = 0; c < 3; c++)
+				sum.weightRadianceSum[c] = FromFixedPoint(pixel.weightRadianceSum[c].load(std::memory_order_relaxed));
+			sum.filterWeightSum = FromFixedPoint(pixel.filterWeightSum.load(std::memory_order_relaxed));
+			return sum;
+		}
+
+		// luminance moments of the samples taken in a pixel, not filtered
+		// luminance is clamped to maxMomentLum, so 2^16 samples of a pixel fit
+		struct AtomicMoments {
+			std::atomic<int> sampleNum{ 0 };
+			std::atomic<long long> lumSum{ 0 };
+			std::atomic<long long> lumSquareSum{ 0 };
+			std::atomic<long long> costSum{ 0 };
+		};
+		static constexpr float maxMomentLum = 64.f;
+		static constexpr double momentScale = 4294967296.0; // 2^32
+
+		// fixed point like the pixels, misses add to sampleNum only
+		struct AtomicAOV {
+			std::atomic<long long> albedoSum[3]{};
+			std::atomic<long long> normalSum[3]{};
+			std::atomic<long long> depthSum{ 0 };
+			std::atomic<int> sampleNum{ 0 };
+			std::atomic<int> hitNum{ 0 };
+		};
+
+		// at the start of a checkpoint file, followed by the pixels, the moments, the done loops of every tile
+		// and the journal, the pixels and moments of the footprint of the loop being merged
+		struct CheckpointHeader;
+		struct CheckpointOffsets {
+			size_t moments;
+			size_t loopBits;
+			size_t journal;
+		};
+		static size_t CheckpointLayout(size_t pixelNum, int tileNum, int loopWords, size_t journalPixelNum, CheckpointOffsets& offsets);
+		// header of a whole checkpoint file of a known layout, nullptr otherwise
+		static CheckpointHeader* CheckpointHeaderOf(const MappedBuffer& file);
+		// adds the pixels and moments of in to the ones of out, the files are of pixelNum pixels
+		static void AddCheckpointSums(MappedBuffer& out, const MappedBuffer& in, size_t pixelNum);
+		// copies the sums of the pixels of footprint to the journal, or back with restore
+		void CopyJournal(const bboxi2& footprint, bool restore);
+
 	private:
 		Ptr<Image> img;
 		const vali2 resolution;
-		std::vector<std::vector<Pixel>> pixels;
+		// row major, in pixelBuffer and momentBuffer or in the checkpoint
+		AtomicPixel* pixels;
+		AtomicMoments* moments;
+		std::vector<AtomicPixel> pixelBuffer;
+		std::vector<AtomicMoments> momentBuffer;
+		std::vector<AtomicAOV> aovs; // row major, empty without AOVs, not in the checkpoint
+
+		std::unique_ptr<MappedBuffer> checkpoint;
+		CheckpointHeader* checkpointHeader{ nullptr };
+		std::atomic<uint64_t>* loopBits{ nullptr }; // loopWords words per tile
+		AtomicPixel* journalPixels{ nullptr };
+		AtomicMoments* journalMoments{ nullptr };
+		std::mutex mergeMutex; // held from BeginLoop to SetLoopDone
+		int loopWords{ 0 };
+		int firstLoop{ 0 };
 
 		const bboxi2 frame; // ϵı߽
 		Ptr<ImgFilter> filter;
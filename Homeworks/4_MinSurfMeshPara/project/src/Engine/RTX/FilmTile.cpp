@@ -3,37 +3,96 @@
 #include <Engine/Filter/ImgFilter.h>
 #include <UGM/val.h>
 
+#include <cmath>
+#include <algorithm>
+
 using namespace Ubpa;
 
+void FilmTile::Reset(const bboxi2 & frame) {
+	this->frame = frame;
+
+	// a sample at p reaches the pixels whose centers are closer than radius
+	const auto & radius = filter->radius;
+	const int minX = std::max(static_cast<int>(std::floor(frame.minP()[0] - radius[0] - 0.5f)) + 1, filmFrame.minP()[0]);
+	const int minY = std::max(static_cast<int>(std::floor(frame.minP()[1] - radius[1] - 0.5f)) + 1, filmFrame.minP()[1]);
+	const int maxX = std::min(static_cast<int>(std::ceil(frame.maxP()[0] + radius[0] - 0.5f)), filmFrame.maxP()[0]);
+	const int maxY = std::min(static_cast<int>(std::ceil(frame.maxP()[1] + radius[1] - 0.5f)), filmFrame.maxP()[1]);
+	footprint = bboxi2({ minX, minY }, { maxX, maxY });
+	footprintWidth = maxX - minX;
 
-const bboxi2 FilmTile::SampleFrame() const {
-	auto minP = (frame[0].cast_to<vecf2>() + vecf2(0.5f) - filter->radius).cast_to<pointi2>();
-	auto maxP = (frame[1].cast_to<vecf2>() + filter->radius).cast_to<pointi2>(); // Ϊ frame ϱ߽磬Ǽȥ
-	return bboxi2(minP, maxP);
+	// assign keeps the capacity, so a thread allocates once for all its tiles
+	pixels.assign(static_cast<size_t>(footprintWidth) * (maxY - minY), Film::Pixel());
+	const auto frameSize = frame.diagonal();
+	moments.assign(static_cast<size_t>(frameSize[0]) * frameSize[1], Moments());
+	if (hasAOV)
+		aovs.assign(static_cast<size_t>(frameSize[0]) * frameSize[1], AOVSum());
+
+	// a sample reaches at most 2 * radius + 1 pixels on an axis
+	weightsX.resize(static_cast<size_t>(std::ceil(2 * radius[0])) + 1);
+	weightsY.resize(static_cast<size_t>(std::ceil(2 * radius[1])) + 1);
 }
 
-void FilmTile::AddSample(const pointf2 & pos, const rgbf & radiance) {
+void FilmTile::AddSample(const pointf2 & pos, const rgbf & radiance, long long cost) {
 	if (radiance.has_nan())
 		return;
 
-	const auto minP = pos - filter->radius;
-	const auto maxP = pos + filter->radius;
+	// moments of the pixel the sample is taken in
+	const int sampleX = static_cast<int>(std::floor(pos[0]));
+	const int sampleY = static_cast<int>(std::floor(pos[1]));
+	if (sampleX >= frame.minP()[0] && sampleX < frame.maxP()[0] && sampleY >= frame.minP()[1] && sampleY < frame.maxP()[1]) {
+		const double lum = Math::Clamp(radiance.illumination(), 0.f, Film::maxMomentLum);
+		auto & sampleMoments = moments[(sampleY - frame.minP()[1]) * (frame.maxP()[0] - frame.minP()[0]) + sampleX - frame.minP()[0]];
+		sampleMoments.sampleNum++;
+		sampleMoments.lumSum += std::llround(lum * Film::momentScale);
+		sampleMoments.lumSquareSum += std::llround(lum * lum * Film::momentScale);
+		sampleMoments.costSum += cost;
+	}
 
-	const int x0 = std::max(static_cast<int>(minP[0] + 0.5f), frame.minP()[0]);
-	const int x1 = std::min(static_cast<int>(maxP[0] - 0.5f), frame.maxP()[0]);
+	const auto & radius = filter->radius;
 
-	const int y0 = std::max(static_cast<int>(minP[1] + 0.5f), frame.minP()[1]);
-	const int y1 = std::min(static_cast<int>(maxP[1] - 0.5f), frame.maxP()[1]);
+	const int x0 = std::max(static_cast<int>(std::floor(pos[0] - radius[0] - 0.5f)) + 1, footprint.minP()[0]);
+	const int x1 = std::min(static_cast<int>(std::ceil(pos[0] + radius[0] - 0.5f)), footprint.maxP()[0]);
 
-	const int width = frame.maxP()[0] - frame.minP()[0];
-	for (int x = x0; x < x1; x++) {
-		int idxX = x - frame.minP()[0];
-		for (int y = y0; y < y1; y++) {
-			int idxY = y - frame.minP()[1];
+	const int y0 = std::max(static_cast<int>(std::floor(pos[1] - radius[1] - 0.5f)) + 1, footprint.minP()[1]);
+	const int y1 = std::min(static_cast<int>(std::ceil(pos[1] + radius[1] - 0.5f)), footprint.maxP()[1]);
 
-			const auto weight = filter->Evaluate(pos - (vecf2(x, y) + vecf2(0.5f)));
-			pixels[idxX][idxY].filterWeightSum += weight;
-			pixels[idxX][idxY].weightRadianceSum += weight * radiance;
+	// the filter is separable, so the weights of the columns and rows are looked up once
+	for (int x = x0; x < x1; x++)
+		weightsX[x - x0] = filter->Lookup1D(pos[0] - (x + 0.5f), 0);
+	for (int y = y0; y < y1; y++)
+		weightsY[y - y0] = filter->Lookup1D(pos[1] - (y + 0.5f), 1);
+
+	for (int y = y0; y < y1; y++) {
+		const float weightY = weightsY[y - y0];
+		if (weightY == 0.f)
+			continue;
+
+		auto row = pixels.data() + (y - footprint.minP()[1]) * footprintWidth + x0 - footprint.minP()[0];
+		for (int x = x0; x < x1; x++) {
+			const float weight = weightY * weightsX[x - x0];
+			auto & pixel = row[x - x0];
+			pixel.filterWeightSum += weight;
+			pixel.weightRadianceSum += weight * radiance;
 		}
 	}
 }
+
+void FilmTile::AddAOV(const pointf2 & pos, const RayTracer::AOV & aov) {
+	if (!hasAOV)
+		return;
+
+	const int x = static_cast<int>(std::floor(pos[0]));
+	const int y = static_cast<int>(std::floor(pos[1]));
+	if (x < frame.minP()[0] || x >= frame.maxP()[0] || y < frame.minP()[1] || y >= frame.maxP()[1])
+		return;
+
+	auto & sum = aovs[(y - frame.minP()[1]) * (frame.maxP()[0] - frame.minP()[0]) + x - frame.minP()[0]];
+	sum.sampleNum++;
+	if (!(aov.depth > 0.f))
+		return;
+
+	sum.albedoSum += aov.albedo;
+	sum.normalSum += aov.normal.cast_to<vecf3>();
+	sum.depthSum += aov.depth;
+	sum.hitNum++;
+}
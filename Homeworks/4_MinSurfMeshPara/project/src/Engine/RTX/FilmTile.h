@@ -5,46 +5,79 @@
 namespace Ubpa {
 	class FilmTile : public HeapObj {
 	public:
-		FilmTile(const bboxi2& frame, Ptr<ImgFilter> filter)
-			: frame(frame),
+		FilmTile(const bboxi2& filmFrame, Ptr<ImgFilter> filter, bool hasAOV = false)
+			: filmFrame(filmFrame),
 			filter(filter),
-			pixels(frame.diagonal()[0], std::vector<Film::Pixel>(frame.diagonal()[1])) { }
+			hasAOV(hasAOV) { }
 
 	protected:
 		virtual ~FilmTile() = default;
 
 	public:
-		// Frame ϱ߽
-		const bboxi2 SampleFrame() const;
+		// starts the tile of frame, the buffer is kept for the next tiles of the thread
+		void Reset(const bboxi2& frame);
 
-		void AddSample(const pointf2& pos, const rgbf& radiance);
+		// cost is the number of BVH nodes the sample visited, summed in the pixel it is taken in
+		void AddSample(const pointf2& pos, const rgbf& radiance, long long cost = 0);
+		// to the pixel the sample is taken in, nothing if the tile has no AOVs
+		void AddAOV(const pointf2& pos, const RayTracer::AOV& aov);
 
+		// Frame ϱ߽
 		const bboxi2 GetFrame() const { return frame; }
-		const std::vector<vali2> AllPos() const {
-			std::vector<vali2> posArr;
-			posArr.reserve(frame.area());
-			for (int x = frame.minP()[0]; x < frame.maxP()[0]; x++) {
-				for (int y = frame.minP()[1]; y < frame.maxP()[1]; y++) {
-					posArr.push_back({ x,y });
-				}
-			}
-			return posArr;
-		}
+		// pixels the samples in the frame reach, the frame grown by the filter radius and clipped to the film
+		const bboxi2 GetFootprint() const { return footprint; }
 		const Film::Pixel& At(const vali2& pos) const {
+			assert(pos[0] >= footprint.minP()[0] && pos[0] < footprint.maxP()[0]);
+			assert(pos[1] >= footprint.minP()[1] && pos[1] < footprint.maxP()[1]);
+			return pixels[(pos[1] - footprint.minP()[1]) * footprintWidth + pos[0] - footprint.minP()[0]];
+		}
+
+		// fixed point luminance moments of the samples taken in a pixel of the frame, and their cost
+		struct Moments {
+			int sampleNum{ 0 };
+			long long lumSum{ 0 };
+			long long lumSquareSum{ 0 };
+			long long costSum{ 0 };
+		};
+		const Moments& MomentsAt(const vali2& pos) const {
 			assert(pos[0] >= frame.minP()[0] && pos[0] < frame.maxP()[0]);
 			assert(pos[1] >= frame.minP()[1] && pos[1] < frame.maxP()[1]);
-			return pixels[pos[0] - frame.minP()[0]][pos[1] - frame.minP()[1]];
+			return moments[(pos[1] - frame.minP()[1]) * (frame.maxP()[0] - frame.minP()[0]) + pos[0] - frame.minP()[0]];
+		}
+
+		struct AOVSum {
+			rgbf albedoSum{ 0.f };
+			vecf3 normalSum{ 0.f };
+			float depthSum{ 0.f };
+			int sampleNum{ 0 };
+			int hitNum{ 0 };
+		};
+		const AOVSum& AOVAt(const vali2& pos) const {
+			assert(hasAOV);
+			assert(pos[0] >= frame.minP()[0] && pos[0] < frame.maxP()[0]);
+			assert(pos[1] >= frame.minP()[1] && pos[1] < frame.maxP()[1]);
+			return aovs[(pos[1] - frame.minP()[1]) * (frame.maxP()[0] - frame.minP()[0]) + pos[0] - frame.minP()[0]];
 		}
 
 	public:
-		static Ptr<FilmTile> New(const bboxi2& frame, Ptr<ImgFilter> filter) {
-			return Ubpa::New<FilmTile>(frame, filter);
+		static Ptr<FilmTile> New(const bboxi2& filmFrame, Ptr<ImgFilter> filter, bool hasAOV = false) {
+			return Ubpa::New<FilmTile>(filmFrame, filter, hasAOV);
 		}
 
 	private:
-		const bboxi2 frame;
-		std::vector<std::vector<Film::Pixel>> pixels;
+		const bboxi2 filmFrame;
+		bboxi2 frame;
+		bboxi2 footprint;
+		int footprintWidth{ 0 };
+		std::vector<Film::Pixel> pixels; // row major over the footprint
+		std::vector<Moments> moments; // row major over the frame
+		std::vector<AOVSum> aovs; // row major over the frame, empty without AOVs
+
+		// filter weights of the columns and rows a sample reaches
+		std::vector<float> weightsX;
+		std::vector<float> weightsY;
 
 		Ptr<ImgFilter> filter;
+		const bool hasAOV;
 	};
 }
@@ -0,0 +1,468 @@
+#include "LBVH.h"
+
+#include <Basic/Parallel.h>
+
+#include <thread>
+#include <atomic>
+#include <array>
+#include <algorithm>
+#include <cfloat>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace Ubpa;
+
+using namespace std;
+
+namespace Ubpa {
+	// below this many items the work runs on the calling thread
+	static constexpr size_t parallelThreshold = 1 << 12;
+
+	// x != 0
+	static int CountLeadingZeros(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long idx;
+		_BitScanReverse64(&idx, x);
+		return 63 - static_cast<int>(idx);
+#elif defined(__GNUC__)
+		return __builtin_clzll(x);
+#else
+		int num = 0;
+		for (uint64_t bit = static_cast<uint64_t>(1) << 63; (x & bit) == 0; bit >>= 1)
+			num++;
+		return num;
+#endif
+	}
+
+	// insert two zeros after each of the lower 21 bits
+	static uint64_t ExpandBits(uint64_t v) {
+		v &= 0x1fffff;
+		v = (v | v << 32) & 0x1f00000000ffff;
+		v = (v | v << 16) & 0x1f0000ff0000ff;
+		v = (v | v << 8) & 0x100f00f00f00f00f;
+		v = (v | v << 4) & 0x10c30c30c30c30c3;
+		v = (v | v << 2) & 0x1249249249249249;
+		return v;
+	}
+
+	// LSD radix sort of (keys, values) by the lower keyBits bits, 8 bits a pass, stable
+	static void RadixSort(vector<uint64_t>& keys, vector<int>& values, int keyBits) {
+		const size_t n = keys.size();
+		vector<uint64_t> sortedKeys(n);
+		vector<int> sortedValues(n);
+		vector<array<size_t, 256>> offsets(Parallel::Instance().CoreNum());
+		for (int shift = 0; shift < keyBits; shift += 8) {
+			// 1. histogram of each chunk
+			const size_t chunkNum = Parallel::Instance().RunChunks([&](size_t begin, size_t end, size_t chunkID) {
+				auto& histogram = offsets[chunkID];
+				histogram.fill(0);
+				for (size_t i = begin; i < end; i++)
+					histogram[(keys[i] >> shift) & 0xff]++;
+			}, n, 0, parallelThreshold);
+
+			// 2. exclusive prefix sum, digit major and chunk minor keeps the order of equal digits
+			size_t sum = 0;
+			for (int digit = 0; digit < 256; digit++) {
+				for (size_t chunkID = 0; chunkID < chunkNum; chunkID++) {
+					const size_t num = offsets[chunkID][digit];
+					offsets[chunkID][digit] = sum;
+					sum += num;
+				}
+			}
+
+			// 3. scatter
+			Parallel::Instance().RunChunks([&](size_t begin, size_t end, size_t chunkID) {
+				auto& offset = offsets[chunkID];
+				for (size_t i = begin; i < end; i++) {
+					const size_t dst = offset[(keys[i] >> shift) & 0xff]++;
+					sortedKeys[dst] = keys[i];
+					sortedValues[dst] = values[i];
+				}
+			}, n, 0, parallelThreshold);
+
+			keys.swap(sortedKeys);
+			values.swap(sortedValues);
+		}
+	}
+
+	// binary radix tree over the sorted primitives
+	// internal node i has the children children[i], leaf i is the id ~i, the root is internal node 0
+	class LBVHTree {
+	public:
+		LBVHTree(const vector<bboxf3>& primBoxes, const vector<int>& sortedPrims)
+			: primBoxes(primBoxes), sortedPrims(sortedPrims),
+			children(sortedPrims.size() - 1), boxes(sortedPrims.size() - 1),
+			primNums(sortedPrims.size() - 1), costs(sortedPrims.size() - 1) { }
+
+	public:
+		// Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees"
+		// every internal node finds its range and split from the codes alone
+		void BuildHierarchy(const vector<uint64_t>& codes);
+		// bottom-up boxes and SAH costs, the second child to arrive computes its parent
+		void ComputeBounds();
+
+		// Karras and Aila, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies"
+		// the best topology of every treelet is searched, bottom-up
+		void Restructure(int id, int forkDepth);
+
+		// depth first like BVHAccel::LinearizeBVH, subtrees of at most maxLeafSize primitives become leaves
+		void Linearize(int id, vector<BVHAccel::LinearBVHNode>& nodes, vector<int>& primIdx, int& depth, int nodeDepth = 1) const;
+
+	private:
+		const bboxf3& Box(int id) const { return id < 0 ? primBoxes[sortedPrims[~id]] : boxes[id]; }
+		int PrimNum(int id) const { return id < 0 ? 1 : primNums[id]; }
+		// SAH cost sum of the subtree, not normalized
+		double Cost(int id) const { return id < 0 ? primBoxes[sortedPrims[~id]].area() : costs[id]; }
+
+		// subtrees of at most maxLeafSize primitives cost like a leaf, they are linearized into one
+		static double NodeCost(double area, int primNum, double childrenCost) {
+			return static_cast<size_t>(primNum) <= BVHNode::maxLeafSize ? primNum * area : BVHNode::t_trav * area + childrenCost;
+		}
+
+		void OptimizeTreelet(int root);
+		void GatherPrims(int id, vector<int>& primIdx) const;
+
+		// leaves and internal nodes of a treelet, and the best topology of every subset of the leaves
+		struct Treelet {
+			int leaves[LBVH::treeletSize];
+			int internals[LBVH::treeletSize - 1];
+			bboxf3 boxes[1 << LBVH::treeletSize];
+			int primNums[1 << LBVH::treeletSize];
+			double costs[1 << LBVH::treeletSize];
+			int partitions[1 << LBVH::treeletSize];
+		};
+		int RebuildTreelet(const Treelet& treelet, int subset, int& nextInternal);
+
+	private:
+		const vector<bboxf3>& primBoxes;
+		const vector<int>& sortedPrims;
+
+		vector<array<int, 2>> children;
+		vector<int> parents; // only valid before the restructuring
+		vector<int> leafParents;
+		vector<bboxf3> boxes;
+		vector<int> primNums;
+		vector<double> costs;
+	};
+}
+
+void LBVHTree::BuildHierarchy(const vector<uint64_t>& codes) {
+	const int n = static_cast<int>(sortedPrims.size());
+	parents.resize(n - 1);
+	leafParents.resize(n);
+	parents[0] = -1;
+
+	// length of the common prefix of keys i and j, -1 out of range, equal codes are told apart by the index
+	auto delta = [&codes, n](int i, int j) {
+		if (j < 0 || j >= n)
+			return -1;
+
+		const uint64_t diff = codes[i] ^ codes[j];
+		if (diff != 0)
+			return CountLeadingZeros(diff);
+
+		return 64 + CountLeadingZeros(static_cast<uint64_t>(static_cast<uint32_t>(i ^ j))) - 32;
+	};
+
+	Parallel::Instance().RunChunks([&](size_t begin, size_t end, size_t) {
+		for (int i = static_cast<int>(begin); i < static_cast<int>(end); i++) {
+			// direction of the range
+			const int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+
+			// other end of the range
+			const int deltaMin = delta(i, i - d);
+			int lMax = 2;
+			while (delta(i, i + lMax * d) > deltaMin)
+				lMax *= 2;
+			int l = 0;
+			for (int t = lMax / 2; t >= 1; t /= 2) {
+				if (delta(i, i + (l + t) * d) > deltaMin)
+					l += t;
+			}
+			const int j = i + l * d;
+
+			// split, the last key sharing the prefix of the node with key i
+			const int deltaNode = delta(i, j);
+			int s = 0;
+			for (int div = 2; ; div *= 2) {
+				const int t = (l + div - 1) / div;
+				if (delta(i, i + (s + t) * d) > deltaNode)
+					s += t;
+				if (t == 1)
+					break;
+			}
+			const int gamma = i + s * d + std::min(d, 0);
+
+			const int first = std::min(i, j);
+			const int last = std::max(i, j);
+			const int left = first == gamma ? ~gamma : gamma;
+			const int right = last == gamma + 1 ? ~(gamma + 1) : gamma + 1;
+			children[i] = { left, right };
+			primNums[i] = last - first + 1;
+			for (const int child : { left, right }) {
+				if (child < 0)
+					leafParents[~child] = i;
+				else
+					parents[child] = i;
+			}
+		}
+	}, static_cast<size_t>(n - 1), 0, parallelThreshold);
+}
+
+void LBVHTree::ComputeBounds() {
+	// value initialized to 0
+	vector<atomic<int>> visitNums(children.size());
+
+	Parallel::Instance().RunChunks([&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			for (int id = leafParents[i]; id != -1; id = parents[id]) {
+				// the first child to arrive stops, its sibling may not be ready
+				if (visitNums[id].fetch_add(1, memory_order_acq_rel) == 0)
+					break;
+
+				const auto& child = children[id];
+				bboxf3 box = Box(child[0]);
+				box.combine_with(Box(child[1]));
+				boxes[id] = box;
+				costs[id] = NodeCost(box.area(), primNums[id], Cost(child[0]) + Cost(child[1]));
+			}
+		}
+	}, leafParents.size(), 0, parallelThreshold);
+}
+
+void LBVHTree::Restructure(int id, int forkDepth) {
+	if (id < 0 || static_cast<size_t>(primNums[id]) <= BVHNode::maxLeafSize)
+		return;
+
+	// children first, their treelets only touch their own subtrees
+	const auto child = children[id];
+	if (forkDepth > 0 && static_cast<size_t>(primNums[id]) >= parallelThreshold) {
+		thread leftWorker([&]() { Restructure(child[0], forkDepth - 1); });
+		Restructure(child[1], forkDepth - 1);
+		leftWorker.join();
+	}
+	else {
+		Restructure(child[0], 0);
+		Restructure(child[1], 0);
+	}
+
+	OptimizeTreelet(id);
+}
+
+void LBVHTree::OptimizeTreelet(int root) {
+	Treelet treelet;
+
+	// 1. grow the treelet, expand the leaf with the largest surface area
+	treelet.leaves[0] = children[root][0];
+	treelet.leaves[1] = children[root][1];
+	treelet.internals[0] = root;
+	int leafNum = 2;
+	while (leafNum < LBVH::treeletSize) {
+		int bestLeaf = -1;
+		float bestArea = -1.f;
+		for (int i = 0; i < leafNum; i++) {
+			const int id = treelet.leaves[i];
+			if (id < 0)
+				continue;
+
+			const float area = boxes[id].area();
+			if (area > bestArea) {
+				bestArea = area;
+				bestLeaf = i;
+			}
+		}
+		if (bestLeaf == -1)
+			break;
+
+		const int expanded = treelet.leaves[bestLeaf];
+		treelet.internals[leafNum - 1] = expanded;
+		treelet.leaves[bestLeaf] = children[expanded][0];
+		treelet.leaves[leafNum++] = children[expanded][1];
+	}
+
+	// two or three leaves leave little to choose from
+	if (leafNum <= 3)
+		return;
+
+	// 2. optimal cost of every subset of the leaves, subsets of a set have smaller masks
+	const int fullSet = (1 << leafNum) - 1;
+	for (int s = 1; s <= fullSet; s++) {
+		const int lowBit = s & -s;
+		if (s == lowBit) {
+			int leafIdx = 0;
+			while ((1 << leafIdx) != s)
+				leafIdx++;
+			const int id = treelet.leaves[leafIdx];
+			treelet.boxes[s] = Box(id);
+			treelet.primNums[s] = PrimNum(id);
+			treelet.costs[s] = Cost(id);
+			continue;
+		}
+
+		treelet.boxes[s] = treelet.boxes[s ^ lowBit];
+		treelet.boxes[s].combine_with(treelet.boxes[lowBit]);
+		treelet.primNums[s] = treelet.primNums[s ^ lowBit] + treelet.primNums[lowBit];
+
+		// only partitions with the low bit on the left, each split is seen once
+		double bestCost = DBL_MAX;
+		int bestPartition = lowBit;
+		if (static_cast<size_t>(treelet.primNums[s]) > BVHNode::maxLeafSize) {
+			for (int p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+				if ((p & lowBit) == 0)
+					continue;
+
+				const double cost = treelet.costs[p] + treelet.costs[s ^ p];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestPartition = p;
+				}
+			}
+		}
+		else
+			bestCost = 0.;
+
+		treelet.costs[s] = NodeCost(treelet.boxes[s].area(), treelet.primNums[s], bestCost);
+		treelet.partitions[s] = bestPartition;
+	}
+
+	// 3. write back only real improvements
+	if (treelet.costs[fullSet] >= costs[root] * (1. - 1e-6))
+		return;
+
+	int nextInternal = 0;
+	RebuildTreelet(treelet, fullSet, nextInternal);
+}
+
+int LBVHTree::RebuildTreelet(const Treelet& treelet, int subset, int& nextInternal) {
+	if ((subset & (subset - 1)) == 0) {
+		int leafIdx = 0;
+		while ((1 << leafIdx) != subset)
+			leafIdx++;
+		return treelet.leaves[leafIdx];
+	}
+
+	// the full set comes first and takes the root
+	const int id = treelet.internals[nextInternal++];
+	const int partition = treelet.partitions[subset];
+	const int left = RebuildTreelet(treelet, partition, nextInternal);
+	const int right = RebuildTreelet(treelet, subset ^ partition, nextInternal);
+	children[id] = { left, right };
+	boxes[id] = treelet.boxes[subset];
+	primNums[id] = treelet.primNums[subset];
+	costs[id] = treelet.costs[subset];
+	return id;
+}
+
+void LBVHTree::GatherPrims(int id, vector<int>& primIdx) const {
+	if (id < 0) {
+		primIdx.push_back(sortedPrims[~id]);
+		return;
+	}
+
+	GatherPrims(children[id][0], primIdx);
+	GatherPrims(children[id][1], primIdx);
+}
+
+void LBVHTree::Linearize(int id, vector<BVHAccel::LinearBVHNode>& nodes, vector<int>& primIdx, int& depth, int nodeDepth) const {
+	depth = std::max(depth, nodeDepth);
+	const int curNodeIdx = static_cast<int>(nodes.size());
+	nodes.emplace_back();
+
+	if (static_cast<size_t>(PrimNum(id)) <= BVHNode::maxLeafSize) {
+		const int shapesOffset = static_cast<int>(primIdx.size());
+		GatherPrims(id, primIdx);
+		nodes[curNodeIdx].InitLeaf(Box(id), shapesOffset, PrimNum(id));
+		return;
+	}
+
+	// the first child is the lower one along the axis separating the children most, as the traversal expects
+	int left = children[id][0];
+	int right = children[id][1];
+	const auto offset = Box(right).center() - Box(left).center();
+	int axis = 0;
+	for (int dim = 1; dim < 3; dim++) {
+		if (std::abs(offset[dim]) > std::abs(offset[axis]))
+			axis = dim;
+	}
+	if (offset[axis] < 0.f)
+		std::swap(left, right);
+
+	Linearize(left, nodes, primIdx, depth, nodeDepth + 1);
+	nodes[curNodeIdx].InitBranch(Box(id), static_cast<int>(nodes.size()), axis);
+	Linearize(right, nodes, primIdx, depth, nodeDepth + 1);
+}
+
+void LBVH::Build(const BVHNode::BuildData& data, int treeletPasses, vector<BVHAccel::LinearBVHNode>& nodes, int& depth) {
+	const size_t n = data.primIdx.size();
+	nodes.clear();
+	depth = 0;
+	if (n == 0)
+		return;
+
+	if (n <= BVHNode::maxLeafSize) {
+		bboxf3 box;
+		for (auto id : data.primIdx)
+			box.combine_with(data.boxes[id]);
+		nodes.emplace_back();
+		nodes.back().InitLeaf(box, 0, static_cast<int>(n));
+		depth = 1;
+		return;
+	}
+
+	// 1. box of the centroids
+
+	vector<bboxf3> chunkBoxes(Parallel::Instance().CoreNum());
+	const size_t chunkNum = Parallel::Instance().RunChunks([&](size_t begin, size_t end, size_t chunkID) {
+		for (size_t i = begin; i < end; i++)
+			chunkBoxes[chunkID].combine_with(data.centroids[data.primIdx[i]]);
+	}, n, 0, parallelThreshold);
+	bboxf3 centroidBox;
+	for (size_t i = 0; i < chunkNum; i++)
+		centroidBox.combine_with(chunkBoxes[i]);
+
+	// 2. Morton codes, 30 bits while they still tell the primitives apart, 63 bits for large scenes
+
+	const int bitsPerAxis = n <= (static_cast<size_t>(1) << 20) ? 10 : 21;
+	const float cellNum = static_cast<float>(1 << bitsPerAxis);
+	const auto & minP = centroidBox.minP();
+	const auto extent = centroidBox.diagonal();
+	float scale[3];
+	for (int dim = 0; dim < 3; dim++)
+		scale[dim] = extent[dim] > 0.f ? cellNum / extent[dim] : 0.f;
+
+	vector<uint64_t> codes(n);
+	vector<int> sortedPrims(data.primIdx);
+	Parallel::Instance().RunChunks([&](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			const auto& centroid = data.centroids[sortedPrims[i]];
+			uint64_t cell[3];
+			for (int dim = 0; dim < 3; dim++)
+				cell[dim] = static_cast<uint64_t>(std::min((centroid[dim] - minP[dim]) * scale[dim], cellNum - 1.f));
+			codes[i] = (ExpandBits(cell[0]) << 2) | (ExpandBits(cell[1]) << 1) | ExpandBits(cell[2]);
+		}
+	}, n, 0, parallelThreshold);
+
+	// 3. sort
+
+	RadixSort(codes, sortedPrims, 3 * bitsPerAxis);
+
+	// 4. hierarchy, bounds and treelets
+
+	LBVHTree tree(data.boxes, sortedPrims);
+	tree.BuildHierarchy(codes);
+	tree.ComputeBounds();
+
+	int forkDepth = 0;
+	while ((static_cast<size_t>(1) << forkDepth) < Parallel::Instance().CoreNum())
+		forkDepth++;
+	for (int i = 0; i < treeletPasses; i++)
+		tree.Restructure(0, forkDepth + 1);
+
+	// 5. depth first nodes, primIdx in leaf order
+
+	data.primIdx.clear();
+	nodes.reserve(2 * n);
+	tree.Linearize(0, nodes, data.primIdx, depth);
+}
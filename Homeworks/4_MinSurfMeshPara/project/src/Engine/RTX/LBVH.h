@@ -0,0 +1,23 @@
+#pragma once
+
+#include "BVHNode.h"
+
+#include <Engine/Viewer/BVHAccel.h>
+
+#include <vector>
+
+namespace Ubpa {
+	// linear BVH, primitives are sorted along a Morton curve of their centroids
+	// and the hierarchy follows the common prefixes of the sorted codes
+	// much faster to build than the SAH builder of BVHNode, at the price of trace speed
+	class LBVH {
+	public:
+		// nodes are in depth first order like BVHAccel::LinearizeBVH, primIdx is reordered into leaf order
+		// treeletPasses rounds of treelet restructuring improve the SAH cost after the build
+		static void Build(const BVHNode::BuildData& data, int treeletPasses, std::vector<BVHAccel::LinearBVHNode>& nodes, int& depth);
+
+	public:
+		// leaves of a treelet in the restructuring, 2^treeletSize subsets are searched
+		static constexpr int treeletSize = 7;
+	};
+}
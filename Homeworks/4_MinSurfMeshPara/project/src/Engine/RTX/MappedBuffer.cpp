@@ -0,0 +1,94 @@
+#include "MappedBuffer.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace Ubpa;
+
+using namespace std;
+
+MappedBuffer::MappedBuffer(const string & path, size_t size, bool readOnly)
+	: readOnly(readOnly)
+{
+	const bool create = size > 0;
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), readOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		nullptr, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER fileSize;
+	if (create) {
+		fileSize.QuadPart = static_cast<LONGLONG>(size);
+		if (!SetFilePointerEx(file, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+			return;
+	}
+	else if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		return;
+
+	mapping = CreateFileMappingA(file, nullptr, readOnly ? PAGE_READONLY : PAGE_READWRITE, 0, 0, nullptr);
+	if (mapping == nullptr)
+		return;
+
+	data = MapViewOfFile(mapping, readOnly ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, 0);
+	if (data != nullptr)
+		this->size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	fd = open(path.c_str(), readOnly ? O_RDONLY : (create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR), 0644);
+	if (fd == -1)
+		return;
+
+	if (create && ftruncate(fd, static_cast<off_t>(size)) != 0)
+		return;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+		return;
+
+	void * addr = mmap(nullptr, static_cast<size_t>(fileStat.st_size), readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		return;
+
+	data = addr;
+	this->size = static_cast<size_t>(fileStat.st_size);
+#endif
+}
+
+MappedBuffer::~MappedBuffer() {
+#ifdef _WIN32
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+#else
+	if (data != nullptr)
+		munmap(data, size);
+	if (fd != -1)
+		close(fd);
+#endif
+}
+
+bool MappedBuffer::Flush() {
+	if (data == nullptr || readOnly)
+		return false;
+
+#ifdef _WIN32
+	return FlushViewOfFile(data, 0) && FlushFileBuffers(file);
+#else
+	return msync(data, size, MS_SYNC) == 0;
+#endif
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace Ubpa {
+	// shared view of a whole file, writes go to the page cache of the file,
+	// so they outlive the process even if it is killed, Flush also writes them to the disk
+	class MappedBuffer {
+	public:
+		// opens the file at path, with size > 0 creates it instead, zero filled, replacing any file there
+		MappedBuffer(const std::string& path, size_t size = 0, bool readOnly = false);
+		~MappedBuffer();
+
+		MappedBuffer(const MappedBuffer&) = delete;
+		MappedBuffer& operator=(const MappedBuffer&) = delete;
+
+	public:
+		bool IsValid() const { return data != nullptr; }
+		bool IsReadOnly() const { return readOnly; }
+		unsigned char* GetData() const { return static_cast<unsigned char*>(data); }
+		size_t GetSize() const { return size; }
+
+		// blocks until the changes are on the disk
+		bool Flush();
+
+	private:
+#ifdef _WIN32
+		void* file;
+		void* mapping{ nullptr };
+#else
+		int fd{ -1 };
+#endif
+		void* data{ nullptr };
+		size_t size{ 0 };
+		const bool readOnly;
+	};
+}
@@ -14,15 +14,40 @@
 #include <Engine/Scene/CmptLight.h>
 #include <Engine/Light/Light.h>
 
+#include <Engine/Scene/CmptGeometry.h>
+#include <Engine/Primitive/Primitive.h>
+#include <Engine/Primitive/Shape.h>
+
+#include <Engine/Material/SurfCoord.h>
+
 #include <Basic/Math.h>
 
+#include <algorithm>
+
 using namespace Ubpa;
 
 using namespace std;
 
+namespace Ubpa {
+	// bounces before Russian roulette starts
+	static constexpr int rouletteDepth = 3;
+
+	static float PowerHeuristic(float fPD, float gPD) {
+		const float f2 = fPD * fPD;
+		const float g2 = gPD * gPD;
+		return f2 + g2 > 0.f ? f2 / (f2 + g2) : 0.f;
+	}
+
+	static float MaxComponent(const rgbf& c) {
+		return max(max(c[0], c[1]), c[2]);
+	}
+}
+
 PathTracer::PathTracer()
 	:
 	maxDepth(20),
+	lightSelection(LightSampler::Mode::Auto),
+	lightSampler(LightSampler::New()),
 	closestIntersector(ClosestIntersector::New()),
 	visibilityChecker(VisibilityChecker::New())
 { }
@@ -50,10 +75,233 @@ void PathTracer::Init(Ptr<Scene> scene, Ptr<BVHAccel> bvhAccel) {
 		worldToLightVec.push_back(worldToLight);
 		lightToWorldVec.push_back(lightToWorld);
 	}
+	lightSampler->Init(lightSelection, lights, lightToWorldVec,
+		bvhAccel->IsEmpty() ? bboxf3() : bvhAccel->GetBVHNodes()[0].GetBox());
+
+	primitive2surface.clear();
+	bsdfNum = 0;
+	if (!scene->GetRoot())
+		return;
+	map<Ptr<BSDF>, int> bsdfToIdx;
+	for (auto geo : scene->GetRoot()->GetComponentsInChildren<CmptGeometry>()) {
+		if (!geo->primitive)
+			continue;
+
+		auto sobj = geo->GetSObj();
+		Surface surface{ nullptr, -1, -1 };
+
+		auto cmptMaterial = sobj->GetComponent<CmptMaterial>();
+		if (cmptMaterial)
+			surface.bsdf = CastTo<BSDF>(cmptMaterial->material);
+		if (!surface.bsdf)
+			continue;
+
+		auto bsdfTarget = bsdfToIdx.find(surface.bsdf);
+		if (bsdfTarget == bsdfToIdx.cend())
+			bsdfTarget = bsdfToIdx.emplace(surface.bsdf, bsdfNum++).first;
+		surface.bsdfIdx = bsdfTarget->second;
+
+		auto cmptLight = sobj->GetComponent<CmptLight>();
+		if (cmptLight) {
+			auto target = lightToIdx.find(cmptLight->light);
+			if (target != lightToIdx.cend())
+				surface.lightIdx = target->second;
+		}
+
+		primitive2surface[geo->primitive.get()] = surface;
+	}
+}
+
+const RayTracer::AOV PathTracer::TraceAOV(const Ray & ray) {
+	AOV aov;
+
+	UBPA_STATS_ADD(rays[RTStats::CameraRay], 1);
+	Ray aovRay = ray;
+	closestIntersector->Init(&aovRay);
+	closestIntersector->Visit(bvhAccel);
+	const auto & closestRst = closestIntersector->GetRst();
+	if (!closestRst.IsIntersect())
+		return aov;
+
+	const auto surface = GetSurface(closestRst.closestShape);
+	if (!surface)
+		return aov;
+
+	const auto frame = GenFrame(*surface, closestRst.texcoord, closestRst.n, closestRst.tangent);
+	aov.albedo = surface->bsdf->Albedo(closestRst.texcoord);
+	aov.normal = frame.n.cast_to<normalf>();
+	aov.depth = (closestRst.pos - ray.o).norm();
+	return aov;
 }
 
 const rgbf PathTracer::Trace(Ray & ray, int depth, rgbf pathThroughput) {
-	//cout << "WARNING::PathTracer::Trace:" << endl
-	//	<< "\t" << "not implemented" << endl;
-	return { 1.f,0.f,1.f };
+	rgbf L(0.f);
+
+	// the last scattering, emission found by BSDF sampling is weighted against the light sampling there
+	pointf3 lastPos;
+	normalf lastN(0.f);
+	float lastPD = 0.f;
+	bool lastIsDelta = true; // nothing samples the lights for the camera ray
+
+	for (;; depth++) {
+		UBPA_STATS_ADD(rays[depth == 0 ? RTStats::CameraRay : RTStats::IndirectRay], 1);
+		closestIntersector->Init(&ray);
+		closestIntersector->Visit(bvhAccel);
+		const auto & closestRst = closestIntersector->GetRst();
+
+		if (!closestRst.IsIntersect()) {
+			L += pathThroughput * Background(ray, lastIsDelta, lastPos, lastN, lastPD);
+			break;
+		}
+
+		const auto surface = GetSurface(closestRst.closestShape);
+		if (!surface)
+			break;
+		const auto & bsdf = surface->bsdf;
+
+		const pointf3 pos = closestRst.pos;
+		const pointf2 texcoord = closestRst.texcoord;
+		const auto frame = GenFrame(*surface, texcoord, closestRst.n, closestRst.tangent);
+		const vecf3 dir = ray.d.normalize();
+		const normalf wo = frame.ToLocal(-dir);
+
+		L += pathThroughput * Emission(*surface, wo, dir, lastIsDelta, lastPos, lastN, lastPD);
+
+		LightSample lightSample;
+		if (SampleLight(pos, wo, texcoord, frame, *surface, lightSample)) {
+			UBPA_STATS_ADD(rays[RTStats::ShadowRay], 1);
+			Ray shadowRay(pos, lightSample.dir);
+			visibilityChecker->Init(&shadowRay, lightSample.dist - shadowRayEpsilon);
+			visibilityChecker->Visit(bvhAccel);
+			if (!visibilityChecker->GetRst().IsIntersect())
+				L += pathThroughput * lightSample.contribution;
+		}
+
+		normalf wi;
+		float PD;
+		const rgbf f = bsdf->Sample_f(wo, texcoord, wi, PD);
+		if (PD <= 0.f || MaxComponent(f) <= 0.f)
+			break;
+
+		pathThroughput *= SurfCoord::AbsCosTheta(wi) / PD * f;
+
+		const float survival = SurvivalProbability(pathThroughput, depth);
+		if (!(survival >= 1.f)) {
+			if (!(survival > 0.f) || Math::Rand_F() >= survival)
+				break;
+			pathThroughput /= survival;
+		}
+
+		lastPos = pos;
+		lastN = frame.n.cast_to<normalf>();
+		lastPD = PD;
+		lastIsDelta = bsdf->IsDelta();
+		ray = Ray(pos, frame.ToWorld(wi));
+	}
+	// depth is of the last ray
+	UBPA_STATS_PATH(depth + 1);
+
+	return L;
+}
+
+const PathTracer::Surface * PathTracer::GetSurface(const Ptr<Shape> & shape) const {
+	const auto target = primitive2surface.find(shape->GetPrimitive().get());
+	return target != primitive2surface.cend() ? &target->second : nullptr;
+}
+
+const PathTracer::Frame PathTracer::GenFrame(const Surface & surface, const pointf2 & texcoord, const normalf & n, const normalf & tangent) {
+	normalf changedN = n;
+	surface.bsdf->ChangeNormal(texcoord, tangent, changedN);
+	const vecf3 nw = changedN.cast_to<vecf3>();
+
+	vecf3 s = tangent.cast_to<vecf3>();
+	s -= s.dot(nw) * nw;
+	if (s.norm2() < 1e-8f) {
+		s = abs(nw[0]) > 0.9f ? vecf3(0.f, 1.f, 0.f) : vecf3(1.f, 0.f, 0.f);
+		s -= s.dot(nw) * nw;
+	}
+	s.normalize_self();
+
+	return Frame(s, nw.cross(s), nw);
+}
+
+const rgbf PathTracer::Emission(const Surface & surface, const normalf & wo, const vecf3 & dir,
+	bool lastIsDelta, const pointf3 & lastPos, const normalf & lastN, float lastPD) const
+{
+	const rgbf emission = surface.bsdf->Emission(wo);
+	if (MaxComponent(emission) <= 0.f)
+		return rgbf(0.f);
+
+	// emission without a light isn't sampled by SampleLight
+	if (lastIsDelta || surface.lightIdx == -1)
+		return emission;
+
+	return PowerHeuristic(lastPD, LightPDF(surface.lightIdx, lastPos, lastN, dir)) * emission;
+}
+
+const rgbf PathTracer::Background(const Ray & ray, bool lastIsDelta, const pointf3 & lastPos, const normalf & lastN, float lastPD) const {
+	rgbf L(0.f);
+	const vecf3 dir = ray.d.normalize();
+	for (size_t i = 0; i < lights.size(); i++) {
+		const rgbf Le = lights[i]->Le(Ray(worldToLightVec[i] * ray.o, worldToLightVec[i] * dir));
+		if (MaxComponent(Le) <= 0.f)
+			continue;
+
+		const float weight = lastIsDelta ? 1.f : PowerHeuristic(lastPD, LightPDF(static_cast<int>(i), lastPos, lastN, dir));
+		L += weight * Le;
+	}
+	return L;
+}
+
+bool PathTracer::SampleLight(const pointf3 & pos, const normalf & wo, const pointf2 & texcoord,
+	const Frame & frame, const Surface & surface, LightSample & sample) const
+{
+	const auto & bsdf = surface.bsdf;
+	if (bsdf->IsDelta() || lights.empty())
+		return false;
+
+	float lightPMF;
+	const int lightIdx = lightSampler->Sample(pos, frame.n.cast_to<normalf>(), lightPMF);
+	if (lightIdx == -1)
+		return false;
+	const auto & light = lights[lightIdx];
+
+	normalf lightWi;
+	float PD;
+	const rgbf Li = light->Sample_L(worldToLightVec[lightIdx] * pos, lightWi, sample.dist, PD);
+	if (PD <= 0.f || MaxComponent(Li) <= 0.f)
+		return false;
+
+	sample.dir = (lightToWorldVec[lightIdx] * lightWi.cast_to<vecf3>()).normalize();
+	const normalf wi = frame.ToLocal(sample.dir);
+	const rgbf f = bsdf->F(wo, wi, texcoord);
+	const float absCosTheta = SurfCoord::AbsCosTheta(wi);
+	if (absCosTheta == 0.f || MaxComponent(f) <= 0.f)
+		return false;
+
+	const float lightPD = PD * lightPMF;
+	const float weight = light->IsDelta() ? 1.f : PowerHeuristic(lightPD, bsdf->PDF(wo, wi, texcoord));
+	sample.contribution = weight * absCosTheta / lightPD * f * Li;
+	return true;
+}
+
+float PathTracer::SurvivalProbability(const rgbf & pathThroughput, int depth) const {
+	// the chance to go on follows the throughput, past maxDepth at most half of the paths go on
+	if (depth + 1 < rouletteDepth)
+		return 1.f;
+
+	float survival = min(MaxComponent(pathThroughput), 1.f);
+	if (depth + 1 >= maxDepth)
+		survival = min(survival, 0.5f);
+	return survival;
+}
+
+float PathTracer::LightPDF(int lightIdx, const pointf3 & pos, const normalf & n, const vecf3 & dir) const {
+	const auto & light = lights[lightIdx];
+	if (light->IsDelta())
+		return 0.f;
+
+	const auto & worldToLight = worldToLightVec[lightIdx];
+	const normalf lightWi = (worldToLight * dir).normalize().cast_to<normalf>();
+	return light->PDF(worldToLight * pos, lightWi) * lightSampler->PMF(pos, n, lightIdx);
 }
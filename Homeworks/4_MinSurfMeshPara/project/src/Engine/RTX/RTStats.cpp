@@ -0,0 +1,65 @@
+#include <Engine/Viewer/RTStats.h>
+
+#include <cstdio>
+
+using namespace Ubpa;
+
+using namespace std;
+
+RTStats & RTStats::Local() {
+	static thread_local RTStats stats;
+	return stats;
+}
+
+RTStats & RTStats::operator+=(const RTStats & stats) {
+	nodeVisits += stats.nodeVisits;
+	primitiveTests += stats.primitiveTests;
+	for (int i = 0; i < RayTypeNum; i++)
+		rays[i] += stats.rays[i];
+	for (int i = 0; i < pathLengthBinNum; i++)
+		pathLengths[i] += stats.pathLengths[i];
+	pathLengthSum += stats.pathLengthSum;
+	maxPathLength = stats.maxPathLength > maxPathLength ? stats.maxPathLength : maxPathLength;
+	return *this;
+}
+
+long long RTStats::PathNum() const {
+	long long num = 0;
+	for (int i = 0; i < pathLengthBinNum; i++)
+		num += pathLengths[i];
+	return num;
+}
+
+const string RTStats::ToJSON(const string & indent) const {
+	const long long rayNum = RayNum();
+	char buffer[256];
+	string json = "{\n";
+	auto line = [&](const char * format, auto... args) {
+		snprintf(buffer, sizeof(buffer), format, args...);
+		json += indent + "\t" + buffer;
+	};
+
+	line("\"enabled\": %s,\n", enabled ? "true" : "false");
+	line("\"nodeVisits\": %lld,\n", nodeVisits);
+	line("\"primitiveTests\": %lld,\n", primitiveTests);
+	line("\"cameraRays\": %lld,\n", rays[CameraRay]);
+	line("\"indirectRays\": %lld,\n", rays[IndirectRay]);
+	line("\"shadowRays\": %lld,\n", rays[ShadowRay]);
+	line("\"nodeVisitsPerRay\": %f,\n", rayNum > 0 ? static_cast<double>(nodeVisits) / rayNum : 0.);
+	line("\"primitiveTestsPerRay\": %f,\n", rayNum > 0 ? static_cast<double>(primitiveTests) / rayNum : 0.);
+	line("\"paths\": %lld,\n", PathNum());
+	line("\"meanPathLength\": %f,\n", MeanPathLength());
+	line("\"maxPathLength\": %d,\n", maxPathLength);
+
+	// trailing empty bins are left out
+	int binNum = pathLengthBinNum;
+	while (binNum > 0 && pathLengths[binNum - 1] == 0)
+		binNum--;
+	json += indent + "\t\"pathLengths\": [";
+	for (int i = 0; i < binNum; i++) {
+		snprintf(buffer, sizeof(buffer), "%s%lld", i == 0 ? "" : ", ", pathLengths[i]);
+		json += buffer;
+	}
+	json += "]\n" + indent + "}";
+	return json;
+}
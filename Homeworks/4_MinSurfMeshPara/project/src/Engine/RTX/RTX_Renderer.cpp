@@ -17,8 +17,16 @@
 
 #include <omp.h>
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
 #include "Film.h"
 #include "FilmTile.h"
+#include "Denoiser.h"
 
 #ifdef NDEBUG
 #define THREAD_NUM omp_get_num_procs() - 1
@@ -32,56 +40,214 @@ using namespace Ubpa;
 using namespace std;
 
 namespace Ubpa {
-	class TileTask {
-	public:
-		TileTask(int tileNum, int maxLoop)
-			: tileNum(tileNum), maxLoop(maxLoop), curTile(0), curLoop(0) { }
-
-	public:
-		void Init(int tileNum, int maxLoop) {
-			this->tileNum = tileNum;
-			this->maxLoop = maxLoop;
-			curTile = 0;
-			curLoop = 0;
-		}
-
-	public:
-		struct Task {
-			Task(bool hasTask, int tileID = -1, int curLoop = -1)
-				: hasTask(hasTask), tileID(tileID), curLoop(curLoop) { }
-
-			bool hasTask;
-			int tileID;
-			int curLoop;
-		};
-		static constexpr int ERROR = -1;
-		const Task GetTask() {
-			if (curLoop == maxLoop)
-				return Task(false);
-
-			m.lock();
-			auto rst = Task(true, curTile, curLoop);
-			curTile++;
-			if (curTile == tileNum) {
-				curTile = 0;
-				curLoop += 1;
+	// position of the d-th cell along the Hilbert curve of an n x n grid, n is a power of 2
+	static const pointi2 HilbertCell(int n, int d) {
+		int x = 0;
+		int y = 0;
+		for (int s = 1; s < n; s *= 2) {
+			const int rx = 1 & (d / 2);
+			const int ry = 1 & (d ^ rx);
+			if (ry == 0) {
+				if (rx == 1) {
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				swap(x, y);
 			}
-			m.unlock();
+			x += s * rx;
+			y += s * ry;
+			d /= 4;
+		}
+		return pointi2(x, y);
+	}
 
-			return rst;
+	// tiles covering the image in the given order, the last row and column are clipped to the image
+	static const vector<bboxi2> GenTiles(int w, int h, int tileSize, RTX_Renderer::TileOrder order) {
+		const int colTiles = (w + tileSize - 1) / tileSize;
+		const int rowTiles = (h + tileSize - 1) / tileSize;
+
+		vector<pointi2> cells;
+		cells.reserve(colTiles * rowTiles);
+		switch (order)
+		{
+		case RTX_Renderer::TileOrder::Hilbert: {
+			int n = 1;
+			while (n < colTiles || n < rowTiles)
+				n *= 2;
+			for (int d = 0; d < n * n; d++) {
+				const auto cell = HilbertCell(n, d);
+				if (cell[0] < colTiles && cell[1] < rowTiles)
+					cells.push_back(cell);
+			}
+			break;
+		}
+		case RTX_Renderer::TileOrder::Spiral: {
+			// rings around the center, counterclockwise in a ring
+			for (int row = 0; row < rowTiles; row++) {
+				for (int col = 0; col < colTiles; col++)
+					cells.push_back(pointi2(col, row));
+			}
+			const float centerX = 0.5f * (colTiles - 1);
+			const float centerY = 0.5f * (rowTiles - 1);
+			auto ring = [=](const pointi2 & cell) {
+				return static_cast<int>(max(abs(cell[0] - centerX), abs(cell[1] - centerY)) + 0.5f);
+			};
+			auto angle = [=](const pointi2 & cell) {
+				return atan2(cell[1] - centerY, cell[0] - centerX);
+			};
+			stable_sort(cells.begin(), cells.end(), [&](const pointi2 & lhs, const pointi2 & rhs) {
+				const int lhsRing = ring(lhs);
+				const int rhsRing = ring(rhs);
+				return lhsRing < rhsRing || (lhsRing == rhsRing && angle(lhs) < angle(rhs));
+			});
+			break;
+		}
+		default:
+			for (int row = 0; row < rowTiles; row++) {
+				for (int col = 0; col < colTiles; col++)
+					cells.push_back(pointi2(col, row));
+			}
+			break;
 		}
 
-		int GetCurLoop() const {
-			return curLoop;
+		vector<bboxi2> tiles;
+		tiles.reserve(cells.size());
+		for (const auto & cell : cells) {
+			const int baseX = cell[0] * tileSize;
+			const int baseY = cell[1] * tileSize;
+			tiles.push_back(bboxi2({ baseX, baseY }, { min(baseX + tileSize, w), min(baseY + tileSize, h) }));
 		}
+		return tiles;
+	}
 
-	private:
-		int tileNum;
-		int curTile;
-		int maxLoop;
-		int curLoop;
-		mutex m;
-	};
+	// the geometry and the camera a checkpoint is rendered for, FNV-1a over the bytes of the camera
+	static uint64_t CheckpointSceneHash(const Ptr<BVHAccel> & bvhAccel, const Ptr<CmptCamera> & camera) {
+		uint64_t hash = bvhAccel->GetSceneHash();
+		auto combine = [&hash](const void * data, size_t size) {
+			const auto bytes = static_cast<const unsigned char *>(data);
+			for (size_t i = 0; i < size; i++) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+		};
+		const transformf l2w = camera->GetSObj()->GetLocalToWorldMatrix();
+		const float fov = camera->GetFOV();
+		combine(&l2w, sizeof(l2w));
+		combine(&fov, sizeof(fov));
+		return hash;
+	}
+}
+
+void RTX_Renderer::TileTask::Init(int tileNum, int maxLoop, int minLoop, float timeBudget, const function<bool(int tileID)>& isConverged) {
+	lock_guard<mutex> lock(m);
+	this->maxLoop = maxLoop;
+	this->minLoop = minLoop;
+	this->timeBudget = timeBudget;
+	this->isConverged = isConverged;
+	startTime = chrono::steady_clock::now();
+	doneTaskNum = 0;
+
+	passes.clear();
+	curPass = nullptr;
+	if (tileNum <= 0 || maxLoop <= 0)
+		return;
+
+	vector<int> tiles(tileNum);
+	for (int i = 0; i < tileNum; i++)
+		tiles[i] = i;
+	passes.push_back(GenPass(0, move(tiles)));
+	curPass = passes.back().get();
+}
+
+unique_ptr<RTX_Renderer::TileTask::Pass> RTX_Renderer::TileTask::GenPass(int firstLoop, vector<int>&& tiles) const {
+	const int tileNum = static_cast<int>(tiles.size());
+	int loopNum = maxLoop - firstLoop;
+	if (isConverged != nullptr) {
+		loopNum = min(loopNum, max((minPassTaskNum + tileNum - 1) / tileNum, minLoop - firstLoop));
+		loopNum = max(loopNum, 1);
+	}
+	return make_unique<Pass>(firstLoop, loopNum, move(tiles));
+}
+
+const RTX_Renderer::TileTask::Task RTX_Renderer::TileTask::GetTask() {
+	while (true) {
+		Pass * pass = curPass.load(memory_order_acquire);
+		if (pass == nullptr)
+			return Task(false);
+
+		if (timeBudget > 0.f && chrono::duration<float>(chrono::steady_clock::now() - startTime).count() > timeBudget) {
+			Stop();
+			return Task(false);
+		}
+
+		const long long task = pass->nextTask.fetch_add(1, memory_order_relaxed);
+		if (task < pass->taskNum) {
+			const long long tileNum = static_cast<long long>(pass->tiles.size());
+			return Task(true, pass->tiles[task % tileNum], pass->firstLoop + static_cast<int>(task / tileNum), pass);
+		}
+		// without adaptive sampling the one pass holds all loops, nothing follows it
+		if (isConverged == nullptr)
+			return Task(false);
+
+		// the pass is handed out, the threads still rendering it decide the next one
+		unique_lock<mutex> lock(m);
+		passCV.wait(lock, [&]() { return curPass.load(memory_order_relaxed) != pass; });
+	}
+}
+
+void RTX_Renderer::TileTask::FinishTask(const Task & task) {
+	doneTaskNum.fetch_add(1, memory_order_relaxed);
+	if (isConverged == nullptr)
+		return;
+
+	Pass * pass = task.pass;
+	if (pass->doneTaskNum.fetch_add(1, memory_order_acq_rel) + 1 != pass->taskNum)
+		return;
+
+	// all samples of the pass are merged
+	const int nextLoop = pass->firstLoop + pass->loopNum;
+	vector<int> tiles;
+	if (nextLoop < maxLoop) {
+		for (auto tile : pass->tiles) {
+			if (isConverged == nullptr || nextLoop < minLoop || !isConverged(tile))
+				tiles.push_back(tile);
+		}
+	}
+
+	lock_guard<mutex> lock(m);
+	if (curPass.load(memory_order_relaxed) != pass) // stopped
+		return;
+
+	if (tiles.empty())
+		curPass.store(nullptr, memory_order_release);
+	else {
+		passes.push_back(GenPass(nextLoop, move(tiles)));
+		curPass.store(passes.back().get(), memory_order_release);
+	}
+	passCV.notify_all();
+}
+
+void RTX_Renderer::TileTask::Stop() {
+	lock_guard<mutex> lock(m);
+	curPass.store(nullptr, memory_order_release);
+	passCV.notify_all();
+}
+
+float RTX_Renderer::TileTask::Progress() {
+	lock_guard<mutex> lock(m);
+	const Pass * pass = curPass.load(memory_order_relaxed);
+	if (pass == nullptr)
+		return passes.empty() ? 0.f : 1.f;
+
+	const long long done = doneTaskNum.load(memory_order_relaxed);
+	// the one pass without adaptive sampling counts its done tasks in doneTaskNum only
+	const long long passDone = isConverged == nullptr ? done : pass->doneTaskNum.load(memory_order_relaxed);
+	const long long remaining = pass->taskNum - passDone
+		+ static_cast<long long>(pass->tiles.size()) * (maxLoop - pass->firstLoop - pass->loopNum);
+	float rate = static_cast<float>(done) / static_cast<float>(max(done + remaining, 1ll));
+	if (timeBudget > 0.f)
+		rate = max(rate, chrono::duration<float>(chrono::steady_clock::now() - startTime).count() / timeBudget);
+	return Math::Clamp(rate, 0.f, 1.f);
 }
 
 RTX_Renderer::RTX_Renderer(const function<Ptr<RayTracer>()> & generator)
@@ -90,18 +256,42 @@ RTX_Renderer::RTX_Renderer(const function<Ptr<RayTracer>()> & generator)
 	bvhAccel(BVHAccel::New()),
 	state(RendererState::Stop),
 	maxLoop(200),
-	threadNum(THREAD_NUM)
+	threadNum(THREAD_NUM),
+	tileSize(32),
+	tileOrder(TileOrder::Hilbert),
+	resolveInterval(0.1f),
+	errorThreshold(0.f),
+	minLoop(16),
+	timeBudget(0.f),
+	renderTime(0.),
+	sampleNum(0),
+	cost(false),
+	firstLoop(0),
+	resumedSampleNum(0),
+	aov(false),
+	denoise(false),
+	denoiseTime(0.)
 {
 }
 
 void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 	state = RendererState::Running;
+	renderTime = 0.;
+	sampleNum = 0;
+	resumedSampleNum = 0;
+	stats = RTStats();
+	costImg = nullptr;
+	denoiseTime = 0.;
+	albedoImg = nullptr;
+	normalImg = nullptr;
+	depthImg = nullptr;
 
 	const float lightNum = static_cast<float>(scene->GetCmptLights().size());
 
 	// init rst image
 
-	auto film = Film::New(img, FilterMitchell::New(vecf2(2.f), 1.f / 3.f, 1.f / 3.f));
+	const bool hasAOV = aov || denoise;
+	auto film = Film::New(img, FilterMitchell::New(vecf2(2.f), 1.f / 3.f, 1.f / 3.f), hasAOV);
 	int w = img->GetWidth();
 	int h = img->GetHeight();
 
@@ -114,7 +304,11 @@ void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 		rayTracers.push_back(rayTracer);
 	}
 	
-	bvhAccel->Init(scene->GetRoot());
+	// a scene whose vertices just moved is refitted, much faster than a build
+	if (bvhAccel->IsRefittable(scene->GetRoot()) && bvhAccel->Refit())
+		printf("BVH refit done, cost %f s, SAH cost %f\n", bvhAccel->GetRefitTime(), bvhAccel->GetSAHCost());
+	else
+		bvhAccel->Init(scene->GetRoot());
 	// init ray tracer
 	for (auto rayTracer : rayTracers)
 		rayTracer->Init(scene, bvhAccel);
@@ -131,54 +325,144 @@ void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 	camera->InitCoordinate();
 
 	// jobs
-	const int tileSize = 64;
-	const int rowTiles = w / tileSize;
-	const int tileNum = w * h / (tileSize*tileSize);
-	tileTask.Init(tileNum, maxLoop);
+	const auto tiles = GenTiles(w, h, tileSize, tileOrder);
+	const int tileNum = static_cast<int>(tiles.size());
+	const int loopNum = maxLoop;
+
+	// the checkpoint tells the tiles apart by their cells, so the order may change between runs
+	const int colTiles = (w + tileSize - 1) / tileSize;
+	vector<int> tileCells(tileNum);
+	for (int i = 0; i < tileNum; i++)
+		tileCells[i] = tiles[i].minP()[1] / tileSize * colTiles + tiles[i].minP()[0] / tileSize;
+	if (!checkpointPath.empty()) {
+		const Film::CheckpointKey key{ CheckpointSceneHash(bvhAccel, camera), tileSize, tileNum, firstLoop, loopNum };
+		bool resumed;
+		if (!film->MapCheckpoint(checkpointPath, key, resumed)) {
+			state = RendererState::Stop;
+			return;
+		}
+		if (resumed) {
+			resumedSampleNum = film->GetCheckpointSampleNum();
+			printf("resume from %s, %lld samples done\n", checkpointPath.c_str(), resumedSampleNum);
+			film->Resolve();
+		}
+	}
+
+	function<bool(int)> isConverged;
+	if (errorThreshold > 0.f) {
+		isConverged = [&](int tileID) {
+			return film->Error(tiles[tileID]) <= errorThreshold;
+		};
+	}
+	tileTask.Init(tileNum, loopNum, minLoop, timeBudget, isConverged);
+
+	using Clock = chrono::steady_clock;
+	const auto runStart = Clock::now();
+	vector<double> busyTimes(threadNum, 0.);
+	vector<int> taskNums(threadNum, 0);
+	vector<long long> sampleNums(threadNum, 0);
+	vector<RTStats> threadStats(threadNum);
 
-	// init float image
-	int imgSize = w * h;
-	vector<vector<rgbf>> imgTiles(tileNum, vector<rgbf>(tileSize*tileSize, rgbf(0.f)));
+	mutex workingMutex;
+	condition_variable workingCV;
+	int workingNum = threadNum;
 
 	auto renderPartImg = [&](int id) {
 		auto & rayTracer = rayTracers[id];
+		Ptr<FilmTile> filmTile;
+
+		// a task is traced as one batch, the buffers are reused
+		vector<pointf2> samplePositions;
+		vector<Ray> rays;
+		vector<Math::PCG32> generators;
+		vector<rgbf> radiances;
+		vector<long long> costs;
+
+		// the thread counts into its own stats, copied out once at the end
+		RTStats::Local() = RTStats();
 
 		for (auto task = tileTask.GetTask(); task.hasTask; task = tileTask.GetTask()) {
 			if (state == RendererState::Stop)
-				return;
+				break;
+
+			// a loop in the checkpoint only takes its AOVs again
+			const int loop = firstLoop + task.curLoop;
+			const bool loopDone = film->IsLoopDone(tileCells[task.tileID], loop);
+			if (loopDone && !hasAOV) {
+				tileTask.FinishTask(task);
+				continue;
+			}
 
-			int tileID = task.tileID;
-			int tileRow = tileID / rowTiles;
-			int tileCol = tileID - tileRow * rowTiles;
-			int baseX = tileCol * tileSize;
-			int baseY = tileRow * tileSize;
+			const auto taskStart = Clock::now();
+			if (filmTile == nullptr)
+				filmTile = film->GenFilmTile(tiles[task.tileID]);
+			else
+				filmTile->Reset(tiles[task.tileID]);
+
+			const auto frame = filmTile->GetFrame();
+			samplePositions.clear();
+			rays.clear();
+			generators.clear();
+			for (int y = frame.minP()[1]; y < frame.maxP()[1]; y++) {
+				for (int x = frame.minP()[0]; x < frame.maxP()[0]; x++) {
+					// the random numbers of a sample depend on the pixel and the loop only, the image on no thread timing
+					Math::RandSetPixelSample(static_cast<uint64_t>(y) * w + x, loop);
+					const pointf2 posf(x + Math::Rand_F(), y + Math::Rand_F());
+					const float u = posf[0] / w;
+					const float v = posf[1] / h;
+
+					samplePositions.push_back(posf);
+					rays.push_back(camera->GenRay(u, v));
+					generators.push_back(Math::RandGenerator());
+				}
+			}
 
-			auto filmTile = film->GenFilmTile(bboxi2({ baseX, baseY }, { baseX + tileSize, baseY + tileSize }));
+			// before the rays are traced, the tracers may change them
+			if (hasAOV) {
+				for (size_t i = 0; i < rays.size(); i++)
+					filmTile->AddAOV(samplePositions[i], rayTracer->TraceAOV(rays[i]));
+			}
 
-			for (const auto pos : filmTile->AllPos()) {
-				auto posf = pos.cast_to<pointf2>() + vecf2(Math::Rand_F(), Math::Rand_F());
-				const float u = posf[0] / w;
-				const float v = posf[1] / h;
+			if (!loopDone) {
+				rayTracer->TraceBatch(rays, generators, radiances, costs);
 
-				auto ray = camera->GenRay(u, v);
-				rgbf radiance = rayTracer->Trace(ray);
+				for (size_t i = 0; i < radiances.size(); i++) {
+					auto radiance = radiances[i];
 
-				if (radiance.has_nan()) {
-					printf("WARNING::RTX_Renderer::Run:\n"
-						"\t""radiance is NaN\n");
-					continue;
-				}
+					if (radiance.has_nan()) {
+						printf("WARNING::RTX_Renderer::Run:\n"
+							"\t""radiance is NaN\n");
+						continue;
+					}
 
-				// һԼļٰ㣨رɵԴ
-				//float illum = radiance.illumination();
-				//if (illum > lightNum)
-				//	radiance *= lightNum / illum;
+					// һԼļٰ㣨رɵԴ
+					//float illum = radiance.illumination();
+					//if (illum > lightNum)
+					//	radiance *= lightNum / illum;
 
-				filmTile->AddSample(posf, radiance);
+					filmTile->AddSample(samplePositions[i], radiance, costs[i]);
+				}
 			}
 
+			if (!loopDone)
+				film->BeginLoop(tileCells[task.tileID], loop, filmTile);
 			film->MergeFilmTile(filmTile);
+			if (!loopDone)
+				film->SetLoopDone(tileCells[task.tileID], loop, frame.area());
+			tileTask.FinishTask(task);
+
+			busyTimes[id] += chrono::duration<double>(Clock::now() - taskStart).count();
+			taskNums[id]++;
+			if (!loopDone)
+				sampleNums[id] += frame.area();
+		}
+		threadStats[id] = RTStats::Local();
+
+		{
+			lock_guard<mutex> lock(workingMutex);
+			workingNum--;
 		}
+		workingCV.notify_all();
 	};
 
 	// init all workers first
@@ -186,17 +470,123 @@ void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 	for (int i = 0; i < threadNum; i++)
 		workers.push_back(thread(renderPartImg, i));
 
+	// resolve the image at display rate instead of after every tile
+	{
+		unique_lock<mutex> lock(workingMutex);
+		while (!workingCV.wait_for(lock, chrono::duration<float>(resolveInterval), [&]() { return workingNum == 0; })) {
+			lock.unlock();
+			film->Resolve();
+			lock.lock();
+		}
+	}
+
 	// wait workers
 	for (auto & worker : workers)
 		worker.join();
+	film->Resolve();
+	if (film->HasCheckpoint() && !film->FlushCheckpoint()) {
+		printf("WARNING::RTX_Renderer::Run:\n"
+			"\t""flush %s fail\n", checkpointPath.c_str());
+	}
+
+	const double runTime = chrono::duration<double>(Clock::now() - runStart).count();
+	renderTime = runTime;
+
+	for (const auto & threadStat : threadStats)
+		stats += threadStat;
+
+	if (cost) {
+		vector<float> costs;
+		film->ResolveCost(costs);
+		costImg = Image::New(w, h, 3);
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++)
+				costImg->SetPixel(x, y, rgbf(costs[y * w + x]));
+		}
+	}
+
+	if (hasAOV) {
+		vector<RayTracer::AOV> aovs;
+		film->ResolveAOV(aovs);
+
+		if (aov) {
+			albedoImg = Image::New(w, h, 3);
+			normalImg = Image::New(w, h, 3);
+			depthImg = Image::New(w, h, 3);
+			for (int y = 0; y < h; y++) {
+				for (int x = 0; x < w; x++) {
+					const auto & pixelAOV = aovs[y * w + x];
+					albedoImg->SetPixel(x, y, pixelAOV.albedo);
+					normalImg->SetPixel(x, y, pixelAOV.normal[0], pixelAOV.normal[1], pixelAOV.normal[2]);
+					depthImg->SetPixel(x, y, rgbf(pixelAOV.depth));
+				}
+			}
+		}
+
+		if (denoise && state == RendererState::Running) {
+			const auto denoiseStart = Clock::now();
+
+			vector<rgbf> radiance(static_cast<size_t>(w) * h);
+			for (int y = 0; y < h; y++) {
+				for (int x = 0; x < w; x++)
+					radiance[y * w + x] = img->GetPixel(x, y).to_rgb();
+			}
+			vector<float> variances;
+			film->ResolveVariance(variances);
+
+			Denoiser::New()->Run(w, h, radiance, aovs, variances, threadNum);
+			for (int y = 0; y < h; y++) {
+				for (int x = 0; x < w; x++)
+					img->SetPixel(x, y, radiance[y * w + x]);
+			}
+
+			denoiseTime = chrono::duration<double>(Clock::now() - denoiseStart).count();
+			printf("denoise done, cost %f s\n", denoiseTime);
+		}
+	}
+
+	sampleNum = 0;
+	for (auto num : sampleNums)
+		sampleNum += num;
+	printf("render done, cost %f s, %d tiles of %d x %d pixels per loop\n", runTime, tileNum, tileSize, tileSize);
+	printf("\t%lld of %lld tile loops rendered, %lld samples, %f Msamples/s\n", tileTask.GetDoneTaskNum(),
+		static_cast<long long>(tileNum) * loopNum, sampleNum, runTime > 0. ? sampleNum / runTime / 1e6 : 0.);
+	if (resumedSampleNum > 0)
+		printf("\t%lld samples resumed from %s\n", resumedSampleNum, checkpointPath.c_str());
+	if (RTStats::enabled && stats.RayNum() > 0) {
+		printf("\t%lld rays, %.1f BVH nodes and %.1f primitive tests per ray, %.2f rays per path\n", stats.RayNum(),
+			static_cast<double>(stats.nodeVisits) / stats.RayNum(), static_cast<double>(stats.primitiveTests) / stats.RayNum(), stats.MeanPathLength());
+	}
+	threadUtilization.resize(threadNum);
+	for (int i = 0; i < threadNum; i++) {
+		threadUtilization[i] = runTime > 0. ? static_cast<float>(busyTimes[i] / runTime) : 0.f;
+		printf("\tthread %d: %d tiles, %.1f%% busy\n", i, taskNums[i], 100.f * threadUtilization[i]);
+	}
 
 	state = RendererState::Stop;
 }
 
+bool RTX_Renderer::MergeCheckpoints(const string & outPath, const vector<string> & inPaths) {
+	return Film::MergeCheckpoints(outPath, inPaths);
+}
+
+bool RTX_Renderer::AddCheckpoint(const string & outPath, const string & inPath, int firstLoop, int loopNum) {
+	return Film::AddCheckpoint(outPath, inPath, firstLoop, loopNum);
+}
+
+bool RTX_Renderer::GetCheckpointLoops(const string & path, int firstLoop, int loopNum, vector<bool> & loops) {
+	return Film::GetCheckpointLoops(path, firstLoop, loopNum, loops);
+}
+
+const Ptr<Image> RTX_Renderer::ResolveCheckpoint(const string & path) {
+	return Film::ResolveCheckpoint(path);
+}
+
 void RTX_Renderer::Stop() {
 	state = RendererState::Stop;
+	tileTask.Stop();
 }
 
 float RTX_Renderer::ProgressRate() {
-	return Math::Clamp((float(tileTask.GetCurLoop()) + 0.5f) / float(maxLoop), 0.f, 1.f);
+	return tileTask.Progress();
 }
@@ -0,0 +1,466 @@
+#include "SBVH.h"
+
+#include <Basic/Math.h>
+#include <Basic/Parallel.h>
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cfloat>
+
+using namespace Ubpa;
+
+using namespace std;
+
+namespace Ubpa {
+	// nodes with at least this many references build their children on two threads
+	static constexpr size_t parallelBuildThreshold = 1 << 12;
+
+	// a primitive clipped to a part of the space
+	struct Reference {
+		bboxf3 box;
+		int primID;
+	};
+
+	static bool IsEmpty(const bboxf3& box) {
+		return box.minP()[0] > box.maxP()[0] || box.minP()[1] > box.maxP()[1] || box.minP()[2] > box.maxP()[2];
+	}
+
+	static double Area(const bboxf3& box) {
+		return IsEmpty(box) ? 0. : box.area();
+	}
+
+	static const bboxf3 Union(const bboxf3& a, const bboxf3& b) {
+		bboxf3 rst = a;
+		rst.combine_with(b);
+		return rst;
+	}
+
+	// empty if a and b are disjoint
+	static const bboxf3 Intersect(const bboxf3& a, const bboxf3& b) {
+		bboxf3 rst;
+		for (int dim = 0; dim < 3; dim++) {
+			const float minP = std::max(a.minP()[dim], b.minP()[dim]);
+			const float maxP = std::min(a.maxP()[dim], b.maxP()[dim]);
+			if (minP > maxP)
+				return bboxf3();
+			rst.minP()[dim] = minP;
+			rst.maxP()[dim] = maxP;
+		}
+		return rst;
+	}
+
+	static int BinID(float x, float minP, float extent) {
+		const int binID = static_cast<int>(SBVH::binNum * ((x - minP) / extent));
+		return Math::Clamp(binID, 0, SBVH::binNum - 1);
+	}
+
+	// builds a subtree depth first into its own nodes and primIdx, subtrees built on other threads are appended
+	class SBVHBuilder {
+	public:
+		SBVHBuilder(const SBVH::SplitFunc& splitPrim, atomic<int64_t>& splitsLeft, double rootArea, int forkDepth)
+			: splitPrim(splitPrim), splitsLeft(splitsLeft), rootArea(rootArea), forkDepth(forkDepth) { }
+
+	public:
+		void BuildNode(vector<Reference>& refs, const bboxf3& box, int nodeDepth);
+
+	public:
+		vector<BVHAccel::LinearBVHNode> nodes;
+		vector<int> primIdx;
+		int depth{ 0 };
+
+	private:
+		// the children are the bins [0, bin) and [bin, binNum) along axis
+		struct Split {
+			double cost{ DBL_MAX };
+			int axis{ -1 };
+			int bin{ -1 };
+			bboxf3 leftBox;
+			bboxf3 rightBox;
+		};
+
+		// binned SAH over the centroids of the references
+		const Split FindObjectSplit(const vector<Reference>& refs, const bboxf3& centroidBox) const;
+		// binned SAH over planes in box, references are clipped into every bin they cross
+		const Split FindSpatialSplit(const vector<Reference>& refs, const bboxf3& box) const;
+
+		// axis -1 splits into halves
+		void PerformObjectSplit(const vector<Reference>& refs, const bboxf3& centroidBox, const Split& split,
+			vector<Reference>& left, vector<Reference>& right) const;
+		// references crossing the plane are split, or kept whole on one side if that is cheaper or the budget is spent
+		// returns false if a side stays empty
+		bool PerformSpatialSplit(const vector<Reference>& refs, const bboxf3& box, const Split& split,
+			vector<Reference>& left, vector<Reference>& right);
+
+		void SplitReference(const Reference& ref, int axis, float pos, Reference& left, Reference& right) const;
+		bool TakeSplit();
+
+		void Append(const SBVHBuilder& subtree);
+
+	private:
+		const SBVH::SplitFunc& splitPrim;
+		atomic<int64_t>& splitsLeft;
+		const double rootArea;
+		const int forkDepth;
+	};
+}
+
+void SBVHBuilder::BuildNode(vector<Reference>& refs, const bboxf3& box, int nodeDepth) {
+	depth = std::max(depth, nodeDepth);
+	const int nodeIdx = static_cast<int>(nodes.size());
+	nodes.emplace_back();
+
+	if (refs.size() <= BVHNode::maxLeafSize) {
+		nodes[nodeIdx].InitLeaf(box, static_cast<int>(primIdx.size()), static_cast<int>(refs.size()));
+		for (const auto& ref : refs)
+			primIdx.push_back(ref.primID);
+		return;
+	}
+
+	bboxf3 centroidBox;
+	for (const auto& ref : refs)
+		centroidBox.combine_with(ref.box.center());
+
+	// 1. object split, the spatial split is only searched if the children of the object split overlap
+
+	const Split objectSplit = FindObjectSplit(refs, centroidBox);
+	Split spatialSplit;
+	if (nodeDepth < SBVH::maxSpatialDepth && splitsLeft.load(memory_order_relaxed) > 0) {
+		const double overlap = objectSplit.axis == -1 ? Area(box) : Area(Intersect(objectSplit.leftBox, objectSplit.rightBox));
+		if (overlap > SBVH::minOverlap * rootArea)
+			spatialSplit = FindSpatialSplit(refs, box);
+	}
+
+	// 2. partition
+
+	vector<Reference> left;
+	vector<Reference> right;
+	int axis;
+	if (spatialSplit.cost < objectSplit.cost && PerformSpatialSplit(refs, box, spatialSplit, left, right))
+		axis = spatialSplit.axis;
+	else {
+		PerformObjectSplit(refs, centroidBox, objectSplit, left, right);
+		if (objectSplit.axis != -1)
+			axis = objectSplit.axis;
+		else {
+			const auto diagonal = box.diagonal();
+			axis = diagonal[0] > diagonal[1] ? (diagonal[0] > diagonal[2] ? 0 : 2) : (diagonal[1] > diagonal[2] ? 1 : 2);
+		}
+	}
+
+	// the references of the whole level would be alive at once otherwise
+	vector<Reference>().swap(refs);
+
+	bboxf3 leftBox, rightBox;
+	for (const auto& ref : left)
+		leftBox.combine_with(ref.box);
+	for (const auto& ref : right)
+		rightBox.combine_with(ref.box);
+
+	// recursion, the lower child first as the traversal expects
+	if (nodeDepth < forkDepth && left.size() + right.size() >= parallelBuildThreshold) {
+		SBVHBuilder leftBuilder(splitPrim, splitsLeft, rootArea, forkDepth);
+		SBVHBuilder rightBuilder(splitPrim, splitsLeft, rootArea, forkDepth);
+		thread leftWorker([&]() { leftBuilder.BuildNode(left, leftBox, nodeDepth + 1); });
+		rightBuilder.BuildNode(right, rightBox, nodeDepth + 1);
+		leftWorker.join();
+
+		Append(leftBuilder);
+		nodes[nodeIdx].InitBranch(box, static_cast<int>(nodes.size()), axis);
+		Append(rightBuilder);
+	}
+	else {
+		BuildNode(left, leftBox, nodeDepth + 1);
+		nodes[nodeIdx].InitBranch(box, static_cast<int>(nodes.size()), axis);
+		BuildNode(right, rightBox, nodeDepth + 1);
+	}
+}
+
+const SBVHBuilder::Split SBVHBuilder::FindObjectSplit(const vector<Reference>& refs, const bboxf3& centroidBox) const {
+	Split best;
+	const auto& minP = centroidBox.minP();
+	const auto extent = centroidBox.diagonal();
+	for (int dim = 0; dim < 3; dim++) {
+		if (extent[dim] <= 0.f)
+			continue;
+
+		bboxf3 binBoxes[SBVH::binNum];
+		size_t binNums[SBVH::binNum] = { 0 };
+		for (const auto& ref : refs) {
+			const int binID = BinID(ref.box.center()[dim], minP[dim], extent[dim]);
+			binBoxes[binID].combine_with(ref.box);
+			binNums[binID]++;
+		}
+
+		bboxf3 rightBoxes[SBVH::binNum];
+		size_t rightNums[SBVH::binNum];
+		bboxf3 rightBox;
+		size_t rightNum = 0;
+		for (int i = SBVH::binNum - 1; i > 0; i--) {
+			rightBox.combine_with(binBoxes[i]);
+			rightNum += binNums[i];
+			rightBoxes[i] = rightBox;
+			rightNums[i] = rightNum;
+		}
+
+		bboxf3 leftBox;
+		size_t leftNum = 0;
+		for (int bin = 1; bin < SBVH::binNum; bin++) {
+			leftBox.combine_with(binBoxes[bin - 1]);
+			leftNum += binNums[bin - 1];
+			if (leftNum == 0 || rightNums[bin] == 0)
+				continue;
+
+			const double cost = Area(leftBox) * leftNum + Area(rightBoxes[bin]) * rightNums[bin];
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = dim;
+				best.bin = bin;
+				best.leftBox = leftBox;
+				best.rightBox = rightBoxes[bin];
+			}
+		}
+	}
+	return best;
+}
+
+const SBVHBuilder::Split SBVHBuilder::FindSpatialSplit(const vector<Reference>& refs, const bboxf3& box) const {
+	Split best;
+	const auto extent = box.diagonal();
+	for (int dim = 0; dim < 3; dim++) {
+		if (extent[dim] <= 0.f)
+			continue;
+
+		const float minP = box.minP()[dim];
+		const float binWidth = extent[dim] / SBVH::binNum;
+
+		// a reference enters the scan at its first bin and exits at its last one
+		bboxf3 binBoxes[SBVH::binNum];
+		size_t entries[SBVH::binNum] = { 0 };
+		size_t exits[SBVH::binNum] = { 0 };
+		for (const auto& ref : refs) {
+			const int firstBin = BinID(ref.box.minP()[dim], minP, extent[dim]);
+			const int lastBin = std::max(firstBin, BinID(ref.box.maxP()[dim], minP, extent[dim]));
+
+			Reference rest = ref;
+			for (int bin = firstBin; bin < lastBin; bin++) {
+				Reference part;
+				SplitReference(rest, dim, minP + (bin + 1) * binWidth, part, rest);
+				binBoxes[bin].combine_with(part.box);
+			}
+			binBoxes[lastBin].combine_with(rest.box);
+			entries[firstBin]++;
+			exits[lastBin]++;
+		}
+
+		bboxf3 rightBoxes[SBVH::binNum];
+		size_t rightNums[SBVH::binNum];
+		bboxf3 rightBox;
+		size_t rightNum = 0;
+		for (int i = SBVH::binNum - 1; i > 0; i--) {
+			rightBox.combine_with(binBoxes[i]);
+			rightNum += exits[i];
+			rightBoxes[i] = rightBox;
+			rightNums[i] = rightNum;
+		}
+
+		bboxf3 leftBox;
+		size_t leftNum = 0;
+		for (int bin = 1; bin < SBVH::binNum; bin++) {
+			leftBox.combine_with(binBoxes[bin - 1]);
+			leftNum += entries[bin - 1];
+			// a side with every reference makes no progress
+			if (leftNum == 0 || rightNums[bin] == 0 || leftNum == refs.size() || rightNums[bin] == refs.size())
+				continue;
+
+			const double cost = Area(leftBox) * leftNum + Area(rightBoxes[bin]) * rightNums[bin];
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = dim;
+				best.bin = bin;
+				best.leftBox = leftBox;
+				best.rightBox = rightBoxes[bin];
+			}
+		}
+	}
+	return best;
+}
+
+void SBVHBuilder::PerformObjectSplit(const vector<Reference>& refs, const bboxf3& centroidBox, const Split& split,
+	vector<Reference>& left, vector<Reference>& right) const
+{
+	if (split.axis == -1) {
+		// all centroids coincide, split into halves to keep leaves small
+		const size_t leftNum = refs.size() / 2;
+		left.assign(refs.cbegin(), refs.cbegin() + leftNum);
+		right.assign(refs.cbegin() + leftNum, refs.cend());
+		return;
+	}
+
+	const float minP = centroidBox.minP()[split.axis];
+	const float extent = centroidBox.diagonal()[split.axis];
+	for (const auto& ref : refs) {
+		if (BinID(ref.box.center()[split.axis], minP, extent) < split.bin)
+			left.push_back(ref);
+		else
+			right.push_back(ref);
+	}
+}
+
+bool SBVHBuilder::PerformSpatialSplit(const vector<Reference>& refs, const bboxf3& box, const Split& split,
+	vector<Reference>& left, vector<Reference>& right)
+{
+	const int axis = split.axis;
+	const float pos = box.minP()[axis] + split.bin * (box.diagonal()[axis] / SBVH::binNum);
+
+	vector<const Reference*> straddlers;
+	for (const auto& ref : refs) {
+		if (ref.box.maxP()[axis] <= pos)
+			left.push_back(ref);
+		else if (ref.box.minP()[axis] >= pos)
+			right.push_back(ref);
+		else
+			straddlers.push_back(&ref);
+	}
+
+	// reference unsplitting, a straddler goes to the side where it costs the least,
+	// counting it on both sides until it is decided
+	bboxf3 leftBox = split.leftBox;
+	bboxf3 rightBox = split.rightBox;
+	size_t leftNum = left.size() + straddlers.size();
+	size_t rightNum = right.size() + straddlers.size();
+	int64_t splitNum = 0;
+	for (const auto ref : straddlers) {
+		Reference leftRef, rightRef;
+		SplitReference(*ref, axis, pos, leftRef, rightRef);
+
+		// the clipped primitive may lie on one side only
+		if (IsEmpty(rightRef.box)) {
+			left.push_back(IsEmpty(leftRef.box) ? *ref : leftRef);
+			rightNum--;
+			continue;
+		}
+		if (IsEmpty(leftRef.box)) {
+			right.push_back(rightRef);
+			leftNum--;
+			continue;
+		}
+
+		const double splitCost = Area(Union(leftBox, leftRef.box)) * leftNum + Area(Union(rightBox, rightRef.box)) * rightNum;
+		const double leftCost = Area(Union(leftBox, ref->box)) * leftNum + Area(rightBox) * (rightNum - 1);
+		const double rightCost = Area(leftBox) * (leftNum - 1) + Area(Union(rightBox, ref->box)) * rightNum;
+		if (splitCost < leftCost && splitCost < rightCost && TakeSplit()) {
+			left.push_back(leftRef);
+			right.push_back(rightRef);
+			leftBox.combine_with(leftRef.box);
+			rightBox.combine_with(rightRef.box);
+			splitNum++;
+		}
+		else if (leftCost <= rightCost) {
+			left.push_back(*ref);
+			leftBox.combine_with(ref->box);
+			rightNum--;
+		}
+		else {
+			right.push_back(*ref);
+			rightBox.combine_with(ref->box);
+			leftNum--;
+		}
+	}
+
+	if (left.empty() || right.empty()) {
+		splitsLeft.fetch_add(splitNum, memory_order_relaxed);
+		left.clear();
+		right.clear();
+		return false;
+	}
+	return true;
+}
+
+void SBVHBuilder::SplitReference(const Reference& ref, int axis, float pos, Reference& left, Reference& right) const {
+	bboxf3 leftPrimBox, rightPrimBox;
+	splitPrim(ref.primID, axis, pos, leftPrimBox, rightPrimBox);
+
+	bboxf3 leftHalf = ref.box;
+	leftHalf.maxP()[axis] = std::min(leftHalf.maxP()[axis], pos);
+	bboxf3 rightHalf = ref.box;
+	rightHalf.minP()[axis] = std::max(rightHalf.minP()[axis], pos);
+
+	left = { Intersect(leftPrimBox, leftHalf), ref.primID };
+	right = { Intersect(rightPrimBox, rightHalf), ref.primID };
+}
+
+bool SBVHBuilder::TakeSplit() {
+	if (splitsLeft.fetch_sub(1, memory_order_relaxed) > 0)
+		return true;
+
+	splitsLeft.fetch_add(1, memory_order_relaxed);
+	return false;
+}
+
+void SBVHBuilder::Append(const SBVHBuilder& subtree) {
+	const int nodeOffset = static_cast<int>(nodes.size());
+	const int primOffset = static_cast<int>(primIdx.size());
+	for (const auto& node : subtree.nodes) {
+		nodes.emplace_back();
+		if (node.IsLeaf())
+			nodes.back().InitLeaf(node.GetBox(), node.GetShapesOffset() + primOffset, node.GetShapesNum());
+		else
+			nodes.back().InitBranch(node.GetBox(), node.GetSecondChildIdx() + nodeOffset, node.GetAxis());
+	}
+	primIdx.insert(primIdx.end(), subtree.primIdx.cbegin(), subtree.primIdx.cend());
+	depth = std::max(depth, subtree.depth);
+}
+
+void SBVH::SplitTriangle(const pointf3& p0, const pointf3& p1, const pointf3& p2, int axis, float pos, bboxf3& leftBox, bboxf3& rightBox) {
+	const pointf3 vertices[3] = { p0, p1, p2 };
+	for (int i = 0; i < 3; i++) {
+		const auto& v0 = vertices[i];
+		const auto& v1 = vertices[(i + 1) % 3];
+		if (v0[axis] <= pos)
+			leftBox.combine_with(v0);
+		if (v0[axis] >= pos)
+			rightBox.combine_with(v0);
+
+		// the edge crosses the plane
+		if ((v0[axis] < pos && pos < v1[axis]) || (v1[axis] < pos && pos < v0[axis])) {
+			const float t = (pos - v0[axis]) / (v1[axis] - v0[axis]);
+			pointf3 p = v0;
+			for (int dim = 0; dim < 3; dim++)
+				p[dim] = v0[dim] + t * (v1[dim] - v0[dim]);
+			p[axis] = pos;
+			leftBox.combine_with(p);
+			rightBox.combine_with(p);
+		}
+	}
+}
+
+void SBVH::Build(const vector<bboxf3>& boxes, const SplitFunc& splitPrim, float splitBudget,
+	vector<int>& primIdx, vector<BVHAccel::LinearBVHNode>& nodes, int& depth)
+{
+	primIdx.clear();
+	nodes.clear();
+	depth = 0;
+	if (boxes.empty())
+		return;
+
+	vector<Reference> refs(boxes.size());
+	bboxf3 box;
+	for (size_t i = 0; i < boxes.size(); i++) {
+		refs[i] = { boxes[i], static_cast<int>(i) };
+		box.combine_with(boxes[i]);
+	}
+
+	// the top levels of the tree are built as parallel tasks, enough to keep every core busy
+	int forkDepth = 0;
+	while ((static_cast<size_t>(1) << forkDepth) < Parallel::Instance().CoreNum())
+		forkDepth++;
+
+	atomic<int64_t> splitsLeft(static_cast<int64_t>(std::max(0.f, splitBudget) * boxes.size()));
+	SBVHBuilder builder(splitPrim, splitsLeft, Area(box), forkDepth + 1);
+	builder.BuildNode(refs, box, 1);
+
+	nodes.swap(builder.nodes);
+	primIdx.swap(builder.primIdx);
+	depth = builder.depth;
+}
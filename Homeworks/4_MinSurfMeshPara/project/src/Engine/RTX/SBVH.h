@@ -0,0 +1,35 @@
+#pragma once
+
+#include "BVHNode.h"
+
+#include <Engine/Viewer/BVHAccel.h>
+
+#include <vector>
+#include <functional>
+
+namespace Ubpa {
+	// SAH builder with spatial splits, Stich et al., "Spatial Splits in Bounding Volume Hierarchies"
+	// a node may split the space instead of the primitives, the primitives crossing the plane are
+	// clipped and referenced by both children, so long thin triangles stop inflating the boxes
+	// slower to build and more references than BVHNode, for final renders
+	class SBVH {
+	public:
+		// bounds of the parts of primitive primID below and above the plane pos on axis
+		using SplitFunc = std::function<void(int primID, int axis, float pos, bboxf3& leftBox, bboxf3& rightBox)>;
+
+		// boxes are indexed by primitive ID, primIdx gets the references in leaf order, a primitive may appear several times
+		// at most splitBudget * boxes.size() extra references are made
+		static void Build(const std::vector<bboxf3>& boxes, const SplitFunc& splitPrim, float splitBudget,
+			std::vector<int>& primIdx, std::vector<BVHAccel::LinearBVHNode>& nodes, int& depth);
+
+		// SplitFunc of a triangle, bounds of the two clipped polygons
+		static void SplitTriangle(const pointf3& p0, const pointf3& p1, const pointf3& p2, int axis, float pos, bboxf3& leftBox, bboxf3& rightBox);
+
+	public:
+		static constexpr int binNum = 32;
+		// spatial splits are only searched when the children of the object split overlap more than this fraction of the root area
+		static constexpr double minOverlap = 1e-5;
+		// spatial splits stop here, the object splits below always terminate
+		static constexpr int maxSpatialDepth = 48;
+	};
+}
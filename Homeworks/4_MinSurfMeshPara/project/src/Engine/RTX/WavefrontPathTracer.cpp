@@ -0,0 +1,152 @@
+#include <Engine/Viewer/WavefrontPathTracer.h>
+
+#include <Engine/Viewer/BVHAccel.h>
+
+#include <Engine/Intersector/ClosestIntersector.h>
+#include <Engine/Intersector/VisibilityChecker.h>
+
+#include <Engine/Material/BSDF.h>
+#include <Engine/Material/SurfCoord.h>
+
+#include <Basic/Math.h>
+
+using namespace Ubpa;
+
+using namespace std;
+
+void WavefrontPathTracer::TraceBatch(vector<Ray> & rays, vector<Math::PCG32> & generators, vector<rgbf> & radiances, vector<long long> & costs) {
+	const int pathNum = static_cast<int>(rays.size());
+	paths.resize(pathNum);
+	activePaths.clear();
+	for (int i = 0; i < pathNum; i++) {
+		auto & path = paths[i];
+		path.ray = rays[i];
+		path.throughput = rgbf(1.f);
+		path.L = rgbf(0.f);
+		path.depth = 0;
+		path.cost = 0;
+		path.lastN = normalf(0.f);
+		path.lastPD = 0.f;
+		path.lastIsDelta = true; // nothing samples the lights for the camera ray
+		activePaths.push_back(i);
+	}
+
+	while (!activePaths.empty()) {
+		Extend();
+		SortHits();
+		Shade(generators);
+		TraceShadowRays();
+	}
+
+	radiances.resize(pathNum);
+	costs.resize(pathNum);
+	for (int i = 0; i < pathNum; i++) {
+		radiances[i] = paths[i].L;
+		costs[i] = paths[i].cost;
+		UBPA_STATS_PATH(paths[i].depth + 1);
+	}
+}
+
+void WavefrontPathTracer::Extend() {
+	hits.clear();
+	const auto & stats = RTStats::Local();
+	for (auto pathIdx : activePaths) {
+		auto & path = paths[pathIdx];
+		UBPA_STATS_ADD(rays[path.depth == 0 ? RTStats::CameraRay : RTStats::IndirectRay], 1);
+		const long long nodeVisits = stats.nodeVisits;
+		closestIntersector->Init(&path.ray);
+		closestIntersector->Visit(bvhAccel);
+		path.cost += stats.nodeVisits - nodeVisits;
+		const auto & closestRst = closestIntersector->GetRst();
+
+		if (!closestRst.IsIntersect()) {
+			path.L += path.throughput * Background(path.ray, path.lastIsDelta, path.lastPos, path.lastN, path.lastPD);
+			continue;
+		}
+
+		const auto surface = GetSurface(closestRst.closestShape);
+		if (!surface)
+			continue;
+
+		hits.push_back({ pathIdx, surface, closestRst.pos, closestRst.n, closestRst.tangent, closestRst.texcoord });
+	}
+}
+
+void WavefrontPathTracer::SortHits() {
+	bsdfOffsets.assign(bsdfNum + 1, 0);
+	for (const auto & hit : hits)
+		bsdfOffsets[hit.surface->bsdfIdx + 1]++;
+	for (int i = 0; i < bsdfNum; i++)
+		bsdfOffsets[i + 1] += bsdfOffsets[i];
+
+	sortedHits.resize(hits.size());
+	for (const auto & hit : hits)
+		sortedHits[bsdfOffsets[hit.surface->bsdfIdx]++] = hit;
+}
+
+void WavefrontPathTracer::Shade(vector<Math::PCG32> & generators) {
+	activePaths.clear();
+	shadowRays.clear();
+
+	auto & generator = Math::RandGenerator();
+	for (const auto & hit : sortedHits) {
+		// the generator of the thread continues the numbers of the path
+		generator = generators[hit.pathIdx];
+		if (ShadeHit(hit, paths[hit.pathIdx]))
+			activePaths.push_back(hit.pathIdx);
+		generators[hit.pathIdx] = generator;
+	}
+}
+
+bool WavefrontPathTracer::ShadeHit(const Hit & hit, Path & path) {
+	const auto & surface = *hit.surface;
+	const auto & bsdf = surface.bsdf;
+
+	const auto frame = GenFrame(surface, hit.texcoord, hit.n, hit.tangent);
+	const vecf3 dir = path.ray.d.normalize();
+	const normalf wo = frame.ToLocal(-dir);
+
+	path.L += path.throughput * Emission(surface, wo, dir, path.lastIsDelta, path.lastPos, path.lastN, path.lastPD);
+
+	LightSample lightSample;
+	if (SampleLight(hit.pos, wo, hit.texcoord, frame, surface, lightSample)) {
+		shadowRays.push_back({ hit.pathIdx, Ray(hit.pos, lightSample.dir),
+			lightSample.dist - shadowRayEpsilon, path.throughput * lightSample.contribution });
+	}
+
+	normalf wi;
+	float PD;
+	const rgbf f = bsdf->Sample_f(wo, hit.texcoord, wi, PD);
+	if (PD <= 0.f || max(max(f[0], f[1]), f[2]) <= 0.f)
+		return false;
+
+	path.throughput *= SurfCoord::AbsCosTheta(wi) / PD * f;
+
+	const float survival = SurvivalProbability(path.throughput, path.depth);
+	if (!(survival >= 1.f)) {
+		if (!(survival > 0.f) || Math::Rand_F() >= survival)
+			return false;
+		path.throughput /= survival;
+	}
+
+	path.depth++;
+	path.lastPos = hit.pos;
+	path.lastN = frame.n.cast_to<normalf>();
+	path.lastPD = PD;
+	path.lastIsDelta = bsdf->IsDelta();
+	path.ray = Ray(hit.pos, frame.ToWorld(wi));
+	return true;
+}
+
+void WavefrontPathTracer::TraceShadowRays() {
+	UBPA_STATS_ADD(rays[RTStats::ShadowRay], static_cast<long long>(shadowRays.size()));
+	const auto & stats = RTStats::Local();
+	for (auto & shadowRay : shadowRays) {
+		const long long nodeVisits = stats.nodeVisits;
+		visibilityChecker->Init(&shadowRay.ray, shadowRay.tMax);
+		visibilityChecker->Visit(bvhAccel);
+		paths[shadowRay.pathIdx].cost += stats.nodeVisits - nodeVisits;
+		if (!visibilityChecker->GetRst().IsIntersect())
+			paths[shadowRay.pathIdx].L += shadowRay.contribution;
+	}
+}